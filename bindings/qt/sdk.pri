@@ -29,6 +29,7 @@ SOURCES += src/attrmap.cpp \
     src/user.cpp \
     src/utils.cpp \
     src/logging.cpp \
+    src/metrics.cpp \
     src/waiterbase.cpp  \
     src/proxy.cpp \
     src/pendingcontactrequest.cpp \
@@ -135,6 +136,7 @@ HEADERS  += include/mega.h \
             include/mega/user.h \
             include/mega/utils.h \
             include/mega/logging.h \
+            include/mega/metrics.h \
             include/mega/waiter.h \
             include/mega/proxy.h \
             include/mega/pendingcontactrequest.h \
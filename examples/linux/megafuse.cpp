@@ -20,10 +20,11 @@
  */
 
 // This example implements the following operations: getattr, readdir,
-// open, read, mkdir, rmdir, unlink and rename.
+// open, read, release, mkdir, rmdir, unlink and rename.
 // File writes are NOT supported yet.
-// There isn't any caching nor the implementation does any prefetching
-// to improve read performance.
+// Attributes and folder listings are cached until the nodes change, the
+// decrypted data of files is cached in blocks and sequential reads download
+// the next blocks in advance. FUSE requests are handled by several threads.
 
 #define FUSE_USE_VERSION 30
 #include <fuse.h>
@@ -36,7 +37,12 @@
 #include <termios.h>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <list>
+#include <vector>
+#include "megafuse.h"
 
 using namespace mega;
 using namespace std;
@@ -105,105 +111,32 @@ class SynchronousRequestListenerFuse : public MegaRequestListener
 		mutex m;
 };
 
-class SynchronousTransferListenerFuse : public MegaTransferListener
+// path of a FUSE request in MEGA, without trailing slashes
+static string megaPath(const char *p)
 {
-	public:
-		SynchronousTransferListenerFuse()
-		{
-			transfer = NULL;
-			error = NULL;
-			notified = false;
-		}
-		
-		~SynchronousTransferListenerFuse()
-		{
-			delete transfer;
-			delete error;
-		}
-		
-		void onTransferFinish(MegaApi *api, MegaTransfer *transfer, MegaError *error) 
-		{
-			this->error = error->copy();
-			this->transfer = transfer->copy();
-		
-			{
-				unique_lock<mutex> lock(m);
-				notified = true;
-			}
-			cv.notify_all();
-		}
-				
-		bool onTransferData(MegaApi *api, MegaTransfer *transfer, char *buffer, size_t s)
-		{
-			data.append(buffer, s);
-			return true;
-		}
-		
-		void wait() 
-		{
-			unique_lock<mutex> lock(m);
-			cv.wait(lock, [this]{return notified;});
-		}
-		
-		void reset()
-		{
-			delete transfer;
-			delete error;
-			transfer = NULL;
-			error = NULL;
-			notified = false;
-		}
-		
-		MegaTransfer *getTransfer()
-		{
-			return transfer;
-		}
-		
-		MegaError *getError()
-		{
-			return error;
-		}
-		
-		const char *getData()
-		{
-			return data.data();
-		}
-		
-		long long getDataSize()
-		{
-			return data.size();
-		}
-		
-	private:
-		bool notified;
-		MegaError *error;
-		MegaTransfer *transfer;
-		string data;
-		condition_variable cv;
-		mutex m;
-};
+	string path = megaBasePath + p;
+	if (path.size() > 1 && path[path.size() - 1] == '/')
+	{
+		path.resize(path.size() - 1);
+	}
+	return path;
+}
+
+BlockCache *blockCache;
+AttrCache *attrCache;
 
 static int MEGAgetattr(const char *p, struct stat *stbuf)
 {
-	string path = megaBasePath + p;
+	string path = megaPath(p);
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Getting attributes:");
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, path.c_str());
 
-	MegaNode *n = megaApi->getNodeByPath(path.c_str());
-	if (!n)
+	if (attrCache->getattr(path, stbuf))
 	{
 		MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Node not found");
 		return -ENOENT;
 	}
-	
-	stbuf->st_uid = getuid();
-	stbuf->st_gid = getgid();
-	stbuf->st_mode = n->isFile() ? S_IFREG | 0444 : S_IFDIR | 0755;
-	stbuf->st_nlink = 1;
-	stbuf->st_size = n->isFile() ? n->getSize() : 4096;
-	stbuf->st_mtime = n->isFile() ? n->getModificationTime() : n->getCreationTime();
-		
-	delete n;
+
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Attributes read OK");
 	return 0;
 }
@@ -251,6 +184,7 @@ static int MEGAmkdir(const char *p, mode_t mode)
 		return -EIO;
 	}
 
+	attrCache->invalidate(megaPath(p));
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Folder created OK");
 	return 0;
 }
@@ -293,6 +227,7 @@ static int MEGArmdir(const char *p)
 		return -EIO;
 	}
 
+	attrCache->invalidate(megaPath(p));
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Folder deleted OK");
 	return 0;
 }
@@ -329,6 +264,7 @@ static int MEGAunlink(const char *p)
 		return -EIO;
 	}
 
+	attrCache->invalidate(megaPath(p));
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "File deleted OK");
 	return 0;
 }
@@ -374,6 +310,8 @@ static int MEGArename(const char *f, const char *t)
 				return -EIO;
 			}
 
+			attrCache->invalidate(megaPath(f));
+			attrCache->invalidate(megaPath(t));
 			MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "File/folder moved OK");
 			return 0;
 		}
@@ -427,6 +365,8 @@ static int MEGArename(const char *f, const char *t)
 		MegaApi::log(MegaApi::LOG_LEVEL_ERROR, "Error moving file/folder");
 		return -EIO;
 	}
+	attrCache->invalidate(megaPath(f));
+	attrCache->invalidate(megaPath(t));
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "File/folder moved OK");
 
 	if (strcmp(source->getName(), destname.c_str()))
@@ -442,6 +382,7 @@ static int MEGArename(const char *f, const char *t)
 			return -EIO;
 		}
 		
+		attrCache->invalidate(megaPath(t));
 		MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "File/folder renamed OK");
 	}
 	
@@ -452,83 +393,79 @@ static int MEGArename(const char *f, const char *t)
 static int MEGAreaddir(const char *p, void *buf, fuse_fill_dir_t filler,
                          off_t offset, struct fuse_file_info *fi)
 {
-	string path = megaBasePath + p;
+	string path = megaPath(p);
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Listing folder:");
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, path.c_str());
 
-	MegaNode *node = megaApi->getNodeByPath(path.c_str());
-	if (!node)
+	vector<string> names;
+	vector<struct stat> attrs;
+	int result = attrCache->list(path, &names, &attrs);
+	if (result)
 	{
 		MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Folder not found");
-		return -ENOENT;
+		return result;
 	}
 	
 	filler(buf, ".", NULL, 0);
 	filler(buf, "..", NULL, 0);
-	MegaNodeList *children = megaApi->getChildren(node);
-	for (int i=0; i<children->size(); i++)
+	for (size_t i = 0; i < names.size(); i++)
 	{
-		MegaNode *n = children->get(i);
-		filler(buf, n->getName(), NULL, 0);
-		MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, n->getName());
+		filler(buf, names[i].c_str(), &attrs[i], 0);
+		MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, names[i].c_str());
 	}
-	
-	delete node;
-	delete children;
 
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Folder listed OK");	
 	return 0;
 }
 
-static int MEGAopen(const char *path, struct fuse_file_info *fi)
+static int MEGAopen(const char *p, struct fuse_file_info *fi)
 {
-    return 0;
-}
-
-static int MEGAread(const char *p, char *buf, size_t size, off_t offset,
-                      struct fuse_file_info *fi)
-{
-	string path = megaBasePath + p;
-	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Reading file:");
-	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, path.c_str());
-        	
-	MegaNode *node = megaApi->getNodeByPath(path.c_str());
+	string path = megaPath(p);
+	MegaNode *node = attrCache->getNode(path);
 	if (!node)
 	{
 		MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "File not found");
 		return -ENOENT;
-	}	
-	
-	if (offset >= node->getSize())
-	{
-		delete node;
-		return 0;
 	}
-	
-	if (offset + size > node->getSize())
+
+	if (!node->isFile())
 	{
-		size = node->getSize() - offset;
+		delete node;
+		return -EISDIR;
 	}
+
+	OpenFile *file = new OpenFile();
+	file->node = node;
+	file->nextOffset = 0;
+	fi->fh = (uint64_t)file;
+	return 0;
+}
+
+static int MEGAread(const char *p, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi)
+{
+	OpenFile *file = (OpenFile *)fi->fh;
+	MegaNode *node = file->node;
+	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "Reading file:");
+	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, node->getName());
 	
-	SynchronousTransferListenerFuse listener;
-	megaApi->startStreaming(node, offset, size, &listener);
-	listener.wait();
-	delete node;
-	if (listener.getError()->getErrorCode() != MegaError::API_OK)
+	int result = readFile(blockCache, file, buf, size, offset);
+	if (result < 0)
 	{
 		MegaApi::log(MegaApi::LOG_LEVEL_ERROR, "Transfer error");
-		return -EIO;
+		return result;
 	}
-	
-	if (listener.getDataSize() != size)
-	{
-		MegaApi::log(MegaApi::LOG_LEVEL_ERROR, "Internal error");
-		return -EIO;
-	}
-	
-	memcpy(buf, listener.getData(), size);
+
 	MegaApi::log(MegaApi::LOG_LEVEL_DEBUG, "File read OK");
-    return size;
+	return result;
+}
+
+static int MEGArelease(const char *p, struct fuse_file_info *fi)
+{
+	OpenFile *file = (OpenFile *)fi->fh;
+	delete file->node;
+	delete file;
+	return 0;
 }
 
 int main(int argc, char *argv[])
@@ -536,13 +473,29 @@ int main(int argc, char *argv[])
 	string megauser;
 	string megapassword;
 	string mountpoint;
-	if (argc != 1 && argc != 4 && argc != 5)
+	string benchfile;
+	string apiurl;
+	bool bench = argc > 1 && !strcmp(argv[1], "--bench");
+	if (bench ? argc != 5 && argc != 6 : argc != 1 && argc != 4 && argc != 5)
 	{
 		cout << "Usage: " << argv[0] << " [megauser megapassword localmountpoint [megamountpoint]]" << endl; 
+		cout << "       " << argv[0] << " --bench megauser megapassword megafile [apiurl]" << endl;
 		return 0;
 	}
 	
-	if (argc == 1)
+	if (bench)
+	{
+		megauser = argv[2];
+		megapassword = argv[3];
+		benchfile = argv[4];
+
+		// a local server can stand in for MEGA
+		if (argc == 6)
+		{
+			apiurl = argv[5];
+		}
+	}
+	else if (argc == 1)
 	{
 		cout << "MEGA email: ";
 		getline(cin, megauser);
@@ -582,6 +535,12 @@ int main(int argc, char *argv[])
 			
 	megaApi = new MegaApi("BhU0CKAT", (const char*)NULL, "MEGA/SDK FUSE filesystem");
 	megaApi->setLogLevel(MegaApi::LOG_LEVEL_INFO);
+	blockCache = new BlockCache(megaApi);
+	attrCache = new AttrCache(megaApi, blockCache);
+	if (apiurl.size())
+	{
+		megaApi->changeApiUrl(apiurl.c_str());
+	}
 	
 	//Login
 	SynchronousRequestListenerFuse listener;
@@ -617,6 +576,40 @@ int main(int argc, char *argv[])
 		
 	MegaApi::log(MegaApi::LOG_LEVEL_INFO, "MEGA initialization complete!");	
 	megaApi->setLogLevel(MegaApi::LOG_LEVEL_WARNING);
+	megaApi->addGlobalListener(attrCache);
+
+	if (bench)
+	{
+		MegaNode *node = attrCache->getNode(megaPath(benchfile.c_str()));
+		if (!node || !node->isFile())
+		{
+			cout << "File not found: " << benchfile << endl;
+			delete node;
+			return 1;
+		}
+
+		vector<BenchResult> results = runBenchmark(megaApi, blockCache, node);
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BenchResult &result = results[i];
+			cout << result.name << ": bs=" << result.blockSize / 1024 << "k ops=" << result.ops;
+			if (result.failed)
+			{
+				cout << " FAILED" << endl;
+				continue;
+			}
+
+			cout << " " << result.bytes / 1048576.0 / result.seconds << " MB/s " << result.ops / result.seconds << " IOPS";
+			if (result.hits >= 0)
+			{
+				cout << " (blocks cached " << result.hits << ", downloaded " << result.misses << ")";
+			}
+			cout << endl;
+		}
+
+		delete node;
+		return 0;
+	}
 
 	//Start FUSE
 	struct fuse_operations ops = {0};
@@ -624,11 +617,13 @@ int main(int argc, char *argv[])
     ops.readdir     = MEGAreaddir;
     ops.open        = MEGAopen;
     ops.read		= MEGAread;
+    ops.release		= MEGArelease;
     ops.mkdir		= MEGAmkdir;
     ops.rmdir		= MEGArmdir;
     ops.unlink		= MEGAunlink;
 	ops.rename		= MEGArename;
     
-	char *fuseargv[3] = { argv[0], (char *)"-f", (char *)mountpoint.c_str()};
-    return fuse_main(3, fuseargv, &ops, NULL);
+	// without -s, FUSE handles requests in several threads
+	char *fuseargv[5] = { argv[0], (char *)"-f", (char *)"-o", (char *)"use_ino", (char *)mountpoint.c_str()};
+    return fuse_main(5, fuseargv, &ops, NULL);
 }
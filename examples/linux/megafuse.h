@@ -0,0 +1,218 @@
+/**
+ * @file examples/linux/megafuse.h
+ * @brief Caches of the example MEGA filesystem based on FUSE
+ *
+ * (c) 2013-2014 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGAFUSE_H
+#define MEGAFUSE_H 1
+
+#include <megaapi.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+
+// decrypted data of the files in blocks, shared by all the open files and
+// bounded in size (least recently used blocks go first) - readers of a block
+// being downloaded wait for it instead of downloading it again
+class BlockCache
+{
+	public:
+		static const int BLOCK_SIZE = 1048576;
+		static const int READ_AHEAD = 4;
+		static const long long MAX_SIZE = 268435456;
+
+		BlockCache(mega::MegaApi *api);
+
+		// waits for the downloads in progress, they write to the blocks
+		~BlockCache();
+
+		// copies the data of the node into buf, downloading the missing blocks
+		int read(mega::MegaNode *node, char *buf, size_t len, off_t offset);
+
+		// starts downloading the blocks after the offset that aren't cached
+		void readAhead(mega::MegaNode *node, off_t offset);
+
+		// forgets the blocks of a node
+		void invalidate(mega::MegaHandle h);
+
+		void clear();
+
+		// blocks found in the cache (or being downloaded) and downloaded
+		long long getHits();
+		long long getMisses();
+
+	private:
+		typedef std::pair<mega::MegaHandle, long long> BlockKey;
+
+		struct Block
+		{
+			BlockKey key;
+			std::string data;
+			size_t expected;
+			int users;
+			bool ready;
+			bool failed;
+			bool stale;
+			bool cached;
+			std::list<Block*>::iterator lru;
+		};
+
+		class BlockFetch : public mega::MegaTransferListener
+		{
+			public:
+				BlockFetch(BlockCache *cache, Block *block);
+				bool onTransferData(mega::MegaApi *api, mega::MegaTransfer *transfer, char *buffer, size_t s);
+				void onTransferFinish(mega::MegaApi *api, mega::MegaTransfer *transfer, mega::MegaError *error);
+
+			private:
+				BlockCache *cache;
+				Block *block;
+				std::string data;
+		};
+
+		mega::MegaApi *api;
+		std::mutex m;
+		std::condition_variable cv;
+		std::map<BlockKey, Block*> blocks;
+		std::list<Block*> lru;
+		long long size;
+		int pending;
+		std::atomic<long long> hits;
+		std::atomic<long long> misses;
+
+		// expects the lock, starts downloading the block if it's not cached
+		Block *get(mega::MegaNode *node, long long index);
+
+		void finished(Block *block, std::string *data, bool ok);
+
+		// expects the lock, deletes the block if it's unusable and unused
+		void release(Block *block);
+
+		// expects the lock
+		void evict();
+};
+
+// attributes of the paths looked up and the names of the folders listed,
+// valid until the nodes change (onNodesUpdate) - nonexistent paths are
+// cached too, so repeated lookups of missing files don't walk the tree
+class AttrCache : public mega::MegaGlobalListener
+{
+	public:
+		AttrCache(mega::MegaApi *api, BlockCache *blockCache);
+
+		// attributes of the node at the path, -ENOENT if there isn't any
+		int getattr(const std::string &path, struct stat *stbuf);
+
+		// node at the path, NULL if there isn't any
+		mega::MegaNode *getNode(const std::string &path);
+
+		// names and attributes of the children of the folder at the path
+		int list(const std::string &path, std::vector<std::string> *names, std::vector<struct stat> *attrs);
+
+		// forgets the path, the paths below it and the listing of its parent
+		void invalidate(const std::string &path);
+
+		void clear();
+
+		// lookups and listings answered from the cache and from the node tree
+		long long getHits();
+		long long getMisses();
+
+		void onNodesUpdate(mega::MegaApi *api, mega::MegaNodeList *nodes);
+
+	private:
+		struct Entry
+		{
+			// INVALID_HANDLE if the path doesn't exist
+			mega::MegaHandle h;
+			struct stat st;
+			bool listed;
+			std::vector<std::string> children;
+		};
+
+		mega::MegaApi *api;
+		BlockCache *blockCache;
+		std::mutex m;
+		std::map<std::string, Entry> entries;
+		std::map<mega::MegaHandle, std::string> paths;
+		std::map<mega::MegaHandle, ino_t> inodes;
+		ino_t nextInode;
+		std::atomic<long long> hits;
+		std::atomic<long long> misses;
+
+		// changes with every invalidation, lookups that started before don't
+		// store their (maybe outdated) result
+		unsigned long long generation;
+
+		int lookup(const std::string &path, mega::MegaHandle *h, struct stat *stbuf);
+
+		// expects the lock
+		Entry *add(const std::string &path, mega::MegaNode *n);
+
+		// expects the lock
+		void remove(const std::string &path);
+
+		// expects the lock
+		void forget(std::map<std::string, Entry>::iterator it);
+
+		// expects the lock
+		int copyChildren(const std::string &path, Entry *entry, std::vector<std::string> *names, std::vector<struct stat> *attrs);
+
+		// expects the lock, inode numbers are stable while the filesystem is
+		// mounted
+		void fillStat(mega::MegaNode *n, struct stat *stbuf);
+};
+
+// state of an open file
+struct OpenFile
+{
+	mega::MegaNode *node;
+
+	// end of the last read, to detect sequential reads
+	std::atomic<long long> nextOffset;
+};
+
+// reads from an open file through the block cache, sequential reads
+// download the next blocks in advance
+int readFile(BlockCache *cache, OpenFile *file, char *buf, size_t size, off_t offset);
+
+// outcome of a benchmark job, hits and misses are the blocks found in the
+// cache and downloaded since its last cold start, -1 for uncached reads
+struct BenchResult
+{
+	const char *name;
+	size_t blockSize;
+	int ops;
+	bool failed;
+	long long bytes;
+	double seconds;
+	long long hits;
+	long long misses;
+};
+
+// fio-like jobs over (the first 64 MB of) a file, through the same read path
+// as the filesystem
+std::vector<BenchResult> runBenchmark(mega::MegaApi *api, BlockCache *cache, mega::MegaNode *node);
+
+#endif
@@ -0,0 +1,748 @@
+/**
+ * @file examples/linux/megafuse_cache.cpp
+ * @brief Caches of the example MEGA filesystem based on FUSE
+ *
+ * (c) 2013-2014 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <chrono>
+#include "megafuse.h"
+
+using namespace mega;
+using namespace std;
+
+static string parentPath(const string &path)
+{
+	size_t index = path.find_last_of('/');
+	if (index == string::npos)
+	{
+		return string();
+	}
+	return index ? path.substr(0, index) : string("/");
+}
+
+static string childPath(const string &path, const char *name)
+{
+	return path == "/" ? path + name : path + "/" + name;
+}
+
+class SynchronousTransferListenerFuse : public MegaTransferListener
+{
+	public:
+		SynchronousTransferListenerFuse()
+		{
+			transfer = NULL;
+			error = NULL;
+			notified = false;
+		}
+		
+		~SynchronousTransferListenerFuse()
+		{
+			delete transfer;
+			delete error;
+		}
+		
+		void onTransferFinish(MegaApi *api, MegaTransfer *transfer, MegaError *error) 
+		{
+			this->error = error->copy();
+			this->transfer = transfer->copy();
+		
+			{
+				unique_lock<mutex> lock(m);
+				notified = true;
+			}
+			cv.notify_all();
+		}
+				
+		bool onTransferData(MegaApi *api, MegaTransfer *transfer, char *buffer, size_t s)
+		{
+			data.append(buffer, s);
+			return true;
+		}
+		
+		void wait() 
+		{
+			unique_lock<mutex> lock(m);
+			cv.wait(lock, [this]{return notified;});
+		}
+		
+		void reset()
+		{
+			delete transfer;
+			delete error;
+			transfer = NULL;
+			error = NULL;
+			notified = false;
+		}
+		
+		MegaTransfer *getTransfer()
+		{
+			return transfer;
+		}
+		
+		MegaError *getError()
+		{
+			return error;
+		}
+		
+		const char *getData()
+		{
+			return data.data();
+		}
+		
+		long long getDataSize()
+		{
+			return data.size();
+		}
+		
+	private:
+		bool notified;
+		MegaError *error;
+		MegaTransfer *transfer;
+		string data;
+		condition_variable cv;
+		mutex m;
+};
+
+BlockCache::BlockFetch::BlockFetch(BlockCache *cache, Block *block)
+{
+	this->cache = cache;
+	this->block = block;
+}
+
+bool BlockCache::BlockFetch::onTransferData(MegaApi *api, MegaTransfer *transfer, char *buffer, size_t s)
+{
+	data.append(buffer, s);
+	return true;
+}
+
+void BlockCache::BlockFetch::onTransferFinish(MegaApi *api, MegaTransfer *transfer, MegaError *error)
+{
+	cache->finished(block, &data, error->getErrorCode() == MegaError::API_OK);
+	delete this;
+}
+
+BlockCache::BlockCache(MegaApi *api)
+{
+	this->api = api;
+	size = 0;
+	pending = 0;
+	hits = 0;
+	misses = 0;
+}
+
+BlockCache::~BlockCache()
+{
+	unique_lock<mutex> lock(m);
+	cv.wait(lock, [this]{ return !pending; });
+
+	for (map<BlockKey, Block*>::iterator it = blocks.begin(); it != blocks.end(); it++)
+	{
+		if (!it->second->cached)
+		{
+			delete it->second;
+		}
+	}
+	for (list<Block*>::iterator it = lru.begin(); it != lru.end(); it++)
+	{
+		delete *it;
+	}
+}
+
+int BlockCache::read(MegaNode *node, char *buf, size_t len, off_t offset)
+{
+	size_t copied = 0;
+	unique_lock<mutex> lock(m);
+
+	while (copied < len)
+	{
+		off_t position = offset + copied;
+		long long index = position / BLOCK_SIZE;
+		Block *block = get(node, index);
+
+		block->users++;
+		cv.wait(lock, [block]{ return block->ready; });
+		block->users--;
+
+		size_t start = position - index * BLOCK_SIZE;
+		if (block->failed || start >= block->data.size())
+		{
+			release(block);
+			return -EIO;
+		}
+
+		size_t num = block->data.size() - start;
+		if (num > len - copied)
+		{
+			num = len - copied;
+		}
+		memcpy(buf + copied, block->data.data() + start, num);
+		copied += num;
+
+		if (block->cached)
+		{
+			lru.splice(lru.begin(), lru, block->lru);
+		}
+		release(block);
+	}
+
+	return copied;
+}
+
+void BlockCache::readAhead(MegaNode *node, off_t offset)
+{
+	unique_lock<mutex> lock(m);
+	for (int i = 0; i < READ_AHEAD; i++)
+	{
+		long long index = offset / BLOCK_SIZE + i;
+		if (index * BLOCK_SIZE >= node->getSize())
+		{
+			break;
+		}
+
+		if (blocks.find(BlockKey(node->getHandle(), index)) == blocks.end())
+		{
+			get(node, index);
+		}
+	}
+}
+
+void BlockCache::invalidate(MegaHandle h)
+{
+	unique_lock<mutex> lock(m);
+	vector<Block*> stale;
+	map<BlockKey, Block*>::iterator it = blocks.lower_bound(BlockKey(h, 0));
+	while (it != blocks.end() && it->first.first == h)
+	{
+		stale.push_back((it++)->second);
+	}
+
+	for (size_t i = 0; i < stale.size(); i++)
+	{
+		stale[i]->stale = true;
+		release(stale[i]);
+	}
+}
+
+void BlockCache::clear()
+{
+	unique_lock<mutex> lock(m);
+	vector<Block*> stale;
+	for (map<BlockKey, Block*>::iterator it = blocks.begin(); it != blocks.end(); it++)
+	{
+		stale.push_back(it->second);
+	}
+
+	for (size_t i = 0; i < stale.size(); i++)
+	{
+		stale[i]->stale = true;
+		release(stale[i]);
+	}
+	hits = 0;
+	misses = 0;
+}
+
+long long BlockCache::getHits()
+{
+	return hits;
+}
+
+long long BlockCache::getMisses()
+{
+	return misses;
+}
+
+BlockCache::Block *BlockCache::get(MegaNode *node, long long index)
+{
+	BlockKey key(node->getHandle(), index);
+	map<BlockKey, Block*>::iterator it = blocks.find(key);
+	if (it != blocks.end())
+	{
+		hits++;
+		return it->second;
+	}
+
+	misses++;
+	Block *block = new Block();
+	block->key = key;
+	block->users = 0;
+	block->ready = false;
+	block->failed = false;
+	block->stale = false;
+	block->cached = false;
+	blocks[key] = block;
+
+	long long start = index * BLOCK_SIZE;
+	long long len = node->getSize() - start;
+	if (len > BLOCK_SIZE)
+	{
+		len = BLOCK_SIZE;
+	}
+	block->expected = len;
+	pending++;
+	api->startStreaming(node, start, len, new BlockFetch(this, block));
+	return block;
+}
+
+void BlockCache::finished(Block *block, string *data, bool ok)
+{
+	unique_lock<mutex> lock(m);
+	pending--;
+	block->data.swap(*data);
+	block->ready = true;
+	block->failed = !ok || block->data.size() != block->expected;
+
+	if (!block->failed && !block->stale)
+	{
+		lru.push_front(block);
+		block->lru = lru.begin();
+		block->cached = true;
+		size += block->data.size();
+	}
+
+	release(block);
+	evict();
+	cv.notify_all();
+}
+
+void BlockCache::release(Block *block)
+{
+	if (block->users)
+	{
+		return;
+	}
+
+	// stale or failed blocks are replaced by the next reader
+	map<BlockKey, Block*>::iterator it = blocks.find(block->key);
+	if ((block->stale || block->failed) && it != blocks.end() && it->second == block)
+	{
+		blocks.erase(it);
+	}
+
+	if ((block->stale || block->failed) && block->ready)
+	{
+		if (block->cached)
+		{
+			lru.erase(block->lru);
+			size -= block->data.size();
+		}
+		delete block;
+	}
+}
+
+void BlockCache::evict()
+{
+	list<Block*>::iterator it = lru.end();
+	while (size > MAX_SIZE && it != lru.begin())
+	{
+		Block *block = *--it;
+		if (!block->users)
+		{
+			it++;
+			block->stale = true;
+			release(block);
+		}
+	}
+}
+
+AttrCache::AttrCache(MegaApi *api, BlockCache *blockCache)
+{
+	this->api = api;
+	this->blockCache = blockCache;
+	nextInode = 2;
+	generation = 0;
+	hits = 0;
+	misses = 0;
+}
+
+int AttrCache::getattr(const string &path, struct stat *stbuf)
+{
+	MegaHandle h;
+	return lookup(path, &h, stbuf);
+}
+
+MegaNode *AttrCache::getNode(const string &path)
+{
+	MegaHandle h;
+	struct stat st;
+	if (lookup(path, &h, &st))
+	{
+		return NULL;
+	}
+	return api->getNodeByHandle(h);
+}
+
+int AttrCache::list(const string &path, vector<string> *names, vector<struct stat> *attrs)
+{
+	unsigned long long gen;
+	{
+		unique_lock<mutex> lock(m);
+		map<string, Entry>::iterator it = entries.find(path);
+		if (it != entries.end() && it->second.listed)
+		{
+			hits++;
+			return copyChildren(path, &it->second, names, attrs);
+		}
+		gen = generation;
+	}
+
+	misses++;
+	MegaNode *node = api->getNodeByPath(path.c_str());
+	if (!node)
+	{
+		return -ENOENT;
+	}
+
+	if (node->isFile())
+	{
+		delete node;
+		return -ENOTDIR;
+	}
+
+	MegaNodeList *children = api->getChildren(node);
+	unique_lock<mutex> lock(m);
+	for (int i = 0; i < children->size(); i++)
+	{
+		MegaNode *n = children->get(i);
+		struct stat st;
+		fillStat(n, &st);
+		names->push_back(n->getName());
+		attrs->push_back(st);
+	}
+
+	// the children are looked up right after a listing (ls -l)
+	if (gen == generation)
+	{
+		Entry *entry = add(path, node);
+		entry->children = *names;
+		entry->listed = true;
+
+		for (int i = 0; i < children->size(); i++)
+		{
+			add(childPath(path, (*names)[i].c_str()), children->get(i));
+		}
+	}
+
+	delete children;
+	delete node;
+	return 0;
+}
+
+void AttrCache::invalidate(const string &path)
+{
+	unique_lock<mutex> lock(m);
+	remove(path);
+}
+
+void AttrCache::clear()
+{
+	unique_lock<mutex> lock(m);
+	entries.clear();
+	paths.clear();
+	generation++;
+}
+
+long long AttrCache::getHits()
+{
+	return hits;
+}
+
+long long AttrCache::getMisses()
+{
+	return misses;
+}
+
+void AttrCache::onNodesUpdate(MegaApi *api, MegaNodeList *nodes)
+{
+	if (!nodes)
+	{
+		// the whole account has been reloaded
+		clear();
+		return;
+	}
+
+	unique_lock<mutex> lock(m);
+	for (int i = 0; i < nodes->size(); i++)
+	{
+		MegaNode *n = nodes->get(i);
+
+		// previous location of the node
+		map<MegaHandle, string>::iterator it = paths.find(n->getHandle());
+		if (it != paths.end())
+		{
+			remove(string(it->second));
+		}
+
+		// current one
+		it = paths.find(n->getParentHandle());
+		if (it != paths.end() && n->getName())
+		{
+			remove(childPath(it->second, n->getName()));
+		}
+
+		if (n->hasChanged(MegaNode::CHANGE_TYPE_REMOVED))
+		{
+			blockCache->invalidate(n->getHandle());
+		}
+	}
+}
+
+int AttrCache::lookup(const string &path, MegaHandle *h, struct stat *stbuf)
+{
+	unsigned long long gen;
+	{
+		unique_lock<mutex> lock(m);
+		map<string, Entry>::iterator it = entries.find(path);
+		if (it != entries.end())
+		{
+			hits++;
+			if (it->second.h == INVALID_HANDLE)
+			{
+				return -ENOENT;
+			}
+			*h = it->second.h;
+			*stbuf = it->second.st;
+			return 0;
+		}
+		gen = generation;
+	}
+
+	misses++;
+	MegaNode *n = api->getNodeByPath(path.c_str());
+	unique_lock<mutex> lock(m);
+	if (!n)
+	{
+		if (gen == generation)
+		{
+			entries[path].h = INVALID_HANDLE;
+		}
+		return -ENOENT;
+	}
+
+	*h = n->getHandle();
+	fillStat(n, stbuf);
+	if (gen == generation)
+	{
+		add(path, n);
+	}
+	delete n;
+	return 0;
+}
+
+AttrCache::Entry *AttrCache::add(const string &path, MegaNode *n)
+{
+	Entry *entry = &entries[path];
+	if (entry->h != n->getHandle())
+	{
+		entry->h = n->getHandle();
+		entry->listed = false;
+		entry->children.clear();
+	}
+	fillStat(n, &entry->st);
+	paths[entry->h] = path;
+	return entry;
+}
+
+void AttrCache::remove(const string &path)
+{
+	generation++;
+
+	string prefix = path == "/" ? path : path + "/";
+	map<string, Entry>::iterator it = entries.lower_bound(prefix);
+	while (it != entries.end() && !it->first.compare(0, prefix.size(), prefix))
+	{
+		forget(it++);
+	}
+
+	it = entries.find(path);
+	if (it != entries.end())
+	{
+		forget(it);
+	}
+
+	it = entries.find(parentPath(path));
+	if (it != entries.end())
+	{
+		it->second.listed = false;
+		it->second.children.clear();
+	}
+}
+
+void AttrCache::forget(map<string, Entry>::iterator it)
+{
+	map<MegaHandle, string>::iterator pit = paths.find(it->second.h);
+	if (pit != paths.end() && pit->second == it->first)
+	{
+		paths.erase(pit);
+	}
+	entries.erase(it);
+}
+
+int AttrCache::copyChildren(const string &path, Entry *entry, vector<string> *names, vector<struct stat> *attrs)
+{
+	for (size_t i = 0; i < entry->children.size(); i++)
+	{
+		map<string, Entry>::iterator it = entries.find(childPath(path, entry->children[i].c_str()));
+		if (it == entries.end() || it->second.h == INVALID_HANDLE)
+		{
+			continue;
+		}
+		names->push_back(entry->children[i]);
+		attrs->push_back(it->second.st);
+	}
+	return 0;
+}
+
+void AttrCache::fillStat(MegaNode *n, struct stat *stbuf)
+{
+	ino_t &inode = inodes[n->getHandle()];
+	if (!inode)
+	{
+		inode = nextInode++;
+	}
+
+	memset(stbuf, 0, sizeof(struct stat));
+	stbuf->st_ino = inode;
+	stbuf->st_uid = getuid();
+	stbuf->st_gid = getgid();
+	stbuf->st_mode = n->isFile() ? S_IFREG | 0444 : S_IFDIR | 0755;
+	stbuf->st_nlink = 1;
+	stbuf->st_size = n->isFile() ? n->getSize() : 4096;
+	stbuf->st_mtime = n->isFile() ? n->getModificationTime() : n->getCreationTime();
+}
+
+// reads from an open file through the block cache, sequential reads
+// download the next blocks in advance
+int readFile(BlockCache *cache, OpenFile *file, char *buf, size_t size, off_t offset)
+{
+	MegaNode *node = file->node;
+	if (offset >= node->getSize())
+	{
+		return 0;
+	}
+
+	if (offset + size > node->getSize())
+	{
+		size = node->getSize() - offset;
+	}
+
+	if (file->nextOffset.exchange(offset + size) == offset)
+	{
+		cache->readAhead(node, offset + size);
+	}
+
+	return cache->read(node, buf, size, offset);
+}
+
+// reads the range with a streaming transfer of its own, as every read did
+// before the block cache
+static int readDirect(MegaApi *api, MegaNode *node, char *buf, size_t size, off_t offset)
+{
+	SynchronousTransferListenerFuse listener;
+	api->startStreaming(node, offset, size, &listener);
+	listener.wait();
+	if (listener.getError()->getErrorCode() != MegaError::API_OK
+			|| listener.getDataSize() != (long long)size)
+	{
+		return -EIO;
+	}
+
+	memcpy(buf, listener.getData(), size);
+	return size;
+}
+
+// fio-like jobs over (the first 64 MB of) a file, through the same read path
+// as the filesystem
+vector<BenchResult> runBenchmark(MegaApi *api, BlockCache *cache, MegaNode *node)
+{
+	struct BenchJob
+	{
+		const char *name;
+		size_t blockSize;
+		bool random;
+		bool direct;
+		bool cold;
+	};
+
+	const BenchJob jobs[] = {
+		{ "seqread cold", 131072, false, false, true },
+		{ "seqread warm", 131072, false, false, false },
+		{ "randread cold", 4096, true, false, true },
+		{ "randread uncached", 4096, true, true, true },
+	};
+	const int randomOps = 256;
+	const long long maxBytes = 67108864;
+
+	OpenFile file;
+	file.node = node;
+	long long fileSize = node->getSize();
+	if (fileSize > maxBytes)
+	{
+		fileSize = maxBytes;
+	}
+
+	vector<BenchResult> results;
+	vector<char> buf(131072);
+	srand(0);
+
+	for (size_t j = 0; j < sizeof(jobs) / sizeof(jobs[0]); j++)
+	{
+		const BenchJob &job = jobs[j];
+		if (job.cold)
+		{
+			cache->clear();
+		}
+		file.nextOffset = 0;
+
+		BenchResult result;
+		result.name = job.name;
+		result.blockSize = job.blockSize;
+		result.ops = 0;
+		result.failed = false;
+		result.bytes = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		for (long long offset = 0; !result.failed && (job.random ? result.ops < randomOps : offset < fileSize); result.ops++)
+		{
+			if (job.random)
+			{
+				offset = (rand() % (fileSize / job.blockSize)) * job.blockSize;
+			}
+
+			int n = job.direct ? readDirect(api, node, buf.data(), job.blockSize, offset)
+			                   : readFile(cache, &file, buf.data(), job.blockSize, offset);
+			result.failed = n < 0;
+			result.bytes += n > 0 ? n : 0;
+
+			if (!job.random)
+			{
+				offset += job.blockSize;
+			}
+		}
+
+		result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		result.hits = job.direct ? -1 : cache->getHits();
+		result.misses = job.direct ? -1 : cache->getMisses();
+		results.push_back(result);
+	}
+
+	return results;
+}
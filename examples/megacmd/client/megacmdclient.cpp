@@ -26,6 +26,7 @@
 #include <vector>
 #include <memory.h>
 #include <limits.h>
+#include <stdlib.h>
 
 
 #include <sys/types.h>
@@ -37,6 +38,8 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
+#include <sys/time.h>
+#include <stdint.h>
 #endif
 #define MEGACMDINITIALPORTNUMBER 12300
 
@@ -421,29 +424,14 @@ return INVALID_SOCKET;
 #endif
 }
 
-int main(int argc, char* argv[])
+/**
+ * @brief executePetition
+ * Sends a petition to the server using a new connection and a new response socket
+ * @param out stream to write the output to (it is discarded if NULL)
+ * @return the outcode of the petition or a negative value in case of communication error
+ */
+int executePetition(const string &parsedArgs, ostream *out)
 {
-    if (argc < 2)
-    {
-        cerr << "Too few arguments" << endl;
-        return -1;
-    }
-    string parsedArgs = parseArgs(argc,argv);
-
-#if _WIN32
-    WORD wVersionRequested;
-    WSADATA wsaData;
-    int err;
-
-    /* Use the MAKEWORD(lowbyte, highbyte) macro declared in Windef.h */
-    wVersionRequested = MAKEWORD(2, 2);
-
-    err = WSAStartup(wVersionRequested, &wsaData);
-    if (err != 0) {
-        cerr << "ERROR initializing WSA" << endl;
-    }
-#endif
-
     int thesock = createSocket();
     if (thesock == INVALID_SOCKET)
     {
@@ -483,10 +471,10 @@ int main(int argc, char* argv[])
     char buffer[1025];
     do{
         n = recv(newsockfd, buffer, BUFFERSIZE, MSG_NOSIGNAL);
-        if (n)
+        if (n > 0 && out)
         {
             buffer[n]='\0';
-            cout << buffer;
+            *out << buffer;
         }
     } while(n == BUFFERSIZE && n !=SOCKET_ERROR);
 
@@ -498,6 +486,279 @@ int main(int argc, char* argv[])
 
     closeSocket(thesock);
     closeSocket(newsockfd);
+    return outcode;
+}
+
+#ifndef _WIN32
+// A connection opened with this byte is kept open by the server, which
+// reads framed petitions ([uint32 length][line]) and answers them in order
+// ([int outcode][uint32 length][output])
+#define MEGACMD_KEEPALIVE_MAGIC '\0'
+
+// max petitions sent ahead of their responses
+#define PIPELINEWINDOW 32
+
+bool sendAll(int socket, const void *data, size_t size)
+{
+    const char *ptr = (const char *)data;
+    while (size)
+    {
+        ssize_t n = send(socket, ptr, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool recvAll(int socket, void *data, size_t size)
+{
+    char *ptr = (char *)data;
+    while (size)
+    {
+        ssize_t n = recv(socket, ptr, size, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+int openKeepAliveConnection()
+{
+    int thesock = createSocket();
+    if (thesock == INVALID_SOCKET)
+    {
+        return INVALID_SOCKET;
+    }
+
+    char magic = MEGACMD_KEEPALIVE_MAGIC;
+    if (!sendAll(thesock, &magic, 1))
+    {
+        cerr << "ERROR opening keep-alive connection: " << ERRNO << endl;
+        closeSocket(thesock);
+        return INVALID_SOCKET;
+    }
+    return thesock;
+}
+
+bool sendPetition(int socket, const string &line)
+{
+    uint32_t size = line.size();
+    string frame((const char *)&size, sizeof(size));
+    frame.append(line);
+    return sendAll(socket, frame.data(), frame.size());
+}
+
+bool receiveResponse(int socket, int *outcode, string *output)
+{
+    uint32_t size;
+    if (!recvAll(socket, outcode, sizeof(*outcode)) || !recvAll(socket, &size, sizeof(size)))
+    {
+        return false;
+    }
+    output->resize(size);
+    return !size || recvAll(socket, (char *)output->data(), size);
+}
+
+/**
+ * @brief runPipeline
+ * Executes the commands read from stdin (one per line) through a single connection,
+ * keeping up to PIPELINEWINDOW of them in flight. Outputs are printed in order.
+ * @return the first non-zero outcode, 0 if all of them succeeded
+ */
+int runPipeline()
+{
+    int thesock = openKeepAliveConnection();
+    if (thesock == INVALID_SOCKET)
+    {
+        return INVALID_SOCKET;
+    }
+
+    int outcode = 0;
+    int inflight = 0;
+    bool eof = false;
+    string line;
+    string output;
+    while (!eof || inflight)
+    {
+        while (!eof && inflight < PIPELINEWINDOW)
+        {
+            if (!getline(cin, line))
+            {
+                eof = true;
+            }
+            else if (line.size())
+            {
+                if (!sendPetition(thesock, line))
+                {
+                    cerr << "ERROR writing to socket: " << ERRNO << endl;
+                    closeSocket(thesock);
+                    return -1;
+                }
+                inflight++;
+            }
+        }
+
+        if (inflight)
+        {
+            int code;
+            if (!receiveResponse(thesock, &code, &output))
+            {
+                cerr << "ERROR reading output: " << ERRNO << endl;
+                closeSocket(thesock);
+                return -1;
+            }
+            cout << output;
+            if (code && !outcode)
+            {
+                outcode = code;
+            }
+            inflight--;
+        }
+    }
+
+    closeSocket(thesock);
+    return outcode;
+}
+
+double currentms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+void printBenchmarkResult(const char *mode, int count, double ms)
+{
+    cout << mode << ": " << count << " commands in " << ms << " ms, "
+         << ms / count << " ms/command, " << count * 1000.0 / ms << " commands/s" << endl;
+}
+
+/**
+ * @brief runBenchmark
+ * Measures the latency and throughput of command round trips using one connection
+ * per command (as the mega-* scripts do), a keep-alive connection with one command
+ * at a time and a keep-alive connection with pipelined commands
+ */
+int runBenchmark(int count, const string &line)
+{
+    double start = currentms();
+    for (int i = 0; i < count; i++)
+    {
+        if (executePetition(line, NULL) < 0)
+        {
+            return -1;
+        }
+    }
+    printBenchmarkResult("One-shot", count, currentms() - start);
+
+    int thesock = openKeepAliveConnection();
+    if (thesock == INVALID_SOCKET)
+    {
+        return INVALID_SOCKET;
+    }
+
+    int outcode;
+    string output;
+    start = currentms();
+    for (int i = 0; i < count; i++)
+    {
+        if (!sendPetition(thesock, line) || !receiveResponse(thesock, &outcode, &output))
+        {
+            cerr << "ERROR in keep-alive connection: " << ERRNO << endl;
+            closeSocket(thesock);
+            return -1;
+        }
+    }
+    printBenchmarkResult("Keep-alive", count, currentms() - start);
+
+    int sent = 0;
+    int received = 0;
+    start = currentms();
+    while (received < count)
+    {
+        while (sent < count && sent - received < PIPELINEWINDOW)
+        {
+            if (!sendPetition(thesock, line))
+            {
+                cerr << "ERROR writing to socket: " << ERRNO << endl;
+                closeSocket(thesock);
+                return -1;
+            }
+            sent++;
+        }
+
+        if (!receiveResponse(thesock, &outcode, &output))
+        {
+            cerr << "ERROR reading output: " << ERRNO << endl;
+            closeSocket(thesock);
+            return -1;
+        }
+        received++;
+    }
+    printBenchmarkResult("Pipelined", count, currentms() - start);
+
+    closeSocket(thesock);
+    return 0;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Too few arguments" << endl;
+        return -1;
+    }
+
+#if _WIN32
+    WORD wVersionRequested;
+    WSADATA wsaData;
+    int err;
+
+    /* Use the MAKEWORD(lowbyte, highbyte) macro declared in Windef.h */
+    wVersionRequested = MAKEWORD(2, 2);
+
+    err = WSAStartup(wVersionRequested, &wsaData);
+    if (err != 0) {
+        cerr << "ERROR initializing WSA" << endl;
+    }
+#else
+    if (!strcmp(argv[1], "--pipeline"))
+    {
+        return runPipeline();
+    }
+
+    if (!strcmp(argv[1], "--benchmark"))
+    {
+        int count = argc > 2 ? atoi(argv[2]) : 0;
+        if (count <= 0)
+        {
+            cerr << "Usage: " << argv[0] << " --benchmark COUNT [command]" << endl;
+            return -1;
+        }
+        return runBenchmark(count, argc > 3 ? parseArgs(argc - 2, argv + 2) : string("version"));
+    }
+#endif
+
+    string parsedArgs = parseArgs(argc,argv);
+    int outcode = executePetition(parsedArgs, &cout);
+
 #if _WIN32
     WSACleanup();
 #endif
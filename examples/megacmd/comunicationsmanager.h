@@ -28,7 +28,6 @@ class CmdPetition
 {
     public:
         char * line = NULL;
-        mega::MegaThread * petitionThread = NULL;
 
         char *getLine()
         {
@@ -41,8 +40,6 @@ class CmdPetition
                 free(line);
             }
         }
-        mega::MegaThread *getPetitionThread() const;
-        void setPetitionThread(mega::MegaThread *value);
 };
 
 
@@ -72,6 +69,7 @@ public:
     /**
      * @brief getPetition
      * @return pointer to new CmdPetition. Petition returned must be properly deleted (this can be calling returnAndClosePetition)
+     * NULL if the event didn't carry a petition (e.g: a keep-alive connection was opened or closed)
      */
     virtual CmdPetition *getPetition();
 
@@ -21,8 +21,59 @@
 
 #include "comunicationsmanagerfilesockets.h"
 
+#include <fcntl.h>
+#include <stdint.h>
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef __MACH__
+#define MSG_NOSIGNAL 0
+#endif
+
 using namespace mega;
 
+static bool recvAll(int socket, void *data, size_t size)
+{
+    char *ptr = (char *)data;
+    while (size)
+    {
+        ssize_t n = recv(socket, ptr, size, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool sendAll(int socket, const void *data, size_t size)
+{
+    const char *ptr = (const char *)data;
+    while (size)
+    {
+        ssize_t n = send(socket, ptr, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
 int ComunicationsManagerFileSockets::get_next_outSocket_id()
 {
     mtx->lock();
@@ -86,8 +137,41 @@ int ComunicationsManagerFileSockets::create_new_socket(int *sockId)
 ComunicationsManagerFileSockets::ComunicationsManagerFileSockets()
 {
     count = 0;
+    listenerReady = false;
+    readlineReady = false;
     mtx = new MegaMutex();
     initialize();
+
+#ifdef USE_EPOLL
+    readlinefd = -1;
+    epollfd = epoll_create(16);
+    if (epollfd < 0)
+    {
+        LOG_fatal << "ERROR creating epoll instance: " << errno;
+    }
+    else if (sockfd >= 0)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof( event ));
+        event.events = EPOLLIN;
+        event.data.fd = sockfd;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event))
+        {
+            LOG_fatal << "ERROR watching socket: " << errno;
+        }
+    }
+#else
+    if (pipe(wakeuppipe))
+    {
+        LOG_fatal << "ERROR creating wakeup pipe: " << errno;
+        wakeuppipe[0] = wakeuppipe[1] = -1;
+    }
+    else
+    {
+        fcntl(wakeuppipe[0], F_SETFL, fcntl(wakeuppipe[0], F_GETFL) | O_NONBLOCK);
+        fcntl(wakeuppipe[1], F_SETFL, fcntl(wakeuppipe[1], F_GETFL) | O_NONBLOCK);
+    }
+#endif
 }
 
 int ComunicationsManagerFileSockets::initialize()
@@ -154,43 +238,99 @@ int ComunicationsManagerFileSockets::initialize()
 
 bool ComunicationsManagerFileSockets::receivedReadlineInput(int readline_fd)
 {
-    return FD_ISSET(readline_fd, &fds);
+    return readlineReady;
 }
 
 bool ComunicationsManagerFileSockets::receivedPetition()
 {
-    return FD_ISSET(sockfd, &fds);
+    return listenerReady || readyKeepAliveSockets.size();
 }
 
-int ComunicationsManagerFileSockets::waitForPetitionOrReadlineInput(int readline_fd)
+int ComunicationsManagerFileSockets::waitForEvents(int readline_fd)
 {
-    FD_ZERO(&fds);
-    FD_SET(readline_fd, &fds);
-    if (sockfd)
+    readlineReady = false;
+
+    // events already reported are served before blocking again
+    bool pending = listenerReady || readyKeepAliveSockets.size();
+
+#ifdef USE_EPOLL
+    if (readline_fd != readlinefd)
     {
-        FD_SET(sockfd, &fds);
+        struct epoll_event event;
+        memset(&event, 0, sizeof( event ));
+        if (readlinefd >= 0)
+        {
+            epoll_ctl(epollfd, EPOLL_CTL_DEL, readlinefd, &event);
+        }
+        if (readline_fd >= 0)
+        {
+            event.events = EPOLLIN;
+            event.data.fd = readline_fd;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, readline_fd, &event))
+            {
+                LOG_err << "ERROR watching readline input: " << errno;
+            }
+        }
+        readlinefd = readline_fd;
     }
-    int rc = select(FD_SETSIZE, &fds, NULL, NULL, NULL);
+
+    struct epoll_event events[64];
+    int rc = epoll_wait(epollfd, events, sizeof( events ) / sizeof( *events ), pending ? 0 : -1);
     if (rc < 0)
     {
         if (errno != EINTR)  //syscall
         {
-            LOG_fatal << "Error at select: " << errno;
+            LOG_fatal << "Error at epoll_wait: " << errno;
             return errno;
         }
+        return 0;
     }
-    return 0;
-}
-
 
-int ComunicationsManagerFileSockets::waitForPetition()
-{
+    for (int i = 0; i < rc; i++)
+    {
+        int fd = events[i].data.fd;
+        if (fd == sockfd)
+        {
+            listenerReady = true;
+        }
+        else if (fd == readlinefd)
+        {
+            readlineReady = true;
+        }
+        else
+        {
+            // one-shot: disarmed until its petition is answered
+            readyKeepAliveSockets.push_back(fd);
+        }
+    }
+#else
     FD_ZERO(&fds);
-    if (sockfd)
+    int maxfd = -1;
+    if (wakeuppipe[0] >= 0)
+    {
+        FD_SET(wakeuppipe[0], &fds);
+        maxfd = wakeuppipe[0];
+    }
+    if (readline_fd >= 0)
+    {
+        FD_SET(readline_fd, &fds);
+        maxfd = std::max(maxfd, readline_fd);
+    }
+    if (sockfd >= 0)
     {
         FD_SET(sockfd, &fds);
+        maxfd = std::max(maxfd, sockfd);
     }
-    int rc = select(FD_SETSIZE, &fds, NULL, NULL, NULL);
+    mtx->lock();
+    for (std::set<int>::iterator it = idleKeepAliveSockets.begin(); it != idleKeepAliveSockets.end(); it++)
+    {
+        FD_SET(*it, &fds);
+        maxfd = std::max(maxfd, *it);
+    }
+    mtx->unlock();
+
+    struct timeval notimeout = { 0, 0 };
+    int rc = select(maxfd + 1, &fds, NULL, NULL, pending ? &notimeout : NULL);
     if (rc < 0)
     {
         if (errno != EINTR)  //syscall
@@ -198,16 +338,146 @@ int ComunicationsManagerFileSockets::waitForPetition()
             LOG_fatal << "Error at select: " << errno;
             return errno;
         }
+        return 0;
     }
+
+    if (rc > 0)
+    {
+        if (wakeuppipe[0] >= 0 && FD_ISSET(wakeuppipe[0], &fds))
+        {
+            char buf[64];
+            while (read(wakeuppipe[0], buf, sizeof( buf )) > 0);
+        }
+
+        readlineReady = readline_fd >= 0 && FD_ISSET(readline_fd, &fds);
+        listenerReady = listenerReady || (sockfd >= 0 && FD_ISSET(sockfd, &fds));
+
+        mtx->lock();
+        for (std::set<int>::iterator it = idleKeepAliveSockets.begin(); it != idleKeepAliveSockets.end(); )
+        {
+            if (FD_ISSET(*it, &fds))
+            {
+                readyKeepAliveSockets.push_back(*it);
+                idleKeepAliveSockets.erase(it++);
+            }
+            else
+            {
+                it++;
+            }
+        }
+        mtx->unlock();
+    }
+#endif
     return 0;
 }
 
+int ComunicationsManagerFileSockets::waitForPetitionOrReadlineInput(int readline_fd)
+{
+    return waitForEvents(readline_fd);
+}
+
+int ComunicationsManagerFileSockets::waitForPetition()
+{
+    return waitForEvents(-1);
+}
+
+void ComunicationsManagerFileSockets::armKeepAliveSocket(int socket)
+{
+#ifdef USE_EPOLL
+    struct epoll_event event;
+    memset(&event, 0, sizeof( event ));
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = socket;
+    if (epoll_ctl(epollfd, EPOLL_CTL_MOD, socket, &event)
+            && (errno != ENOENT || epoll_ctl(epollfd, EPOLL_CTL_ADD, socket, &event)))
+    {
+        LOG_err << "ERROR watching keep-alive socket " << socket << ": " << errno;
+        close(socket);
+    }
+#else
+    mtx->lock();
+    idleKeepAliveSockets.insert(socket);
+    mtx->unlock();
+
+    char c = 0;
+    if (write(wakeuppipe[1], &c, 1) < 0 && errno != EAGAIN)
+    {
+        LOG_err << "ERROR writing to wakeup pipe: " << errno;
+    }
+#endif
+}
+
+void ComunicationsManagerFileSockets::closeKeepAliveSocket(int socket)
+{
+    LOG_verbose << "Closing keep-alive socket " << socket;
+#ifdef USE_EPOLL
+    struct epoll_event event;
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, socket, &event);
+#else
+    mtx->lock();
+    idleKeepAliveSockets.erase(socket);
+    mtx->unlock();
+#endif
+    close(socket);
+}
+
+CmdPetition *ComunicationsManagerFileSockets::getKeepAlivePetition(int socket)
+{
+    uint32_t size;
+    if (!recvAll(socket, &size, sizeof( size )) || size > MEGACMD_MAX_PETITION_SIZE)
+    {
+        // client closed the connection (or sent garbage)
+        closeKeepAliveSocket(socket);
+        return NULL;
+    }
+
+    CmdPetitionPosixSockets *inf = new CmdPetitionPosixSockets();
+    inf->keepAliveSocket = socket;
+    inf->line = (char *)malloc(size + 1);
+    if (!recvAll(socket, inf->line, size))
+    {
+        LOG_err << "ERROR reading petition from keep-alive socket " << socket;
+        closeKeepAliveSocket(socket);
+        delete inf;
+        return NULL;
+    }
+    inf->line[size] = '\0';
+
+    return inf;
+}
+
 /**
  * @brief returnAndClosePetition
  * I will clean struct and close the socket within
  */
 void ComunicationsManagerFileSockets::returnAndClosePetition(CmdPetition *inf, std::ostringstream *s, int outCode)
 {
+    int keepAliveSocket = ((CmdPetitionPosixSockets *)inf)->keepAliveSocket;
+    if (keepAliveSocket >= 0)
+    {
+        LOG_verbose << "Output to write in keep-alive socket " << keepAliveSocket << ": <<" << s->str() << ">>";
+
+        // single write per response
+        string frame;
+        string sout = s->str();
+        uint32_t size = sout.size();
+        frame.reserve(sizeof( outCode ) + sizeof( size ) + size);
+        frame.append((const char *)&outCode, sizeof( outCode ));
+        frame.append((const char *)&size, sizeof( size ));
+        frame.append(sout);
+
+        if (sendAll(keepAliveSocket, frame.data(), frame.size()))
+        {
+            armKeepAliveSocket(keepAliveSocket);
+        }
+        else
+        {
+            LOG_err << "ERROR writing to keep-alive socket: " << errno;
+            closeKeepAliveSocket(keepAliveSocket);
+        }
+        delete inf;
+        return;
+    }
 
     LOG_verbose << "Output to write in socket " << ((CmdPetitionPosixSockets *)inf)->outSocket << ": <<" << s->str() << ">>";
     sockaddr_in cliAddr;
@@ -220,9 +490,6 @@ void ComunicationsManagerFileSockets::returnAndClosePetition(CmdPetition *inf, s
         return;
     }
     string sout = s->str();
-#ifdef __MACH__
-#define MSG_NOSIGNAL 0
-#endif
     int n = send(connectedsocket, (void*)&outCode, sizeof( outCode ), MSG_NOSIGNAL);
     if (n < 0)
     {
@@ -244,6 +511,15 @@ void ComunicationsManagerFileSockets::returnAndClosePetition(CmdPetition *inf, s
  */
 CmdPetition * ComunicationsManagerFileSockets::getPetition()
 {
+    if (readyKeepAliveSockets.size())
+    {
+        int socket = readyKeepAliveSockets.front();
+        readyKeepAliveSockets.pop_front();
+        return getKeepAlivePetition(socket);
+    }
+
+    listenerReady = false;
+
     CmdPetitionPosixSockets *inf = new CmdPetitionPosixSockets();
 
     clilen = sizeof( cli_addr );
@@ -258,6 +534,16 @@ CmdPetition * ComunicationsManagerFileSockets::getPetition()
         return inf;
     }
 
+    char magic;
+    if (recv(newsockfd, &magic, 1, MSG_PEEK) == 1 && magic == MEGACMD_KEEPALIVE_MAGIC)
+    {
+        recv(newsockfd, &magic, 1, 0);
+        LOG_verbose << "Keep-alive connection opened: " << newsockfd;
+        armKeepAliveSocket(newsockfd);
+        delete inf;
+        return NULL;
+    }
+
     bzero(buffer, 1024);
     int n = read(newsockfd, buffer, 1023);
     if (n < 0)
@@ -294,12 +580,31 @@ CmdPetition * ComunicationsManagerFileSockets::getPetition()
 string ComunicationsManagerFileSockets::get_petition_details(CmdPetition *inf)
 {
     ostringstream os;
-    os << "socket output: " << ((CmdPetitionPosixSockets *)inf)->outSocket;
+    if (((CmdPetitionPosixSockets *)inf)->keepAliveSocket >= 0)
+    {
+        os << "keep-alive socket: " << ((CmdPetitionPosixSockets *)inf)->keepAliveSocket;
+    }
+    else
+    {
+        os << "socket output: " << ((CmdPetitionPosixSockets *)inf)->outSocket;
+    }
     return os.str();
 }
 
 
 ComunicationsManagerFileSockets::~ComunicationsManagerFileSockets()
 {
+#ifdef USE_EPOLL
+    if (epollfd >= 0)
+    {
+        close(epollfd);
+    }
+#else
+    if (wakeuppipe[0] >= 0)
+    {
+        close(wakeuppipe[0]);
+        close(wakeuppipe[1]);
+    }
+#endif
     delete mtx;
 }
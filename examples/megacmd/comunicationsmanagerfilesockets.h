@@ -26,10 +26,27 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include <deque>
+#include <set>
+
+#ifdef __linux__
+#define USE_EPOLL
+#endif
+
+// a client opening a connection with this byte keeps it open and sends
+// framed petitions: [uint32 length][line], answered in order with
+// [int outcode][uint32 length][output]
+#define MEGACMD_KEEPALIVE_MAGIC '\0'
+#define MEGACMD_MAX_PETITION_SIZE 65536
+
 class CmdPetitionPosixSockets: public CmdPetition
 {
 public:
-    int outSocket;
+    // listening socket for the response of a one-shot petition
+    int outSocket = -1;
+
+    // connection of a keep-alive petition
+    int keepAliveSocket = -1;
 };
 
 std::ostream &operator<<(std::ostream &os, CmdPetitionPosixSockets &p);
@@ -39,6 +56,22 @@ class ComunicationsManagerFileSockets : public ComunicationsManager
 private:
     fd_set fds;
 
+#ifdef USE_EPOLL
+    int epollfd;
+    int readlinefd;
+#else
+    // wakes up the select() in the main thread when a keep-alive
+    // connection is ready to receive its next petition
+    int wakeuppipe[2];
+    std::set<int> idleKeepAliveSockets;
+#endif
+
+    // keep-alive connections with pending input and listener state
+    // as reported by the last wait
+    std::deque<int> readyKeepAliveSockets;
+    bool listenerReady;
+    bool readlineReady;
+
     // sockets and asociated variables
     int sockfd, newsockfd;
     socklen_t clilen;
@@ -58,6 +91,14 @@ private:
      */
     int create_new_socket(int *sockId);
 
+    int waitForEvents(int readline_fd);
+
+    // (re)starts watching a keep-alive connection for its next petition
+    void armKeepAliveSocket(int socket);
+    void closeKeepAliveSocket(int socket);
+
+    CmdPetition *getKeepAlivePetition(int socket);
+
 public:
     ComunicationsManagerFileSockets();
 
@@ -80,6 +121,7 @@ public:
     /**
      * @brief getPetition
      * @return pointer to new CmdPetitionPosix. Petition returned must be properly deleted (this can be calling returnAndClosePetition)
+     * NULL if the event didn't carry a petition (a keep-alive connection was opened or closed)
      */
     CmdPetition *getPetition();
 
@@ -38,6 +38,7 @@
 #include <readline/history.h>
 #include <iomanip>
 #include <string>
+#include <deque>
 
 
 #ifdef _WIN32
@@ -53,7 +54,15 @@ using namespace mega;
 
 MegaCmdExecuter *cmdexecuter;
 
-MegaSemaphore semaphoreClients; //to limit max parallel petitions
+// petitions are served by a pool of reusable threads, created on demand
+// up to MAXPETITIONWORKERS (max parallel petitions)
+#define MAXPETITIONWORKERS 100
+std::deque<CmdPetition *> petitionQueue;
+MegaMutex mutexPetitionQueue;
+MegaSemaphore semaphorePetitionQueue;
+std::vector<MegaThread *> petitionWorkers;
+int idlePetitionWorkers = 0;
+bool stopPetitionWorkers = false;
 
 MegaApi *api;
 
@@ -65,10 +74,6 @@ MegaMutex mutexapiFolders;
 
 MegaCMDLogger *loggerCMD;
 
-MegaMutex mutexEndedPetitionThreads;
-std::vector<MegaThread *> petitionThreads;
-std::vector<MegaThread *> endedPetitionThreads;
-
 
 //Comunications Manager
 ComunicationsManager * cm;
@@ -1967,10 +1972,8 @@ static bool process_line(char* l)
     return false; //Do not exit
 }
 
-void * doProcessLine(void *pointer)
+void processPetition(CmdPetition *inf)
 {
-    CmdPetition *inf = (CmdPetition*)pointer;
-
     std::ostringstream s;
     setCurrentThreadOutStream(&s);
     setCurrentThreadLogLevel(MegaApi::LOG_LEVEL_ERROR);
@@ -1982,49 +1985,81 @@ void * doProcessLine(void *pointer)
 
     LOG_verbose << " Procesed " << *inf << " in thread: " << MegaThread::currentThreadId() << " " << cm->get_petition_details(inf);
 
-    MegaThread * petitionThread = inf->getPetitionThread();
     cm->returnAndClosePetition(inf, &s, getCurrentOutCode());
 
-    semaphoreClients.release();
     if (doExit)
     {
         exit(0);
     }
-
-    mutexEndedPetitionThreads.lock();
-    endedPetitionThreads.push_back(petitionThread);
-    mutexEndedPetitionThreads.unlock();
-
-    return NULL;
 }
 
-
-void delete_finished_threads()
+void * doProcessPetitions(void *)
 {
-    mutexEndedPetitionThreads.lock();
-    for (std::vector<MegaThread *>::iterator it = endedPetitionThreads.begin(); it != endedPetitionThreads.end(); )
+    for (;;)
     {
-        MegaThread *mt = (MegaThread*)*it;
-        for (std::vector<MegaThread *>::iterator it2 = petitionThreads.begin(); it2 != petitionThreads.end(); )
+        semaphorePetitionQueue.wait();
+
+        mutexPetitionQueue.lock();
+        if (stopPetitionWorkers)
         {
-            if (mt == (MegaThread*)*it2)
-            {
-                it2 = petitionThreads.erase(it2);
-            }
-            else
-            {
-                ++it2;
-            }
+            mutexPetitionQueue.unlock();
+            break;
         }
+        CmdPetition *inf = petitionQueue.front();
+        petitionQueue.pop_front();
+        mutexPetitionQueue.unlock();
+
+        processPetition(inf);
+
+        mutexPetitionQueue.lock();
+        idlePetitionWorkers++;
+        mutexPetitionQueue.unlock();
+    }
+
+    return NULL;
+}
+
+void queuePetition(CmdPetition *inf)
+{
+    mutexPetitionQueue.lock();
+    petitionQueue.push_back(inf);
 
-        mt->join();
-        delete mt;
-        it = endedPetitionThreads.erase(it);
+    // every queued petition reserves an idle worker, so that a new one is
+    // only started when all of them are busy
+    if (idlePetitionWorkers)
+    {
+        idlePetitionWorkers--;
+    }
+    else if (petitionWorkers.size() < MAXPETITIONWORKERS)
+    {
+        MegaThread *worker = new MegaThread();
+        petitionWorkers.push_back(worker);
+        worker->start(doProcessPetitions, NULL);
+        LOG_debug << "Started petition worker " << petitionWorkers.size();
+    }
+    else
+    {
+        LOG_debug << "All petition workers busy, queued: " << *inf;
     }
-    mutexEndedPetitionThreads.unlock();
+    mutexPetitionQueue.unlock();
+
+    semaphorePetitionQueue.release();
 }
 
+// wakes up idle workers so that they exit. Busy ones are not waited for:
+// they might be serving a long-running petition
+void stopPetitionProcessing()
+{
+    mutexPetitionQueue.lock();
+    stopPetitionWorkers = true;
+    size_t workers = petitionWorkers.size();
+    mutexPetitionQueue.unlock();
 
+    for (size_t i = 0; i < workers; i++)
+    {
+        semaphorePetitionQueue.release();
+    }
+}
 
 void finalize()
 {
@@ -2033,7 +2068,7 @@ void finalize()
         return;
     alreadyfinalized = true;
     LOG_info << "closing application ...";
-    delete_finished_threads();
+    stopPetitionProcessing();
     delete cm;
     if (!consoleFailed)
     {
@@ -2117,23 +2152,13 @@ void megacmd()
                     }
                     else if (cm->receivedPetition())
                     {
-                        semaphoreClients.wait();
-                        LOG_verbose << "Client connected ";
-
                         CmdPetition *inf = cm->getPetition();
+                        if (inf)
+                        {
+                            LOG_verbose << "petition registered: " << *inf;
 
-                        LOG_verbose << "petition registered: " << *inf;
-
-                        delete_finished_threads();
-
-                        //append new one
-                        MegaThread * petitionThread = new MegaThread();
-                        petitionThreads.push_back(petitionThread);
-                        inf->setPetitionThread(petitionThread);
-
-                        LOG_debug << "starting processing: " << *inf;
-
-                        petitionThread->start(doProcessLine, (void*)inf);
+                            queuePetition(inf);
+                        }
                     }
                 }
                 else
@@ -2331,7 +2356,7 @@ int main(int argc, char* argv[])
 
     mutexHistory.init(false);
 
-    mutexEndedPetitionThreads.init(false);
+    mutexPetitionQueue.init(false);
 
     ConfigurationManager::loadConfiguration(( argc > 1 ) && !( strcmp(argv[1], "--debug")));
 
@@ -2370,11 +2395,6 @@ int main(int argc, char* argv[])
         semaphoreapiFolders.release();
     }
 
-    for (int i = 0; i < 100; i++)
-    {
-        semaphoreClients.release();
-    }
-
     mutexapiFolders.init(false);
 
     api->setLoggerObject(loggerCMD);
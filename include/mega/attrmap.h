@@ -27,7 +27,43 @@
 namespace mega {
 
 // maps attribute names to attribute values
-typedef map<nameid, string> attr_map;
+// nodes carry very few attributes, so they are kept in a sorted vector
+// (single allocation) with the subset of the std::map interface in use
+class MEGA_API attr_map
+{
+public:
+    typedef pair<nameid, string> value_type;
+    typedef vector<value_type>::iterator iterator;
+    typedef vector<value_type>::const_iterator const_iterator;
+
+    iterator begin() { return values.begin(); }
+    iterator end() { return values.end(); }
+    const_iterator begin() const { return values.begin(); }
+    const_iterator end() const { return values.end(); }
+
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+    void clear() { values.clear(); }
+
+    iterator find(nameid);
+    const_iterator find(nameid) const;
+    size_t count(nameid name) const { return find(name) != end(); }
+
+    // the returned reference is invalidated by insertions and removals
+    string& operator[](nameid);
+
+    pair<iterator, bool> insert(const value_type&);
+    size_t erase(nameid);
+    void erase(iterator it) { values.erase(it); }
+
+    bool operator==(const attr_map& other) const { return values == other.values; }
+    bool operator!=(const attr_map& other) const { return values != other.values; }
+
+private:
+    vector<value_type> values;
+
+    iterator lowerbound(nameid);
+};
 
 struct MEGA_API AttrMap
 {
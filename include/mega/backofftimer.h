@@ -25,6 +25,17 @@
 #include "types.h"
 
 namespace mega {
+class TimerWheel;
+class BackoffTimer;
+
+// notified by the TimerWheel when a pending timer elapses
+class MEGA_API TimerListener
+{
+public:
+    virtual void timerexpired(BackoffTimer*) = 0;
+    virtual ~TimerListener() { }
+};
+
 // generic timer facility with exponential backoff
 class MEGA_API BackoffTimer
 {
@@ -32,6 +43,22 @@ class MEGA_API BackoffTimer
     dstime delta;
     dstime base;
 
+    // position in the TimerWheel while the timer is pending
+    TimerWheel* wheel;
+    BackoffTimer* wheelprev;
+    BackoffTimer* wheelnext;
+    int wheelslot;
+    TimerListener* listener;
+
+    // update the TimerWheel after a change of the trigger time
+    void reschedule();
+
+    friend class TimerWheel;
+
+    // timers are linked into the wheel by address
+    BackoffTimer(const BackoffTimer&);
+    BackoffTimer& operator=(const BackoffTimer&);
+
 public:
     // reset timer
     void reset();
@@ -63,7 +90,62 @@ public:
     // update time to wait
     void update(dstime*);
 
+    // keep the timer in a TimerWheel while it's pending, optionally
+    // notifying the listener when it elapses there
+    void setwheel(TimerWheel*, TimerListener* = NULL);
+
     BackoffTimer();
+    ~BackoffTimer();
+};
+
+// hierarchical timing wheel (decisecond ticks, LEVELS x SLOTS buckets)
+// tracking pending BackoffTimers, so that the next wakeup is found without
+// visiting every timer. Timers more than SLOTS ds away are kept in coarser
+// buckets and moved to finer ones when their range is reached.
+class MEGA_API TimerWheel
+{
+public:
+    static const int SLOTBITS = 6;
+    static const int SLOTS = 1 << SLOTBITS;
+    static const int LEVELS = 4;
+
+    // expire timers up to Waiter::ds and update the time to wait: 0 if
+    // timers expired since the last call, otherwise the next trigger time
+    // or the time at which the bucket containing it is refined
+    void update(dstime*);
+
+    // expire timers up to Waiter::ds (notifying their listeners) without
+    // consuming the wakeup reported by update()
+    void expire();
+
+    // number of pending timers
+    unsigned size() const;
+
+    TimerWheel();
+    ~TimerWheel();
+
+protected:
+    friend class BackoffTimer;
+
+    // queue or requeue a timer at its trigger time
+    void add(BackoffTimer*);
+
+    // dequeue a timer (no-op if not queued)
+    void remove(BackoffTimer*);
+
+private:
+    BackoffTimer* slots[LEVELS][SLOTS];
+    uint64_t occupied[LEVELS];
+
+    // next tick to be processed
+    dstime current;
+
+    unsigned count;
+    bool expired;
+
+    void insert(BackoffTimer*);
+    void advance(dstime);
+    void cascade(int level, int index);
 };
 } // namespace
 
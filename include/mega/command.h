@@ -51,6 +51,14 @@ public:
     char level;
     bool persistent;
 
+    // command name passed to cmd()
+    const char* cmdname;
+
+    // the command may be in flight along with other requests (API
+    // pipelining) - commands with the same order key are kept in order
+    bool concurrent;
+    handle orderkey;
+
     void cmd(const char*);
     void notself(MegaClient*);
     virtual void cancel(void);
@@ -22,6 +22,9 @@
 /* Define to 1 if you have the `fdopendir' function. */
 #define HAVE_FDOPENDIR 1
 
+/* Define to 1 if you have the `fstatat' function. */
+#define HAVE_FSTATAT 1
+
 /* Define to 1 if you have the <FreeImage.h> header file. */
 /* #undef HAVE_FREEIMAGE_H */
 
@@ -34,6 +34,7 @@
 #include <cryptopp/rsa.h>
 #include <cryptopp/crc.h>
 #include <cryptopp/nbtheory.h>
+#include <cryptopp/modarith.h>
 #include <cryptopp/algparam.h>
 #include <cryptopp/hmac.h>
 
@@ -265,6 +266,13 @@ class MEGA_API AsymmCipher
 {
     int decodeintarray(CryptoPP::Integer*, int, const byte*, int);
 
+    // CRT exponents d mod (p-1) and d mod (q-1), and the p, q and d they
+    // were computed for
+    CryptoPP::Integer crtexp[2];
+    CryptoPP::Integer crtkey[3];
+
+    void precompute();
+
 public:
     enum { PRIV_P, PRIV_Q, PRIV_D, PRIV_U };
     enum { PUB_PQ, PUB_E };
@@ -346,6 +354,24 @@ public:
      */
     unsigned rawdecrypt(const byte* cipher, int cipherlen, byte* buf, int buflen);
 
+    // threads decrypting a batch, and minimum number of cipher texts per thread
+    static const unsigned BATCHTHREADS = 4;
+    static const unsigned BATCHPERTHREAD = 16;
+
+    /**
+     * @brief Decrypts several cipher texts like AsymmCipher::decrypt.
+     *
+     * The CRT exponents are computed once for the whole batch, which is
+     * spread over a pool of threads with a Montgomery context each.
+     *
+     * @param ciphers Cipher texts.
+     * @param count Number of cipher texts.
+     * @param plains Strings to take the plain texts (empty if invalid).
+     * @param numbytes Length of the plain texts.
+     * @return Number of cipher texts decrypted.
+     */
+    unsigned decryptbatch(const string* ciphers, unsigned count, string* plains, int numbytes);
+
     static void serializeintarray(CryptoPP::Integer*, int, string*, bool headers = true);
 
     /**
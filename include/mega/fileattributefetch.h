@@ -53,7 +53,15 @@ struct MEGA_API FileAttributeFetchChannel
     // notify app of nodes that failed to receive their requested attribute
     void failed(MegaClient*);
 
+    // keep the timeout in the client's TimerWheel while a request is in
+    // flight and the backoff timer while fetches are waiting for a retry
+    void updatetimers(MegaClient*);
+
     FileAttributeFetchChannel();
+
+private:
+    bool btqueued;
+    bool timeoutqueued;
 };
 
 // pending individual attribute fetch
@@ -158,6 +158,23 @@ struct MEGA_API InputStreamAccess
     virtual ~InputStreamAccess() { }
 };
 
+// directory record as returned by DirAccess::dnextentry()
+struct MEGA_API DirEntry
+{
+    nodetype_t type;
+
+    // only set if statvalid (same semantics as in FileAccess)
+    m_off_t size;
+    m_time_t mtime;
+    handle fsid;
+    bool fsidvalid;
+
+    // size, mtime and fsid were obtained during the enumeration
+    bool statvalid;
+
+    DirEntry();
+};
+
 // generic host directory enumeration
 struct MEGA_API DirAccess
 {
@@ -167,6 +184,10 @@ struct MEGA_API DirAccess
     // get next record
     virtual bool dnext(string*, string*, bool = true, nodetype_t* = NULL) = 0;
 
+    // get next record with as many of its attributes as the platform can
+    // provide without opening it (by default, only the type)
+    virtual bool dnextentry(string*, string*, bool, DirEntry*);
+
     virtual ~DirAccess() { }
 };
 
@@ -179,6 +200,32 @@ struct MEGA_API DirNotify
     // notifyq[RETRY] receives transient errors that need to be retried
     notify_deque notifyq[NUMQUEUES];
 
+    // number of queued records per (LocalNode, path) and sequence number of
+    // the last one - repeated notifications of a still queued item are
+    // coalesced into it
+    struct PendingNotification
+    {
+        unsigned count;
+        uint64_t last;
+    };
+    typedef map<pair<LocalNode*, string>, PendingNotification> notifykey_map;
+    notifykey_map pendingnotifications[NUMQUEUES];
+
+    // sequence number of the first record of each queue
+    uint64_t firstnotification[NUMQUEUES];
+
+    // set while the first record of a queue is being processed - it no longer
+    // takes repeated notifications, which are queued again instead
+    bool processingnotification[NUMQUEUES];
+
+    // notifications received / dropped because the item was already queued
+    m_off_t notifications;
+    m_off_t coalescednotifications;
+
+    // per-sync limit of filesystem watches, on platforms that need one per
+    // folder (0: only bounded by the platform)
+    unsigned maxwatches;
+
     // set if no notification available on this platform or a permanent failure
     // occurred
     bool failed;
@@ -192,7 +239,16 @@ struct MEGA_API DirNotify
     virtual void addnotify(LocalNode*, string*) { }
     virtual void delnotify(LocalNode*) { }
 
-    void notify(notifyqueue, LocalNode *, const char*, size_t, bool = false);
+    void notify(notifyqueue, LocalNode *, const char*, size_t, bool = false, ScanRecord* = NULL);
+
+    // start processing the first record of a queue
+    void processnotification(notifyqueue);
+
+    // remove the first record of a queue
+    void popnotification(notifyqueue);
+
+    // deactivate all queued records of a LocalNode that is being deleted
+    void cancelnotifications(LocalNode*);
 
     // filesystem fingerprint
     virtual fsfp_t fsfingerprint();
@@ -203,7 +259,7 @@ struct MEGA_API DirNotify
     Sync *sync;
 
     DirNotify(string*, string*);
-    virtual ~DirNotify() {}
+    virtual ~DirNotify();
 };
 
 // generic host filesystem access interface
@@ -242,9 +298,17 @@ struct MEGA_API FileSystemAccess : public EventTrigger
     // convert local path to MEGA format (UTF-8) with unescaping
     void name2local(string*) const;
 
-    //Normalize UTF-8 string
+    // normalize UTF-8 string to NFC (cleared if not valid UTF-8) - strings
+    // that are normalized already are left alone without allocating memory
     void normalize(string *) const;
 
+    // normalize a batch of UTF-8 strings, with a scratch buffer that can be
+    // reused across calls - returns the number of strings that were changed
+    size_t normalize(string*, size_t, vector<int32_t>*) const;
+
+    // NFC quick check (true if known to be normalized)
+    static bool isnormalized(const char*, size_t);
+
     // generate local temporary file name
     virtual void tmpnamelocal(string*) const = 0;
 
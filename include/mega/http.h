@@ -172,6 +172,35 @@ struct MEGA_API HttpIO : public EventTrigger
     // get max upload speed
     virtual m_off_t getmaxuploadspeed();
 
+    // multiplex requests to the same host over HTTP/2 (where available)
+    virtual bool sethttp2(bool);
+
+    // check if HTTP/2 multiplexing is enabled
+    virtual bool usinghttp2();
+
+    // connection statistics: requests that needed a new connection, requests
+    // that reused an existing one and accumulated TLS handshake time (ms)
+    long long newconnections;
+    long long reusedconnections;
+    long long handshaketimems;
+
+    // resolve the host of an URL in advance, so that the first request to
+    // it doesn't have to wait for the DNS lookup
+    virtual void prefetchdns(const string*) { }
+
+    // DNS statistics: lookups sent, requests served from the cache (stale
+    // entries are revalidated in the background) and accumulated time
+    // requests spent waiting for name resolution (ms)
+    long long dnslookups;
+    long long dnscachehits;
+    long long dnsstalehits;
+    long long dnswaittimems;
+
+    // bytes received by HttpReq::put() and bytes copied to store them
+    // (including buffer reallocations and compaction)
+    long long receivedbytes;
+    long long copiedbytes;
+
     HttpIO();
     virtual ~HttpIO() { }
 };
@@ -247,6 +276,9 @@ struct MEGA_API HttpReq
     // timestamp of last data sent or received
     dstime lastdata;
 
+    // time spent waiting for name resolution before sending (ms)
+    m_time_t dnswaitms;
+
     // prevent raw data from being dumped in debug mode
     bool binary;
 
@@ -285,10 +317,18 @@ struct MEGA_API HttpReqDL : public HttpReqXfer
     m_off_t dlpos;
     chunkmac_map chunkmacs;
 
+    // pool the receive buffer was taken from (NULL if allocated with new[])
+    TransferBufferPool* bufferpool;
+
+    // allocated size of buf (buflen is the size of the current request)
+    m_off_t bufcapacity;
+
     void prepare(const char*, SymmCipher*, chunkmac_map*, uint64_t, m_off_t, m_off_t);
     void finalize(Transfer *transfer);
+    void finalize(SymmCipher*, chunkmac_map*, int64_t, m_off_t);
 
-    ~HttpReqDL() { }
+    HttpReqDL() : bufferpool(NULL), bufcapacity(0) { }
+    ~HttpReqDL();
 };
 
 // file attribute get
@@ -296,6 +336,69 @@ struct MEGA_API HttpReqGetFA : public HttpReq
 {
     ~HttpReqGetFA() { }
 };
+
+// recycles chunk-sized receive buffers and chunk requests across transfers,
+// so that steady-state transfers don't hit the allocator for every chunk
+class MEGA_API TransferBufferPool
+{
+public:
+    // buffer sizes are rounded up to a multiple of this (one chunk MAC segment)
+    static const m_off_t GRANULARITY = 131072;
+
+    // default limit of idle buffer memory kept for reuse
+    static const m_off_t MAXCACHEDBYTES = 33554432;
+
+    // maximum number of idle request objects kept per direction
+    static const unsigned MAXSPAREREQS = 24;
+
+    // alignment of the buffers
+    static const m_off_t ALIGNMENT = 4096;
+
+    // get a buffer of at least len bytes, padded to a multiple of
+    // SymmCipher::BLOCKSIZE - its real size is returned in capacity
+    byte* allocbuf(m_off_t len, m_off_t* capacity);
+
+    // return a buffer obtained from allocbuf()
+    void freebuf(byte*, m_off_t capacity);
+
+    // get a recycled or new chunk request for the given direction
+    HttpReqXfer* allocreq(direction_t);
+
+    // disconnect a chunk request and keep it for reuse
+    void freereq(HttpReqXfer*);
+
+    // release all idle buffers and requests
+    void clear();
+
+    // limit of idle buffer memory
+    m_off_t maxcachedbytes;
+
+    // buffer memory handed out / kept idle / high watermark of both
+    m_off_t bytesinuse;
+    m_off_t bytescached;
+    m_off_t peakbytes;
+
+    // number of buffers allocated from the heap / served from the pool
+    long long bufallocs;
+    long long bufreuses;
+
+    // number of requests created / recycled
+    long long reqallocs;
+    long long reqreuses;
+
+    TransferBufferPool();
+    ~TransferBufferPool();
+
+private:
+    static byte* allocaligned(m_off_t);
+    static void freealigned(byte*);
+
+    // idle buffers by capacity
+    multimap<m_off_t, byte*> freebufs;
+
+    // idle requests (PUT/GET)
+    vector<HttpReqXfer*> sparereqs[2];
+};
 } // namespace
 
 #endif
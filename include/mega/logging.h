@@ -74,6 +74,15 @@
     QString a = QString::fromAscii("test1");
     LOG_info << a;
     LOG_info << QString::fromAscii("test2");
+
+
+    4)
+    // format and write log lines in a background thread
+    SimpleLogger::setAsyncMode(true);
+
+    ...
+    LOG_debug << "test"; // only copied to a buffer of the current thread
+    SimpleLogger::flush(); // write pending lines now
 */
 
 #ifndef MEGA_LOGGING_H
@@ -129,16 +138,20 @@ public:
 class MEGA_API SimpleLogger {
     enum LogLevel level;
     bool lineBreak;
-    std::ostringstream ostr;
-    std::string t;
-    std::string fname;
+    char const* filename;
+    int line;
 
-    OutputStreams getOutput(enum LogLevel ll)
-    {
-        return outputs[ll];
-    }
+    // reusable stream of the thread, or a private one
+    std::ostringstream *ostr;
+    bool ownStream;
 
-    string getTime();
+    static string getTime();
+
+    // write a formatted line to the output class and streams
+    static void output(enum LogLevel ll, const char *time, char const* filename, int line,
+                       const char *message, size_t length, bool lBreak);
+
+    friend class AsyncLogWriter;
 
 public:
     static OutputMap outputs;
@@ -148,6 +161,9 @@ public:
 
     static enum LogLevel logCurrentLevel;
 
+    // default size of the per-thread buffers of the asynchronous mode
+    static const size_t ASYNC_BUFFER_SIZE = 262144;
+
     SimpleLogger(enum LogLevel ll, char const* filename, int line, bool lBreak = true);
     ~SimpleLogger();
 
@@ -175,9 +191,9 @@ public:
     SimpleLogger& operator<<(T* obj)
     {
         if(obj != NULL)
-            ostr << obj;
+            *ostr << obj;
         else
-            ostr << "(NULL)";
+            *ostr << "(NULL)";
 
         return *this;
     }
@@ -185,14 +201,14 @@ public:
     template <typename T>
     SimpleLogger& operator<<(T const& obj)
     {
-        ostr << obj;
+        *ostr << obj;
         return *this;
     }
 
 #ifdef MEGA_QT_LOGGING
     SimpleLogger& operator<<(const QString& s)
     {
-        ostr << s.toUtf8().constData();
+        *ostr << s.toUtf8().constData();
         return *this;
     }
 #endif
@@ -223,8 +239,17 @@ public:
     }
 
     // Synchronizes all registered stream buffers with their controlled output sequence
+    // (in asynchronous mode, pending lines are written first)
     static void flush();
 
+    // asynchronous mode: log lines are stored with a monotonic timestamp in
+    // per-thread ring buffers, then formatted and written by a background
+    // thread. Enable it before other threads start logging.
+    // returns false if the platform doesn't support it
+    static bool setAsyncMode(bool enable, size_t bufferSize = ASYNC_BUFFER_SIZE);
+
+    static bool isAsyncMode();
+
     // set output settings for log level
     static void setOutputSettings(enum LogLevel ll, bool enableTime, bool enableLevel, bool enableSource)
     {
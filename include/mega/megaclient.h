@@ -180,6 +180,9 @@ public:
     // all nodes
     node_map nodes;
 
+    // storage of the Node objects
+    NodeArena nodearena;
+
     // all users
     user_map users;
 
@@ -263,6 +266,13 @@ public:
     // fetchnodes stats
     FetchNodesStats fnstats;
 
+    // thread ID of the exec() phases in a performance trace
+    unsigned traceid;
+
+    // queue depths and connection statistics for a performance snapshot
+    void getmetrics(ClientMetrics*);
+    void resetmetrics();
+
 #ifdef ENABLE_CHAT
     // load cryptographic keys: RSA, Ed25519, Cu25519 and their signatures
     void fetchkeys();    
@@ -316,6 +326,15 @@ public:
 
     // indicates whether all startup syncs have been fully scanned
     bool syncsup;
+
+    // threads enumerating folders and fingerprinting files during the
+    // initial scan of a sync (0: the scan runs on the SDK thread only)
+    unsigned syncscanthreads;
+    static const unsigned MAXSYNCSCANTHREADS = 16;
+
+    // filesystem watch limit of new syncs (0: no per-sync limit), folders
+    // beyond it are rescanned periodically
+    unsigned syncmaxwatches;
 #endif
 
     // if set, symlinks will be followed except in recursive deletions
@@ -388,6 +407,9 @@ public:
     // abort lock request
     void abortlockrequest();
 
+    // the oldest API request in flight is done, continue with the next one
+    void nextpendingcs();
+
     // abort session and free all state information
     void logout();
 
@@ -611,9 +633,6 @@ private:
     // maximum number of concurrent putfa
     static const int MAXPUTFA;
 
-    // update time at which next deferred transfer retry kicks in
-    void nexttransferretry(direction_t d, dstime*);
-
     // a TransferSlot chunk failed
     bool chunkfailed;
     
@@ -675,6 +694,9 @@ private:
     // execute pending direct reads
     bool execdirectreads();
 
+    // HTTP I/O step of exec(), closes its trace phase
+    bool doio(m_time_t*);
+
     // maximum number parallel connections for the direct read subsystem
     static const int MAXDRSLOTS = 16;
 
@@ -710,6 +732,17 @@ public:
 
     // transfer cache table
     DbTable* tctable;
+
+    // transfers whose cache record is outdated
+    transfer_set tcdirty;
+
+    // tctable transaction holding the changes since the last flush
+    bool tctransaction;
+
+    // next transfer cache flush (NEVER if there is nothing to write)
+    dstime tcflushds;
+
+    void tcbegin();
     // scsn as read from sctable
     handle cachedscsn;
 
@@ -722,11 +755,12 @@ public:
     // current file attributes being sent
     putfa_list activefa;
 
-    // API request queue double buffering:
-    // reqs[r] is open for adding commands
-    // reqs[r^1] is being processed on the API server
+    // oldest API request in flight (NULL while it waits to be sent again)
     HttpReq* pendingcs;
 
+    // newer API requests in flight (pipelining), oldest first
+    deque<HttpReq*> pipelinedcs;
+
     // record type indicator for sctable
     enum { CACHEDSCSN, CACHEDNODE, CACHEDUSER, CACHEDLOCALNODE, CACHEDPCR, CACHEDTRANSFER, CACHEDFILE } sctablerectype;
 
@@ -816,16 +850,27 @@ public:
     // transfer tslots
     transferslot_list tslots;
 
+    // pending backoff timers of transfers, transfer slots and file
+    // attribute channels
+    TimerWheel timers;
+
     // next TransferSlot to doio() on
     transferslot_list::iterator slotit;
 
+    // recycled chunk buffers and chunk requests of the transfer slots
+    TransferBufferPool bufferpool;
+
     // FileFingerprint to node mapping
-    fingerprint_set fingerprints;
+    FingerprintIndex fingerprints;
 
     // asymmetric to symmetric key rewriting
     handle_vector nodekeyrewrite;
     handle_vector sharekeyrewrite;
 
+    // RSA-encrypted node keys decrypted in advance by decryptrsakeys(),
+    // indexed by their Base64 encoding
+    map<string, string> rsakeys;
+
     static const char* const EXPORTEDLINK;
 
     // minimum number of bytes in transit for upload/download pipelining
@@ -859,18 +904,31 @@ public:
     node_vector nodenotify;
     void notifynode(Node*);
 
-    // update transfer in the persistent cache
+    // update transfer in the persistent cache (written behind, see
+    // transfercacheflush())
     void transfercacheadd(Transfer*);
 
     // remove a transfer from the persistent cache
     void transfercachedel(Transfer*);
 
+    // the Transfer object goes away: its pending changes are written if
+    // its record stays in the cache
+    void transfercachedetach(Transfer*);
+
     // add a file to the persistent cache
     void filecacheadd(File*);
 
     // remove a file from the persistent cache
     void filecachedel(File*);
 
+    // write the updated transfers and commit all pending changes of the
+    // transfer cache in one transaction
+    void transfercacheflush();
+
+    // transfer cache changes are committed at most this long after they
+    // were made
+    static const int TRANSFERCACHEFLUSHDS = 10;
+
 #ifdef ENABLE_CHAT
     textchat_map chatnotify;
     void notifychat(TextChat *);
@@ -884,6 +942,8 @@ public:
     void deltree(handle);
 
     Node* nodebyhandle(handle);
+    // first node with this fingerprint, the others follow through
+    // FingerprintIndex::next()
     Node* nodebyfingerprint(FileFingerprint*);
     node_vector *nodesbyfingerprint(FileFingerprint* fingerprint);
 
@@ -1003,7 +1063,7 @@ public:
 
     dstime transferretrydelay();
 
-    // client-server request double-buffering
+    // client-server requests
     RequestDispatcher reqs;
 
     // upload handle -> node handle map (filled by upload completion)
@@ -1040,6 +1100,9 @@ public:
     void setkey(SymmCipher*, const char*);
     bool decryptkey(const char*, byte*, int, SymmCipher*, int, handle);
 
+    // decrypt the RSA-encrypted keys of the nodes (all if NULL) in one batch
+    void decryptrsakeys(node_vector*);
+
     void handleauth(handle, byte*);
 
     bool procsc();
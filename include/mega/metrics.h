@@ -0,0 +1,203 @@
+/**
+ * @file mega/metrics.h
+ * @brief Performance counters, latency histograms and event tracing
+ *
+ * (c) 2013-2014 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_METRICS_H
+#define MEGA_METRICS_H 1
+
+#include "types.h"
+
+namespace mega {
+// latency histogram with power-of-two microsecond buckets: bucket i counts
+// the samples of up to 2^i us, the last one everything above
+struct MEGA_API MetricHistogram
+{
+    static const int NUMBUCKETS = 26;
+
+    volatile uint64_t count;
+    volatile uint64_t sum;
+    volatile uint64_t max;
+    volatile uint64_t buckets[NUMBUCKETS];
+
+    void observe(m_time_t);
+    void reset();
+
+    // upper bound of the bucket that contains the given fraction of the
+    // samples (-1: no samples)
+    m_time_t percentile(double) const;
+
+    MetricHistogram();
+};
+
+// metrics kept by each client (MegaClient, its HttpIO and the MegaApi on
+// top of it), collected when a snapshot is taken
+struct MEGA_API ClientMetrics
+{
+    enum counter_t
+    {
+        HTTP_NEW_CONNECTIONS,   // completed HTTP requests that had to open a connection...
+        HTTP_REUSED_CONNECTIONS, // ...and those that reused one
+        HTTP_HANDSHAKE_MS,      // TLS handshake time
+        DNS_LOOKUPS,
+        DNS_CACHE_HITS,
+        DNS_STALE_HITS,         // cache hits revalidated in the background
+        DNS_WAIT_MS,            // time requests waited for name resolution
+        NUMCOUNTERS
+    };
+
+    enum gauge_t
+    {
+        API_COMMANDS_QUEUED,    // commands waiting to be sent
+        API_REQUESTS_INFLIGHT,
+        TRANSFERS_QUEUED,
+        TRANSFER_SLOTS,         // active transfers
+        CALLBACKS_QUEUED,       // asynchronous listener callbacks pending
+        NUMGAUGES
+    };
+
+    int64_t counters[NUMCOUNTERS];
+    int64_t gauges[NUMGAUGES];
+
+    // queueing to delivery of asynchronous listener callbacks (NULL: none)
+    const MetricHistogram* callbacklatency;
+
+    ClientMetrics();
+};
+
+// process-wide registry of performance metrics, shared by all MegaClient
+// instances. Counters and histograms are updated with atomic additions and
+// can be used from any thread.
+class MEGA_API Metrics
+{
+public:
+    enum counter_t
+    {
+        API_REQUESTS,           // client-server requests answered
+        API_COMMANDS,           // commands in them
+        ACTION_PACKETS,         // server-client action packets processed
+        CRYPTO_BYTES,           // AES-CTR file data encrypted/decrypted
+        CRYPTO_MICROS,          // time spent doing it (only while timing is enabled)
+        DISK_READ_BYTES,
+        DISK_WRITE_BYTES,
+        FS_NOTIFICATIONS,       // filesystem changes reported in syncs...
+        FS_NOTIFICATIONS_COALESCED, // ...dropped because the item was still queued
+        FS_NOTIFY_OVERFLOWS,    // kernel notification queue overflows
+        FS_UNWATCHED_SCANS,     // rescans of sync folders without a watch
+        NUMCOUNTERS
+    };
+
+    enum histogram_t
+    {
+        API_RTT,                // request sent to result received
+        ACTION_PACKET_TIME,     // processing of one action packet
+        UPDATESC_TIME,          // local state cache flush
+        DISK_READ_TIME,         // (only while timing is enabled)
+        DISK_WRITE_TIME,        // (only while timing is enabled)
+        LISTENER_CALLBACK_TIME, // delivery of a callback to the listeners
+        EXEC_TIME,              // one MegaClient::exec() call
+        NUMHISTOGRAMS
+    };
+
+    // command types with a round trip histogram of their own, further ones
+    // are only counted in API_RTT
+    static const int MAXCOMMANDS = 256;
+
+    static void add(counter_t, uint64_t = 1);
+    static void observe(histogram_t, m_time_t);
+
+    // per API command type (command names are string literals)
+    static void observecommand(const char*, m_time_t);
+
+    static uint64_t get(counter_t);
+    static const MetricHistogram& get(histogram_t);
+
+    // timing of calls on the data path (disk I/O, AES-CTR), which costs two
+    // clock reads per call
+    static void settiming(bool);
+
+    static bool timing()
+    {
+        return timingenabled;
+    }
+
+    // snapshots of all metrics, plus those of a client
+    static void tojson(string*, const ClientMetrics* = NULL);
+    static void toprometheus(string*, const ClientMetrics* = NULL);
+
+    static void reset();
+
+private:
+    static volatile uint64_t counters[NUMCOUNTERS];
+    static MetricHistogram histograms[NUMHISTOGRAMS];
+
+    // open addressing by a hash of the name, slots are claimed atomically
+    // and never released
+    static const char* volatile commandnames[MAXCOMMANDS];
+    static MetricHistogram commandhistograms[MAXCOMMANDS];
+
+    static volatile bool timingenabled;
+};
+
+// measures the lifetime of the object into a histogram
+class MEGA_API MetricTimer
+{
+    Metrics::histogram_t histogram;
+    m_time_t start;
+
+public:
+    MetricTimer(Metrics::histogram_t, bool enabled = true);
+    ~MetricTimer();
+};
+
+// optional recorder of complete ("X") events in the Chrome trace event
+// format, viewable in chrome://tracing or Perfetto. While no trace is
+// active, now() returns 0 and complete() ignores it, so that instrumented
+// code costs a branch.
+class MEGA_API TraceRecorder
+{
+public:
+    // events are written when this much output has accumulated
+    static const size_t FLUSHSIZE = 65536;
+
+    // starts writing a trace to the file, replacing an active one
+    static bool start(const char* path);
+    static void stop();
+
+    static bool active()
+    {
+        return enabled;
+    }
+
+    // start timestamp for complete(), 0 if no trace is active
+    static m_time_t now();
+
+    // records an event from start until now and returns now (the start of
+    // the following phase)
+    static m_time_t complete(const char* name, m_time_t start, unsigned tid = 0);
+
+    // distinct thread IDs for the recorded event sources
+    static unsigned newtid();
+
+private:
+    static volatile bool enabled;
+};
+} // namespace
+
+#endif
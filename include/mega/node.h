@@ -27,6 +27,110 @@
 #include "attrmap.h"
 
 namespace mega {
+// children of a Node, linked through the child nodes themselves (no
+// separately allocated list element per node)
+class MEGA_API node_list
+{
+public:
+    class iterator
+    {
+    public:
+        iterator(Node* n = NULL) : node(n) { }
+
+        Node* operator*() const { return node; }
+        inline iterator& operator++();
+        inline iterator operator++(int);
+
+        bool operator==(const iterator& other) const { return node == other.node; }
+        bool operator!=(const iterator& other) const { return node != other.node; }
+
+    private:
+        Node* node;
+    };
+
+    iterator begin() const { return iterator(first); }
+    iterator end() const { return iterator(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return !count; }
+
+    inline void push_back(Node*);
+    inline void erase(Node*);
+
+    node_list() : first(NULL), last(NULL), count(0) { }
+
+private:
+    Node* first;
+    Node* last;
+    unsigned count;
+};
+
+// fixed-size block allocator for the Nodes of a MegaClient - blocks are
+// carved from aligned chunks whose header points back to the arena, so
+// that freeing a block only needs its address
+class MEGA_API NodeArena
+{
+public:
+    void* allocate(size_t);
+    static void deallocate(void*);
+
+    // blocks in use / chunk memory held
+    size_t inuse;
+    size_t reserved;
+
+    NodeArena();
+    ~NodeArena();
+
+private:
+    static const size_t CHUNKSIZE = 1 << 20;
+
+    struct Chunk
+    {
+        NodeArena* arena;
+        Chunk* next;
+    };
+
+    Chunk* chunks;
+    void* freeblocks;
+    size_t blocksize;
+
+    void release();
+
+    NodeArena(const NodeArena&);
+    NodeArena& operator=(const NodeArena&);
+};
+
+// file nodes hashed by size / mtime / sparse CRC - the bucket chains are
+// linked through the nodes themselves, so lookups and updates don't allocate
+class MEGA_API FingerprintIndex
+{
+public:
+    void add(Node*);
+    void remove(Node*);
+    static bool contains(const Node*);
+
+    // first node with this fingerprint, NULL if none
+    Node* find(const FileFingerprint*) const;
+
+    // next node with the same fingerprint as the given one, NULL if none
+    static Node* next(const Node*);
+
+    size_t size() const { return count; }
+    void clear();
+
+    FingerprintIndex();
+
+private:
+    static const size_t INITIALBUCKETS = 1024;
+
+    vector<Node*> buckets;
+    size_t count;
+
+    static size_t hash(const FileFingerprint*);
+    static bool equal(const FileFingerprint*, const FileFingerprint*);
+    void rehash(size_t);
+};
+
 struct MEGA_API NodeCore
 {
     NodeCore();
@@ -38,9 +142,6 @@ struct MEGA_API NodeCore
     // parent node handle (in a Node context, temporary placeholder until parent is set)
     handle parenthandle;
 
-    // node type
-    nodetype_t type;
-
     // full folder/file key, symmetrically or asymmetrically encrypted
     // node crypto keys (raw or cooked -
     // cooked if size() == FOLDERNODEKEYLENGTH or FILEFOLDERNODEKEYLENGTH)
@@ -48,6 +149,9 @@ struct MEGA_API NodeCore
 
     // node attributes
     string *attrstring;
+
+    // node type (last, so that Node can place its own int in the tail padding)
+    nodetype_t type;
 };
 
 // new node for putnodes()
@@ -96,6 +200,9 @@ struct MEGA_API PublicLink
 // filesystem node
 struct MEGA_API Node : public NodeCore, FileFingerprint
 {
+    // source tag
+    int tag;
+
     MegaClient* client;
 
     // change parent node association
@@ -164,6 +271,11 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
         bool parent : 1;
         bool publiclink : 1;
     } changed;
+
+#ifdef ENABLE_SYNC
+    // state of removal to //bin / SyncDebris
+    syncdel_t syncdeleted;
+#endif
     
     void setkey(const byte* = NULL);
 
@@ -178,10 +290,12 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     node_list children;
 
     // own position in parent's children
-    node_list::iterator child_it;
+    Node* prevsibling;
+    Node* nextsibling;
 
-    // own position in fingerprint set (only valid for file nodes)
-    fingerprint_set::iterator fingerprint_it;
+    // own position in the fingerprint index bucket (NULL if not indexed)
+    Node* fingerprintnext;
+    Node** fingerprintprev;
 
 #ifdef ENABLE_SYNC
     // related synced item or NULL
@@ -189,21 +303,8 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
 
     // active sync get
     struct SyncFileGet* syncget;
-
-    // state of removal to //bin / SyncDebris
-    syncdel_t syncdeleted;
-
-    // location in the todebris node_set
-    node_set::iterator todebris_it;
-
-    // location in the tounlink node_set
-    // FIXME: merge todebris / tounlink
-    node_set::iterator tounlink_it;
 #endif
 
-    // source tag
-    int tag;
-
     // check if node is below this node
     bool isbelow(Node*) const;
 
@@ -217,8 +318,68 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
 
     Node(MegaClient*, vector<Node*>*, handle, handle, nodetype_t, m_off_t, handle, const char*, m_time_t);
     ~Node();
+
+    // Nodes are allocated from their client's NodeArena: new (client) Node(client, ...)
+    static void* operator new(size_t, MegaClient*);
+    static void operator delete(void*, MegaClient*);
+    static void operator delete(void*);
 };
 
+node_list::iterator& node_list::iterator::operator++()
+{
+    node = node->nextsibling;
+    return *this;
+}
+
+node_list::iterator node_list::iterator::operator++(int)
+{
+    iterator it = *this;
+    node = node->nextsibling;
+    return it;
+}
+
+void node_list::push_back(Node* n)
+{
+    n->prevsibling = last;
+    n->nextsibling = NULL;
+
+    if (last)
+    {
+        last->nextsibling = n;
+    }
+    else
+    {
+        first = n;
+    }
+
+    last = n;
+    count++;
+}
+
+void node_list::erase(Node* n)
+{
+    if (n->prevsibling)
+    {
+        n->prevsibling->nextsibling = n->nextsibling;
+    }
+    else
+    {
+        first = n->nextsibling;
+    }
+
+    if (n->nextsibling)
+    {
+        n->nextsibling->prevsibling = n->prevsibling;
+    }
+    else
+    {
+        last = n->prevsibling;
+    }
+
+    n->prevsibling = n->nextsibling = NULL;
+    count--;
+}
+
 #ifdef ENABLE_SYNC
 struct MEGA_API LocalNode : public File
 {
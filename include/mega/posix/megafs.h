@@ -50,6 +50,10 @@ struct MEGA_API PosixDirAccess : public DirAccess
 
     bool dopen(string*, FileAccess*, bool);
     bool dnext(string*, string*, bool, nodetype_t*);
+    bool dnextentry(string*, string*, bool, DirEntry*);
+
+    // next record of dp, attributes looked up relative to the directory
+    bool nextentry(string*, string*, bool, DirEntry*);
 
     PosixDirAccess();
     virtual ~PosixDirAccess();
@@ -68,6 +72,27 @@ public:
     LocalNode* lastlocalnode;
     uint32_t lastcookie;
     string lastname;
+
+    // watch budget (a share of fs.inotify.max_user_watches) and watches in use
+    unsigned maxwatches;
+    unsigned numwatches;
+
+    // folders left without a watch once the budget was exhausted - they are
+    // rescanned in batches every UNWATCHEDSCANINTERVAL_DS
+    localnode_set unwatched;
+    LocalNode* lastunwatched;
+    dstime nextunwatchedscan;
+
+    // event queue overflows reported by the kernel
+    m_off_t notifyoverflows;
+
+    // unwatched folders rescanned so far
+    m_off_t unwatchedscans;
+
+    static const int UNWATCHEDSCANINTERVAL_DS;
+    static const unsigned UNWATCHEDSCANBATCH;
+
+    int scanunwatched();
 #endif
 
 #ifdef USE_IOS
@@ -172,6 +197,16 @@ class MEGA_API PosixDirNotify : public DirNotify
 public:
     PosixFileSystemAccess* fsaccess;
 
+    // folders of this sync with/without a watch
+    unsigned numwatches;
+    unsigned numunwatched;
+
+    // a watch is available within the global and the per-sync budget
+    bool canwatch() const;
+
+    // returns false if the folder could not be watched
+    bool addwatch(LocalNode*, string*);
+
     void addnotify(LocalNode*, string*);
     void delnotify(LocalNode*);
 
@@ -51,6 +51,7 @@ struct MEGA_API SockInfo
 };
 
 struct MEGA_API CurlDNSEntry;
+struct MEGA_API CurlDNSQuery;
 struct MEGA_API CurlHttpContext;
 class CurlHttpIO: public HttpIO
 {
@@ -109,7 +110,9 @@ protected:
 
     static void proxy_ready_callback(void*, int, int, struct hostent*);
     static void ares_completed_callback(void*, int, int, struct hostent*);
+    static void dns_query_callback(void*, int, int, struct hostent*);
     static void send_request(CurlHttpContext*);
+    void resolve(const string&, int, CurlHttpContext* = NULL);
     void request_proxy_ip();
     static struct curl_slist* clone_curl_slist(struct curl_slist*);
     static bool crackurl(string*, string*, string*, int*);
@@ -143,6 +146,18 @@ protected:
     bool curlsocketsprocessed;
     m_time_t arestimeout;
 
+    // HTTP/2 support in cURL and multiplexing enabled
+    bool http2available;
+    bool http2;
+    void setpipelining();
+
+    // HTTP/2 receive buffer limits for chunk downloads
+    static const long MINHTTP2BUFFERSIZE = 16384;
+    static const long MAXHTTP2BUFFERSIZE = 524288;
+
+    // connect timeout for IPv6 when an IPv4 address is also known (ms)
+    static const long HAPPYEYEBALLSTIMEOUTMS = 2500;
+
 public:
     void post(HttpReq*, const char* = 0, unsigned = 0);
     void cancel(HttpReq*);
@@ -171,6 +186,13 @@ public:
     // get max upload speed
     virtual m_off_t getmaxuploadspeed();
 
+    // multiplex requests to the same host over HTTP/2
+    virtual bool sethttp2(bool);
+    virtual bool usinghttp2();
+
+    // resolve the host of an URL in advance
+    virtual void prefetchdns(const string*);
+
     CurlHttpIO();
     ~CurlHttpIO();
 };
@@ -194,6 +216,10 @@ struct MEGA_API CurlHttpContext
     unsigned len;
     const char* data;
     int ares_pending;
+
+    // start of the name resolution (Waiter::getmicros(), -1 when already
+    // accounted)
+    m_time_t dnsstart;
 };
 
 struct MEGA_API CurlDNSEntry
@@ -204,6 +230,19 @@ struct MEGA_API CurlDNSEntry
     dstime ipv4timestamp;
     string ipv6;
     dstime ipv6timestamp;
+
+    // lookups in flight for this host (shared by prefetches and requests)
+    CurlDNSQuery* ipv4query;
+    CurlDNSQuery* ipv6query;
+};
+
+// a c-ares lookup and the requests waiting for it
+struct MEGA_API CurlDNSQuery
+{
+    CurlHttpIO* httpio;
+    string hostname;
+    int family;
+    std::vector<CurlHttpContext*> waiting;
 };
 
 } // namespace
@@ -30,44 +30,119 @@ class MEGA_API Request
 {
     vector<Command*> cmds;
 
+    // commands that must not be in flight along with other requests
+    int serialcmds;
+
 public:
+    // request ID, reused when the request is sent again
+    string id;
+
+    // when the request was (last) sent, for the round-trip metrics
+    m_time_t senttime;
+
     void add(Command*);
 
     int cmdspending() const;
 
+    // true if the request may be in flight along with other requests
+    bool concurrent() const;
+
+    // checks the commands from *verified on against the order keys in
+    // flight, stops at the first conflict
+    bool independent(const orderkey_map&, int* verified) const;
+
+    // record / forget the order keys of the commands in flight
+    void addkeys(orderkey_map*) const;
+    void removekeys(orderkey_map*) const;
+
+    // move the commands into another request, before its command at the
+    // given position
+    void moveto(Request*, int);
+
     void get(string*) const;
 
     void procresult(MegaClient*);
 
     void clear();
+
+    Request();
 };
 
+// API requests are sent in order and their results processed in the same
+// order. By default a request is only sent after the previous one
+// completed - with pipelining, up to maxinflight requests of concurrent
+// commands without common order keys can be in flight at the same time.
 class MEGA_API RequestDispatcher
 {
-    // active request buffer
-    int r;
+public:
+    // upper limit for the requests in flight
+    static const int MAXINFLIGHT = 8;
+
+private:
+    // ring of requests: numinflight requests starting at first have been
+    // sent (oldest first), the next one is being filled
+    Request reqs[MAXINFLIGHT + 1];
+    int first;
+    int numinflight;
 
-    // client-server request double-buffering
-    Request reqs[2];
+    // requests allowed in flight at the same time (1: no pipelining)
+    int maxinflight;
+
+    // the oldest request in flight failed and must be sent again
+    bool resend;
+
+    // commands of a rejected request at the front of the request being
+    // filled - they are sent again along with the next new command
+    int stalecmds;
+
+    // commands of the request being filled that were checked against the
+    // order keys in flight
+    int verifiedcmds;
+
+    // order keys of the commands in flight / requests in flight that
+    // don't allow others
+    orderkey_map inflightkeys;
+    int serialinflight;
 
     // secondary request buffer
     queue<Command *> reqbuf;
 
     static const int MAX_COMMANDS = 10000;
 
+    int index(int) const;
+    void popfirst();
+
 public:
     RequestDispatcher();
 
-    void nextRequest();
+    void setmaxinflight(int);
+    int getmaxinflight() const;
 
     void add(Command*);
 
+    // commands in the request to be sent next
     int cmdspending() const;
 
-    void get(string*) const;
+    // requests sent and not processed yet
+    int inflight() const;
+
+    // true if the request to be sent next may go out now
+    bool cansend();
+
+    // serialize the request to be sent next and record it as in flight -
+    // returns false if it is a failed request being sent again, which keeps
+    // its ID (otherwise, the request takes *id)
+    bool send(string* out, string* id);
 
+    // process the results of the oldest request in flight
     void procresult(MegaClient*);
 
+    // the oldest request in flight failed and is sent again
+    void failed();
+
+    // the server refused the oldest request in flight
+    void rejected();
+
     void clear();
 };
 
@@ -26,6 +26,21 @@
 #include "megaclient.h"
 
 namespace mega {
+// file or folder found by the parallel initial scan: attributes from the
+// enumeration and, for new or changed files, the fingerprint
+struct MEGA_API ScanRecord
+{
+    string localname;
+    DirEntry entry;
+
+    FileFingerprint fingerprint;
+    bool fingerprinted;
+
+    ScanRecord() : fingerprinted(false) { }
+};
+
+class SyncScanner;
+
 class MEGA_API Sync
 {
 public:
@@ -59,7 +74,7 @@ public:
     void statecacheadd(LocalNode*);
 
     // recursively add children
-    void addstatecachechildren(uint32_t, idlocalnode_map*, string*, LocalNode*, int);
+    void addstatecachechildren(uint32_t, idlocalnode_vector*, string*, LocalNode*, int);
     
     // Caches all synchronized LocalNode
     void cachenodes();
@@ -73,8 +88,10 @@ public:
     // recursively look for vanished child nodes and delete them
     void deletemissing(LocalNode*);
 
-    // scan specific path
-    LocalNode* checkpath(LocalNode*, string*, string* = NULL);
+    // scan specific path (during the initial scan, with the attributes
+    // obtained while enumerating its parent folder and the fingerprint
+    // computed by the scanner threads, if any)
+    LocalNode* checkpath(LocalNode*, string*, string* = NULL, const DirEntry* = NULL, const FileFingerprint* = NULL);
 
     m_off_t localbytes;
     unsigned localnodes[2];
@@ -86,6 +103,21 @@ public:
     // LocalNode
     bool scan(string*, FileAccess*);
 
+    // parallel initial scan (NULL if disabled or finished)
+    SyncScanner* scanner;
+
+    // queue the records found by the scanner threads for processing
+    void mergescan();
+
+    // folders being scanned / batches not merged yet
+    unsigned scanpending();
+
+    // initial scan progress: folders enumerated, records found and files
+    // fingerprinted by the scanner threads
+    unsigned scannedfolders;
+    m_off_t scannedrecords;
+    m_off_t scannedfingerprints;
+
     // own position in session sync list
     sync_list::iterator sync_it;
 
@@ -121,6 +153,7 @@ public:
     ~Sync();
 
     static const int SCANNING_DELAY_DS;
+    static const unsigned PRESCANNEDBATCH;
 
 protected :
     bool readstatecache();
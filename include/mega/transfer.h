@@ -28,7 +28,7 @@
 
 namespace mega {
 // pending/active up/download ordered by file fingerprint (size - mtime - sparse CRC)
-struct MEGA_API Transfer : public FileFingerprint
+struct MEGA_API Transfer : public FileFingerprint, public TimerListener
 {
     // PUT or GET
     direction_t type;
@@ -87,6 +87,9 @@ struct MEGA_API Transfer : public FileFingerprint
     // signal failure
     void failed(error, dstime = 0);
 
+    // backoff elapsed: the transfer can be dispatched again
+    void timerexpired(BackoffTimer*);
+
     // signal completion
     void complete();
     
@@ -129,6 +132,12 @@ struct MEGA_API Transfer : public FileFingerprint
     // state of the transfer
     transferstate_t state;
 
+    // listed in the TransferList
+    bool listed;
+
+    // member of TransferList::ready[type]
+    bool inreadyset;
+
     Transfer(MegaClient*, direction_t);
     virtual ~Transfer();
 
@@ -139,6 +148,12 @@ struct MEGA_API Transfer : public FileFingerprint
     static Transfer* unserialize(MegaClient *, string*, transfer_map *);
 };
 
+// orders transfers by priority
+struct MEGA_API TransferPriorityCmp
+{
+    bool operator()(const Transfer* a, const Transfer* b) const;
+};
+
 class MEGA_API TransferList
 {
 public:
@@ -167,13 +182,21 @@ public:
     Transfer *nexttransfer(direction_t direction);
     Transfer *transferat(direction_t direction, unsigned int position);
 
+    // (re)index a transfer after its slot, state or backoff changed
+    void schedule(Transfer *transfer);
+
     transfer_list transfers[2];
     MegaClient *client;
     uint64_t currentpriority;
 
+    // dispatch candidates without slot, not paused and not in backoff
+    // (validated lazily by nexttransfer())
+    transfer_list ready[2];
+
 private:
-    void prepareIncreasePriority(Transfer *transfer, transfer_list::iterator srcit, transfer_list::iterator dstit);
-    void prepareDecreasePriority(Transfer *transfer, transfer_list::iterator it, transfer_list::iterator dstit);
+    void unschedule(Transfer *transfer);
+    void prepareIncreasePriority(Transfer *transfer);
+    void prepareDecreasePriority(Transfer *transfer, transfer_list::iterator dstit);
     bool isReady(Transfer *transfer);
 };
 
@@ -27,6 +27,27 @@
 #include "backofftimer.h"
 
 namespace mega {
+class ChunkDecryptor;
+
+// finished download request detached from its connection: it's decrypted
+// and MACed (in a separate thread where available) and then written to its
+// position in the file, while the connection already fetches the next chunk
+struct MEGA_API DownloadChunk
+{
+    HttpReqDL* req;
+
+    // private copy of the file key for the decryption thread
+    SymmCipher key;
+    int64_t ctriv;
+    m_off_t filesize;
+
+    // decryption and MAC done
+    bool decrypted;
+
+    // write in progress (async file access)
+    AsyncIOContext* asyncIO;
+};
+
 // active transfer
 struct MEGA_API TransferSlot
 {
@@ -50,6 +71,13 @@ struct MEGA_API TransferSlot
     static const m_off_t MAX_DOWNLOAD_REQ_SIZE;
     m_off_t maxDownloadRequestSize;
 
+    // end of the download request that starts at pos with the chunk ending at
+    // npos: whole chunks are added up to a size that depends on the bytes
+    // left and the number of connections, and before any chunk that was
+    // already (partly) downloaded
+    static m_off_t downloadrequestend(m_off_t pos, m_off_t npos, m_off_t size, m_off_t remaining,
+                                      int connections, m_off_t maxrequestsize, chunkmac_map*);
+
     m_off_t progressreported;
 
     m_time_t lastprogressreport;
@@ -81,6 +109,17 @@ struct MEGA_API TransferSlot
     // async IO operations
     AsyncIOContext** asyncIO;
 
+    // download pipeline: chunks being decrypted or written, at most one per
+    // connection - positional writes complete in any order unless
+    // MegaClient::orderdownloadedchunks is set
+    std::list<DownloadChunk*> downloadchunks;
+
+    // decryption thread (NULL for small files or without thread support)
+    ChunkDecryptor* decryptor;
+
+    // minimum size of downloads decrypted in a separate thread
+    static const m_off_t MIN_THREADED_DECRYPT_SIZE;
+
     // handle I/O for this slot
     void doio(MegaClient*);
 
@@ -109,6 +148,21 @@ struct MEGA_API TransferSlot
 protected:
     void toggleport(HttpReqXfer* req);
 
+    // detach a finished download request from its connection
+    void queuechunk(HttpReqDL*);
+
+    // write decrypted chunks and merge the written ones into the transfer
+    bool processchunks(MegaClient*, dstime*);
+
+    // check completion and the meta MAC of a finished download
+    void downloadfinished(MegaClient*);
+
+    // true once the chunk has been decrypted
+    bool chunkdecrypted(DownloadChunk*);
+
+    // merge the MACs and the size of a written chunk into the transfer
+    void mergechunk(HttpReqDL*);
+
 };
 } // namespace
 
@@ -65,6 +65,7 @@ using namespace std;
 // forward declaration
 struct AttrMap;
 class BackoffTimer;
+class TimerWheel;
 class Command;
 struct DirectRead;
 struct DirectReadNode;
@@ -84,13 +85,17 @@ struct NodeCore;
 class PubKeyAction;
 class Request;
 struct Transfer;
+struct TransferPriorityCmp;
 class TreeProc;
 class LocalTreeProc;
 struct User;
 struct Waiter;
 struct Proxy;
 struct PendingContactRequest;
+struct ScanRecord;
 class TransferList;
+class TransferBufferPool;
+struct ClientMetrics;
 
 #define EOO 0
 
@@ -245,13 +250,13 @@ typedef list<LocalNode*> localnode_list;
 
 typedef set<LocalNode*> localnode_set;
 
-typedef multimap<int32_t, LocalNode*> idlocalnode_map;
+// cached LocalNodes by parent dbid (sorted)
+typedef vector<pair<uint32_t, LocalNode*> > idlocalnode_vector;
 
 typedef set<Node*> node_set;
 
 // enumerates a node's children
 // FIXME: switch to forward_list once C++11 becomes more widely available
-typedef list<Node*> node_list;
 
 // undefined node handle
 const handle UNDEF = ~(handle)0;
@@ -266,7 +271,11 @@ typedef list<HttpReqCommandPutFA*> putfa_list;
 // map a FileFingerprint to the transfer for that FileFingerprint
 typedef map<FileFingerprint*, Transfer*, FileFingerprintCmp> transfer_map;
 
-typedef deque<Transfer*> transfer_list;
+// transfers of one direction, ordered by priority
+typedef set<Transfer*, TransferPriorityCmp> transfer_list;
+
+// transfers with unsaved changes
+typedef set<Transfer*> transfer_set;
 
 // map a request tag with pending dbids of transfers and files
 typedef map<int, vector<uint32_t> > pendingdbid_map;
@@ -353,8 +362,8 @@ typedef map<handle, NewNode*> handlenewnode_map;
 
 typedef map<handle, char> handlecount_map;
 
-// maps FileFingerprints to node
-typedef multiset<FileFingerprint*, FileFingerprintCmp> fingerprint_set;
+// commands in flight per order key
+typedef map<handle, int> orderkey_map;
 
 typedef enum { TREESTATE_NONE = 0, TREESTATE_SYNCED, TREESTATE_PENDING, TREESTATE_SYNCING } treestate_t;
 
@@ -367,6 +376,9 @@ struct Notification
     dstime timestamp;
     string path;
     LocalNode* localnode;
+
+    // attributes found by the parallel initial scan (owned), or NULL
+    ScanRecord* scanned;
 };
 
 typedef deque<Notification> notify_deque;
@@ -48,6 +48,9 @@ struct MEGA_API Waiter
     // set ds to current time
     static void bumpds();
 
+    // monotonic timestamp in microseconds (for latency measurements)
+    static m_time_t getmicros();
+
     // wait ceiling
     dstime maxds;
 
@@ -4215,6 +4215,11 @@ class MegaApi
             LOG_LEVEL_MAX
         };
 
+        enum {
+            PERFORMANCE_STATS_JSON = 0,
+            PERFORMANCE_STATS_PROMETHEUS = 1
+        };
+
         enum {
             ATTR_TYPE_THUMBNAIL = 0,
             ATTR_TYPE_PREVIEW = 1
@@ -4429,6 +4434,150 @@ class MegaApi
          */
         void removeGlobalListener(MegaGlobalListener* listener);
 
+        /**
+         * @brief Call the registered listeners from a dedicated callback thread
+         *
+         * By default, listeners are called synchronously from the thread of the SDK, so a slow
+         * callback delays transfers and the processing of changes made by other clients.
+         *
+         * When this mode is enabled, the SDK queues a copy of the parameters of each callback
+         * for the listeners registered with MegaApi::addListener, MegaApi::addRequestListener,
+         * MegaApi::addTransferListener, MegaApi::addGlobalListener and MegaApi::addSyncListener,
+         * and a dedicated thread calls them in the same order. Pending updates are coalesced:
+         * only the latest MegaListener::onTransferUpdate of each transfer is delivered and
+         * consecutive MegaListener::onNodesUpdate callbacks are merged into one, with the latest
+         * version of each node.
+         *
+         * Listeners passed to a specific request or transfer are still called synchronously, from
+         * the thread of the SDK. They are not ordered with the queued callbacks: for example, the
+         * listener of a request can receive MegaRequestListener::onRequestFinish before the
+         * registered listeners receive MegaListener::onRequestStart for the same request.
+         *
+         * Inside a callback of the callback thread, MegaApi::getCurrentRequest,
+         * MegaApi::getCurrentTransfer, MegaApi::getCurrentError, MegaApi::getCurrentNodes and
+         * MegaApi::getCurrentUsers return the parameters of that callback.
+         *
+         * If more than maxPendingCallbacks callbacks are waiting, the SDK waits (up to one second
+         * per iteration) for the callback thread before processing more network activity.
+         *
+         * Once an unregister function returns, the listener won't receive more callbacks,
+         * unless it is called from the SDK thread while the callback thread is inside that listener.
+         *
+         * When this mode is disabled, the callbacks that are still queued are delivered first, and
+         * new callbacks keep going through the queue until it is empty, so that the order is kept.
+         *
+         * @param enable True to use the callback thread, false to call listeners synchronously
+         * @param maxPendingCallbacks Maximum number of undelivered callbacks before the SDK waits
+         */
+        void setAsyncCallbacks(bool enable, int maxPendingCallbacks = 1000);
+
+        /**
+         * @brief Get the number of callbacks waiting for the callback thread
+         * @return Number of queued callbacks, including the one being delivered
+         * @see MegaApi::setAsyncCallbacks
+         */
+        int getPendingCallbacks();
+
+        /**
+         * @brief Get the maximum number of callbacks that have been waiting at the same time
+         * @return Peak number of pending callbacks
+         * @see MegaApi::setAsyncCallbacks
+         */
+        int getPeakPendingCallbacks();
+
+        /**
+         * @brief Get the number of callbacks merged into a pending one
+         * @return Number of coalesced callbacks
+         * @see MegaApi::setAsyncCallbacks
+         */
+        long long getCoalescedCallbacks();
+
+        /**
+         * @brief Get the average time between queueing a callback and delivering it
+         * @return Average latency in microseconds
+         * @see MegaApi::setAsyncCallbacks
+         */
+        long long getAverageCallbackLatency();
+
+        /**
+         * @brief Get the maximum time between queueing a callback and delivering it
+         * @return Maximum latency in microseconds
+         * @see MegaApi::setAsyncCallbacks
+         */
+        long long getMaxCallbackLatency();
+
+        /**
+         * @brief Get the performance metrics of the SDK
+         *
+         * Most metrics are shared by all MegaApi instances of the process:
+         * - Counters: API requests and commands, action packets, bytes encrypted/decrypted
+         * and the time spent doing it, bytes read from/written to disk, filesystem changes
+         * reported in syncs (and those coalesced with a queued one), overflows of the
+         * filesystem notification queue, rescans of synced folders without a watch
+         * (see MegaApi::setMaxSyncWatches)
+         * - Latency histograms: API round trip (also per command type), processing of each
+         * action packet, flushes of the local cache, disk reads and writes, listener callbacks
+         * and iterations of the SDK loop
+         *
+         * The snapshot adds those of this MegaApi instance:
+         * - Counters: HTTP requests that opened a new connection or reused one, TLS handshake
+         * time, DNS lookups, cache hits (and stale ones) and the time spent waiting for them
+         * - Gauges: API commands waiting to be sent, API requests in flight, queued transfers,
+         * active transfers, pending asynchronous callbacks
+         * - Latency histogram: queueing to delivery of asynchronous callbacks
+         * (see MegaApi::getAverageCallbackLatency)
+         *
+         * The time spent encrypting/decrypting and the disk latency are only measured while
+         * enabled with MegaApi::setPerformanceTiming.
+         *
+         * With MegaApi::PERFORMANCE_STATS_JSON, the result is a JSON object with "counters",
+         * "gauges", "histograms" (count, sum, mean and the 50th, 90th and 99th percentiles,
+         * in microseconds, and the maximum) and "api_commands" objects. With MegaApi::PERFORMANCE_STATS_PROMETHEUS,
+         * it is in the Prometheus text exposition format, with times in seconds.
+         *
+         * You take the ownership of the returned value
+         *
+         * @param format MegaApi::PERFORMANCE_STATS_JSON or MegaApi::PERFORMANCE_STATS_PROMETHEUS
+         * @return Snapshot of the performance metrics
+         */
+        char *getPerformanceStats(int format = PERFORMANCE_STATS_JSON);
+
+        /**
+         * @brief Reset the performance counters and histograms
+         *
+         * The process-wide ones and those of this MegaApi instance are reset. Gauges keep
+         * their current values.
+         */
+        void resetPerformanceStats();
+
+        /**
+         * @brief Measure the time spent on disk I/O and encryption/decryption
+         *
+         * These are timed on every call, which costs two clock reads each time,
+         * so they are disabled by default. The setting applies to the whole process.
+         *
+         * @param enable True to measure them
+         * @see MegaApi::getPerformanceStats
+         */
+        void setPerformanceTiming(bool enable);
+
+        /**
+         * @brief Record the phases of the SDK loop in a trace file
+         *
+         * The file uses the Chrome trace event format and can be opened in chrome://tracing
+         * or https://ui.perfetto.dev. Each MegaApi instance appears as a separate thread.
+         * An active trace is stopped first.
+         *
+         * @param path Path of the trace file, which is overwritten
+         * @return True if the file could be created
+         */
+        bool startPerformanceTrace(const char *path);
+
+        /**
+         * @brief Stop recording the trace started by MegaApi::startPerformanceTrace
+         */
+        void stopPerformanceTrace();
+
         /**
          * @brief Get the current request
          *
@@ -6945,6 +7094,19 @@ class MegaApi
          */
         void setUploadLimit(int bpslimit);
 
+        /**
+         * @brief Set the maximum number of API requests in flight at the same time
+         *
+         * By default, a request to the MEGA API is only sent when the previous one has finished,
+         * so commands issued meanwhile wait for a full round trip. With a higher value, commands
+         * that don't depend on the ones in flight (for example, changes of attributes of different
+         * nodes or user attributes) can be sent right away on high latency links. The others are
+         * still sent one request at a time, and results are always processed in order.
+         *
+         * @param requests Maximum number of requests in flight (between 1 and 8, 1 by default)
+         */
+        void setMaxApiRequestsInFlight(int requests);
+
         /**
          * @brief Set the maximum number of connections per transfer
          *
@@ -7092,6 +7254,28 @@ class MegaApi
          */
         int getCurrentSpeed(int type);
 
+        /**
+         * @brief Enable or disable HTTP/2 multiplexing
+         *
+         * When enabled, parallel requests to the same HTTPS server (API and transfer chunks)
+         * are sent as streams of a single HTTP/2 connection instead of opening a new
+         * TCP+TLS connection for each one. Plain HTTP transfers (see MegaApi::useHttpsOnly)
+         * are not affected.
+         *
+         * Currently, this method is only available using the cURL-based network layer,
+         * and only if cURL was built with HTTP/2 support.
+         *
+         * @param enable True to enable HTTP/2 multiplexing, false to disable it
+         * @return true if the network layer supports HTTP/2, otherwise false
+         */
+        bool useHttp2(bool enable);
+
+        /**
+         * @brief Check if HTTP/2 multiplexing is enabled
+         * @return true if HTTP/2 multiplexing is enabled, otherwise false
+         */
+        bool usingHttp2();
+
         /**
          * @brief Get the active transfer method for downloads
          *
@@ -7480,6 +7664,35 @@ class MegaApi
          */
         void setExclusionUpperSizeLimit(long long limit);
 
+        /**
+         * @brief Set the number of threads used for the initial scan of new syncs
+         *
+         * During the initial scan, these threads list the local folders and read the fingerprints
+         * of new or modified files in parallel, which keeps several disk requests in flight on
+         * large volumes. Folders and files are still added to the sync one by one.
+         *
+         * The value applies to syncs added after this call.
+         *
+         * @param threads Number of threads (between 0 and 16, 4 by default). With 0, the initial
+         * scan runs on the SDK thread only
+         */
+        void setSyncScanThreads(int threads);
+
+        /**
+         * @brief Limit the number of filesystem watches of each sync
+         *
+         * On Linux, every synced folder needs an inotify watch, and all the applications of a user
+         * share fs.inotify.max_user_watches (the SDK uses up to 7/8 of it). Folders that don't get
+         * a watch are rescanned every 30 seconds instead, and get one when watches are released.
+         *
+         * The limit applies to the folders that start being watched after this call, in existing
+         * and new syncs. It has no effect on other platforms.
+         *
+         * @param maxWatches Maximum number of watches per sync (0, the default, for no limit
+         * other than the global one)
+         */
+        void setMaxSyncWatches(int maxWatches);
+
         /**
          * @brief Move a local file to the local "Debris" folder
          *
@@ -9038,6 +9251,77 @@ class MegaApi
          */
         int httpServerGetMaxOutputSize();
 
+        /**
+         * @brief Set the number of threads used by the HTTP proxy server
+         *
+         * Each thread runs an event loop that serves a share of the connections, so
+         * many clients streaming at the same time don't compete for a single thread.
+         * The value is limited to 32. On Windows, the server always uses one thread.
+         *
+         * The new value will be taken into account the next time the server is started.
+         * It's possible to call this function even before the server has been started.
+         *
+         * @param numThreads Number of threads of the server or a number <= 0 to use the
+         * internal default value
+         */
+        void httpServerSetNumThreads(int numThreads);
+
+        /**
+         * @brief Get the number of threads used by the HTTP proxy server
+         *
+         * See MegaApi::httpServerSetNumThreads
+         *
+         * @return Number of threads of the server
+         */
+        int httpServerGetNumThreads();
+
+        /**
+         * @brief Set the maximum size of the cache of streamed data
+         *
+         * The HTTP proxy server keeps the data received from MEGA in a cache shared by
+         * all connections, so that several players streaming the same file, or a player
+         * that requests overlapping ranges while seeking, don't download and decrypt the
+         * same data again. Connections that need data that is about to be received for
+         * another connection wait for it instead of starting a new download.
+         *
+         * When the cache is full, the least recently used data is discarded.
+         *
+         * It's possible and effective to call this function even before the server has been
+         * started, and the value will be still active even if the server is stopped and
+         * started again. The cache is emptied when the server is stopped.
+         *
+         * @param cacheSize Maximum size of the cache (in bytes) or a number <= 0 to use the
+         * internal default value
+         */
+        void httpServerSetMaxCacheSize(long long cacheSize);
+
+        /**
+         * @brief Get the maximum size of the cache of streamed data
+         *
+         * See MegaApi::httpServerSetMaxCacheSize
+         *
+         * @return Maximum size of the cache (in bytes)
+         */
+        long long httpServerGetMaxCacheSize();
+
+        /**
+         * @brief Get the number of bytes sent to clients from the cache of streamed data
+         *
+         * These bytes didn't have to be downloaded again. See MegaApi::httpServerSetMaxCacheSize
+         *
+         * @return Bytes sent from the cache since the server was started
+         */
+        long long httpServerGetCacheBytesSaved();
+
+        /**
+         * @brief Get the hit rate of the cache of streamed data
+         *
+         * See MegaApi::httpServerSetMaxCacheSize
+         *
+         * @return Share of the bytes sent to clients that came from the cache, between 0 and 1
+         */
+        double httpServerGetCacheHitRate();
+
         /**
          * @brief Get the MIME type associated with the extension
          *
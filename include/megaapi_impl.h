@@ -288,6 +288,7 @@ class MegaNodePrivate : public MegaNode, public Cachable
         void setForeign(bool foreign);
         void setChildren(MegaNodeList *children);
         void setName(const char *newName);
+        void setChanges(int changes);
         virtual std::string* getPublicAuth();
         virtual bool isShared();
         virtual bool isOutShare();
@@ -1026,6 +1027,7 @@ class MegaNodeListPrivate : public MegaNodeList
         MegaNodeListPrivate();
         MegaNodeListPrivate(Node** newlist, int size);
         MegaNodeListPrivate(MegaNodeListPrivate *nodeList, bool copyChildren = false);
+        MegaNodeListPrivate(MegaNode** newlist, int size);
         virtual ~MegaNodeListPrivate();
 		virtual MegaNodeList *copy();
 		virtual MegaNode* get(int i);
@@ -1250,6 +1252,54 @@ class TransferQueue
         void removeListener(MegaTransferListener *listener);
 };
 
+// listener callback waiting for the callback thread (see MegaApi::setAsyncCallbacks)
+class MegaCallback
+{
+    public:
+        enum
+        {
+            REQUEST_START, REQUEST_FINISH, REQUEST_UPDATE, REQUEST_TEMPORARY_ERROR,
+            TRANSFER_START, TRANSFER_FINISH, TRANSFER_UPDATE, TRANSFER_TEMPORARY_ERROR,
+            USERS_UPDATE, NODES_UPDATE, ACCOUNT_UPDATE, CONTACT_REQUESTS_UPDATE, RELOAD_NEEDED,
+            GLOBAL_SYNC_STATE_CHANGED, SYNC_STATE_CHANGED, SYNC_EVENT, FILE_SYNC_STATE_CHANGED,
+            CHATS_UPDATE
+        };
+
+        MegaCallback(int type);
+        ~MegaCallback();
+
+        // add copies of updated nodes / take ownership of an updated node,
+        // keeping the latest version of each handle with all its changes
+        void addNodes(MegaNodeList *nodes);
+        void addNode(MegaNode *node);
+
+        int type;
+        MegaRequestPrivate *request;
+        MegaTransferPrivate *transfer;
+        MegaError *error;
+        MegaUserList *users;
+        MegaContactRequestList *contactRequests;
+
+        // updated nodes and their position by handle (NULL list => reload)
+        vector<MegaNode *> nodes;
+        map<MegaHandle, size_t> nodePositions;
+        bool allNodes;
+
+#ifdef ENABLE_SYNC
+        MegaSyncPrivate *sync;
+        MegaSyncEvent *syncEvent;
+        string filePath;
+        int syncState;
+#endif
+
+#ifdef ENABLE_CHAT
+        MegaTextChatList *chats;
+#endif
+
+        // time the callback was queued (microseconds)
+        m_time_t queuedTime;
+};
+
 class MegaApiImpl : public MegaApp
 {
     public:
@@ -1271,6 +1321,17 @@ class MegaApiImpl : public MegaApp
         void removeRequestListener(MegaRequestListener* listener);
         void removeTransferListener(MegaTransferListener* listener);
         void removeGlobalListener(MegaGlobalListener* listener);
+        void setAsyncCallbacks(bool enable, int maxPendingCallbacks);
+        int getPendingCallbacks();
+        int getPeakPendingCallbacks();
+        long long getCoalescedCallbacks();
+        long long getAverageCallbackLatency();
+        long long getMaxCallbackLatency();
+        char *getPerformanceStats(int format);
+        void resetPerformanceStats();
+        void setPerformanceTiming(bool enable);
+        bool startPerformanceTrace(const char *path);
+        void stopPerformanceTrace();
 
         MegaRequest *getCurrentRequest();
         MegaTransfer *getCurrentTransfer();
@@ -1428,6 +1489,7 @@ class MegaApiImpl : public MegaApp
         void disableTransferResumption(const char* loggedOutId);
         bool areTransfersPaused(int direction);
         void setUploadLimit(int bpslimit);
+        void setMaxApiRequestsInFlight(int requests);
         void setMaxConnections(int direction, int connections, MegaRequestListener* listener = NULL);
         void setDownloadMethod(int method);
         void setUploadMethod(int method);
@@ -1438,6 +1500,8 @@ class MegaApiImpl : public MegaApp
         int getCurrentDownloadSpeed();
         int getCurrentUploadSpeed();
         int getCurrentSpeed(int type);
+        bool useHttp2(bool enable);
+        bool usingHttp2();
         int getDownloadMethod();
         int getUploadMethod();
         MegaTransferData *getTransferData(MegaTransferListener *listener = NULL);
@@ -1463,6 +1527,8 @@ class MegaApiImpl : public MegaApp
         void setExcludedNames(vector<string> *excludedNames);
         void setExclusionLowerSizeLimit(long long limit);
         void setExclusionUpperSizeLimit(long long limit);
+        void setSyncScanThreads(int threads);
+        void setMaxSyncWatches(int maxWatches);
         bool moveToLocalDebris(const char *path);
         string getLocalPath(MegaNode *node);
         long long getNumLocalNodes();
@@ -1604,6 +1670,12 @@ class MegaApiImpl : public MegaApp
         int httpServerGetMaxBufferSize();
         void httpServerSetMaxOutputSize(int outputSize);
         int httpServerGetMaxOutputSize();
+        void httpServerSetNumThreads(int numThreads);
+        int httpServerGetNumThreads();
+        void httpServerSetMaxCacheSize(long long cacheSize);
+        long long httpServerGetMaxCacheSize();
+        long long httpServerGetCacheBytesSaved();
+        double httpServerGetCacheHitRate();
 
         // permissions
         void httpServerEnableFileServer(bool enable);
@@ -1653,6 +1725,7 @@ protected:
         void init(MegaApi *api, const char *appKey, MegaGfxProcessor* processor, const char *basePath = NULL, const char *userAgent = NULL, int fseventsfd = -1);
 
         static void *threadEntryPoint(void *param);
+        static void *callbackThreadEntryPoint(void *param);
         static ExternalLogger *externalLogger;
 
         MegaTransferPrivate* getMegaTransferPrivate(int tag);
@@ -1679,6 +1752,18 @@ protected:
         void fireOnChatsUpdate(MegaTextChatList *chats);
 #endif
 
+        // asynchronous listener dispatch
+        void queueCallback(MegaCallback *callback);
+        void deliverCallback(MegaCallback *callback);
+        void waitCallbackQueue();
+        void checkAsyncCallbacks();
+        void waitListenerCallback(void *listener);
+        bool isCallbackThread();
+        template <class L> bool startListenerCallback(set<L *> *listenerSet, L *listener);
+        void endListenerCallback();
+        void callbackLoop();
+        void stopCallbackThread();
+
         void processTransferPrepare(Transfer *t, MegaTransferPrivate *transfer);
         void processTransferUpdate(Transfer *tr, MegaTransferPrivate *transfer);
         void processTransferComplete(Transfer *tr, MegaTransferPrivate *transfer);
@@ -1700,6 +1785,8 @@ protected:
         MegaHTTPServer *httpServer;
         int httpServerMaxBufferSize;
         int httpServerMaxOutputSize;
+        int httpServerNumThreads;
+        long long httpServerMaxCacheSize;
         bool httpServerEnableFiles;
         bool httpServerEnableFolders;
         int httpServerRestrictedMode;
@@ -1737,6 +1824,42 @@ protected:
         long long syncLowerSizeLimit;
         long long syncUpperSizeLimit;
         MegaMutex sdkMutex;
+
+        // asynchronous listener dispatch: the SDK thread queues copies of the
+        // callback parameters and the callback thread calls the listeners
+        static const unsigned CALLBACK_BACKPRESSURE_TIMEOUT_MS = 1000;
+        bool asyncCallbacks;
+        unsigned maxPendingCallbacks;
+
+        // asynchronous callbacks disabled while some were pending: they keep
+        // being queued, to be delivered in order, until the queue is empty
+        bool asyncCallbacksStopping;
+        MegaThread callbackThread;
+        bool callbackThreadStarted;
+        bool callbackThreadExit;
+        uint64_t sdkThreadId;
+        uint64_t callbackThreadId;
+
+        // protects the queue, the metrics, deliveringListener and (together
+        // with sdkMutex) the listener sets; never held while calling out
+        MegaMutex callbackMutex;
+        MegaSemaphore callbackSemaphore;
+        MegaSemaphore callbackSpaceSemaphore;
+        MegaSemaphore callbackDoneSemaphore;
+        std::deque<MegaCallback *> callbackQueue;
+        map<int, MegaCallback *> queuedTransferUpdates;
+        void *deliveringListener;
+        int listenerWaiters;
+        bool waitingCallbackSpace;
+
+        // queued plus in delivery
+        unsigned pendingCallbacks;
+        unsigned peakPendingCallbacks;
+        long long coalescedCallbacks;
+
+        // queueing to delivery of asynchronous callbacks
+        MetricHistogram callbackLatency;
+
         MegaTransferPrivate *currentTransfer;
         MegaRequestPrivate *activeRequest;
         MegaTransferPrivate *activeTransfer;
@@ -1744,6 +1867,14 @@ protected:
         MegaNodeList *activeNodes;
         MegaUserList *activeUsers;
         MegaContactRequestList *activeContactRequests;
+
+        // parameters of the callback being delivered by the callback thread
+        // (returned by getCurrentRequest() and co. on that thread)
+        MegaRequestPrivate *callbackRequest;
+        MegaTransferPrivate *callbackTransfer;
+        MegaError *callbackError;
+        MegaNodeList *callbackNodes;
+        MegaUserList *callbackUsers;
         string appKey;
 
         int threadExit;
@@ -1985,6 +2116,9 @@ public:
 };
 
 #ifdef HAVE_LIBUV
+// circular buffer with a single producer (the thread that receives the data)
+// and a single consumer (the event loop of the connection), without locks:
+// each side only updates its own position and counter
 class StreamingBuffer
 {
 public:
@@ -2006,15 +2140,121 @@ public:
 protected:
     char *buffer;
     unsigned int capacity;
-    unsigned int size;
-    unsigned int free;
+
+    // producer side
     unsigned int inpos;
+    volatile unsigned int written;
+
+    // consumer side (data is sent first and released when the write finishes)
     unsigned int outpos;
+    unsigned int sent;
+    volatile unsigned int released;
+
     unsigned int maxBufferSize;
     unsigned int maxOutputSize;
 };
 
+class MegaHTTPContext;
+
+// decrypted data of the files being streamed, shared by all the connections
+// of the HTTP server and bounded in size (least recently used segments go
+// first) - connections that need data that a transfer in progress is about
+// to receive wait for it instead of starting their own transfer
+class StreamingCache
+{
+public:
+    StreamingCache();
+    ~StreamingCache();
+
+    // copies the cached data of the node from offset up to end into the
+    // buffer and returns the number of bytes copied - if the data after that
+    // is about to be received by a transfer, the reader is attached to it and
+    // woken up (asynchandle) when new data arrives
+    unsigned int read(handle h, m_off_t offset, m_off_t end, StreamingBuffer *buffer,
+                      MegaHTTPContext *reader, bool *attached);
+
+    // transfer of the range [offset, end) of a node on behalf of a connection
+    void startFetch(handle h, m_off_t offset, m_off_t end, MegaHTTPContext *fetcher);
+    void write(MegaHTTPContext *fetcher, const char *data, unsigned int len);
+    void endFetch(MegaHTTPContext *fetcher);
+
+    // forget a connection that is being closed
+    void detach(MegaHTTPContext *ctx);
+
+    void setMaxSize(m_off_t maxSize);
+    m_off_t getMaxSize();
+
+    // bytes sent from the cache instead of being downloaded again, and their
+    // share of all the bytes streamed
+    m_off_t getBytesSaved();
+    double getHitRate();
+
+    static const unsigned int SEGMENT_SIZE = 131072;
+    static const unsigned int ATTACH_DISTANCE = 1048576;
+    static const m_off_t MAX_CACHE_SIZE = 67108864;
+
+protected:
+    struct Segment
+    {
+        handle h;
+        m_off_t offset;
+        string data;
+        list<Segment *>::iterator lru;
+    };
+
+    struct Fetch
+    {
+        handle h;
+        m_off_t offset;
+        m_off_t end;
+    };
+
+    struct Reader
+    {
+        handle h;
+        m_off_t offset;
+    };
+
+    typedef map<m_off_t, Segment *> segment_map;
+
+    map<handle, segment_map> nodes;
+    list<Segment *> lru;
+    map<MegaHTTPContext *, Fetch> fetches;
+    map<MegaHTTPContext *, Reader> readers;
+    m_off_t size;
+    m_off_t maxSize;
+    m_off_t bytesSaved;
+    m_off_t bytesFetched;
+    uv_mutex_t mutex;
+
+    void store(handle h, m_off_t offset, const char *data, unsigned int len);
+    void wake(handle h, m_off_t offset);
+    void evict();
+};
+
 class MegaHTTPServer;
+class MegaHTTPContext;
+
+// event loop of the HTTP server running in its own thread, the first one
+// accepts the connections and hands some of them over to the others
+class MegaHTTPLoop
+{
+public:
+    MegaHTTPLoop(MegaHTTPServer *server);
+    ~MegaHTTPLoop();
+
+    MegaHTTPServer *server;
+    uv_loop_t loop;
+    uv_async_t handoff_handle;
+    uv_async_t exit_handle;
+    MegaThread thread;
+    list<MegaHTTPContext*> connections;
+
+    // sockets accepted for this loop, pending to be opened in it
+    uv_mutex_t mutex;
+    deque<uv_os_sock_t> handoff;
+};
+
 class MegaHTTPContext : public MegaTransferListener, public MegaRequestListener
 {
 public:
@@ -2022,12 +2262,12 @@ public:
 
     // Connection management
     MegaHTTPServer *server;
+    MegaHTTPLoop *loop;
     StreamingBuffer streamingBuffer;
     MegaTransferPrivate *transfer;
     uv_tcp_t tcphandle;
     uv_async_t asynchandle;
     http_parser parser;
-    uv_mutex_t mutex;
     MegaApiImpl *megaApi;
     m_off_t bytesWritten;
     m_off_t size;
@@ -2036,7 +2276,8 @@ public:
     bool nodereceived;
     bool finished;
     bool failed;
-    bool pause;
+    volatile bool pause;
+    bool waiting;
 
     // Request information
     bool range;
@@ -2058,18 +2299,24 @@ public:
 
 class MegaHTTPServer
 {
+    friend class MegaHTTPContext;
+    friend class MegaHTTPLoop;
+
 protected:
     static void *threadEntryPoint(void *param);
+    static void *loopEntryPoint(void *param);
     static http_parser_settings parsercfg;
 
     set<handle> allowedHandles;
     handle lastHandle;
-    list<MegaHTTPContext*> connections;
-    uv_async_t exit_handle;
+    vector<MegaHTTPLoop*> loops;
+    unsigned int nextLoop;
+    int numThreads;
     MegaApiImpl *megaApi;
     uv_sem_t semaphore;
     MegaThread thread;
     uv_tcp_t server;
+    StreamingCache cache;
     int maxBufferSize;
     int maxOutputSize;
     bool fileServerEnabled;
@@ -2082,6 +2329,8 @@ protected:
 
     // libuv callbacks
     static void onNewClient(uv_stream_t* server_handle, int status);
+    static void onHandoff(uv_async_t* handle);
+    static void onAcceptedClose(uv_handle_t* handle);
     static void onDataReceived(uv_stream_t* tcp, ssize_t nread, const uv_buf_t * buf);
     static void allocBuffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t* buf);
     static void onClose(uv_handle_t* handle);
@@ -2100,9 +2349,12 @@ protected:
     static int onMessageComplete(http_parser* parser);
 
     void run();
+    void stopLoops();
+    static MegaHTTPContext *newConnection(MegaHTTPLoop *loop);
     static void sendHeaders(MegaHTTPContext *httpctx, string *headers);
     static void sendNextBytes(MegaHTTPContext *httpctx);
     static int streamNode(MegaHTTPContext *httpctx);
+    static void readStream(MegaHTTPContext *httpctx);
 
 public:
     MegaHTTPServer(MegaApiImpl *megaApi);
@@ -2115,6 +2367,12 @@ public:
     void setMaxOutputSize(int outputSize);
     int getMaxBufferSize();
     int getMaxOutputSize();
+    void setNumThreads(int numThreads);
+    int getNumThreads();
+    void setMaxCacheSize(long long cacheSize);
+    long long getMaxCacheSize();
+    long long getCacheBytesSaved();
+    double getCacheHitRate();
     void enableFileServer(bool enable);
     void enableFolderServer(bool enable);
     void setRestrictedMode(int mode);
@@ -2126,6 +2384,9 @@ public:
     char* getLink(MegaNode *node);
     bool isSubtitlesSupportEnabled();
     void enableSubtitlesSupport(bool enable);
+
+    static const int DEFAULT_NUM_THREADS = 4;
+    static const int MAX_NUM_THREADS = 32;
 };
 #endif
 
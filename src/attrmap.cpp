@@ -22,6 +22,75 @@
 #include "mega/attrmap.h"
 
 namespace mega {
+attr_map::iterator attr_map::lowerbound(nameid name)
+{
+    iterator it = values.begin();
+
+    // linear: a handful of elements
+    while (it != values.end() && it->first < name)
+    {
+        it++;
+    }
+
+    return it;
+}
+
+attr_map::iterator attr_map::find(nameid name)
+{
+    iterator it = lowerbound(name);
+
+    return (it != values.end() && it->first == name) ? it : values.end();
+}
+
+attr_map::const_iterator attr_map::find(nameid name) const
+{
+    const_iterator it = values.begin();
+
+    while (it != values.end() && it->first < name)
+    {
+        it++;
+    }
+
+    return (it != values.end() && it->first == name) ? it : values.end();
+}
+
+string& attr_map::operator[](nameid name)
+{
+    iterator it = lowerbound(name);
+
+    if (it == values.end() || it->first != name)
+    {
+        it = values.insert(it, value_type(name, string()));
+    }
+
+    return it->second;
+}
+
+pair<attr_map::iterator, bool> attr_map::insert(const value_type& value)
+{
+    iterator it = lowerbound(value.first);
+
+    if (it != values.end() && it->first == value.first)
+    {
+        return pair<iterator, bool>(it, false);
+    }
+
+    return pair<iterator, bool>(values.insert(it, value), true);
+}
+
+size_t attr_map::erase(nameid name)
+{
+    iterator it = find(name);
+
+    if (it == values.end())
+    {
+        return 0;
+    }
+
+    values.erase(it);
+    return 1;
+}
+
 // approximate raw storage size of serialized AttrMap, not taking JSON escaping
 // or name length into account
 unsigned AttrMap::storagesize(int perrecord) const
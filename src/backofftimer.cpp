@@ -27,14 +27,58 @@ namespace mega {
 // timer with capped exponential backoff
 BackoffTimer::BackoffTimer()
 {
+    wheel = NULL;
+    wheelprev = NULL;
+    wheelnext = NULL;
+    wheelslot = -1;
+    listener = NULL;
+
     reset();
 }
 
+BackoffTimer::~BackoffTimer()
+{
+    if (wheel)
+    {
+        wheel->remove(this);
+    }
+}
+
+void BackoffTimer::setwheel(TimerWheel* newwheel, TimerListener* newlistener)
+{
+    if (wheel)
+    {
+        wheel->remove(this);
+    }
+
+    wheel = newwheel;
+    listener = newlistener;
+    reschedule();
+}
+
+// pending timers are kept in the wheel, elapsed ones are removed
+void BackoffTimer::reschedule()
+{
+    if (wheel)
+    {
+        if (next > Waiter::ds)
+        {
+            wheel->add(this);
+        }
+        else
+        {
+            wheel->remove(this);
+        }
+    }
+}
+
 void BackoffTimer::reset()
 {
     next = 0;
     delta = 1;
     base = 1;
+
+    reschedule();
 }
 
 void BackoffTimer::backoff()
@@ -49,6 +93,8 @@ void BackoffTimer::backoff()
     }
 
     delta = base + (dstime)((base / 2.0) * (PrnGen::genuint32(RAND_MAX)/(float)RAND_MAX));
+
+    reschedule();
 }
 
 void BackoffTimer::backoff(dstime newdelta)
@@ -56,6 +102,8 @@ void BackoffTimer::backoff(dstime newdelta)
     next = Waiter::ds + newdelta;
     delta = newdelta;
     base = newdelta;
+
+    reschedule();
 }
 
 bool BackoffTimer::armed() const
@@ -71,6 +119,7 @@ bool BackoffTimer::arm()
         delta = 1;
         base = 1;
 
+        reschedule();
         return true;
     }
 
@@ -82,6 +131,7 @@ void BackoffTimer::set(dstime newds)
     if (newds < next)
     {
         next = newds;
+        reschedule();
     }
 }
 
@@ -121,6 +171,7 @@ void BackoffTimer::update(dstime* waituntil)
         {
             *waituntil = 0;
             next = 1;
+            reschedule();
         }
         else if (next < *waituntil)
         {
@@ -128,4 +179,262 @@ void BackoffTimer::update(dstime* waituntil)
         }
     }
 }
+
+TimerWheel::TimerWheel()
+{
+    memset(slots, 0, sizeof slots);
+    memset(occupied, 0, sizeof occupied);
+    current = 0;
+    count = 0;
+    expired = false;
+}
+
+TimerWheel::~TimerWheel()
+{
+    for (int level = 0; level < LEVELS; level++)
+    {
+        for (int index = 0; index < SLOTS; index++)
+        {
+            for (BackoffTimer* timer = slots[level][index]; timer; timer = timer->wheelnext)
+            {
+                timer->wheelslot = -1;
+                timer->wheel = NULL;
+            }
+        }
+    }
+}
+
+unsigned TimerWheel::size() const
+{
+    return count;
+}
+
+void TimerWheel::add(BackoffTimer* timer)
+{
+    remove(timer);
+
+    if (!count)
+    {
+        // nothing to process until now
+        current = Waiter::ds + 1;
+    }
+
+    insert(timer);
+    count++;
+}
+
+void TimerWheel::remove(BackoffTimer* timer)
+{
+    if (timer->wheelslot < 0)
+    {
+        return;
+    }
+
+    int level = timer->wheelslot / SLOTS;
+    int index = timer->wheelslot % SLOTS;
+
+    if (timer->wheelprev)
+    {
+        timer->wheelprev->wheelnext = timer->wheelnext;
+    }
+    else
+    {
+        slots[level][index] = timer->wheelnext;
+        if (!timer->wheelnext)
+        {
+            occupied[level] &= ~((uint64_t)1 << index);
+        }
+    }
+
+    if (timer->wheelnext)
+    {
+        timer->wheelnext->wheelprev = timer->wheelprev;
+    }
+
+    timer->wheelprev = NULL;
+    timer->wheelnext = NULL;
+    timer->wheelslot = -1;
+    count--;
+}
+
+// link a timer into the bucket of its trigger time relative to current
+void TimerWheel::insert(BackoffTimer* timer)
+{
+    dstime expires = timer->next < current ? current : timer->next;
+    dstime ticks = expires - current;
+    int level = 0;
+
+    while (level < LEVELS - 1 && ticks >= ((dstime)1 << ((level + 1) * SLOTBITS)))
+    {
+        level++;
+    }
+
+    if (level == LEVELS - 1 && ticks >= ((dstime)1 << (LEVELS * SLOTBITS)))
+    {
+        // beyond the range of the wheel, requeued when the bucket is reached
+        expires = current + ((dstime)1 << (LEVELS * SLOTBITS)) - 1;
+    }
+
+    int index = (expires >> (level * SLOTBITS)) & (SLOTS - 1);
+
+    timer->wheelslot = level * SLOTS + index;
+    timer->wheelprev = NULL;
+    timer->wheelnext = slots[level][index];
+    if (timer->wheelnext)
+    {
+        timer->wheelnext->wheelprev = timer;
+    }
+    slots[level][index] = timer;
+    occupied[level] |= (uint64_t)1 << index;
+}
+
+// move the timers of a coarse bucket to finer ones
+void TimerWheel::cascade(int level, int index)
+{
+    BackoffTimer* timer = slots[level][index];
+
+    slots[level][index] = NULL;
+    occupied[level] &= ~((uint64_t)1 << index);
+
+    while (timer)
+    {
+        BackoffTimer* nexttimer = timer->wheelnext;
+        insert(timer);
+        timer = nexttimer;
+    }
+}
+
+// process all ticks up to (and including) ds
+void TimerWheel::advance(dstime ds)
+{
+    while (current <= ds)
+    {
+        if (!count)
+        {
+            current = ds + 1;
+            break;
+        }
+
+        int index = current & (SLOTS - 1);
+
+        if (!index)
+        {
+            // refine the buckets whose range starts now
+            for (int level = 1; level < LEVELS; level++)
+            {
+                int levelindex = (current >> (level * SLOTBITS)) & (SLOTS - 1);
+                cascade(level, levelindex);
+
+                if (levelindex)
+                {
+                    break;
+                }
+            }
+        }
+
+        while (slots[0][index])
+        {
+            BackoffTimer* timer = slots[0][index];
+
+            remove(timer);
+            expired = true;
+
+            if (timer->listener)
+            {
+                timer->listener->timerexpired(timer);
+            }
+        }
+
+        current++;
+
+        // skip ticks without work up to the next bucket boundary
+        for (int level = 0; level < LEVELS && !occupied[level]; level++)
+        {
+            dstime span = (dstime)1 << ((level + 1) * SLOTBITS);
+            dstime boundary = (current + span - 1) & ~(span - 1);
+
+            if (boundary < current)
+            {
+                // wrapped around
+                break;
+            }
+
+            if (boundary > ds)
+            {
+                current = ds + 1;
+                break;
+            }
+
+            current = boundary;
+        }
+    }
+}
+
+void TimerWheel::expire()
+{
+    advance(Waiter::ds);
+}
+
+void TimerWheel::update(dstime* waituntil)
+{
+    advance(Waiter::ds);
+
+    if (expired)
+    {
+        expired = false;
+        *waituntil = 0;
+        return;
+    }
+
+    if (!count)
+    {
+        return;
+    }
+
+    dstime nds = NEVER;
+
+    // exact trigger time of the closest timer in the finest level
+    for (int i = 0; i < SLOTS; i++)
+    {
+        if (occupied[0] & ((uint64_t)1 << ((current + i) & (SLOTS - 1))))
+        {
+            nds = current + i;
+            break;
+        }
+    }
+
+    // earliest refinement of a coarser bucket
+    for (int level = 1; level < LEVELS; level++)
+    {
+        if (!occupied[level])
+        {
+            continue;
+        }
+
+        int shift = level * SLOTBITS;
+        dstime range = current >> shift;
+        if (current & (((dstime)1 << shift) - 1))
+        {
+            range++;
+        }
+
+        for (int i = 0; i < SLOTS; i++)
+        {
+            if (occupied[level] & ((uint64_t)1 << ((range + i) & (SLOTS - 1))))
+            {
+                dstime t = (range + i) << shift;
+                if (t < nds)
+                {
+                    nds = t;
+                }
+                break;
+            }
+        }
+    }
+
+    if (nds < *waituntil)
+    {
+        *waituntil = nds;
+    }
+}
 } // namespace
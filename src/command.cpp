@@ -26,6 +26,9 @@ namespace mega {
 Command::Command()
 {
     persistent = false;
+    cmdname = NULL;
+    concurrent = false;
+    orderkey = UNDEF;
     level = -1;
     canceled = false;
     result = API_OK;
@@ -47,6 +50,7 @@ const char* Command::getstring() const
 // add opcode
 void Command::cmd(const char* cmd)
 {
+    cmdname = cmd;
     json.append("\"a\":\"");
     json.append(cmd);
     json.append("\"");
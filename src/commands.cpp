@@ -336,6 +336,11 @@ void CommandPutFile::procresult()
         {
             case 'p':
                 client->json.storeobject(canceled ? NULL : &tslot->tempurl);
+                if (!canceled && tslot->tempurl.size())
+                {
+                    // start resolving the storage server while the rest is processed
+                    client->httpio->prefetchdns(&tslot->tempurl);
+                }
                 break;
 
             case EOO:
@@ -544,6 +549,11 @@ void CommandGetFile::procresult()
         {
             case 'g':
                 client->json.storeobject(tslot ? &tslot->tempurl : NULL);
+                if (tslot && tslot->tempurl.size())
+                {
+                    // start resolving the storage server while the rest is processed
+                    client->httpio->prefetchdns(&tslot->tempurl);
+                }
                 e = API_OK;
                 break;
 
@@ -775,6 +785,9 @@ CommandSetAttr::CommandSetAttr(MegaClient* client, Node* n, SymmCipher* cipher,
     tag = client->reqtag;
     syncop = prevattr;
 
+    concurrent = true;
+    orderkey = h;
+
     if(prevattr)
     {
         pa = prevattr;
@@ -940,7 +953,7 @@ void CommandPutNodes::procresult()
     {
         if (client->tctable)
         {
-            client->tctable->begin();
+            client->tcbegin();
             vector<uint32_t> &ids = it->second;
             for (unsigned int i = 0; i < ids.size(); i++)
             {
@@ -949,7 +962,6 @@ void CommandPutNodes::procresult()
                     client->tctable->del(ids[i]);
                 }
             }
-            client->tctable->commit();
         }
         client->pendingtcids.erase(it);
     }
@@ -2456,6 +2468,9 @@ CommandPutUA::CommandPutUA(MegaClient* client, attr_t at, const byte* av, unsign
     notself(client);
 
     tag = client->reqtag;
+
+    concurrent = true;
+    orderkey = at;
 }
 
 void CommandPutUA::procresult()
@@ -2492,6 +2507,10 @@ CommandGetUA::CommandGetUA(MegaClient* client, const char* uid, attr_t at, int c
     arg("v", 1);
 
     tag = ctag;
+
+    // ordered with respect to the updates of the same attribute
+    concurrent = true;
+    orderkey = at;
 }
 
 void CommandGetUA::procresult()
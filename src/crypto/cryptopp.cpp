@@ -21,6 +21,12 @@
 
 #include "mega.h"
 
+// target-specific thread support for batch decryption
+#include "mega/thread/qtthread.h"
+#include "mega/thread/posixthread.h"
+#include "mega/thread/win32thread.h"
+#include "mega/thread/cppthread.h"
+
 namespace mega {
 #ifndef htobe64
 #define htobe64(x) (((uint64_t)htonl((uint32_t)((x) >> 32))) | (((uint64_t)htonl((uint32_t)x)) << 32))
@@ -269,6 +275,9 @@ void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv,
     assert(!(pos & (KEYLENGTH - 1)));
 
     byte ctr[BLOCKSIZE], tmp[BLOCKSIZE];
+    m_time_t start = Metrics::timing() ? Waiter::getmicros() : 0;
+
+    Metrics::add(Metrics::CRYPTO_BYTES, len);
 
     MemAccess::set<int64_t>(ctr,ctriv);
     setint64(pos / BLOCKSIZE, ctr + sizeof ctriv);
@@ -317,6 +326,11 @@ void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv,
 
         incblock(ctr);
     }
+
+    if (start)
+    {
+        Metrics::add(Metrics::CRYPTO_MICROS, Waiter::getmicros() - start);
+    }
 }
 
 static void rsaencrypt(Integer* key, Integer* m)
@@ -381,14 +395,37 @@ int AsymmCipher::encrypt(const byte* plain, int plainlen, byte* buf, int buflen)
     return ptr - buf;
 }
 
-static void rsadecrypt(Integer* key, Integer* m)
+// recomputes the CRT exponents if the private key has changed
+void AsymmCipher::precompute()
+{
+    if (crtkey[0] != key[PRIV_P] || crtkey[1] != key[PRIV_Q] || crtkey[2] != key[PRIV_D])
+    {
+        crtkey[0] = key[PRIV_P];
+        crtkey[1] = key[PRIV_Q];
+        crtkey[2] = key[PRIV_D];
+
+        crtexp[0] = key[PRIV_D] % (key[PRIV_P] - Integer::One());
+        crtexp[1] = key[PRIV_D] % (key[PRIV_Q] - Integer::One());
+    }
+}
+
+// CRT decryption with precomputed exponents, in the given Montgomery
+// contexts of p and q (if any)
+static void rsadecrypt(const Integer* key, const Integer* crtexp,
+                       const MontgomeryRepresentation* mp, const MontgomeryRepresentation* mq, Integer* m)
 {
-    Integer xp = a_exp_b_mod_c(*m % key[AsymmCipher::PRIV_P],
-                               key[AsymmCipher::PRIV_D] % (key[AsymmCipher::PRIV_P] - Integer::One()),
-                               key[AsymmCipher::PRIV_P]);
-    Integer xq = a_exp_b_mod_c(*m % key[AsymmCipher::PRIV_Q],
-                               key[AsymmCipher::PRIV_D] % (key[AsymmCipher::PRIV_Q] - Integer::One()),
-                               key[AsymmCipher::PRIV_Q]);
+    Integer xp, xq;
+
+    if (mp && mq)
+    {
+        xp = mp->ConvertOut(mp->Exponentiate(mp->ConvertIn(*m % key[AsymmCipher::PRIV_P]), crtexp[0]));
+        xq = mq->ConvertOut(mq->Exponentiate(mq->ConvertIn(*m % key[AsymmCipher::PRIV_Q]), crtexp[1]));
+    }
+    else
+    {
+        xp = a_exp_b_mod_c(*m % key[AsymmCipher::PRIV_P], crtexp[0], key[AsymmCipher::PRIV_P]);
+        xq = a_exp_b_mod_c(*m % key[AsymmCipher::PRIV_Q], crtexp[1], key[AsymmCipher::PRIV_Q]);
+    }
 
     if (xp > xq)
     {
@@ -402,11 +439,30 @@ static void rsadecrypt(Integer* key, Integer* m)
     *m = *m * key[AsymmCipher::PRIV_P] + xp;
 }
 
+// the numbytes most significant bytes of a padded plain text
+static void rsaplain(const Integer* key, const Integer* m, byte* out, int numbytes)
+{
+    unsigned l = key[AsymmCipher::PRIV_P].ByteCount() + key[AsymmCipher::PRIV_Q].ByteCount() - 2;
+
+    if (m->ByteCount() > l)
+    {
+        l = m->ByteCount();
+    }
+
+    l -= numbytes;
+
+    while (numbytes--)
+    {
+        out[numbytes] = m->GetByte(l++);
+    }
+}
+
 unsigned AsymmCipher::rawdecrypt(const byte* cipher, int cipherlen, byte* buf, int buflen)
 {
     Integer m(cipher, cipherlen);
 
-    rsadecrypt(key, &m);
+    precompute();
+    rsadecrypt(key, crtexp, NULL, NULL, &m);
 
     int i = m.ByteCount();
 
@@ -432,23 +488,129 @@ int AsymmCipher::decrypt(const byte* cipher, int cipherlen, byte* out, int numby
         return 0;
     }
 
-    rsadecrypt(key, &m);
+    precompute();
+    rsadecrypt(key, crtexp, NULL, NULL, &m);
+    rsaplain(key, &m, out, numbytes);
 
-    unsigned l = key[AsymmCipher::PRIV_P].ByteCount() + key[AsymmCipher::PRIV_Q].ByteCount() - 2;
+    return 1;
+}
+
+// cipher texts of a batch, decrypted in place by one or more threads
+struct RSABatch
+{
+    const Integer* key;
+    const Integer* crtexp;
+    Integer* values;
+    unsigned count;
+    unsigned next;
+#ifdef THREAD_CLASS
+    MUTEX_CLASS mutex;
+#endif
+};
+
+static void* rsadecryptbatch(void* param)
+{
+    RSABatch* batch = (RSABatch*)param;
+
+    // the contexts keep a workspace, each thread needs its own
+    MontgomeryRepresentation mp(batch->key[AsymmCipher::PRIV_P]);
+    MontgomeryRepresentation mq(batch->key[AsymmCipher::PRIV_Q]);
+
+    for (;;)
+    {
+#ifdef THREAD_CLASS
+        batch->mutex.lock();
+#endif
+        unsigned i = batch->next++;
+#ifdef THREAD_CLASS
+        batch->mutex.unlock();
+#endif
+
+        if (i >= batch->count)
+        {
+            return NULL;
+        }
 
-    if (m.ByteCount() > l)
+        rsadecrypt(batch->key, batch->crtexp, &mp, &mq, &batch->values[i]);
+    }
+}
+
+unsigned AsymmCipher::decryptbatch(const string* ciphers, unsigned count, string* plains, int numbytes)
+{
+    vector<Integer> values(count);
+    vector<char> valid(count);
+
+    for (unsigned i = 0; i < count; i++)
     {
-        l = m.ByteCount();
+        valid[i] = decodeintarray(&values[i], 1, (const byte*)ciphers[i].data(), ciphers[i].size());
+        plains[i].clear();
     }
 
-    l -= numbytes;
+    if (!count)
+    {
+        return 0;
+    }
 
-    while (numbytes--)
+    precompute();
+
+    RSABatch batch;
+    batch.key = key;
+    batch.crtexp = crtexp;
+    batch.values = &values[0];
+    batch.count = count;
+    batch.next = 0;
+
+#ifdef THREAD_CLASS
+    batch.mutex.init(false);
+
+    unsigned numthreads = count / BATCHPERTHREAD;
+
+    if (numthreads > BATCHTHREADS)
     {
-        out[numbytes] = m.GetByte(l++);
+        numthreads = BATCHTHREADS;
     }
 
-    return 1;
+    // this thread works on the batch too
+    THREAD_CLASS* threads = NULL;
+
+    if (numthreads > 1)
+    {
+        threads = new THREAD_CLASS[numthreads - 1];
+
+        for (unsigned i = 0; i < numthreads - 1; i++)
+        {
+            threads[i].start(rsadecryptbatch, &batch);
+        }
+    }
+#endif
+
+    rsadecryptbatch(&batch);
+
+#ifdef THREAD_CLASS
+    if (threads)
+    {
+        for (unsigned i = 0; i < numthreads - 1; i++)
+        {
+            threads[i].join();
+        }
+
+        delete[] threads;
+    }
+#endif
+
+    unsigned decrypted = 0;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (valid[i])
+        {
+            plains[i].resize(numbytes);
+            rsaplain(key, &values[i], (byte*)plains[i].data(), numbytes);
+            decrypted++;
+        }
+    }
+
+    return decrypted;
 }
 
 int AsymmCipher::setkey(int numints, const byte* data, int len)
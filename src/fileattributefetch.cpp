@@ -33,6 +33,26 @@ FileAttributeFetchChannel::FileAttributeFetchChannel()
     fahref = UNDEF;
     inbytes = 0;
     e = API_EINTERNAL;
+    btqueued = false;
+    timeoutqueued = false;
+}
+
+void FileAttributeFetchChannel::updatetimers(MegaClient* client)
+{
+    bool inflight = req.status == REQ_INFLIGHT;
+    bool waiting = !inflight && (fafs[0].size() || fafs[1].size());
+
+    if (timeoutqueued != inflight)
+    {
+        timeout.setwheel(inflight ? &client->timers : NULL);
+        timeoutqueued = inflight;
+    }
+
+    if (btqueued != waiting)
+    {
+        bt.setwheel(waiting ? &client->timers : NULL);
+        btqueued = waiting;
+    }
 }
 
 FileAttributeFetch::FileAttributeFetch(handle h, fatype t, int ctag)
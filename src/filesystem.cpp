@@ -89,40 +89,156 @@ void FileSystemAccess::name2local(string* filename) const
     path2local(&t, filename);
 }
 
-void FileSystemAccess::normalize(string* filename) const
+// code points that combine with the preceding one when composing
+static bool iscompositionsecond(utf8proc_int32_t uc, const utf8proc_property_t* property)
 {
-    if (!filename) return;
+    // Hangul vowel and trailing consonant jamos compose algorithmically
+    return (property->comb_index != UINT16_MAX && property->comb_index >= 0x8000)
+            || (uc >= 0x1161 && uc < 0x11C3);
+}
 
-    const char* cfilename = filename->c_str();
-    size_t fnsize = filename->size();
-    string result;
+// NFC quick check: true if the string is known to be normalized already,
+// false if it may need to be changed (or is not valid UTF-8)
+// every code point must come back unchanged from its own decomposition and
+// recomposition, start with a starter and not compose with its predecessor
+bool FileSystemAccess::isnormalized(const char* str, size_t len)
+{
+    const uint8_t* ptr = (const uint8_t*)str;
+    const uint8_t* end = ptr + len;
+    utf8proc_option_t options = (utf8proc_option_t)(UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+    utf8proc_int32_t decomposed[16];
+    utf8proc_int32_t uc;
+    utf8proc_ssize_t n;
+    int boundclass = 0;
 
-    for (size_t i = 0; i < fnsize; )
+    while (ptr < end)
     {
-        // allow NUL bytes between valid UTF-8 sequences
-        if (!cfilename[i])
+        // ASCII is normalized
+        if (*ptr < 0x80)
         {
-            result.append("", 1);
-            i++;
+            ptr++;
             continue;
         }
 
-        const char* substring = cfilename + i;
-        char* normalized = (char*)utf8proc_NFC((uint8_t*)substring);
+        if ((n = utf8proc_iterate(ptr, end - ptr, &uc)) <= 0)
+        {
+            return false;
+        }
+        ptr += n;
 
-        if (!normalized)
+        n = utf8proc_decompose_char(uc, decomposed, sizeof decomposed / sizeof *decomposed,
+                                    options, &boundclass);
+
+        if (n <= 0 || n > (utf8proc_ssize_t)(sizeof decomposed / sizeof *decomposed))
         {
-            filename->clear();
-            return;
+            return false;
         }
 
-        result.append(normalized);
-        free(normalized);
+        const utf8proc_property_t* property = utf8proc_get_property(decomposed[0]);
+
+        if (property->combining_class || iscompositionsecond(decomposed[0], property))
+        {
+            return false;
+        }
+
+        if ((n > 1 || decomposed[0] != uc)
+                && (utf8proc_normalize_utf32(decomposed, n, options) != 1
+                    || decomposed[0] != uc))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// normalizes the NUL-free substring starting at pos, returns its new length
+// or a negative value if it is not valid UTF-8
+static utf8proc_ssize_t normalizesegment(string* str, size_t pos, size_t len, vector<int32_t>* buffer, bool* changed)
+{
+    utf8proc_option_t options = (utf8proc_option_t)(UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+    utf8proc_ssize_t n;
+
+    if (buffer->size() <= len)
+    {
+        buffer->resize(len + 1);
+    }
+
+    // the buffer must hold the decomposition plus a spare byte for reencoding
+    while ((n = utf8proc_decompose((const uint8_t*)str->data() + pos, len,
+                                   &(*buffer)[0], buffer->size() - 1, options)) >= (utf8proc_ssize_t)buffer->size())
+    {
+        buffer->resize(n + 1);
+    }
+
+    if (n < 0 || (n = utf8proc_reencode(&(*buffer)[0], n, options)) < 0)
+    {
+        return -1;
+    }
 
-        i += strlen(substring);
+    // the quick check can fail for strings that are normalized already
+    if ((size_t)n != len || memcmp(str->data() + pos, &(*buffer)[0], n))
+    {
+        str->replace(pos, len, (const char*)&(*buffer)[0], n);
+        *changed = true;
     }
 
-    *filename = result;
+    return n;
+}
+
+// normalizes to NFC in place, returns true if the string was changed
+// NUL bytes are allowed between valid UTF-8 sequences
+static bool normalizestring(string* filename, vector<int32_t>* buffer)
+{
+    bool changed = false;
+
+    for (size_t i = 0; i < filename->size(); )
+    {
+        size_t end = filename->find('\0', i);
+
+        if (end == string::npos)
+        {
+            end = filename->size();
+        }
+
+        if (!FileSystemAccess::isnormalized(filename->data() + i, end - i))
+        {
+            utf8proc_ssize_t len = normalizesegment(filename, i, end - i, buffer, &changed);
+
+            if (len < 0)
+            {
+                filename->clear();
+                return true;
+            }
+
+            end = i + len;
+        }
+
+        i = end + 1;
+    }
+
+    return changed;
+}
+
+void FileSystemAccess::normalize(string* filename) const
+{
+    if (!filename) return;
+
+    // the scratch buffer is only allocated if the name has to be changed
+    vector<int32_t> buffer;
+    normalizestring(filename, &buffer);
+}
+
+size_t FileSystemAccess::normalize(string* filenames, size_t count, vector<int32_t>* buffer) const
+{
+    size_t changed = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        changed += normalizestring(filenames + i, buffer);
+    }
+
+    return changed;
 }
 
 // convert from local encoding, then unescape escaped forbidden characters
@@ -144,16 +260,43 @@ DirNotify::DirNotify(string* clocalbasepath, string* cignore)
     failed = true;
     error = false;
     sync = NULL;
+    maxwatches = 0;
+    notifications = 0;
+    coalescednotifications = 0;
+
+    for (int q = RETRY; q >= DIREVENTS; q--)
+    {
+        firstnotification[q] = 0;
+        processingnotification[q] = false;
+    }
+}
+
+DirNotify::~DirNotify()
+{
+#ifdef ENABLE_SYNC
+    for (int q = RETRY; q >= DIREVENTS; q--)
+    {
+        for (notify_deque::iterator it = notifyq[q].begin(); it != notifyq[q].end(); it++)
+        {
+            delete it->scanned;
+        }
+    }
+#endif
 }
 
 // notify base LocalNode + relative path/filename
-void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_t len, bool immediate)
+// (takes ownership of the attributes found by the parallel initial scan)
+void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_t len, bool immediate, ScanRecord* scanned)
 {
     string path;
     path.assign(localpath, len);
 
+    notifications++;
+    Metrics::add(Metrics::FS_NOTIFICATIONS);
+
 #ifdef ENABLE_SYNC
-    if (notifyq[q].size()
+    // (the record being processed already has been checked)
+    if (notifyq[q].size() > (processingnotification[q] ? 1u : 0u)
             && notifyq[q].back().localnode == l
             && notifyq[q].back().path == path)
     {
@@ -161,10 +304,36 @@ void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_
         {
             notifyq[q].back().timestamp = immediate ? 0 : Waiter::ds;
         }
+        if (scanned)
+        {
+            delete notifyq[q].back().scanned;
+            notifyq[q].back().scanned = scanned;
+        }
+        coalescednotifications++;
+        Metrics::add(Metrics::FS_NOTIFICATIONS_COALESCED);
         LOG_debug << "Repeated notification skipped";
         return;
     }
 
+    // the queued record will pick up the current state of the item when
+    // processed, it only has to wait for the item to settle again
+    notifykey_map::iterator pit;
+    if (!immediate && (pit = pendingnotifications[q].find(pair<LocalNode*, string>(l, path))) != pendingnotifications[q].end())
+    {
+        Notification* n = &notifyq[q][pit->second.last - firstnotification[q]];
+
+        if (n->timestamp)
+        {
+            n->timestamp = Waiter::ds;
+        }
+
+        delete scanned;
+        coalescednotifications++;
+        Metrics::add(Metrics::FS_NOTIFICATIONS_COALESCED);
+        LOG_verbose << "Pending notification coalesced";
+        return;
+    }
+
     if (!immediate && sync && !sync->initializing)
     {
         string tmppath;
@@ -195,6 +364,7 @@ void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_
                 && (ll->type != FILENODE || (ll->mtime == fa->mtime && ll->size == fa->size))))
         {
             LOG_debug << "Self filesystem notification skipped";
+            delete scanned;
             delete fa;
             return;
         }
@@ -206,6 +376,73 @@ void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_
     notifyq[q].back().timestamp = immediate ? 0 : Waiter::ds;
     notifyq[q].back().localnode = l;
     notifyq[q].back().path = path;
+    notifyq[q].back().scanned = scanned;
+
+    PendingNotification* pending = &pendingnotifications[q][pair<LocalNode*, string>(l, path)];
+    pending->count++;
+    pending->last = firstnotification[q] + notifyq[q].size() - 1;
+}
+
+// the first record stops taking repeated notifications: the item may change
+// again while it is checked, or its check may have to be retried, and these
+// must not be coalesced into a record that is about to be removed
+void DirNotify::processnotification(notifyqueue q)
+{
+    if (processingnotification[q])
+    {
+        return;
+    }
+
+    Notification* n = &notifyq[q].front();
+    notifykey_map::iterator it = pendingnotifications[q].find(pair<LocalNode*, string>(n->localnode, n->path));
+
+    if (it != pendingnotifications[q].end() && !--it->second.count)
+    {
+        pendingnotifications[q].erase(it);
+    }
+
+    processingnotification[q] = true;
+}
+
+void DirNotify::popnotification(notifyqueue q)
+{
+    processnotification(q);
+    processingnotification[q] = false;
+    firstnotification[q]++;
+
+    Notification* n = &notifyq[q].front();
+
+#ifdef ENABLE_SYNC
+    delete n->scanned;
+#endif
+    notifyq[q].pop_front();
+}
+
+void DirNotify::cancelnotifications(LocalNode* l)
+{
+    for (int q = RETRY; q >= DIREVENTS; q--)
+    {
+        notifykey_map::iterator it = pendingnotifications[q].lower_bound(pair<LocalNode*, string>(l, string()));
+
+        // only walk the queue if it holds records of this LocalNode
+        if (it == pendingnotifications[q].end() || it->first.first != l)
+        {
+            continue;
+        }
+
+        while (it != pendingnotifications[q].end() && it->first.first == l)
+        {
+            pendingnotifications[q].erase(it++);
+        }
+
+        for (notify_deque::iterator nit = notifyq[q].begin(); nit != notifyq[q].end(); nit++)
+        {
+            if (nit->localnode == l)
+            {
+                nit->localnode = (LocalNode*)~0;
+            }
+        }
+    }
 }
 
 // default: no fingerprint
@@ -219,6 +456,24 @@ DirNotify* FileSystemAccess::newdirnotify(string* localpath, string* ignore)
     return new DirNotify(localpath, ignore);
 }
 
+DirEntry::DirEntry()
+{
+    type = TYPE_UNKNOWN;
+    size = -1;
+    mtime = 0;
+    fsid = UNDEF;
+    fsidvalid = false;
+    statvalid = false;
+}
+
+bool DirAccess::dnextentry(string* path, string* name, bool followsymlinks, DirEntry* entry)
+{
+    entry->statvalid = false;
+    entry->fsidvalid = false;
+
+    return dnext(path, name, followsymlinks, &entry->type);
+}
+
 FileAccess::FileAccess(Waiter *waiter)
 {
     this->waiter = waiter;
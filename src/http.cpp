@@ -91,6 +91,17 @@ HttpIO::HttpIO()
     lastdata = NEVER;
     downloadSpeed = 0;
     uploadSpeed = 0;
+    newconnections = 0;
+    reusedconnections = 0;
+    handshaketimems = 0;
+
+    dnslookups = 0;
+    dnscachehits = 0;
+    dnsstalehits = 0;
+    dnswaittimems = 0;
+
+    receivedbytes = 0;
+    copiedbytes = 0;
 }
 
 // signal Internet status - if the Internet was down for more than one minute,
@@ -329,6 +340,16 @@ m_off_t HttpIO::getmaxuploadspeed()
     return 0;
 }
 
+bool HttpIO::sethttp2(bool)
+{
+    return false;
+}
+
+bool HttpIO::usinghttp2()
+{
+    return false;
+}
+
 void HttpReq::post(MegaClient* client, const char* data, unsigned len)
 {
     if (httpio)
@@ -395,6 +416,7 @@ void HttpReq::init()
     timeleft = -1;
     lastdata = NEVER;
     outpos = 0;
+    dnswaitms = 0;
 }
 
 void HttpReq::setreq(const char* u, contenttype_t t)
@@ -410,6 +432,8 @@ void HttpReq::setreq(const char* u, contenttype_t t)
 // add data to fixed or variable buffer
 void HttpReq::put(void* data, unsigned len, bool purge)
 {
+    m_off_t copied;
+
     if (buf)
     {
         if (bufpos + len > buflen)
@@ -417,20 +441,40 @@ void HttpReq::put(void* data, unsigned len, bool purge)
             len = buflen - bufpos;
         }
 
+        // fixed buffers are the final destination (decrypted in place and
+        // written to the file from there): this is the only copy
         memcpy(buf + bufpos, data, len);
+        copied = len;
     }
     else
     {
-        if (inpurge && purge)
+        copied = len;
+
+        // compact only once the consumed part is at least as large as the
+        // unconsumed one, so that each byte is moved at most once on average
+        if (inpurge && purge && inpurge >= in.size() - inpurge)
         {
+            copied += in.size() - inpurge;
             in.erase(0, inpurge);
             inpurge = 0;
         }
 
+        if (in.size() + len > in.capacity())
+        {
+            // reallocation
+            copied += in.size();
+        }
+
         in.append((char*)data, len);
     }
     
     bufpos += len;
+
+    if (httpio)
+    {
+        httpio->receivedbytes += len;
+        httpio->copiedbytes += copied;
+    }
 }
 
 char* HttpReq::data()
@@ -519,31 +563,73 @@ void HttpReqDL::prepare(const char* tempurl, SymmCipher* /*key*/,
     dlpos = pos;
     size = (unsigned)(npos - pos);
 
-    if (!buf || buflen != size)
+    m_off_t paddedsize = (size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE;
+    if (!buf || bufcapacity < paddedsize || (!bufferpool && buflen != size))
     {
         // (re)allocate buffer
         if (buf)
         {
-            delete[] buf;
+            if (bufferpool)
+            {
+                bufferpool->freebuf(buf, bufcapacity);
+            }
+            else
+            {
+                delete[] buf;
+            }
             buf = NULL;
+            bufcapacity = 0;
         }
 
         if (size)
         {
-            buf = new byte[(size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE];
+            if (bufferpool)
+            {
+                buf = bufferpool->allocbuf(size, &bufcapacity);
+            }
+            else
+            {
+                buf = new byte[paddedsize];
+                bufcapacity = paddedsize;
+            }
+        }
+    }
+    buflen = size;
+}
+
+HttpReqDL::~HttpReqDL()
+{
+    if (buf && bufferpool)
+    {
+        // the in-flight transfer (if any) must be stopped before the buffer
+        // can be handed out again
+        if (httpio)
+        {
+            httpio->cancel(this);
+            httpio = NULL;
         }
-        buflen = size;
+
+        bufferpool->freebuf(buf, bufcapacity);
+        buf = NULL;
     }
 }
 
-// decrypt, mac and write downloaded chunk
+// decrypt and mac downloaded chunk
 void HttpReqDL::finalize(Transfer *transfer)
+{
+    finalize(&transfer->key, &transfer->chunkmacs, transfer->ctriv, transfer->size);
+}
+
+// decrypt and mac downloaded chunk using the MAC state of partially
+// downloaded chunks in macs (can be this->chunkmacs, so that it can run
+// without accessing the transfer)
+void HttpReqDL::finalize(SymmCipher* key, chunkmac_map* macs, int64_t ctriv, m_off_t filesize)
 {
     byte *chunkstart = buf;
     m_off_t startpos = dlpos;
     m_off_t finalpos = startpos + bufpos;
-    assert(finalpos <= transfer->size);
-    if (finalpos != transfer->size)
+    assert(finalpos <= filesize);
+    if (finalpos != filesize)
     {
         finalpos &= -SymmCipher::BLOCKSIZE;
         bufpos &= -SymmCipher::BLOCKSIZE;
@@ -557,10 +643,10 @@ void HttpReqDL::finalize(Transfer *transfer)
         ChunkMAC &chunkmac = chunkmacs[chunkid];
         if (!chunkmac.finished)
         {
-            chunkmac = transfer->chunkmacs[chunkid];
-            transfer->key.ctr_crypt(chunkstart, chunksize, startpos, transfer->ctriv,
-                                    chunkmac.mac, false, !chunkmac.finished && !chunkmac.offset);
-            if (endpos == ChunkedHash::chunkceil(chunkid, transfer->size))
+            chunkmac = (*macs)[chunkid];
+            key->ctr_crypt(chunkstart, chunksize, startpos, ctriv,
+                           chunkmac.mac, false, !chunkmac.finished && !chunkmac.offset);
+            if (endpos == ChunkedHash::chunkceil(chunkid, filesize))
             {
                 LOG_debug << "Finished chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
                 chunkmac.finished = true;
@@ -643,6 +729,208 @@ m_off_t HttpReqUL::transferred(MegaClient* client)
     return 0;
 }
 
+TransferBufferPool::TransferBufferPool()
+{
+    maxcachedbytes = MAXCACHEDBYTES;
+    bytesinuse = 0;
+    bytescached = 0;
+    peakbytes = 0;
+    bufallocs = 0;
+    bufreuses = 0;
+    reqallocs = 0;
+    reqreuses = 0;
+}
+
+TransferBufferPool::~TransferBufferPool()
+{
+    clear();
+}
+
+// page-aligned, so that the same buffer can be passed to unbuffered/direct
+// file writes without a bounce buffer
+byte* TransferBufferPool::allocaligned(m_off_t size)
+{
+    void* b;
+
+#ifdef _WIN32
+    if (!(b = _aligned_malloc(size, ALIGNMENT)))
+#else
+    if (posix_memalign(&b, ALIGNMENT, size))
+#endif
+    {
+        throw std::bad_alloc();
+    }
+
+    return (byte*)b;
+}
+
+void TransferBufferPool::freealigned(byte* b)
+{
+#ifdef _WIN32
+    _aligned_free(b);
+#else
+    free(b);
+#endif
+}
+
+byte* TransferBufferPool::allocbuf(m_off_t len, m_off_t* capacity)
+{
+    m_off_t size = (len + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+    byte* b;
+
+    // smallest idle buffer that fits - never hand out more than twice the
+    // requested size to keep large buffers available for large requests
+    multimap<m_off_t, byte*>::iterator it = freebufs.lower_bound(size);
+    if (it != freebufs.end() && it->first <= 2 * size)
+    {
+        size = it->first;
+        b = it->second;
+        freebufs.erase(it);
+        bytescached -= size;
+        bufreuses++;
+    }
+    else
+    {
+        b = allocaligned(size);
+        bufallocs++;
+    }
+
+    bytesinuse += size;
+    if (bytesinuse + bytescached > peakbytes)
+    {
+        peakbytes = bytesinuse + bytescached;
+    }
+
+    *capacity = size;
+    return b;
+}
+
+void TransferBufferPool::freebuf(byte* b, m_off_t capacity)
+{
+    if (!b)
+    {
+        return;
+    }
+
+    bytesinuse -= capacity;
+
+    if (bytescached + capacity > maxcachedbytes)
+    {
+        // evict the smallest idle buffers first, they are the cheapest to
+        // reallocate
+        while (freebufs.size() && bytescached + capacity > maxcachedbytes)
+        {
+            multimap<m_off_t, byte*>::iterator it = freebufs.begin();
+            if (it->first > capacity)
+            {
+                break;
+            }
+
+            bytescached -= it->first;
+            freealigned(it->second);
+            freebufs.erase(it);
+        }
+
+        if (bytescached + capacity > maxcachedbytes)
+        {
+            freealigned(b);
+            return;
+        }
+    }
+
+    freebufs.insert(pair<m_off_t, byte*>(capacity, b));
+    bytescached += capacity;
+}
+
+HttpReqXfer* TransferBufferPool::allocreq(direction_t d)
+{
+    if (sparereqs[d].size())
+    {
+        HttpReqXfer* req = sparereqs[d].back();
+        sparereqs[d].pop_back();
+        reqreuses++;
+        return req;
+    }
+
+    reqallocs++;
+
+    if (d == PUT)
+    {
+        return new HttpReqUL();
+    }
+
+    HttpReqDL* req = new HttpReqDL();
+    req->bufferpool = this;
+    return req;
+}
+
+void TransferBufferPool::freereq(HttpReqXfer* req)
+{
+    if (!req)
+    {
+        return;
+    }
+
+    req->disconnect();
+
+    HttpReqDL* dlreq = dynamic_cast<HttpReqDL*>(req);
+    direction_t d = dlreq ? GET : PUT;
+    if (dlreq)
+    {
+        if (dlreq->bufferpool != this)
+        {
+            delete req;
+            return;
+        }
+
+        // give the buffer back, the next request may need a different size
+        freebuf(dlreq->buf, dlreq->bufcapacity);
+        dlreq->buf = NULL;
+        dlreq->bufcapacity = 0;
+        dlreq->buflen = 0;
+        dlreq->chunkmacs.clear();
+        dlreq->dlpos = 0;
+    }
+
+    if (sparereqs[d].size() >= MAXSPAREREQS)
+    {
+        delete req;
+        return;
+    }
+
+    // keep the allocated capacity of in/out, it's reused by the next chunk
+    req->status = REQ_READY;
+    req->in.clear();
+    req->outbuf.clear();
+    req->out = &req->outbuf;
+    req->posturl.clear();
+    req->sslfakeissuer.clear();
+    req->size = 0;
+    req->pos = 0;
+    req->init();
+
+    sparereqs[d].push_back(req);
+}
+
+void TransferBufferPool::clear()
+{
+    for (int d = 2; d--; )
+    {
+        for (unsigned i = 0; i < sparereqs[d].size(); i++)
+        {
+            delete sparereqs[d][i];
+        }
+        sparereqs[d].clear();
+    }
+
+    for (multimap<m_off_t, byte*>::iterator it = freebufs.begin(); it != freebufs.end(); it++)
+    {
+        freealigned(it->second);
+    }
+    freebufs.clear();
+    bytescached = 0;
+}
+
 SpeedController::SpeedController()
 {
     partialBytes = 0;
@@ -21,6 +21,20 @@
 
 #include "mega/logging.h"
 
+// per-thread buffers require thread-local storage and a background thread
+#if defined(THREAD_CLASS) && (defined(USE_PTHREAD) || (defined(_WIN32) && !defined(WINDOWS_PHONE)))
+#define ENABLE_ASYNC_LOGGING 1
+
+#ifdef _WIN32
+#define LOG_MEMORY_BARRIER() MemoryBarrier()
+#define LOG_TLS_CALLBACK NTAPI
+#else
+#include <pthread.h>
+#define LOG_MEMORY_BARRIER() __sync_synchronize()
+#define LOG_TLS_CALLBACK
+#endif
+#endif
+
 namespace mega {
 
 // static member initialization
@@ -32,47 +46,564 @@ char SimpleLogger::base64Handle[14];
 // by the default, display logs with level equal or less than logInfo
 enum LogLevel SimpleLogger::logCurrentLevel = logInfo;
 
+#ifdef ENABLE_ASYNC_LOGGING
+// header of a log line in a ring buffer, followed by the message
+struct LogRecord
+{
+    m_time_t time;          // Waiter::getmicros()
+    char const* filename;   // __FILE__ literal
+    char *external;         // heap copy of messages too large for the ring
+    uint32_t size;          // bytes used in the ring (0: skip to the start)
+    uint32_t length;        // message length
+    int32_t line;
+    uint8_t level;
+    uint8_t lineBreak;
+};
+
+// logging state of a thread. The ring buffer has a single producer (the
+// thread) and a single consumer (the thread holding the drain mutex), so
+// head and tail are updated without locks.
+struct LogThreadState
+{
+    std::ostringstream stream;
+    bool streamInUse;
+    bool draining;
+
+    char *data;
+    size_t capacity;
+    volatile size_t head;
+    volatile size_t tail;
+
+    LogThreadState()
+    {
+        streamInUse = false;
+        draining = false;
+        data = NULL;
+        capacity = 0;
+        head = 0;
+        tail = 0;
+    }
+
+    ~LogThreadState()
+    {
+        delete [] data;
+    }
+};
+
+class AsyncLogWriter
+{
+public:
+    static const int FLUSH_INTERVAL_MS = 100;
+    static const size_t RECORD_ALIGN = 8;
+
+    bool initialized;
+    volatile bool enabled;
+    bool started;
+    bool exiting;
+    size_t bufferSize;
+
+    THREAD_CLASS thread;
+    MUTEX_CLASS registryMutex;
+    MUTEX_CLASS drainMutex;
+    SEMAPHORE_CLASS wakeup;
+    SEMAPHORE_CLASS space;
+    int spaceWaiters;
+    vector<LogThreadState*> states;
+
+    // wall clock reference for the monotonic timestamps
+    time_t baseTime;
+    m_time_t baseMicros;
+
+    // cache of the last formatted timestamp
+    time_t lastSecond;
+    char lastTime[16];
+
+#ifdef _WIN32
+    DWORD tlsIndex;
+#else
+    pthread_key_t tlsKey;
+#endif
+
+    AsyncLogWriter()
+    {
+        enabled = false;
+        started = false;
+        exiting = false;
+        bufferSize = SimpleLogger::ASYNC_BUFFER_SIZE;
+        spaceWaiters = 0;
+        baseTime = 0;
+        baseMicros = 0;
+        lastSecond = -1;
+        lastTime[0] = '\0';
+
+        registryMutex.init(false);
+        drainMutex.init(true);
+
+#ifdef _WIN32
+        tlsIndex = FlsAlloc(threadexit);
+#else
+        pthread_key_create(&tlsKey, threadexit);
+#endif
+        initialized = true;
+    }
+
+    ~AsyncLogWriter()
+    {
+        stop();
+        initialized = false;
+    }
+
+    // state of the calling thread
+    LogThreadState* state()
+    {
+#ifdef _WIN32
+        LogThreadState* s = (LogThreadState*)FlsGetValue(tlsIndex);
+#else
+        LogThreadState* s = (LogThreadState*)pthread_getspecific(tlsKey);
+#endif
+        if (!s)
+        {
+            s = new LogThreadState();
+
+            registryMutex.lock();
+            states.push_back(s);
+            registryMutex.unlock();
+
+#ifdef _WIN32
+            FlsSetValue(tlsIndex, s);
+#else
+            pthread_setspecific(tlsKey, s);
+#endif
+        }
+
+        return s;
+    }
+
+    static void LOG_TLS_CALLBACK threadexit(void* param);
+
+    static void* threadentry(void* param)
+    {
+        ((AsyncLogWriter*)param)->loop();
+        return NULL;
+    }
+
+    void loop()
+    {
+        for (;;)
+        {
+            wakeup.timedwait(FLUSH_INTERVAL_MS);
+
+            drainMutex.lock();
+            drain(state());
+            bool exit = exiting;
+            drainMutex.unlock();
+
+            if (exit)
+            {
+                return;
+            }
+        }
+    }
+
+    bool start(size_t size)
+    {
+        drainMutex.lock();
+        if (!started)
+        {
+            // existing buffers are resized when they become empty
+            size_t capacity = 4096;
+            while (capacity < size)
+            {
+                capacity <<= 1;
+            }
+            bufferSize = capacity;
+
+            baseTime = time(NULL);
+            baseMicros = Waiter::getmicros();
+            lastSecond = -1;
+
+            exiting = false;
+            started = true;
+            thread.start(threadentry, this);
+        }
+        drainMutex.unlock();
+
+        enabled = true;
+        return true;
+    }
+
+    void stop()
+    {
+        enabled = false;
+        LOG_MEMORY_BARRIER();
+
+        drainMutex.lock();
+        bool running = started;
+        exiting = true;
+        started = false;
+        drainMutex.unlock();
+
+        if (running)
+        {
+            wakeup.release();
+            thread.join();
+        }
+    }
+
+    // copy a line to the ring buffer of the calling thread
+    void push(LogThreadState* s, enum LogLevel level, char const* filename, int line,
+              bool lineBreak, const string& message)
+    {
+        // (re)allocate the ring while the writer has nothing to read from it
+        if (s->capacity != bufferSize && s->head == s->tail)
+        {
+            delete [] s->data;
+            s->capacity = bufferSize;
+            s->data = new char[s->capacity];
+            LOG_MEMORY_BARRIER();
+        }
+
+        size_t length = message.size();
+        bool external = length > s->capacity / 4;
+        size_t needed = align(sizeof(LogRecord) + (external ? 0 : length));
+
+        size_t head = s->head;
+        size_t offset;
+        size_t total;
+
+        for (;;)
+        {
+            offset = head & (s->capacity - 1);
+            size_t toend = s->capacity - offset;
+            total = (needed <= toend) ? needed : (toend + needed);
+
+            if (s->capacity - (head - s->tail) >= total)
+            {
+                break;
+            }
+
+            // ring full: wait until the writer frees some space
+            registryMutex.lock();
+            spaceWaiters++;
+            registryMutex.unlock();
+
+            wakeup.release();
+            space.timedwait(FLUSH_INTERVAL_MS);
+            LOG_MEMORY_BARRIER();
+        }
+
+        if (total != needed)
+        {
+            // the record doesn't fit before the end of the ring
+            size_t toend = s->capacity - offset;
+            if (toend >= sizeof(LogRecord))
+            {
+                ((LogRecord*)(s->data + offset))->size = 0;
+            }
+            offset = 0;
+        }
+
+        LogRecord* record = (LogRecord*)(s->data + offset);
+        record->time = Waiter::getmicros();
+        record->filename = filename;
+        record->size = uint32_t(needed);
+        record->length = uint32_t(length);
+        record->line = line;
+        record->level = uint8_t(level);
+        record->lineBreak = lineBreak;
+
+        if (external)
+        {
+            record->external = new char[length];
+            memcpy(record->external, message.data(), length);
+        }
+        else
+        {
+            record->external = NULL;
+            memcpy((char*)(record + 1), message.data(), length);
+        }
+
+        size_t used = head - s->tail;
+
+        // publish the record after it has been written
+        LOG_MEMORY_BARRIER();
+        s->head = head + total;
+
+        // the writer polls periodically, wake it up if the ring is getting
+        // full or the line is important
+        if (level <= logError || (used <= s->capacity / 2 && used + total > s->capacity / 2))
+        {
+            wakeup.release();
+        }
+    }
+
+    // next record of a ring (NULL if empty)
+    LogRecord* peek(LogThreadState* s, size_t head)
+    {
+        while (s->tail != head)
+        {
+            size_t offset = s->tail & (s->capacity - 1);
+            size_t toend = s->capacity - offset;
+
+            if (toend < sizeof(LogRecord) || !((LogRecord*)(s->data + offset))->size)
+            {
+                s->tail += toend;
+                continue;
+            }
+
+            return (LogRecord*)(s->data + offset);
+        }
+
+        return NULL;
+    }
+
+    // write all pending lines in timestamp order (drain mutex locked)
+    void drain(LogThreadState* current)
+    {
+        registryMutex.lock();
+        vector<LogThreadState*> pending;
+        vector<size_t> heads;
+        for (size_t i = 0; i < states.size(); i++)
+        {
+            if (states[i]->data && states[i]->tail != states[i]->head)
+            {
+                pending.push_back(states[i]);
+                heads.push_back(size_t(states[i]->head));
+            }
+        }
+        registryMutex.unlock();
+
+        if (pending.empty())
+        {
+            return;
+        }
+
+        LOG_MEMORY_BARRIER();
+
+        // lines logged by the output class are written synchronously
+        current->draining = true;
+
+        for (;;)
+        {
+            LogRecord* next = NULL;
+            size_t nexti = 0;
+
+            for (size_t i = 0; i < pending.size(); i++)
+            {
+                LogRecord* record = peek(pending[i], heads[i]);
+                if (record && (!next || record->time < next->time))
+                {
+                    next = record;
+                    nexti = i;
+                }
+            }
+
+            if (!next)
+            {
+                break;
+            }
+
+            SimpleLogger::output(static_cast<LogLevel>(next->level), formattime(next->time),
+                                 next->filename, next->line,
+                                 next->external ? next->external : (const char*)(next + 1),
+                                 next->length, next->lineBreak != 0);
+
+            delete [] next->external;
+
+            LOG_MEMORY_BARRIER();
+            pending[nexti]->tail += next->size;
+        }
+
+        current->draining = false;
+
+        registryMutex.lock();
+        int waiters = spaceWaiters;
+        spaceWaiters = 0;
+        registryMutex.unlock();
+
+        while (waiters--)
+        {
+            space.release();
+        }
+    }
+
+    // HH:MM:SS of a monotonic timestamp, formatted once per second
+    const char* formattime(m_time_t micros)
+    {
+        time_t t = baseTime + time_t((micros - baseMicros) / 1000000);
+
+        if (t != lastSecond)
+        {
+            lastSecond = t;
+            if (!strftime(lastTime, sizeof(lastTime), "%H:%M:%S", gmtime(&t)))
+            {
+                lastTime[0] = '\0';
+            }
+        }
+
+        return lastTime;
+    }
+
+    static size_t align(size_t size)
+    {
+        return (size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+    }
+};
+
+static AsyncLogWriter asyncWriter;
+
+// write the pending lines of an exiting thread and release its state
+void LOG_TLS_CALLBACK AsyncLogWriter::threadexit(void* param)
+{
+    LogThreadState* s = (LogThreadState*)param;
+
+    if (!asyncWriter.initialized)
+    {
+        delete s;
+        return;
+    }
+
+    asyncWriter.drainMutex.lock();
+    asyncWriter.drain(s);
+
+    asyncWriter.registryMutex.lock();
+    for (size_t i = 0; i < asyncWriter.states.size(); i++)
+    {
+        if (asyncWriter.states[i] == s)
+        {
+            asyncWriter.states.erase(asyncWriter.states.begin() + i);
+            break;
+        }
+    }
+    asyncWriter.registryMutex.unlock();
+    asyncWriter.drainMutex.unlock();
+
+    delete s;
+}
+#endif
+
 SimpleLogger::SimpleLogger(enum LogLevel ll, char const* filename, int line, bool lBreak)
 {
-    struct OutputSettings settings = outputSettings[ll];
     level = ll;
     lineBreak = lBreak;
+    this->filename = filename;
+    this->line = line;
 
-    if (settings.enableTime)
-        ostr << "[" << getTime() << "] ";
-    if (settings.enableLevel)
-        ostr << "[" << toStr(ll) << "] ";
-    if (settings.enableSource)
-        ostr << filename << ":" << line << " ";
+    ostr = NULL;
+    ownStream = true;
 
-    if (logger) {
-        t = getTime();
-        std::ostringstream oss;
-        oss << filename;
-        if(line >= 0)
+#ifdef ENABLE_ASYNC_LOGGING
+    // reuse the stream of the thread unless it's busy (nested log line)
+    if (asyncWriter.initialized)
+    {
+        LogThreadState* s = asyncWriter.state();
+        if (!s->streamInUse)
         {
-            oss << ":" << line;
+            s->streamInUse = true;
+            ostr = &s->stream;
+            ownStream = false;
         }
-        fname = oss.str();
+    }
+#endif
+
+    if (!ostr)
+    {
+        ostr = new std::ostringstream();
     }
 }
 
 SimpleLogger::~SimpleLogger()
 {
-    OutputStreams::iterator iter;
-    OutputStreams vec;
+    string message = ostr->str();
+
+    if (ownStream)
+    {
+        delete ostr;
+    }
+    else
+    {
+        ostr->str(string());
+        ostr->clear();
+    }
+
+#ifdef ENABLE_ASYNC_LOGGING
+    if (asyncWriter.initialized)
+    {
+        LogThreadState* s = asyncWriter.state();
+        if (!ownStream)
+        {
+            s->streamInUse = false;
+        }
+
+        if (asyncWriter.enabled && !s->draining)
+        {
+            asyncWriter.push(s, level, filename, line, lineBreak, message);
+
+            if (level == logFatal)
+            {
+                flush();
+            }
+            return;
+        }
+    }
+#endif
+
+    output(level, NULL, filename, line, message.data(), message.size(), lineBreak);
+}
+
+// time is NULL for the current time
+void SimpleLogger::output(enum LogLevel ll, const char *time, char const* filename, int line,
+                          const char *message, size_t length, bool lBreak)
+{
+    OutputSettingsMap::iterator it = outputSettings.find(ll);
+    OutputStreams &vec = outputs[ll];
+    string now;
+
+    if (!time && (logger || (it != outputSettings.end() && it->second.enableTime)))
+    {
+        now = getTime();
+        time = now.c_str();
+    }
+
+    string text;
+    if (it != outputSettings.end()
+            && (it->second.enableTime || it->second.enableLevel || it->second.enableSource))
+    {
+        std::ostringstream prefix;
+        if (it->second.enableTime)
+            prefix << "[" << time << "] ";
+        if (it->second.enableLevel)
+            prefix << "[" << toStr(ll) << "] ";
+        if (it->second.enableSource)
+            prefix << filename << ":" << line << " ";
+        text = prefix.str();
+    }
+    text.append(message, length);
 
     if (logger)
-        logger->log(t.c_str(), level, fname.c_str(), ostr.str().c_str());
+    {
+        std::ostringstream oss;
+        oss << filename;
+        if (line >= 0)
+        {
+            oss << ":" << line;
+        }
+        logger->log(time, ll, oss.str().c_str(), text.c_str());
+    }
 
-    if (lineBreak)
-        ostr << std::endl;
+    if (vec.empty())
+    {
+        return;
+    }
 
-    vec = getOutput(level);
+    if (lBreak)
+    {
+        text.append("\n");
+    }
 
-    for (iter = vec.begin(); iter != vec.end(); iter++)
+    for (OutputStreams::iterator iter = vec.begin(); iter != vec.end(); iter++)
     {
-        **iter << ostr.str();
+        **iter << text;
     }
 }
 
@@ -87,8 +618,41 @@ std::string SimpleLogger::getTime()
     return ts;
 }
 
+bool SimpleLogger::setAsyncMode(bool enable, size_t bufferSize)
+{
+#ifdef ENABLE_ASYNC_LOGGING
+    if (enable)
+    {
+        return asyncWriter.start(bufferSize);
+    }
+
+    asyncWriter.stop();
+    return true;
+#else
+    return !enable;
+#endif
+}
+
+bool SimpleLogger::isAsyncMode()
+{
+#ifdef ENABLE_ASYNC_LOGGING
+    return asyncWriter.enabled;
+#else
+    return false;
+#endif
+}
+
 void SimpleLogger::flush()
 {
+#ifdef ENABLE_ASYNC_LOGGING
+    if (asyncWriter.enabled)
+    {
+        asyncWriter.drainMutex.lock();
+        asyncWriter.drain(asyncWriter.state());
+        asyncWriter.drainMutex.unlock();
+    }
+#endif
+
     for (int i = logFatal; i < logMax; i++)
     {
         OutputStreams::iterator iter;
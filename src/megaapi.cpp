@@ -1873,6 +1873,11 @@ void MegaApi::setUploadLimit(int bpslimit)
     pImpl->setUploadLimit(bpslimit);
 }
 
+void MegaApi::setMaxApiRequestsInFlight(int requests)
+{
+    pImpl->setMaxApiRequestsInFlight(requests);
+}
+
 void MegaApi::setMaxConnections(int direction, int connections, MegaRequestListener *listener)
 {
     pImpl->setMaxConnections(direction,  connections, listener);
@@ -1928,6 +1933,16 @@ int MegaApi::getCurrentSpeed(int type)
     return pImpl->getCurrentSpeed(type);
 }
 
+bool MegaApi::useHttp2(bool enable)
+{
+    return pImpl->useHttp2(enable);
+}
+
+bool MegaApi::usingHttp2()
+{
+    return pImpl->usingHttp2();
+}
+
 int MegaApi::getDownloadMethod()
 {
     return pImpl->getDownloadMethod();
@@ -2206,6 +2221,16 @@ void MegaApi::setExclusionUpperSizeLimit(long long limit)
     pImpl->setExclusionUpperSizeLimit(limit);
 }
 
+void MegaApi::setSyncScanThreads(int threads)
+{
+    pImpl->setSyncScanThreads(threads);
+}
+
+void MegaApi::setMaxSyncWatches(int maxWatches)
+{
+    pImpl->setMaxSyncWatches(maxWatches);
+}
+
 #endif
 
 int MegaApi::getNumPendingUploads()
@@ -2608,6 +2633,61 @@ void MegaApi::removeGlobalListener(MegaGlobalListener* listener)
     pImpl->removeGlobalListener(listener);
 }
 
+void MegaApi::setAsyncCallbacks(bool enable, int maxPendingCallbacks)
+{
+    pImpl->setAsyncCallbacks(enable, maxPendingCallbacks);
+}
+
+int MegaApi::getPendingCallbacks()
+{
+    return pImpl->getPendingCallbacks();
+}
+
+int MegaApi::getPeakPendingCallbacks()
+{
+    return pImpl->getPeakPendingCallbacks();
+}
+
+long long MegaApi::getCoalescedCallbacks()
+{
+    return pImpl->getCoalescedCallbacks();
+}
+
+long long MegaApi::getAverageCallbackLatency()
+{
+    return pImpl->getAverageCallbackLatency();
+}
+
+long long MegaApi::getMaxCallbackLatency()
+{
+    return pImpl->getMaxCallbackLatency();
+}
+
+char *MegaApi::getPerformanceStats(int format)
+{
+    return pImpl->getPerformanceStats(format);
+}
+
+void MegaApi::resetPerformanceStats()
+{
+    pImpl->resetPerformanceStats();
+}
+
+void MegaApi::setPerformanceTiming(bool enable)
+{
+    pImpl->setPerformanceTiming(enable);
+}
+
+bool MegaApi::startPerformanceTrace(const char *path)
+{
+    return pImpl->startPerformanceTrace(path);
+}
+
+void MegaApi::stopPerformanceTrace()
+{
+    pImpl->stopPerformanceTrace();
+}
+
 MegaRequest *MegaApi::getCurrentRequest()
 {
     return pImpl->getCurrentRequest();
@@ -2844,6 +2924,36 @@ int MegaApi::httpServerGetMaxOutputSize()
     return pImpl->httpServerGetMaxOutputSize();
 }
 
+void MegaApi::httpServerSetNumThreads(int numThreads)
+{
+    pImpl->httpServerSetNumThreads(numThreads);
+}
+
+int MegaApi::httpServerGetNumThreads()
+{
+    return pImpl->httpServerGetNumThreads();
+}
+
+void MegaApi::httpServerSetMaxCacheSize(long long cacheSize)
+{
+    pImpl->httpServerSetMaxCacheSize(cacheSize);
+}
+
+long long MegaApi::httpServerGetMaxCacheSize()
+{
+    return pImpl->httpServerGetMaxCacheSize();
+}
+
+long long MegaApi::httpServerGetCacheBytesSaved()
+{
+    return pImpl->httpServerGetCacheBytesSaved();
+}
+
+double MegaApi::httpServerGetCacheHitRate()
+{
+    return pImpl->httpServerGetCacheHitRate();
+}
+
 char *MegaApi::getMimeType(const char *extension)
 {
     if (!extension)
@@ -40,6 +40,7 @@
     #define _LARGEFILE64_SOURCE
 #endif
 #include <signal.h>
+#include <unistd.h>
 #endif
 
 
@@ -1059,6 +1060,11 @@ void MegaNodePrivate::setName(const char *newName)
     name = MegaApi::strdup(newName);
 }
 
+void MegaNodePrivate::setChanges(int changes)
+{
+    changed = changes;
+}
+
 string *MegaNodePrivate::getPublicAuth()
 {
     return &publicAuth;
@@ -2891,6 +2897,16 @@ MegaNodeListPrivate::MegaNodeListPrivate(MegaNodeListPrivate *nodeList, bool cop
     }
 }
 
+MegaNodeListPrivate::MegaNodeListPrivate(MegaNode** newlist, int size)
+{
+    list = NULL; s = size;
+    if (!size) return;
+
+    list = new MegaNode*[size];
+    for (int i = 0; i < size; i++)
+        list[i] = newlist[i]->copy();
+}
+
 MegaNodeListPrivate::~MegaNodeListPrivate()
 {
 	if(!list)
@@ -3512,6 +3528,13 @@ void *MegaApiImpl::threadEntryPoint(void *param)
     return 0;
 }
 
+void *MegaApiImpl::callbackThreadEntryPoint(void *param)
+{
+    MegaApiImpl *megaApiImpl = (MegaApiImpl *)param;
+    megaApiImpl->callbackLoop();
+    return 0;
+}
+
 MegaTransferPrivate *MegaApiImpl::getMegaTransferPrivate(int tag)
 {
     map<int, MegaTransferPrivate *>::iterator it = transferMap.find(tag);
@@ -3561,13 +3584,35 @@ void MegaApiImpl::init(MegaApi *api, const char *appKey, MegaGfxProcessor* proce
     activeError = NULL;
     activeNodes = NULL;
     activeUsers = NULL;
+    callbackRequest = NULL;
+    callbackTransfer = NULL;
+    callbackError = NULL;
+    callbackNodes = NULL;
+    callbackUsers = NULL;
     syncLowerSizeLimit = 0;
     syncUpperSizeLimit = 0;
 
+    callbackMutex.init(false);
+    asyncCallbacks = false;
+    asyncCallbacksStopping = false;
+    maxPendingCallbacks = 1000;
+    callbackThreadStarted = false;
+    callbackThreadExit = false;
+    sdkThreadId = 0;
+    callbackThreadId = 0;
+    deliveringListener = NULL;
+    listenerWaiters = 0;
+    waitingCallbackSpace = false;
+    pendingCallbacks = 0;
+    peakPendingCallbacks = 0;
+    coalescedCallbacks = 0;
+
 #ifdef HAVE_LIBUV
     httpServer = NULL;
     httpServerMaxBufferSize = 0;
     httpServerMaxOutputSize = 0;
+    httpServerNumThreads = 0;
+    httpServerMaxCacheSize = 0;
     httpServerEnableFiles = true;
     httpServerEnableFolders = false;
     httpServerRestrictedMode = MegaApi::HTTP_SERVER_ALLOW_CREATED_LOCAL_LINKS;
@@ -4323,6 +4368,8 @@ MegaProxy *MegaApiImpl::getAutoProxySettings()
 
 void MegaApiImpl::loop()
 {
+    sdkThreadId = MegaThread::currentThreadId();
+
 #if defined(WINDOWS_PHONE) || TARGET_OS_IPHONE
     // Workaround to get the IP of valid DNS servers on Windows Phone/iOS
     string servers;
@@ -4397,17 +4444,30 @@ void MegaApiImpl::loop()
         if (r & Waiter::NEEDEXEC)
         {
             WAIT_CLASS::bumpds();
+
+            if (asyncCallbacks)
+            {
+                checkAsyncCallbacks();
+            }
+
             sendPendingTransfers();
             sendPendingRequests();
             if(threadExit)
                 break;
 
+            if (asyncCallbacks)
+            {
+                waitCallbackQueue();
+            }
+
             sdkMutex.lock();
             client->exec();
             sdkMutex.unlock();
         }
 	}
 
+    stopCallbackThread();
+
     sdkMutex.lock();
     delete client;
     sdkMutex.unlock();
@@ -5273,6 +5333,14 @@ void MegaApiImpl::setUploadLimit(int bpslimit)
     client->putmbpscap = bpslimit;
 }
 
+void MegaApiImpl::setMaxApiRequestsInFlight(int requests)
+{
+    sdkMutex.lock();
+    client->reqs.setmaxinflight(requests);
+    sdkMutex.unlock();
+    waiter->notify();
+}
+
 void MegaApiImpl::setMaxConnections(int direction, int connections, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_SET_MAX_CONNECTIONS, listener);
@@ -5374,6 +5442,19 @@ int MegaApiImpl::getCurrentUploadSpeed()
     return httpio->uploadSpeed;
 }
 
+bool MegaApiImpl::useHttp2(bool enable)
+{
+    sdkMutex.lock();
+    bool result = httpio->sethttp2(enable);
+    sdkMutex.unlock();
+    return result;
+}
+
+bool MegaApiImpl::usingHttp2()
+{
+    return httpio->usinghttp2();
+}
+
 int MegaApiImpl::getCurrentSpeed(int type)
 {
     switch (type)
@@ -6029,6 +6110,38 @@ void MegaApiImpl::setExclusionUpperSizeLimit(long long limit)
     syncUpperSizeLimit = limit;
 }
 
+void MegaApiImpl::setSyncScanThreads(int threads)
+{
+    if (threads < 0)
+    {
+        threads = 0;
+    }
+    else if (threads > (int)MegaClient::MAXSYNCSCANTHREADS)
+    {
+        threads = MegaClient::MAXSYNCSCANTHREADS;
+    }
+
+    sdkMutex.lock();
+    client->syncscanthreads = threads;
+    sdkMutex.unlock();
+}
+
+void MegaApiImpl::setMaxSyncWatches(int maxWatches)
+{
+    if (maxWatches < 0)
+    {
+        maxWatches = 0;
+    }
+
+    sdkMutex.lock();
+    client->syncmaxwatches = maxWatches;
+    for (sync_list::iterator it = client->syncs.begin(); it != client->syncs.end(); it++)
+    {
+        (*it)->dirnotify->maxwatches = maxWatches;
+    }
+    sdkMutex.unlock();
+}
+
 string MegaApiImpl::getLocalPath(MegaNode *n)
 {
     if(!n) return string();
@@ -6226,6 +6339,8 @@ bool MegaApiImpl::httpServerStart(bool localOnly, int port)
     httpServer = new MegaHTTPServer(this);
     httpServer->setMaxBufferSize(httpServerMaxBufferSize);
     httpServer->setMaxOutputSize(httpServerMaxOutputSize);
+    httpServer->setNumThreads(httpServerNumThreads);
+    httpServer->setMaxCacheSize(httpServerMaxCacheSize);
     httpServer->enableFileServer(httpServerEnableFiles);
     httpServer->enableFolderServer(httpServerEnableFolders);
     httpServer->setRestrictedMode(httpServerRestrictedMode);
@@ -6347,6 +6462,80 @@ int MegaApiImpl::httpServerGetMaxOutputSize()
     return value;
 }
 
+void MegaApiImpl::httpServerSetNumThreads(int numThreads)
+{
+    sdkMutex.lock();
+    httpServerNumThreads = numThreads <= 0 ? 0 : numThreads;
+    sdkMutex.unlock();
+}
+
+int MegaApiImpl::httpServerGetNumThreads()
+{
+    int value;
+    sdkMutex.lock();
+    if (httpServerNumThreads)
+    {
+        value = httpServerNumThreads;
+    }
+    else
+    {
+        value = MegaHTTPServer::DEFAULT_NUM_THREADS;
+    }
+    sdkMutex.unlock();
+    return value;
+}
+
+void MegaApiImpl::httpServerSetMaxCacheSize(long long cacheSize)
+{
+    sdkMutex.lock();
+    httpServerMaxCacheSize = cacheSize <= 0 ? 0 : cacheSize;
+    if (httpServer)
+    {
+        httpServer->setMaxCacheSize(httpServerMaxCacheSize);
+    }
+    sdkMutex.unlock();
+}
+
+long long MegaApiImpl::httpServerGetMaxCacheSize()
+{
+    long long value;
+    sdkMutex.lock();
+    if (httpServerMaxCacheSize)
+    {
+        value = httpServerMaxCacheSize;
+    }
+    else
+    {
+        value = StreamingCache::MAX_CACHE_SIZE;
+    }
+    sdkMutex.unlock();
+    return value;
+}
+
+long long MegaApiImpl::httpServerGetCacheBytesSaved()
+{
+    long long value = 0;
+    sdkMutex.lock();
+    if (httpServer)
+    {
+        value = httpServer->getCacheBytesSaved();
+    }
+    sdkMutex.unlock();
+    return value;
+}
+
+double MegaApiImpl::httpServerGetCacheHitRate()
+{
+    double value = 0;
+    sdkMutex.lock();
+    if (httpServer)
+    {
+        value = httpServer->getCacheHitRate();
+    }
+    sdkMutex.unlock();
+    return value;
+}
+
 void MegaApiImpl::httpServerEnableFileServer(bool enable)
 {
     sdkMutex.lock();
@@ -7439,10 +7628,8 @@ MegaNode *MegaApiImpl::getExportableNodeByFingerprint(const char *fingerprint, c
     }
 
     sdkMutex.lock();
-    node_vector *nodes = client->nodesbyfingerprint(fp);
-    for (unsigned int i = 0; i < nodes->size(); i++)
+    for (Node *node = client->nodebyfingerprint(fp); node; node = FingerprintIndex::next(node))
     {
-        Node *node = nodes->at(i);
         if ((!name || !strcmp(name, node->displayname())) &&
                 client->checkaccess(node, OWNER))
         {
@@ -7468,7 +7655,6 @@ MegaNode *MegaApiImpl::getExportableNodeByFingerprint(const char *fingerprint, c
     }
 
     delete fp;
-    delete nodes;
     sdkMutex.unlock();
     return result;
 }
@@ -7800,13 +7986,11 @@ File *MegaApiImpl::file_resume(string *d, direction_t *type)
         file = MegaFilePut::unserialize(d);
         MegaTransferPrivate* transfer = file->getTransfer();
         Node *parent = client->nodebyhandle(transfer->getParentHandle());
-        node_vector *nodes = client->nodesbyfingerprint(file);
         const char *name = transfer->getFileName();
-        if (parent && nodes && name)
+        if (parent && name)
         {
-            for (unsigned int i = 0; i < nodes->size(); i++)
+            for (Node* node = client->nodebyfingerprint(file); node; node = FingerprintIndex::next(node))
             {
-                Node* node = nodes->at(i);
                 if (node->parent == parent && !strcmp(node->displayname(), name))
                 {
                     // don't resume the upload if the node already exist in the target folder
@@ -7817,7 +8001,6 @@ File *MegaApiImpl::file_resume(string *d, direction_t *type)
                 }
             }
         }
-        delete nodes;
         break;
     }
     default:
@@ -10095,7 +10278,9 @@ void MegaApiImpl::addListener(MegaListener* listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     listeners.insert(listener);
+    callbackMutex.unlock();
     sdkMutex.unlock();
 }
 
@@ -10104,7 +10289,9 @@ void MegaApiImpl::addRequestListener(MegaRequestListener* listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     requestListeners.insert(listener);
+    callbackMutex.unlock();
     sdkMutex.unlock();
 }
 
@@ -10113,7 +10300,9 @@ void MegaApiImpl::addTransferListener(MegaTransferListener* listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     transferListeners.insert(listener);
+    callbackMutex.unlock();
     sdkMutex.unlock();
 }
 
@@ -10122,7 +10311,9 @@ void MegaApiImpl::addGlobalListener(MegaGlobalListener* listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     globalListeners.insert(listener);
+    callbackMutex.unlock();
     sdkMutex.unlock();
 }
 
@@ -10132,7 +10323,9 @@ void MegaApiImpl::addSyncListener(MegaSyncListener *listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     syncListeners.insert(listener);
+    callbackMutex.unlock();
     sdkMutex.unlock();
 }
 
@@ -10141,7 +10334,9 @@ void MegaApiImpl::removeSyncListener(MegaSyncListener *listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     syncListeners.erase(listener);
+    callbackMutex.unlock();
 
     std::map<int, MegaSyncPrivate*>::iterator it = syncMap.begin();
     while(it != syncMap.end())
@@ -10155,6 +10350,8 @@ void MegaApiImpl::removeSyncListener(MegaSyncListener *listener)
     requestQueue.removeListener(listener);
 
     sdkMutex.unlock();
+
+    waitListenerCallback(dynamic_cast<void *>(listener));
 }
 #endif
 
@@ -10163,8 +10360,12 @@ void MegaApiImpl::removeListener(MegaListener* listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     listeners.erase(listener);
+    callbackMutex.unlock();
     sdkMutex.unlock();
+
+    waitListenerCallback(dynamic_cast<void *>(listener));
 }
 
 void MegaApiImpl::removeRequestListener(MegaRequestListener* listener)
@@ -10172,7 +10373,9 @@ void MegaApiImpl::removeRequestListener(MegaRequestListener* listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     requestListeners.erase(listener);
+    callbackMutex.unlock();
 
     std::map<int, MegaRequestPrivate*>::iterator it = requestMap.begin();
     while(it != requestMap.end())
@@ -10186,6 +10389,8 @@ void MegaApiImpl::removeRequestListener(MegaRequestListener* listener)
 
     requestQueue.removeListener(listener);
     sdkMutex.unlock();
+
+    waitListenerCallback(dynamic_cast<void *>(listener));
 }
 
 void MegaApiImpl::removeTransferListener(MegaTransferListener* listener)
@@ -10193,7 +10398,9 @@ void MegaApiImpl::removeTransferListener(MegaTransferListener* listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     transferListeners.erase(listener);
+    callbackMutex.unlock();
 
     std::map<int, MegaTransferPrivate*>::iterator it = transferMap.begin();
     while(it != transferMap.end())
@@ -10207,6 +10414,8 @@ void MegaApiImpl::removeTransferListener(MegaTransferListener* listener)
 
     transferQueue.removeListener(listener);
     sdkMutex.unlock();
+
+    waitListenerCallback(dynamic_cast<void *>(listener));
 }
 
 void MegaApiImpl::removeGlobalListener(MegaGlobalListener* listener)
@@ -10214,169 +10423,869 @@ void MegaApiImpl::removeGlobalListener(MegaGlobalListener* listener)
     if(!listener) return;
 
     sdkMutex.lock();
+    callbackMutex.lock();
     globalListeners.erase(listener);
+    callbackMutex.unlock();
     sdkMutex.unlock();
-}
 
-MegaRequest *MegaApiImpl::getCurrentRequest()
-{
-    return activeRequest;
+    waitListenerCallback(dynamic_cast<void *>(listener));
 }
 
-MegaTransfer *MegaApiImpl::getCurrentTransfer()
+MegaCallback::MegaCallback(int type)
 {
-    return activeTransfer;
+    this->type = type;
+    request = NULL;
+    transfer = NULL;
+    error = NULL;
+    users = NULL;
+    contactRequests = NULL;
+    allNodes = false;
+#ifdef ENABLE_SYNC
+    sync = NULL;
+    syncEvent = NULL;
+    syncState = 0;
+#endif
+#ifdef ENABLE_CHAT
+    chats = NULL;
+#endif
+    queuedTime = 0;
 }
 
-MegaError *MegaApiImpl::getCurrentError()
+MegaCallback::~MegaCallback()
 {
-    return activeError;
+    delete request;
+    delete transfer;
+    delete error;
+    delete users;
+    delete contactRequests;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        delete nodes[i];
+    }
+#ifdef ENABLE_SYNC
+    delete sync;
+    delete syncEvent;
+#endif
+#ifdef ENABLE_CHAT
+    delete chats;
+#endif
 }
 
-MegaNodeList *MegaApiImpl::getCurrentNodes()
+void MegaCallback::addNodes(MegaNodeList *nodes)
 {
-    return activeNodes;
+    for (int i = 0; i < nodes->size(); i++)
+    {
+        addNode(nodes->get(i)->copy());
+    }
 }
 
-MegaUserList *MegaApiImpl::getCurrentUsers()
+void MegaCallback::addNode(MegaNode *node)
 {
-    return activeUsers;
+    map<MegaHandle, size_t>::iterator it = nodePositions.find(node->getHandle());
+    if (it == nodePositions.end())
+    {
+        nodePositions[node->getHandle()] = nodes.size();
+        nodes.push_back(node);
+        return;
+    }
+
+    MegaNode *previous = nodes[it->second];
+    ((MegaNodePrivate *)node)->setChanges(node->getChanges() | previous->getChanges());
+    nodes[it->second] = node;
+    delete previous;
 }
 
-void MegaApiImpl::fireOnRequestStart(MegaRequestPrivate *request)
+void MegaApiImpl::setAsyncCallbacks(bool enable, int maxPendingCallbacks)
 {
-    activeRequest = request;
-    LOG_info << "Request (" << request->getRequestString() << ") starting";
-    for(set<MegaRequestListener *>::iterator it = requestListeners.begin(); it != requestListeners.end() ;)
+    sdkMutex.lock();
+    callbackMutex.lock();
+    this->maxPendingCallbacks = maxPendingCallbacks > 0 ? maxPendingCallbacks : 1;
+
+    // the callbacks queued so far are delivered before the synchronous ones
+    asyncCallbacksStopping = !enable && asyncCallbacks;
+    callbackMutex.unlock();
+
+    if (enable && !callbackThreadStarted)
     {
-        (*it++)->onRequestStart(api, request);
+        callbackThreadExit = false;
+        callbackThreadStarted = true;
+        callbackThread.start(callbackThreadEntryPoint, this);
     }
 
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    LOG_debug << "Asynchronous callbacks: " << enable;
+    if (enable)
     {
-        (*it++)->onRequestStart(api, request);
+        asyncCallbacks = true;
     }
+    sdkMutex.unlock();
 
-	MegaRequestListener* listener = request->getListener();
-    if(listener)
+    if (!enable)
     {
-        listener->onRequestStart(api, request);
+        waiter->notify();
     }
-	activeRequest = NULL;
 }
 
-
-void MegaApiImpl::fireOnRequestFinish(MegaRequestPrivate *request, MegaError e)
+// called by the SDK thread: switches to synchronous callbacks once the
+// callbacks queued before setAsyncCallbacks(false) have been delivered
+void MegaApiImpl::checkAsyncCallbacks()
 {
-	MegaError *megaError = new MegaError(e);
-	activeRequest = request;
-	activeError = megaError;
-
-    if(e.getErrorCode())
-    {
-        LOG_warn << "Request (" << request->getRequestString() << ") finished with error: " << e.getErrorString();
-    }
-    else
+    sdkMutex.lock();
+    callbackMutex.lock();
+    if (asyncCallbacksStopping && !pendingCallbacks)
     {
-        LOG_info << "Request (" << request->getRequestString() << ") finished";
+        LOG_debug << "Callback queue empty, delivering callbacks synchronously";
+        asyncCallbacks = false;
+        asyncCallbacksStopping = false;
     }
+    callbackMutex.unlock();
+    sdkMutex.unlock();
+}
 
-    for(set<MegaRequestListener *>::iterator it = requestListeners.begin(); it != requestListeners.end() ;)
-    {
-        (*it++)->onRequestFinish(api, request, megaError);
-    }
+int MegaApiImpl::getPendingCallbacks()
+{
+    callbackMutex.lock();
+    int result = pendingCallbacks;
+    callbackMutex.unlock();
+    return result;
+}
 
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
-    {
-        (*it++)->onRequestFinish(api, request, megaError);
-    }
+int MegaApiImpl::getPeakPendingCallbacks()
+{
+    callbackMutex.lock();
+    int result = peakPendingCallbacks;
+    callbackMutex.unlock();
+    return result;
+}
 
-	MegaRequestListener* listener = request->getListener();
-    if(listener)
-    {
-        listener->onRequestFinish(api, request, megaError);
-    }
+long long MegaApiImpl::getCoalescedCallbacks()
+{
+    callbackMutex.lock();
+    long long result = coalescedCallbacks;
+    callbackMutex.unlock();
+    return result;
+}
 
-    requestMap.erase(request->getTag());
+long long MegaApiImpl::getAverageCallbackLatency()
+{
+    callbackMutex.lock();
+    long long result = callbackLatency.count ? callbackLatency.sum / callbackLatency.count : 0;
+    callbackMutex.unlock();
+    return result;
+}
 
-	activeRequest = NULL;
-	activeError = NULL;
-	delete request;
-    delete megaError;
+long long MegaApiImpl::getMaxCallbackLatency()
+{
+    callbackMutex.lock();
+    long long result = callbackLatency.max;
+    callbackMutex.unlock();
+    return result;
 }
 
-void MegaApiImpl::fireOnRequestUpdate(MegaRequestPrivate *request)
+// the process-wide metrics have their own synchronization, those of this
+// instance are read under its locks
+char *MegaApiImpl::getPerformanceStats(int format)
 {
-    activeRequest = request;
+    ClientMetrics metrics;
+    MetricHistogram latency;
+    string stats;
 
-    for(set<MegaRequestListener *>::iterator it = requestListeners.begin(); it != requestListeners.end() ;)
-    {
-        (*it++)->onRequestUpdate(api, request);
-    }
+    sdkMutex.lock();
+    client->getmetrics(&metrics);
+    sdkMutex.unlock();
+
+    callbackMutex.lock();
+    metrics.gauges[ClientMetrics::CALLBACKS_QUEUED] = pendingCallbacks;
+    latency = callbackLatency;
+    callbackMutex.unlock();
 
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    metrics.callbacklatency = &latency;
+
+    if (format == MegaApi::PERFORMANCE_STATS_PROMETHEUS)
     {
-        (*it++)->onRequestUpdate(api, request);
+        Metrics::toprometheus(&stats, &metrics);
     }
-
-    MegaRequestListener* listener = request->getListener();
-    if(listener)
+    else
     {
-        listener->onRequestUpdate(api, request);
+        Metrics::tojson(&stats, &metrics);
     }
 
-    activeRequest = NULL;
+    return MegaApi::strdup(stats.c_str());
 }
 
-void MegaApiImpl::fireOnRequestTemporaryError(MegaRequestPrivate *request, MegaError e)
+void MegaApiImpl::resetPerformanceStats()
 {
-	MegaError *megaError = new MegaError(e);
-	activeRequest = request;
-	activeError = megaError;
+    Metrics::reset();
 
-    request->setNumRetry(request->getNumRetry() + 1);
+    sdkMutex.lock();
+    client->resetmetrics();
+    sdkMutex.unlock();
 
-    for(set<MegaRequestListener *>::iterator it = requestListeners.begin(); it != requestListeners.end() ;)
-    {
-        (*it++)->onRequestTemporaryError(api, request, megaError);
-    }
+    callbackMutex.lock();
+    callbackLatency.reset();
+    callbackMutex.unlock();
+}
 
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
-    {
-        (*it++)->onRequestTemporaryError(api, request, megaError);
-    }
+void MegaApiImpl::setPerformanceTiming(bool enable)
+{
+    Metrics::settiming(enable);
+}
 
-	MegaRequestListener* listener = request->getListener();
-    if(listener)
+bool MegaApiImpl::startPerformanceTrace(const char *path)
+{
+    if (!path)
     {
-        listener->onRequestTemporaryError(api, request, megaError);
+        return false;
     }
 
-	activeRequest = NULL;
-	activeError = NULL;
-	delete megaError;
+    return TraceRecorder::start(path);
 }
 
-void MegaApiImpl::fireOnTransferStart(MegaTransferPrivate *transfer)
+void MegaApiImpl::stopPerformanceTrace()
 {
-    activeTransfer = transfer;
-    notificationNumber++;
-    transfer->setNotificationNumber(notificationNumber);
+    TraceRecorder::stop();
+}
 
-    for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
-    {
-        (*it++)->onTransferStart(api, transfer);
-    }
+// times the delivery of a callback to the listeners - with asynchronous
+// callbacks, on the callback thread instead of when it is queued
+class ListenerCallbackTimer : public MetricTimer
+{
+public:
+    ListenerCallbackTimer(bool async) : MetricTimer(Metrics::LISTENER_CALLBACK_TIME, !async) { }
+};
+
+// called by the SDK thread with sdkMutex locked
+void MegaApiImpl::queueCallback(MegaCallback *callback)
+{
+    callback->queuedTime = Waiter::getmicros();
 
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    callbackMutex.lock();
+    if (callback->type == MegaCallback::TRANSFER_UPDATE)
     {
-        (*it++)->onTransferStart(api, transfer);
-    }
+        map<int, MegaCallback *>::iterator it = queuedTransferUpdates.find(callback->transfer->getTag());
+        if (it != queuedTransferUpdates.end())
+        {
+            // only the latest state of the transfer is delivered
+            delete it->second->transfer;
+            it->second->transfer = callback->transfer;
+            callback->transfer = NULL;
+            coalescedCallbacks++;
+            callbackMutex.unlock();
+
+            delete callback;
+            return;
+        }
 
-	MegaTransferListener* listener = transfer->getListener();
-    if(listener)
+        queuedTransferUpdates[callback->transfer->getTag()] = callback;
+    }
+    else if (callback->transfer)
     {
-        listener->onTransferStart(api, transfer);
+        // later updates can't be delivered before this callback
+        queuedTransferUpdates.erase(callback->transfer->getTag());
+    }
+    else if (callback->type == MegaCallback::NODES_UPDATE && !callback->allNodes
+             && callbackQueue.size() && callbackQueue.back()->type == MegaCallback::NODES_UPDATE
+             && !callbackQueue.back()->allNodes)
+    {
+        // consecutive node updates are merged
+        MegaCallback *last = callbackQueue.back();
+        for (size_t i = 0; i < callback->nodes.size(); i++)
+        {
+            last->addNode(callback->nodes[i]);
+        }
+        callback->nodes.clear();
+        coalescedCallbacks++;
+        callbackMutex.unlock();
+
+        delete callback;
+        return;
+    }
+
+    callbackQueue.push_back(callback);
+    pendingCallbacks++;
+    if (pendingCallbacks > peakPendingCallbacks)
+    {
+        peakPendingCallbacks = pendingCallbacks;
+    }
+    callbackMutex.unlock();
+
+    callbackSemaphore.release();
+}
+
+// backpressure: give the callback thread time to catch up before generating
+// more callbacks. The wait is limited because a listener could be waiting for
+// the SDK thread.
+void MegaApiImpl::waitCallbackQueue()
+{
+    m_time_t start = Waiter::getmicros();
+
+    callbackMutex.lock();
+    while (pendingCallbacks >= maxPendingCallbacks)
+    {
+        m_time_t elapsed = (Waiter::getmicros() - start) / 1000;
+        if (elapsed >= CALLBACK_BACKPRESSURE_TIMEOUT_MS)
+        {
+            LOG_warn << "Callback queue full: " << pendingCallbacks;
+            break;
+        }
+
+        waitingCallbackSpace = true;
+        callbackMutex.unlock();
+        callbackSpaceSemaphore.timedwait(int(CALLBACK_BACKPRESSURE_TIMEOUT_MS - elapsed));
+        callbackMutex.lock();
+    }
+    callbackMutex.unlock();
+}
+
+// after unregistering a listener, wait until the callback thread leaves it
+// (impossible from the SDK thread, the listener could be waiting for it)
+void MegaApiImpl::waitListenerCallback(void *listener)
+{
+    uint64_t currentThreadId = MegaThread::currentThreadId();
+    if (!callbackThreadStarted || currentThreadId == sdkThreadId)
+    {
+        return;
+    }
+
+    callbackMutex.lock();
+    if (currentThreadId != callbackThreadId)
+    {
+        while (deliveringListener == listener)
+        {
+            listenerWaiters++;
+            callbackMutex.unlock();
+            callbackDoneSemaphore.wait();
+            callbackMutex.lock();
+        }
+    }
+    callbackMutex.unlock();
+}
+
+void MegaApiImpl::callbackLoop()
+{
+    std::deque<MegaCallback *> callbacks;
+
+    callbackMutex.lock();
+    callbackThreadId = MegaThread::currentThreadId();
+    callbackMutex.unlock();
+
+    for (;;)
+    {
+        callbackSemaphore.wait();
+
+        callbackMutex.lock();
+        callbacks.swap(callbackQueue);
+        queuedTransferUpdates.clear();
+        bool exit = callbackThreadExit;
+        callbackMutex.unlock();
+
+        while (callbacks.size())
+        {
+            MegaCallback *callback = callbacks.front();
+            callbacks.pop_front();
+
+            m_time_t latency = Waiter::getmicros() - callback->queuedTime;
+            deliverCallback(callback);
+            delete callback;
+
+            callbackMutex.lock();
+            pendingCallbacks--;
+            callbackLatency.observe(latency);
+
+            bool space = waitingCallbackSpace && pendingCallbacks <= maxPendingCallbacks / 2;
+            if (space)
+            {
+                waitingCallbackSpace = false;
+            }
+            bool drained = asyncCallbacksStopping && !pendingCallbacks;
+            callbackMutex.unlock();
+
+            if (drained)
+            {
+                // let the SDK thread switch to synchronous callbacks
+                waiter->notify();
+            }
+
+            if (space)
+            {
+                callbackSpaceSemaphore.release();
+            }
+        }
+
+        if (exit)
+        {
+            break;
+        }
+    }
+}
+
+// delivers the pending callbacks and stops the callback thread
+void MegaApiImpl::stopCallbackThread()
+{
+    if (!callbackThreadStarted)
+    {
+        return;
+    }
+
+    callbackMutex.lock();
+    callbackThreadExit = true;
+    callbackMutex.unlock();
+
+    callbackSemaphore.release();
+    callbackThread.join();
+    callbackThreadStarted = false;
+    asyncCallbacks = false;
+    asyncCallbacksStopping = false;
+}
+
+template <class L>
+bool MegaApiImpl::startListenerCallback(set<L *> *listenerSet, L *listener)
+{
+    callbackMutex.lock();
+    bool registered = listenerSet->find(listener) != listenerSet->end();
+    if (registered)
+    {
+        deliveringListener = dynamic_cast<void *>(listener);
+    }
+    callbackMutex.unlock();
+    return registered;
+}
+
+void MegaApiImpl::endListenerCallback()
+{
+    callbackMutex.lock();
+    deliveringListener = NULL;
+    int waiters = listenerWaiters;
+    listenerWaiters = 0;
+    callbackMutex.unlock();
+
+    while (waiters--)
+    {
+        callbackDoneSemaphore.release();
+    }
+}
+
+// MegaListener shares the callbacks of the specific listener classes
+template <class L>
+static void deliverRequestCallback(MegaApi *api, L *listener, MegaCallback *callback)
+{
+    switch (callback->type)
+    {
+        case MegaCallback::REQUEST_START:
+            listener->onRequestStart(api, callback->request);
+            break;
+        case MegaCallback::REQUEST_FINISH:
+            listener->onRequestFinish(api, callback->request, callback->error);
+            break;
+        case MegaCallback::REQUEST_UPDATE:
+            listener->onRequestUpdate(api, callback->request);
+            break;
+        case MegaCallback::REQUEST_TEMPORARY_ERROR:
+            listener->onRequestTemporaryError(api, callback->request, callback->error);
+            break;
+    }
+}
+
+template <class L>
+static void deliverTransferCallback(MegaApi *api, L *listener, MegaCallback *callback)
+{
+    switch (callback->type)
+    {
+        case MegaCallback::TRANSFER_START:
+            listener->onTransferStart(api, callback->transfer);
+            break;
+        case MegaCallback::TRANSFER_FINISH:
+            listener->onTransferFinish(api, callback->transfer, callback->error);
+            break;
+        case MegaCallback::TRANSFER_UPDATE:
+            listener->onTransferUpdate(api, callback->transfer);
+            break;
+        case MegaCallback::TRANSFER_TEMPORARY_ERROR:
+            listener->onTransferTemporaryError(api, callback->transfer, callback->error);
+            break;
+    }
+}
+
+template <class L>
+static void deliverGlobalCallback(MegaApi *api, L *listener, MegaCallback *callback, MegaNodeList *nodes)
+{
+    switch (callback->type)
+    {
+        case MegaCallback::USERS_UPDATE:
+            listener->onUsersUpdate(api, callback->users);
+            break;
+        case MegaCallback::NODES_UPDATE:
+            listener->onNodesUpdate(api, nodes);
+            break;
+        case MegaCallback::ACCOUNT_UPDATE:
+            listener->onAccountUpdate(api);
+            break;
+        case MegaCallback::CONTACT_REQUESTS_UPDATE:
+            listener->onContactRequestsUpdate(api, callback->contactRequests);
+            break;
+        case MegaCallback::RELOAD_NEEDED:
+            listener->onReloadNeeded(api);
+            break;
+#ifdef ENABLE_SYNC
+        case MegaCallback::GLOBAL_SYNC_STATE_CHANGED:
+            listener->onGlobalSyncStateChanged(api);
+            break;
+#endif
+#ifdef ENABLE_CHAT
+        case MegaCallback::CHATS_UPDATE:
+            listener->onChatsUpdate(api, callback->chats);
+            break;
+#endif
+    }
+}
+
+#ifdef ENABLE_SYNC
+template <class L>
+static void deliverSyncCallback(MegaApi *api, L *listener, MegaCallback *callback)
+{
+    switch (callback->type)
+    {
+        case MegaCallback::SYNC_STATE_CHANGED:
+            listener->onSyncStateChanged(api, callback->sync);
+            break;
+        case MegaCallback::SYNC_EVENT:
+            listener->onSyncEvent(api, callback->sync, callback->syncEvent);
+            break;
+        case MegaCallback::FILE_SYNC_STATE_CHANGED:
+            listener->onSyncFileStateChanged(api, callback->sync, callback->filePath.c_str(), callback->syncState);
+            break;
+    }
+}
+#endif
+
+// called by the callback thread, listeners removed in the meantime are skipped
+void MegaApiImpl::deliverCallback(MegaCallback *callback)
+{
+    ListenerCallbackTimer timer(false);
+
+    callbackMutex.lock();
+    vector<MegaRequestListener *> requestListenerList(requestListeners.begin(), requestListeners.end());
+    vector<MegaTransferListener *> transferListenerList(transferListeners.begin(), transferListeners.end());
+    vector<MegaGlobalListener *> globalListenerList(globalListeners.begin(), globalListeners.end());
+    vector<MegaListener *> listenerList(listeners.begin(), listeners.end());
+#ifdef ENABLE_SYNC
+    vector<MegaSyncListener *> syncListenerList(syncListeners.begin(), syncListeners.end());
+#endif
+    callbackMutex.unlock();
+
+    MegaNodeList *nodes = NULL;
+    if (callback->type == MegaCallback::NODES_UPDATE && !callback->allNodes)
+    {
+        nodes = new MegaNodeListPrivate(callback->nodes.size() ? &callback->nodes[0] : NULL, callback->nodes.size());
+    }
+
+    callbackRequest = callback->request;
+    callbackTransfer = callback->transfer;
+    callbackError = callback->error;
+    callbackNodes = nodes;
+    callbackUsers = callback->users;
+
+    for (size_t i = 0; i < requestListenerList.size(); i++)
+    {
+        if (callback->request && startListenerCallback(&requestListeners, requestListenerList[i]))
+        {
+            deliverRequestCallback(api, requestListenerList[i], callback);
+            endListenerCallback();
+        }
+    }
+
+    for (size_t i = 0; i < transferListenerList.size(); i++)
+    {
+        if (callback->transfer && startListenerCallback(&transferListeners, transferListenerList[i]))
+        {
+            deliverTransferCallback(api, transferListenerList[i], callback);
+            endListenerCallback();
+        }
+    }
+
+    bool globalCallback = callback->type >= MegaCallback::USERS_UPDATE
+            && callback->type != MegaCallback::SYNC_STATE_CHANGED
+            && callback->type != MegaCallback::SYNC_EVENT
+            && callback->type != MegaCallback::FILE_SYNC_STATE_CHANGED;
+
+    for (size_t i = 0; i < globalListenerList.size(); i++)
+    {
+        if (globalCallback && startListenerCallback(&globalListeners, globalListenerList[i]))
+        {
+            deliverGlobalCallback(api, globalListenerList[i], callback, nodes);
+            endListenerCallback();
+        }
+    }
+
+    for (size_t i = 0; i < listenerList.size(); i++)
+    {
+        if (startListenerCallback(&listeners, listenerList[i]))
+        {
+            deliverRequestCallback(api, listenerList[i], callback);
+            deliverTransferCallback(api, listenerList[i], callback);
+            deliverGlobalCallback(api, listenerList[i], callback, nodes);
+#ifdef ENABLE_SYNC
+            deliverSyncCallback(api, listenerList[i], callback);
+#endif
+            endListenerCallback();
+        }
+    }
+
+#ifdef ENABLE_SYNC
+    for (size_t i = 0; i < syncListenerList.size(); i++)
+    {
+        if (callback->sync && startListenerCallback(&syncListeners, syncListenerList[i]))
+        {
+            deliverSyncCallback(api, syncListenerList[i], callback);
+            endListenerCallback();
+        }
+    }
+#endif
+
+    callbackRequest = NULL;
+    callbackTransfer = NULL;
+    callbackError = NULL;
+    callbackNodes = NULL;
+    callbackUsers = NULL;
+
+    delete nodes;
+}
+
+bool MegaApiImpl::isCallbackThread()
+{
+    callbackMutex.lock();
+    bool callbackThread = callbackThreadStarted && MegaThread::currentThreadId() == callbackThreadId;
+    callbackMutex.unlock();
+    return callbackThread;
+}
+
+// inside a callback of the callback thread, its parameters - the SDK thread
+// sets the active ones around the synchronous callbacks meanwhile
+MegaRequest *MegaApiImpl::getCurrentRequest()
+{
+    return isCallbackThread() ? callbackRequest : activeRequest;
+}
+
+MegaTransfer *MegaApiImpl::getCurrentTransfer()
+{
+    return isCallbackThread() ? callbackTransfer : activeTransfer;
+}
+
+MegaError *MegaApiImpl::getCurrentError()
+{
+    return isCallbackThread() ? callbackError : activeError;
+}
+
+MegaNodeList *MegaApiImpl::getCurrentNodes()
+{
+    return isCallbackThread() ? callbackNodes : activeNodes;
+}
+
+MegaUserList *MegaApiImpl::getCurrentUsers()
+{
+    return isCallbackThread() ? callbackUsers : activeUsers;
+}
+
+void MegaApiImpl::fireOnRequestStart(MegaRequestPrivate *request)
+{
+    ListenerCallbackTimer timer(asyncCallbacks);
+    activeRequest = request;
+    LOG_info << "Request (" << request->getRequestString() << ") starting";
+    if (asyncCallbacks)
+    {
+        if (requestListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::REQUEST_START);
+            callback->request = new MegaRequestPrivate(request);
+            queueCallback(callback);
+        }
+    }
+    else
+    {
+        for(set<MegaRequestListener *>::iterator it = requestListeners.begin(); it != requestListeners.end() ;)
+        {
+            (*it++)->onRequestStart(api, request);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onRequestStart(api, request);
+        }
+    }
+
+	MegaRequestListener* listener = request->getListener();
+    if(listener)
+    {
+        listener->onRequestStart(api, request);
+    }
+	activeRequest = NULL;
+}
+
+
+void MegaApiImpl::fireOnRequestFinish(MegaRequestPrivate *request, MegaError e)
+{
+    ListenerCallbackTimer timer(asyncCallbacks);
+	MegaError *megaError = new MegaError(e);
+	activeRequest = request;
+	activeError = megaError;
+
+    if(e.getErrorCode())
+    {
+        LOG_warn << "Request (" << request->getRequestString() << ") finished with error: " << e.getErrorString();
+    }
+    else
+    {
+        LOG_info << "Request (" << request->getRequestString() << ") finished";
+    }
+
+    if (asyncCallbacks)
+    {
+        if (requestListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::REQUEST_FINISH);
+            callback->request = new MegaRequestPrivate(request);
+            callback->error = megaError->copy();
+            queueCallback(callback);
+        }
+    }
+    else
+    {
+        for(set<MegaRequestListener *>::iterator it = requestListeners.begin(); it != requestListeners.end() ;)
+        {
+            (*it++)->onRequestFinish(api, request, megaError);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onRequestFinish(api, request, megaError);
+        }
+    }
+
+	MegaRequestListener* listener = request->getListener();
+    if(listener)
+    {
+        listener->onRequestFinish(api, request, megaError);
+    }
+
+    requestMap.erase(request->getTag());
+
+	activeRequest = NULL;
+	activeError = NULL;
+	delete request;
+    delete megaError;
+}
+
+void MegaApiImpl::fireOnRequestUpdate(MegaRequestPrivate *request)
+{
+    ListenerCallbackTimer timer(asyncCallbacks);
+    activeRequest = request;
+
+    if (asyncCallbacks)
+    {
+        if (requestListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::REQUEST_UPDATE);
+            callback->request = new MegaRequestPrivate(request);
+            queueCallback(callback);
+        }
+    }
+    else
+    {
+        for(set<MegaRequestListener *>::iterator it = requestListeners.begin(); it != requestListeners.end() ;)
+        {
+            (*it++)->onRequestUpdate(api, request);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onRequestUpdate(api, request);
+        }
+    }
+
+    MegaRequestListener* listener = request->getListener();
+    if(listener)
+    {
+        listener->onRequestUpdate(api, request);
+    }
+
+    activeRequest = NULL;
+}
+
+void MegaApiImpl::fireOnRequestTemporaryError(MegaRequestPrivate *request, MegaError e)
+{
+    ListenerCallbackTimer timer(asyncCallbacks);
+	MegaError *megaError = new MegaError(e);
+	activeRequest = request;
+	activeError = megaError;
+
+    request->setNumRetry(request->getNumRetry() + 1);
+
+    if (asyncCallbacks)
+    {
+        if (requestListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::REQUEST_TEMPORARY_ERROR);
+            callback->request = new MegaRequestPrivate(request);
+            callback->error = megaError->copy();
+            queueCallback(callback);
+        }
+    }
+    else
+    {
+        for(set<MegaRequestListener *>::iterator it = requestListeners.begin(); it != requestListeners.end() ;)
+        {
+            (*it++)->onRequestTemporaryError(api, request, megaError);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onRequestTemporaryError(api, request, megaError);
+        }
+    }
+
+	MegaRequestListener* listener = request->getListener();
+    if(listener)
+    {
+        listener->onRequestTemporaryError(api, request, megaError);
+    }
+
+	activeRequest = NULL;
+	activeError = NULL;
+	delete megaError;
+}
+
+void MegaApiImpl::fireOnTransferStart(MegaTransferPrivate *transfer)
+{
+    ListenerCallbackTimer timer(asyncCallbacks);
+    activeTransfer = transfer;
+    notificationNumber++;
+    transfer->setNotificationNumber(notificationNumber);
+
+    if (asyncCallbacks)
+    {
+        if (transferListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::TRANSFER_START);
+            callback->transfer = new MegaTransferPrivate(transfer);
+            queueCallback(callback);
+        }
+    }
+    else
+    {
+        for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+        {
+            (*it++)->onTransferStart(api, transfer);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onTransferStart(api, transfer);
+        }
+    }
+
+	MegaTransferListener* listener = transfer->getListener();
+    if(listener)
+    {
+        listener->onTransferStart(api, transfer);
     }
 
 	activeTransfer = NULL;
@@ -10384,6 +11293,7 @@ void MegaApiImpl::fireOnTransferStart(MegaTransferPrivate *transfer)
 
 void MegaApiImpl::fireOnTransferFinish(MegaTransferPrivate *transfer, MegaError e)
 {
+    ListenerCallbackTimer timer(asyncCallbacks);
 	MegaError *megaError = new MegaError(e);
 	activeTransfer = transfer;
 	activeError = megaError;
@@ -10400,14 +11310,27 @@ void MegaApiImpl::fireOnTransferFinish(MegaTransferPrivate *transfer, MegaError
         LOG_info << "Transfer (" << transfer->getTransferString() << ") finished. File: " << transfer->getFileName();
     }
 
-    for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+    if (asyncCallbacks)
     {
-        (*it++)->onTransferFinish(api, transfer, megaError);
+        if (transferListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::TRANSFER_FINISH);
+            callback->transfer = new MegaTransferPrivate(transfer);
+            callback->error = megaError->copy();
+            queueCallback(callback);
+        }
     }
-
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onTransferFinish(api, transfer, megaError);
+        for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+        {
+            (*it++)->onTransferFinish(api, transfer, megaError);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onTransferFinish(api, transfer, megaError);
+        }
     }
 
 	MegaTransferListener* listener = transfer->getListener();
@@ -10426,6 +11349,7 @@ void MegaApiImpl::fireOnTransferFinish(MegaTransferPrivate *transfer, MegaError
 
 void MegaApiImpl::fireOnTransferTemporaryError(MegaTransferPrivate *transfer, MegaError e)
 {
+    ListenerCallbackTimer timer(asyncCallbacks);
 	MegaError *megaError = new MegaError(e);
 	activeTransfer = transfer;
 	activeError = megaError;
@@ -10434,14 +11358,27 @@ void MegaApiImpl::fireOnTransferTemporaryError(MegaTransferPrivate *transfer, Me
 
     transfer->setNumRetry(transfer->getNumRetry() + 1);
 
-    for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+    if (asyncCallbacks)
     {
-        (*it++)->onTransferTemporaryError(api, transfer, megaError);
+        if (transferListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::TRANSFER_TEMPORARY_ERROR);
+            callback->transfer = new MegaTransferPrivate(transfer);
+            callback->error = megaError->copy();
+            queueCallback(callback);
+        }
     }
-
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onTransferTemporaryError(api, transfer, megaError);
+        for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+        {
+            (*it++)->onTransferTemporaryError(api, transfer, megaError);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onTransferTemporaryError(api, transfer, megaError);
+        }
     }
 
 	MegaTransferListener* listener = transfer->getListener();
@@ -10462,18 +11399,31 @@ MegaClient *MegaApiImpl::getMegaClient()
 
 void MegaApiImpl::fireOnTransferUpdate(MegaTransferPrivate *transfer)
 {
+    ListenerCallbackTimer timer(asyncCallbacks);
 	activeTransfer = transfer;
     notificationNumber++;
     transfer->setNotificationNumber(notificationNumber);
 
-    for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+    if (asyncCallbacks)
     {
-        (*it++)->onTransferUpdate(api, transfer);
+        if (transferListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::TRANSFER_UPDATE);
+            callback->transfer = new MegaTransferPrivate(transfer);
+            queueCallback(callback);
+        }
     }
-
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onTransferUpdate(api, transfer);
+        for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+        {
+            (*it++)->onTransferUpdate(api, transfer);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onTransferUpdate(api, transfer);
+        }
     }
 
 	MegaTransferListener* listener = transfer->getListener();
@@ -10504,15 +11454,28 @@ bool MegaApiImpl::fireOnTransferData(MegaTransferPrivate *transfer)
 
 void MegaApiImpl::fireOnUsersUpdate(MegaUserList *users)
 {
+    ListenerCallbackTimer timer(asyncCallbacks);
 	activeUsers = users;
 
-    for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+    if (asyncCallbacks)
     {
-        (*it++)->onUsersUpdate(api, users);
+        if (globalListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::USERS_UPDATE);
+            callback->users = users ? users->copy() : NULL;
+            queueCallback(callback);
+        }
     }
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onUsersUpdate(api, users);
+        for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+        {
+            (*it++)->onUsersUpdate(api, users);
+        }
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onUsersUpdate(api, users);
+        }
     }
 
     activeUsers = NULL;
@@ -10520,15 +11483,28 @@ void MegaApiImpl::fireOnUsersUpdate(MegaUserList *users)
 
 void MegaApiImpl::fireOnContactRequestsUpdate(MegaContactRequestList *requests)
 {
+    ListenerCallbackTimer timer(asyncCallbacks);
     activeContactRequests = requests;
 
-    for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+    if (asyncCallbacks)
     {
-        (*it++)->onContactRequestsUpdate(api, requests);
+        if (globalListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::CONTACT_REQUESTS_UPDATE);
+            callback->contactRequests = requests ? requests->copy() : NULL;
+            queueCallback(callback);
+        }
     }
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onContactRequestsUpdate(api, requests);
+        for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+        {
+            (*it++)->onContactRequestsUpdate(api, requests);
+        }
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onContactRequestsUpdate(api, requests);
+        }
     }
 
     activeContactRequests = NULL;
@@ -10536,15 +11512,35 @@ void MegaApiImpl::fireOnContactRequestsUpdate(MegaContactRequestList *requests)
 
 void MegaApiImpl::fireOnNodesUpdate(MegaNodeList *nodes)
 {
+    ListenerCallbackTimer timer(asyncCallbacks);
 	activeNodes = nodes;
 
-    for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+    if (asyncCallbacks)
     {
-        (*it++)->onNodesUpdate(api, nodes);
+        if (globalListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::NODES_UPDATE);
+            if (nodes)
+            {
+                callback->addNodes(nodes);
+            }
+            else
+            {
+                callback->allNodes = true;
+            }
+            queueCallback(callback);
+        }
     }
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onNodesUpdate(api, nodes);
+        for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+        {
+            (*it++)->onNodesUpdate(api, nodes);
+        }
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onNodesUpdate(api, nodes);
+        }
     }
 
     activeNodes = NULL;
@@ -10552,40 +11548,75 @@ void MegaApiImpl::fireOnNodesUpdate(MegaNodeList *nodes)
 
 void MegaApiImpl::fireOnAccountUpdate()
 {
-    for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+    ListenerCallbackTimer timer(asyncCallbacks);
+    if (asyncCallbacks)
     {
-        (*it++)->onAccountUpdate(api);
+        if (globalListeners.size() || listeners.size())
+        {
+            queueCallback(new MegaCallback(MegaCallback::ACCOUNT_UPDATE));
+        }
     }
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onAccountUpdate(api);
+        for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+        {
+            (*it++)->onAccountUpdate(api);
+        }
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onAccountUpdate(api);
+        }
     }
 }
 
 void MegaApiImpl::fireOnReloadNeeded()
 {
-    for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+    ListenerCallbackTimer timer(asyncCallbacks);
+    if (asyncCallbacks)
     {
-        (*it++)->onReloadNeeded(api);
+        if (globalListeners.size() || listeners.size())
+        {
+            queueCallback(new MegaCallback(MegaCallback::RELOAD_NEEDED));
+        }
     }
-
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onReloadNeeded(api);
+        for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+        {
+            (*it++)->onReloadNeeded(api);
+        }
+
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onReloadNeeded(api);
+        }
     }
 }
 
 #ifdef ENABLE_SYNC
 void MegaApiImpl::fireOnSyncStateChanged(MegaSyncPrivate *sync)
 {
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    ListenerCallbackTimer timer(asyncCallbacks);
+    if (asyncCallbacks)
     {
-        (*it++)->onSyncStateChanged(api, sync);
+        if (listeners.size() || syncListeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::SYNC_STATE_CHANGED);
+            callback->sync = new MegaSyncPrivate(sync);
+            queueCallback(callback);
+        }
     }
-
-    for(set<MegaSyncListener *>::iterator it = syncListeners.begin(); it != syncListeners.end() ;)
+    else
     {
-        (*it++)->onSyncStateChanged(api, sync);
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onSyncStateChanged(api, sync);
+        }
+
+        for(set<MegaSyncListener *>::iterator it = syncListeners.begin(); it != syncListeners.end() ;)
+        {
+            (*it++)->onSyncStateChanged(api, sync);
+        }
     }
 
     MegaSyncListener* listener = sync->getListener();
@@ -10597,14 +11628,28 @@ void MegaApiImpl::fireOnSyncStateChanged(MegaSyncPrivate *sync)
 
 void MegaApiImpl::fireOnSyncEvent(MegaSyncPrivate *sync, MegaSyncEvent *event)
 {
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    ListenerCallbackTimer timer(asyncCallbacks);
+    if (asyncCallbacks)
     {
-        (*it++)->onSyncEvent(api, sync, event);
+        if (listeners.size() || syncListeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::SYNC_EVENT);
+            callback->sync = new MegaSyncPrivate(sync);
+            callback->syncEvent = event->copy();
+            queueCallback(callback);
+        }
     }
-
-    for(set<MegaSyncListener *>::iterator it = syncListeners.begin(); it != syncListeners.end() ;)
+    else
     {
-        (*it++)->onSyncEvent(api, sync, event);
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onSyncEvent(api, sync, event);
+        }
+
+        for(set<MegaSyncListener *>::iterator it = syncListeners.begin(); it != syncListeners.end() ;)
+        {
+            (*it++)->onSyncEvent(api, sync, event);
+        }
     }
 
     MegaSyncListener* listener = sync->getListener();
@@ -10618,27 +11663,53 @@ void MegaApiImpl::fireOnSyncEvent(MegaSyncPrivate *sync, MegaSyncEvent *event)
 
 void MegaApiImpl::fireOnGlobalSyncStateChanged()
 {
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    ListenerCallbackTimer timer(asyncCallbacks);
+    if (asyncCallbacks)
     {
-        (*it++)->onGlobalSyncStateChanged(api);
+        if (listeners.size() || globalListeners.size())
+        {
+            queueCallback(new MegaCallback(MegaCallback::GLOBAL_SYNC_STATE_CHANGED));
+        }
     }
-
-    for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+    else
     {
-        (*it++)->onGlobalSyncStateChanged(api);
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onGlobalSyncStateChanged(api);
+        }
+
+        for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+        {
+            (*it++)->onGlobalSyncStateChanged(api);
+        }
     }
 }
 
 void MegaApiImpl::fireOnFileSyncStateChanged(MegaSyncPrivate *sync, const char *filePath, int newState)
 {
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    ListenerCallbackTimer timer(asyncCallbacks);
+    if (asyncCallbacks)
     {
-        (*it++)->onSyncFileStateChanged(api, sync, filePath, newState);
+        if (listeners.size() || syncListeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::FILE_SYNC_STATE_CHANGED);
+            callback->sync = new MegaSyncPrivate(sync);
+            callback->filePath = filePath;
+            callback->syncState = newState;
+            queueCallback(callback);
+        }
     }
-
-    for(set<MegaSyncListener *>::iterator it = syncListeners.begin(); it != syncListeners.end() ;)
+    else
     {
-        (*it++)->onSyncFileStateChanged(api, sync, filePath, newState);
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onSyncFileStateChanged(api, sync, filePath, newState);
+        }
+
+        for(set<MegaSyncListener *>::iterator it = syncListeners.begin(); it != syncListeners.end() ;)
+        {
+            (*it++)->onSyncFileStateChanged(api, sync, filePath, newState);
+        }
     }
 
     MegaSyncListener* listener = sync->getListener();
@@ -10654,13 +11725,26 @@ void MegaApiImpl::fireOnFileSyncStateChanged(MegaSyncPrivate *sync, const char *
 
 void MegaApiImpl::fireOnChatsUpdate(MegaTextChatList *chats)
 {
-    for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+    ListenerCallbackTimer timer(asyncCallbacks);
+    if (asyncCallbacks)
     {
-        (*it++)->onChatsUpdate(api, chats);
+        if (globalListeners.size() || listeners.size())
+        {
+            MegaCallback *callback = new MegaCallback(MegaCallback::CHATS_UPDATE);
+            callback->chats = chats ? chats->copy() : NULL;
+            queueCallback(callback);
+        }
     }
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onChatsUpdate(api, chats);
+        for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+        {
+            (*it++)->onChatsUpdate(api, chats);
+        }
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onChatsUpdate(api, chats);
+        }
     }
 }
 
@@ -11212,19 +12296,13 @@ Node *MegaApiImpl::getNodeByFingerprintInternal(const char *fingerprint, Node *p
         return NULL;
     }
 
-    Node *n = NULL;
     sdkMutex.lock();
-    node_vector *nodes = client->nodesbyfingerprint(fp);
-    if (nodes->size())
-    {
-        n = nodes->at(0);
-    }
+    Node *n = client->nodebyfingerprint(fp);
 
     if (n && parent && n->parent != parent)
     {
-        for (unsigned int i = 1; i < nodes->size(); i++)
+        for (Node* node = FingerprintIndex::next(n); node; node = FingerprintIndex::next(node))
         {
-            Node* node = nodes->at(i);
             if (node->parent == parent)
             {
                 n = node;
@@ -11233,7 +12311,6 @@ Node *MegaApiImpl::getNodeByFingerprintInternal(const char *fingerprint, Node *p
         }
     }
     delete fp;
-    delete nodes;
     sdkMutex.unlock();
 
     return n;
@@ -15778,14 +16855,21 @@ void MegaFolderDownloadController::onTransferFinish(MegaApi *, MegaTransfer *t,
 }
 
 #ifdef HAVE_LIBUV
+#ifdef _WIN32
+#define STREAMING_MEMORY_BARRIER() MemoryBarrier()
+#else
+#define STREAMING_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
 StreamingBuffer::StreamingBuffer()
 {
     this->capacity = 0;
     this->buffer = NULL;
     this->inpos = 0;
+    this->written = 0;
     this->outpos = 0;
-    this->size = 0;
-    this->free = 0;
+    this->sent = 0;
+    this->released = 0;
     this->maxBufferSize = MAX_BUFFER_SIZE;
     this->maxOutputSize = MAX_OUTPUT_SIZE;
 }
@@ -15802,119 +16886,425 @@ void StreamingBuffer::init(unsigned int capacity)
         capacity = maxBufferSize;
     }
 
-    this->capacity = capacity;
-    this->buffer = new char[capacity];
-    this->inpos = 0;
-    this->outpos = 0;
-    this->size = 0;
-    this->free = capacity;
+    this->capacity = capacity;
+    this->buffer = new char[capacity];
+    this->inpos = 0;
+    this->written = 0;
+    this->outpos = 0;
+    this->sent = 0;
+    this->released = 0;
+}
+
+unsigned int StreamingBuffer::append(const char *buf, unsigned int len)
+{
+    if (!buffer)
+    {
+        // initialize the buffer if it's not initialized yet
+        init(len);
+    }
+
+    unsigned int free = availableSpace();
+    if (free < len)
+    {
+        LOG_debug << "Not enough available space";
+        len = free;
+    }
+
+    // append the new data
+    unsigned int num = capacity - inpos;
+    if (len <= num)
+    {
+        memcpy(buffer + inpos, buf, len);
+    }
+    else
+    {
+        memcpy(buffer + inpos, buf, num);
+        memcpy(buffer, buf + num, len - num);
+    }
+
+    // publish it once it's in the buffer
+    inpos = (inpos + len) % capacity;
+    STREAMING_MEMORY_BARRIER();
+    written += len;
+
+    return len;
+}
+
+unsigned int StreamingBuffer::availableData()
+{
+    return written - sent;
+}
+
+unsigned int StreamingBuffer::availableSpace()
+{
+    return capacity - (written - released);
+}
+
+unsigned int StreamingBuffer::availableCapacity()
+{
+    return capacity;
+}
+
+uv_buf_t StreamingBuffer::nextBuffer()
+{
+    unsigned int size = written - sent;
+    if (!size)
+    {
+        // no data available
+        return uv_buf_init(NULL, 0);
+    }
+
+    // don't read the data before the counter that published it
+    STREAMING_MEMORY_BARRIER();
+
+    // prepare output buffer
+    char *outbuf = buffer + outpos;
+    unsigned int len = size < maxOutputSize ? size : maxOutputSize;
+    if (outpos + len > capacity)
+    {
+        len = capacity - outpos;
+    }
+
+    // update the internal state
+    sent += len;
+    outpos += len;
+    outpos %= capacity;
+
+    // return the buffer
+    return uv_buf_init(outbuf, len);
+}
+
+void StreamingBuffer::freeData(unsigned int len)
+{
+    // the data has been written, the producer can reuse the space
+    STREAMING_MEMORY_BARRIER();
+    released += len;
+}
+
+void StreamingBuffer::setMaxBufferSize(unsigned int bufferSize)
+{
+    if (bufferSize)
+    {
+        this->maxBufferSize = bufferSize;
+    }
+    else
+    {
+        this->maxBufferSize = MAX_BUFFER_SIZE;
+    }
+}
+
+void StreamingBuffer::setMaxOutputSize(unsigned int outputSize)
+{
+    if (outputSize)
+    {
+        this->maxOutputSize = outputSize;
+    }
+    else
+    {
+        this->maxOutputSize = MAX_OUTPUT_SIZE;
+    }
+}
+
+StreamingCache::StreamingCache()
+{
+    this->size = 0;
+    this->maxSize = MAX_CACHE_SIZE;
+    this->bytesSaved = 0;
+    this->bytesFetched = 0;
+    uv_mutex_init(&mutex);
+}
+
+StreamingCache::~StreamingCache()
+{
+    for (list<Segment *>::iterator it = lru.begin(); it != lru.end(); it++)
+    {
+        delete *it;
+    }
+    uv_mutex_destroy(&mutex);
+}
+
+unsigned int StreamingCache::read(handle h, m_off_t offset, m_off_t end, StreamingBuffer *buffer,
+                                  MegaHTTPContext *reader, bool *attached)
+{
+    unsigned int copied = 0;
+
+    uv_mutex_lock(&mutex);
+    readers.erase(reader);
+
+    map<handle, segment_map>::iterator nit = nodes.find(h);
+    if (nit != nodes.end())
+    {
+        segment_map *segments = &nit->second;
+
+        while (offset < end && buffer->availableSpace())
+        {
+            // last segment starting at or before the offset
+            segment_map::iterator it = segments->upper_bound(offset);
+            if (it == segments->begin())
+            {
+                break;
+            }
+
+            Segment *segment = (--it)->second;
+            m_off_t available = segment->offset + segment->data.size() - offset;
+            if (available <= 0)
+            {
+                break;
+            }
+
+            unsigned int len = buffer->availableSpace();
+            if (available < len)
+            {
+                len = available;
+            }
+            if (end - offset < len)
+            {
+                len = end - offset;
+            }
+
+            buffer->append(segment->data.data() + (offset - segment->offset), len);
+            lru.splice(lru.begin(), lru, segment->lru);
+            offset += len;
+            copied += len;
+        }
+    }
+
+    bytesSaved += copied;
+
+    // wait for a transfer that is about to get there
+    *attached = false;
+    if (offset < end && buffer->availableSpace())
+    {
+        for (map<MegaHTTPContext *, Fetch>::iterator it = fetches.begin(); it != fetches.end(); it++)
+        {
+            Fetch *fetch = &it->second;
+            if (it->first != reader && fetch->h == h && fetch->offset <= offset
+                    && offset < fetch->end && offset - fetch->offset <= ATTACH_DISTANCE)
+            {
+                Reader *r = &readers[reader];
+                r->h = h;
+                r->offset = offset;
+                *attached = true;
+                break;
+            }
+        }
+    }
+
+    uv_mutex_unlock(&mutex);
+    return copied;
 }
 
-unsigned int StreamingBuffer::append(const char *buf, unsigned int len)
+void StreamingCache::startFetch(handle h, m_off_t offset, m_off_t end, MegaHTTPContext *fetcher)
 {
-    if (!buffer)
+    uv_mutex_lock(&mutex);
+    Fetch *fetch = &fetches[fetcher];
+    fetch->h = h;
+    fetch->offset = offset;
+    fetch->end = end;
+    uv_mutex_unlock(&mutex);
+}
+
+void StreamingCache::write(MegaHTTPContext *fetcher, const char *data, unsigned int len)
+{
+    uv_mutex_lock(&mutex);
+    map<MegaHTTPContext *, Fetch>::iterator it = fetches.find(fetcher);
+    if (it != fetches.end())
     {
-        // initialize the buffer if it's not initialized yet
-        init(len);
+        Fetch *fetch = &it->second;
+
+        bytesFetched += len;
+        store(fetch->h, fetch->offset, data, len);
+        fetch->offset += len;
+        wake(fetch->h, fetch->offset);
     }
+    uv_mutex_unlock(&mutex);
+}
 
-    if (free < len)
+void StreamingCache::endFetch(MegaHTTPContext *fetcher)
+{
+    uv_mutex_lock(&mutex);
+    map<MegaHTTPContext *, Fetch>::iterator it = fetches.find(fetcher);
+    if (it != fetches.end())
     {
-        LOG_debug << "Not enough available space";
-        len = free;
+        // readers waiting for it have to get the data by themselves
+        handle h = it->second.h;
+        fetches.erase(it);
+        wake(h, -1);
     }
+    uv_mutex_unlock(&mutex);
+}
 
-    // update the internal state
-    int currentIndex = inpos;
-    inpos += len;
-    int remaining = inpos - capacity;
-    inpos %= capacity;
-    size += len;
-    free -= len;
+void StreamingCache::detach(MegaHTTPContext *ctx)
+{
+    endFetch(ctx);
 
-    // append the new data
-    if (remaining <= 0)
-    {
-        memcpy(buffer + currentIndex, buf, len);
-    }
-    else
-    {
-        int num = len - remaining;
-        memcpy(buffer + currentIndex, buf, num);
-        memcpy(buffer, buf + num, remaining);
-    }
+    uv_mutex_lock(&mutex);
+    readers.erase(ctx);
+    uv_mutex_unlock(&mutex);
+}
 
-    return len;
+void StreamingCache::setMaxSize(m_off_t maxSize)
+{
+    uv_mutex_lock(&mutex);
+    this->maxSize = maxSize > 0 ? maxSize : MAX_CACHE_SIZE;
+    evict();
+    uv_mutex_unlock(&mutex);
 }
 
-unsigned int StreamingBuffer::availableData()
+m_off_t StreamingCache::getMaxSize()
 {
-    return size;
+    return maxSize;
 }
 
-unsigned int StreamingBuffer::availableSpace()
+m_off_t StreamingCache::getBytesSaved()
 {
-    return free;
+    uv_mutex_lock(&mutex);
+    m_off_t value = bytesSaved;
+    uv_mutex_unlock(&mutex);
+    return value;
 }
 
-unsigned int StreamingBuffer::availableCapacity()
+double StreamingCache::getHitRate()
 {
-    return capacity;
+    uv_mutex_lock(&mutex);
+    double value = (bytesSaved + bytesFetched) ? (double)bytesSaved / (bytesSaved + bytesFetched) : 0;
+    uv_mutex_unlock(&mutex);
+    return value;
 }
 
-uv_buf_t StreamingBuffer::nextBuffer()
+// appends the data to the segment that ends at offset or starts a new one,
+// skipping what is cached already
+void StreamingCache::store(handle h, m_off_t offset, const char *data, unsigned int len)
 {
-    if (!size)
-    {
-        // no data available
-        return uv_buf_init(NULL, 0);
-    }
+    segment_map *segments = &nodes[h];
 
-    // prepare output buffer
-    char *outbuf = buffer + outpos;
-    int len = size < maxOutputSize ? size : maxOutputSize;
-    if (outpos + len > capacity)
+    while (len)
     {
-        len = capacity - outpos;
-    }
+        segment_map::iterator next = segments->upper_bound(offset);
+        Segment *segment = NULL;
+        unsigned int n = len;
 
-    // update the internal state
-    size -= len;
-    outpos += len;
-    outpos %= capacity;
+        if (next != segments->begin())
+        {
+            segment_map::iterator it = next;
+            Segment *previous = (--it)->second;
+            m_off_t previousEnd = previous->offset + previous->data.size();
 
-    // return the buffer
-    return uv_buf_init(outbuf, len);
-}
+            if (offset < previousEnd)
+            {
+                if (previousEnd - offset < n)
+                {
+                    n = previousEnd - offset;
+                }
 
-void StreamingBuffer::freeData(unsigned int len)
-{
-    // update the internal state
-    free += len;
+                offset += n;
+                data += n;
+                len -= n;
+                continue;
+            }
+
+            if (offset == previousEnd && previous->data.size() < SEGMENT_SIZE)
+            {
+                segment = previous;
+                lru.splice(lru.begin(), lru, segment->lru);
+            }
+        }
+
+        if (!segment)
+        {
+            segment = new Segment;
+            segment->h = h;
+            segment->offset = offset;
+            segment->data.reserve(SEGMENT_SIZE);
+            (*segments)[offset] = segment;
+            lru.push_front(segment);
+            segment->lru = lru.begin();
+        }
+
+        // segments don't overlap
+        if (SEGMENT_SIZE - segment->data.size() < n)
+        {
+            n = SEGMENT_SIZE - segment->data.size();
+        }
+        if (next != segments->end() && next->first - offset < n)
+        {
+            n = next->first - offset;
+        }
+
+        segment->data.append(data, n);
+        size += n;
+        offset += n;
+        data += n;
+        len -= n;
+    }
+
+    evict();
 }
 
-void StreamingBuffer::setMaxBufferSize(unsigned int bufferSize)
+// wakes up the readers of the node waiting for data before offset (all of
+// them if offset is negative)
+void StreamingCache::wake(handle h, m_off_t offset)
 {
-    if (bufferSize)
-    {
-        this->maxBufferSize = bufferSize;
-    }
-    else
+    map<MegaHTTPContext *, Reader>::iterator it = readers.begin();
+    while (it != readers.end())
     {
-        this->maxBufferSize = MAX_BUFFER_SIZE;
+        if (it->second.h == h && (offset < 0 || it->second.offset < offset))
+        {
+            uv_async_send(&it->first->asynchandle);
+            readers.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
     }
 }
 
-void StreamingBuffer::setMaxOutputSize(unsigned int outputSize)
+void StreamingCache::evict()
 {
-    if (outputSize)
+    while (size > maxSize && lru.size())
     {
-        this->maxOutputSize = outputSize;
+        Segment *segment = lru.back();
+        map<handle, segment_map>::iterator nit = nodes.find(segment->h);
+
+        nit->second.erase(segment->offset);
+        if (nit->second.empty())
+        {
+            nodes.erase(nit);
+        }
+
+        size -= segment->data.size();
+        lru.pop_back();
+        delete segment;
     }
-    else
+}
+
+MegaHTTPLoop::MegaHTTPLoop(MegaHTTPServer *server)
+{
+    this->server = server;
+    uv_loop_init(&loop);
+    uv_mutex_init(&mutex);
+
+    uv_async_init(&loop, &handoff_handle, MegaHTTPServer::onHandoff);
+    handoff_handle.data = this;
+
+    uv_async_init(&loop, &exit_handle, MegaHTTPServer::onCloseRequested);
+    exit_handle.data = this;
+}
+
+MegaHTTPLoop::~MegaHTTPLoop()
+{
+#ifndef _WIN32
+    // sockets handed over after the loop stopped
+    while (handoff.size())
     {
-        this->maxOutputSize = MAX_OUTPUT_SIZE;
+        close(handoff.front());
+        handoff.pop_front();
     }
+#endif
+
+    uv_loop_close(&loop);
+    uv_mutex_destroy(&mutex);
 }
 
 // http_parser settings
@@ -15933,6 +17323,8 @@ MegaHTTPServer::MegaHTTPServer(MegaApiImpl *megaApi)
     this->restrictedMode = MegaApi::HTTP_SERVER_ALLOW_CREATED_LOCAL_LINKS;
     this->lastHandle = INVALID_HANDLE;
     this->subtitlesSupportEnabled = false;
+    this->nextLoop = 0;
+    this->numThreads = 0;
 }
 
 MegaHTTPServer::~MegaHTTPServer()
@@ -15950,10 +17342,29 @@ bool MegaHTTPServer::start(int port, bool localOnly)
 
     this->port = port;
     this->localOnly = localOnly;
+
+    // the first loop runs in the thread of the server, the others in their own
+    int num = getNumThreads();
+    nextLoop = 0;
+    for (int i = 0; i < num; i++)
+    {
+        loops.push_back(new MegaHTTPLoop(this));
+        if (i)
+        {
+            loops[i]->thread.start(loopEntryPoint, loops[i]);
+        }
+    }
+
     uv_sem_init(&semaphore, 0);
     thread.start(threadEntryPoint, this);
     uv_sem_wait(&semaphore);
     uv_sem_destroy(&semaphore);
+
+    if (!started)
+    {
+        thread.join();
+        stopLoops();
+    }
     return started;
 }
 
@@ -15968,12 +17379,8 @@ void MegaHTTPServer::run()
     parsercfg.on_header_value = onHeaderValue;
     parsercfg.on_body = onBody;
 
-    uv_loop_t *uv_loop = uv_default_loop();
-
-    uv_async_init(uv_loop, &exit_handle, onCloseRequested);
-    exit_handle.data = this;
-
-    uv_tcp_init(uv_loop, &server);
+    MegaHTTPLoop *acceptor = loops[0];
+    uv_tcp_init(&acceptor->loop, &server);
     server.data = this;
 
     uv_tcp_keepalive(&server, 0, 0);
@@ -15992,16 +17399,19 @@ void MegaHTTPServer::run()
         || uv_listen((uv_stream_t*)&server, 32, onNewClient))
     {
         port = 0;
+        uv_close((uv_handle_t *)&server, NULL);
+        uv_close((uv_handle_t *)&acceptor->handoff_handle, NULL);
+        uv_close((uv_handle_t *)&acceptor->exit_handle, NULL);
+        uv_run(&acceptor->loop, UV_RUN_DEFAULT);
         uv_sem_post(&semaphore);
         return;
     }
 
-    LOG_info << "HTTP server started on port " << port;
+    LOG_info << "HTTP server started on port " << port << " with " << loops.size() << " event loops";
     started = true;
     uv_sem_post(&semaphore);
-    uv_run(uv_loop, UV_RUN_DEFAULT);
+    uv_run(&acceptor->loop, UV_RUN_DEFAULT);
 
-    uv_loop_close(uv_loop);
     started = false;
     port = 0;
 
@@ -16015,8 +17425,25 @@ void MegaHTTPServer::stop()
         return;
     }
 
-    uv_async_send(&exit_handle);
+    // no more connections are handed over once the acceptor has finished
+    uv_async_send(&loops[0]->exit_handle);
     thread.join();
+    stopLoops();
+}
+
+void MegaHTTPServer::stopLoops()
+{
+    for (unsigned int i = 1; i < loops.size(); i++)
+    {
+        uv_async_send(&loops[i]->exit_handle);
+        loops[i]->thread.join();
+    }
+
+    for (unsigned int i = 0; i < loops.size(); i++)
+    {
+        delete loops[i];
+    }
+    loops.clear();
 }
 
 int MegaHTTPServer::getPort()
@@ -16059,6 +17486,46 @@ int MegaHTTPServer::getMaxOutputSize()
     return StreamingBuffer::MAX_OUTPUT_SIZE;
 }
 
+void MegaHTTPServer::setNumThreads(int numThreads)
+{
+    this->numThreads = numThreads <= 0 ? 0 : numThreads;
+}
+
+int MegaHTTPServer::getNumThreads()
+{
+#ifdef _WIN32
+    // sockets can't be handed over to another loop
+    return 1;
+#else
+    if (!numThreads)
+    {
+        return DEFAULT_NUM_THREADS;
+    }
+
+    return numThreads < MAX_NUM_THREADS ? numThreads : MAX_NUM_THREADS;
+#endif
+}
+
+void MegaHTTPServer::setMaxCacheSize(long long cacheSize)
+{
+    cache.setMaxSize(cacheSize);
+}
+
+long long MegaHTTPServer::getMaxCacheSize()
+{
+    return cache.getMaxSize();
+}
+
+long long MegaHTTPServer::getCacheBytesSaved()
+{
+    return cache.getBytesSaved();
+}
+
+double MegaHTTPServer::getCacheHitRate()
+{
+    return cache.getHitRate();
+}
+
 void MegaHTTPServer::enableFileServer(bool enable)
 {
     this->fileServerEnabled = enable;
@@ -16159,6 +17626,14 @@ void *MegaHTTPServer::threadEntryPoint(void *param)
     return NULL;
 }
 
+void *MegaHTTPServer::loopEntryPoint(void *param)
+{
+    MegaHTTPLoop *loop = (MegaHTTPLoop *)param;
+    uv_run(&loop->loop, UV_RUN_DEFAULT);
+    LOG_debug << "HTTP server loop exit";
+    return NULL;
+}
+
 void MegaHTTPServer::onNewClient(uv_stream_t* server_handle, int status)
 {
     if (status < 0)
@@ -16166,6 +17641,85 @@ void MegaHTTPServer::onNewClient(uv_stream_t* server_handle, int status)
         return;
     }
 
+    // connections are distributed among the loops
+    MegaHTTPServer *httpServer = (MegaHTTPServer *)server_handle->data;
+    MegaHTTPLoop *loop = httpServer->loops[httpServer->nextLoop++ % httpServer->loops.size()];
+
+#ifndef _WIN32
+    if (loop != httpServer->loops[0])
+    {
+        // accept the connection here and hand the socket over to the other
+        // loop, it opens it in its own thread
+        uv_tcp_t *tcphandle = new uv_tcp_t();
+        uv_os_fd_t fd;
+        int sock = -1;
+
+        uv_tcp_init(&httpServer->loops[0]->loop, tcphandle);
+        if (!uv_accept(server_handle, (uv_stream_t*)tcphandle)
+                && !uv_fileno((uv_handle_t*)tcphandle, &fd))
+        {
+            sock = dup(fd);
+        }
+        uv_close((uv_handle_t*)tcphandle, onAcceptedClose);
+
+        if (sock < 0)
+        {
+            LOG_warn << "Unable to hand over a connection";
+            return;
+        }
+
+        uv_mutex_lock(&loop->mutex);
+        loop->handoff.push_back(sock);
+        uv_mutex_unlock(&loop->mutex);
+        uv_async_send(&loop->handoff_handle);
+        return;
+    }
+#endif
+
+    // Accept the connection
+    MegaHTTPContext* httpctx = newConnection(loop);
+    uv_accept(server_handle, (uv_stream_t*)&httpctx->tcphandle);
+
+    // Start reading
+    uv_read_start((uv_stream_t*)&httpctx->tcphandle, allocBuffer, onDataReceived);
+}
+
+void MegaHTTPServer::onHandoff(uv_async_t *handle)
+{
+    MegaHTTPLoop *loop = (MegaHTTPLoop *)handle->data;
+    deque<uv_os_sock_t> sockets;
+
+    uv_mutex_lock(&loop->mutex);
+    sockets.swap(loop->handoff);
+    uv_mutex_unlock(&loop->mutex);
+
+    while (sockets.size())
+    {
+        MegaHTTPContext* httpctx = newConnection(loop);
+        if (uv_tcp_open(&httpctx->tcphandle, sockets.front()))
+        {
+            LOG_warn << "Unable to open a connection";
+#ifndef _WIN32
+            close(sockets.front());
+#endif
+            uv_close((uv_handle_t*)&httpctx->tcphandle, onClose);
+        }
+        else
+        {
+            // Start reading
+            uv_read_start((uv_stream_t*)&httpctx->tcphandle, allocBuffer, onDataReceived);
+        }
+        sockets.pop_front();
+    }
+}
+
+void MegaHTTPServer::onAcceptedClose(uv_handle_t *handle)
+{
+    delete (uv_tcp_t *)handle;
+}
+
+MegaHTTPContext *MegaHTTPServer::newConnection(MegaHTTPLoop *loop)
+{
     // Create an object to save context information
     MegaHTTPContext* httpctx = new MegaHTTPContext();
 
@@ -16173,23 +17727,20 @@ void MegaHTTPServer::onNewClient(uv_stream_t* server_handle, int status)
     http_parser_init(&httpctx->parser, HTTP_REQUEST);
 
     // Set connection data
-    httpctx->server = (MegaHTTPServer *)(server_handle->data);
+    httpctx->server = loop->server;
+    httpctx->loop = loop;
     httpctx->megaApi = httpctx->server->megaApi;
     httpctx->parser.data = httpctx;
     httpctx->tcphandle.data = httpctx;
     httpctx->asynchandle.data = httpctx;
-    httpctx->server->connections.push_back(httpctx);
-    LOG_debug << "Connection received! " << httpctx->server->connections.size();
+    loop->connections.push_back(httpctx);
+    LOG_debug << "Connection received! " << loop->connections.size();
 
     // Async handle to perform writes
-    uv_async_init(uv_default_loop(), &httpctx->asynchandle, onAsyncEvent);
-
-    // Accept the connection
-    uv_tcp_init(uv_default_loop(), &httpctx->tcphandle);
-    uv_accept(server_handle, (uv_stream_t*)&httpctx->tcphandle);
+    uv_async_init(&loop->loop, &httpctx->asynchandle, onAsyncEvent);
 
-    // Start reading
-    uv_read_start((uv_stream_t*)&httpctx->tcphandle, allocBuffer, onDataReceived);
+    uv_tcp_init(&loop->loop, &httpctx->tcphandle);
+    return httpctx;
 }
 
 void MegaHTTPServer::allocBuffer(uv_handle_t *, size_t suggested_size, uv_buf_t* buf)
@@ -16226,9 +17777,10 @@ void MegaHTTPServer::onClose(uv_handle_t* handle)
     // streaming transfers are automatically stopped when their listener is removed
     httpctx->megaApi->removeTransferListener(httpctx);
     httpctx->megaApi->removeRequestListener(httpctx);
+    httpctx->server->cache.detach(httpctx);
 
-    httpctx->server->connections.remove(httpctx);
-    LOG_debug << "Connection closed: " << httpctx->server->connections.size();
+    httpctx->loop->connections.remove(httpctx);
+    LOG_debug << "Connection closed: " << httpctx->loop->connections.size();
 
     uv_close((uv_handle_t *)&httpctx->asynchandle, onAsyncEventClose);
 }
@@ -16842,12 +18394,43 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
     }
 
     LOG_debug << "Requesting range. From " << start << "  size " << len;
-    uv_mutex_init(&httpctx->mutex);
     httpctx->rangeWritten = 0;
-    httpctx->megaApi->startStreaming(node, start, len, httpctx);
+    readStream(httpctx);
     return 0;
 }
 
+// gets the next data of the range from the cache, from a transfer of another
+// connection that is about to receive it or from a new streaming transfer
+void MegaHTTPServer::readStream(MegaHTTPContext *httpctx)
+{
+    handle h = httpctx->node->getHandle();
+    m_off_t start = httpctx->rangeStart + httpctx->rangeWritten + httpctx->streamingBuffer.availableData();
+    unsigned int cached = httpctx->server->cache.read(h, start, httpctx->rangeEnd, &httpctx->streamingBuffer,
+                                                      httpctx, &httpctx->waiting);
+    start += cached;
+
+    if (cached)
+    {
+        LOG_debug << "Streaming " << cached << " bytes from the cache";
+    }
+
+    if (!httpctx->waiting && start < httpctx->rangeEnd)
+    {
+        if (!httpctx->streamingBuffer.availableSpace())
+        {
+            // resumed by onWriteFinished
+            httpctx->pause = true;
+        }
+        else
+        {
+            m_off_t len = httpctx->rangeEnd - start;
+            LOG_debug << "Streaming from " << start << " len: " << len;
+            httpctx->server->cache.startFetch(h, start, httpctx->rangeEnd, httpctx);
+            httpctx->megaApi->startStreaming(httpctx->node, start, len, httpctx);
+        }
+    }
+}
+
 void MegaHTTPServer::sendHeaders(MegaHTTPContext *httpctx, string *headers)
 {
     LOG_debug << "Response headers: " << *headers;
@@ -16910,15 +18493,21 @@ void MegaHTTPServer::onAsyncEvent(uv_async_t* handle)
         return;
     }
 
+    if (httpctx->waiting)
+    {
+        readStream(httpctx);
+    }
+
     sendNextBytes(httpctx);
 }
 
 void MegaHTTPServer::onCloseRequested(uv_async_t *handle)
 {
     LOG_debug << "HTTP server stopping";
-    MegaHTTPServer *httpServer = (MegaHTTPServer*) handle->data;
+    MegaHTTPLoop *loop = (MegaHTTPLoop*) handle->data;
+    MegaHTTPServer *httpServer = loop->server;
 
-    for (list<MegaHTTPContext*>::iterator it = httpServer->connections.begin(); it != httpServer->connections.end(); it++)
+    for (list<MegaHTTPContext*>::iterator it = loop->connections.begin(); it != loop->connections.end(); it++)
     {
         MegaHTTPContext *httpctx = (*it);
         httpctx->finished = true;
@@ -16928,17 +18517,19 @@ void MegaHTTPServer::onCloseRequested(uv_async_t *handle)
         }
     }
 
-    uv_close((uv_handle_t *)&httpServer->server, NULL);
-    uv_close((uv_handle_t *)&httpServer->exit_handle, NULL);
+    if (loop == httpServer->loops[0])
+    {
+        uv_close((uv_handle_t *)&httpServer->server, NULL);
+    }
+    uv_close((uv_handle_t *)&loop->handoff_handle, NULL);
+    uv_close((uv_handle_t *)&loop->exit_handle, NULL);
 }
 
 void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
 {
-    uv_mutex_lock(&httpctx->mutex);
     if (httpctx->lastBuffer)
     {
         LOG_verbose << "Skipping write due to another ongoing write";
-        uv_mutex_unlock(&httpctx->mutex);
         return;
     }
 
@@ -16951,7 +18542,6 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
     if (httpctx->tcphandle.write_queue_size > httpctx->streamingBuffer.availableCapacity() / 8)
     {
         LOG_warn << "Skipping write. Too much queued data";
-        uv_mutex_unlock(&httpctx->mutex);
         return;
     }
 
@@ -16959,7 +18549,6 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
     if (!resbuf.len)
     {
         LOG_verbose << "Skipping write. No data available";
-        uv_mutex_unlock(&httpctx->mutex);
         return;
     }
 
@@ -16979,7 +18568,6 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
             uv_close((uv_handle_t*)&httpctx->tcphandle, onClose);
         }
     }
-    uv_mutex_unlock(&httpctx->mutex);
 }
 
 void MegaHTTPServer::onWriteFinished(uv_write_t* req, int status)
@@ -17015,19 +18603,17 @@ void MegaHTTPServer::onWriteFinished(uv_write_t* req, int status)
 
     if (httpctx->pause)
     {
-        uv_mutex_lock(&httpctx->mutex);
+        // the transfer doesn't append more data once it has been paused
+        STREAMING_MEMORY_BARRIER();
         if (httpctx->streamingBuffer.availableSpace() > httpctx->streamingBuffer.availableCapacity() / 2)
         {
             httpctx->pause = false;
-            m_off_t start = httpctx->rangeStart + httpctx->rangeWritten + httpctx->streamingBuffer.availableData();
-            m_off_t len =  httpctx->rangeEnd - httpctx->rangeStart - httpctx->rangeWritten - httpctx->streamingBuffer.availableData();
 
-            LOG_debug << "Resuming streaming from " << start << " len: " << len
-                     << " Buffer status: " << httpctx->streamingBuffer.availableSpace()
+            LOG_debug << "Resuming streaming. Buffer status: " << httpctx->streamingBuffer.availableSpace()
                      << " of " << httpctx->streamingBuffer.availableCapacity() << " bytes free";
-            httpctx->megaApi->startStreaming(httpctx->node, start, len, httpctx);
+
+            readStream(httpctx);
         }
-        uv_mutex_unlock(&httpctx->mutex);
     }
     sendNextBytes(httpctx);
 }
@@ -17040,7 +18626,10 @@ MegaHTTPContext::MegaHTTPContext()
     range = false;
     finished = false;
     failed = false;
+    pause = false;
+    waiting = false;
     nodereceived = false;
+    loop = NULL;
     resultCode = API_EINTERNAL;
     node = NULL;
     transfer = NULL;
@@ -17062,23 +18651,34 @@ bool MegaHTTPContext::onTransferData(MegaApi *, MegaTransfer *transfer, char *bu
     if (finished)
     {
         LOG_info << "Removing streaming transfer after " << transfer->getTransferredBytes() << " bytes";
+        server->cache.endFetch(this);
         return false;
     }
 
-    // append the data to the buffer
-    uv_mutex_lock(&mutex);
-    if (streamingBuffer.availableSpace() < 2 * size)
+    // keep the data for other connections
+    server->cache.write(this, buffer, size);
+
+    // append the data to the buffer, the loop of the connection takes it
+    // from there without locking
+    bool full = streamingBuffer.availableSpace() < 2 * size;
+    if (full)
     {
         LOG_debug << "Buffer full: " << streamingBuffer.availableSpace() << " of "
                  << streamingBuffer.availableCapacity() << " bytes available only. Pausing streaming";
-        pause = true;
+        server->cache.endFetch(this);
     }
     streamingBuffer.append(buffer, size);
-    uv_mutex_unlock(&mutex);
+
+    if (full)
+    {
+        // published after the data, the loop resumes the streaming from here
+        STREAMING_MEMORY_BARRIER();
+        pause = true;
+    }
 
     // notify the HTTP server
     uv_async_send(&asynchandle);
-    return !pause;
+    return !full;
 }
 
 void MegaHTTPContext::onTransferFinish(MegaApi *, MegaTransfer *, MegaError *e)
@@ -17091,6 +18691,12 @@ void MegaHTTPContext::onTransferFinish(MegaApi *, MegaTransfer *, MegaError *e)
         finished = true;
         uv_async_send(&asynchandle);
     }
+
+    if (ecode != API_EINCOMPLETE)
+    {
+        // paused transfers were finished by onTransferData
+        server->cache.endFetch(this);
+    }
 }
 
 void MegaHTTPContext::onRequestFinish(MegaApi *, MegaRequest *request, MegaError *)
@@ -85,27 +85,38 @@ bool MegaClient::decryptkey(const char* sk, byte* tk, int tl, SymmCipher* sc, in
     if (sl > 4 * FILENODEKEYLENGTH / 3 + 1)
     {
         // RSA-encrypted key - decrypt and update on the server to save space & client CPU time
-        sl = sl / 4 * 3 + 3;
+        map<string, string>::iterator it = rsakeys.find(string(sk, sl));
 
-        if (sl > 4096)
+        if (it != rsakeys.end() && it->second.size() >= (size_t)tl)
         {
-            return false;
+            // already decrypted in a batch
+            memcpy(tk, it->second.data(), tl);
+            rsakeys.erase(it);
         }
+        else
+        {
+            sl = sl / 4 * 3 + 3;
+
+            if (sl > 4096)
+            {
+                return false;
+            }
 
-        byte* buf = new byte[sl];
+            byte* buf = new byte[sl];
 
-        sl = Base64::atob(sk, buf, sl);
+            sl = Base64::atob(sk, buf, sl);
+
+            // decrypt and set session ID for subsequent API communication
+            if (!asymkey.decrypt(buf, sl, tk, tl))
+            {
+                delete[] buf;
+                LOG_warn << "Corrupt or invalid RSA node key";
+                return false;
+            }
 
-        // decrypt and set session ID for subsequent API communication
-        if (!asymkey.decrypt(buf, sl, tk, tl))
-        {
             delete[] buf;
-            LOG_warn << "Corrupt or invalid RSA node key";
-            return false;
         }
 
-        delete[] buf;
-
         if (!ISUNDEF(node))
         {
             if (type)
@@ -132,6 +143,101 @@ bool MegaClient::decryptkey(const char* sk, byte* tk, int tl, SymmCipher* sc, in
     return true;
 }
 
+// RSA decryption dominates applying the keys of a large batch of nodes shared
+// by other users: decrypt them up front, spread over the cores, and leave the
+// plain keys for decryptkey()
+void MegaClient::decryptrsakeys(node_vector* nv)
+{
+    if (!asymkey.isvalid(AsymmCipher::PRIVKEY))
+    {
+        return;
+    }
+
+    handle me = loggedin() ? this->me : *rootnodes;
+    node_map::iterator it = nodes.begin();
+    vector<string> ciphers;
+    vector<string> encoded;
+    string k;
+
+    for (unsigned i = 0; nv ? i < nv->size() : it != nodes.end(); i++)
+    {
+        Node* n = nv ? (*nv)[i] : (it++)->second;
+        size_t keylength = (n->type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+
+        if (n->nodekey.size() == keylength || !n->nodekey.size())
+        {
+            continue;
+        }
+
+        // the subkey Node::applykey() will use: the whole key if it's a
+        // personal one, otherwise the one addressed to us
+        const char* sk = NULL;
+        size_t t = n->nodekey.find(':');
+
+        if (t == string::npos)
+        {
+            sk = n->nodekey.c_str();
+        }
+        else
+        {
+            for (; t != string::npos; t = n->nodekey.find(':', t))
+            {
+                handle h = 0;
+                int l = Base64::atob(n->nodekey.c_str() + (n->nodekey.find_last_of('/', t) + 1), (byte*)&h, sizeof h);
+                t++;
+
+                if (l == USERHANDLE && h == me)
+                {
+                    sk = n->nodekey.c_str() + t;
+                    break;
+                }
+            }
+        }
+
+        if (!sk)
+        {
+            continue;
+        }
+
+        const char* ptr = sk;
+        while (*ptr && *ptr != '"' && *ptr != '/')
+        {
+            ptr++;
+        }
+
+        int sl = ptr - sk;
+        if (sl <= 4 * FILENODEKEYLENGTH / 3 + 1 || sl / 4 * 3 + 3 > 4096)
+        {
+            continue;
+        }
+
+        k.resize(sl / 4 * 3 + 3);
+        k.resize(Base64::atob(sk, (byte*)k.data(), k.size()));
+
+        encoded.push_back(string(sk, sl));
+        ciphers.push_back(k);
+    }
+
+    if (ciphers.size() < 2)
+    {
+        // not worth a batch, decryptkey() takes care of it
+        return;
+    }
+
+    vector<string> plains(ciphers.size());
+    unsigned decrypted = asymkey.decryptbatch(&ciphers[0], ciphers.size(), &plains[0], FILENODEKEYLENGTH);
+
+    for (unsigned i = 0; i < plains.size(); i++)
+    {
+        if (plains[i].size())
+        {
+            rsakeys[encoded[i]] = plains[i];
+        }
+    }
+
+    LOG_debug << "Decrypted " << decrypted << " of " << ciphers.size() << " RSA node keys";
+}
+
 // apply queued new shares
 void MegaClient::mergenewshares(bool notify)
 {
@@ -775,9 +881,15 @@ MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, Db
 {
     sctable = NULL;
     tctable = NULL;
+    tctransaction = false;
+    tcflushds = NEVER;
     me = UNDEF;
     publichandle = UNDEF;
     followsymlinks = false;
+#ifdef ENABLE_SYNC
+    syncscanthreads = 4;
+    syncmaxwatches = 0;
+#endif
     usealtdownport = false;
     usealtupport = false;
     retryessl = false;
@@ -809,6 +921,8 @@ MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, Db
     pendingcs = NULL;
     pendingsc = NULL;
 
+    traceid = TraceRecorder::newtid();
+
     xferpaused[PUT] = false;
     xferpaused[GET] = false;
     putmbpscap = 0;
@@ -906,6 +1020,8 @@ MegaClient::~MegaClient()
 // nonblocking state machine executing all operations currently in progress
 void MegaClient::exec()
 {
+    MetricTimer exectimer(Metrics::EXEC_TIME);
+
     WAIT_CLASS::bumpds();
 
     if (overquotauntil && overquotauntil < Waiter::ds)
@@ -964,6 +1080,7 @@ void MegaClient::exec()
     }
 
     bool first = true;
+    m_time_t phase = TraceRecorder::now();
     do
     {
         if (!first)
@@ -1164,9 +1281,13 @@ void MegaClient::exec()
                         fc->dispatch(this);
                     }
                 }
+
+                fc->updatetimers(this);
             }
         }
 
+        phase = TraceRecorder::complete("fileattributes", phase, traceid);
+
         // handle API client-server requests
         for (;;)
         {
@@ -1223,21 +1344,7 @@ void MegaClient::exec()
 
                                 WAIT_CLASS::bumpds();
 
-                                delete pendingcs;
-                                pendingcs = NULL;
-
-                                // increment unique request ID
-                                for (int i = sizeof reqid; i--; )
-                                {
-                                    if (reqid[i]++ < 'z')
-                                    {
-                                        break;
-                                    }
-                                    else
-                                    {
-                                        reqid[i] = 'a';
-                                    }
-                                }
+                                nextpendingcs();
                             }
                             else
                             {
@@ -1249,9 +1356,9 @@ void MegaClient::exec()
                                     e = API_EINTERNAL;
                                 }
 
+                                reqs.rejected();
                                 app->request_error(e);
-                                delete pendingcs;
-                                pendingcs = NULL;
+                                nextpendingcs();
                                 break;
                             }
 
@@ -1289,8 +1396,8 @@ void MegaClient::exec()
 
                             if (!retryessl)
                             {
-                                delete pendingcs;
-                                pendingcs = NULL;
+                                reqs.rejected();
+                                nextpendingcs();
                                 break;
                             }
                         }
@@ -1301,6 +1408,7 @@ void MegaClient::exec()
                         delete pendingcs;
                         pendingcs = NULL;
 
+                        reqs.failed();
                         btcs.backoff();
                         app->notify_retry(btcs.retryin());
                         csretrying = true;
@@ -1311,39 +1419,66 @@ void MegaClient::exec()
 
                 if (pendingcs)
                 {
-                    break;
+                    // the next request in flight has already completed
+                    if (pendingcs->status == REQ_SUCCESS || pendingcs->status == REQ_FAILURE)
+                    {
+                        continue;
+                    }
+
+                    if (!reqs.cmdspending() || !reqs.cansend())
+                    {
+                        break;
+                    }
                 }
             }
 
             if (btcs.armed())
             {
-                if (btcs.nextset())
-                {
-                    reqs.nextRequest();
-                }
-
                 if (reqs.cmdspending())
                 {
-                    pendingcs = new HttpReq();
-                    pendingcs->protect = true;
+                    HttpReq* req = new HttpReq();
+                    req->protect = true;
 
-                    reqs.get(pendingcs->out);
+                    string id(reqid, sizeof reqid);
+
+                    if (reqs.send(req->out, &id))
+                    {
+                        // increment unique request ID
+                        for (int i = sizeof reqid; i--; )
+                        {
+                            if (reqid[i]++ < 'z')
+                            {
+                                break;
+                            }
+                            else
+                            {
+                                reqid[i] = 'a';
+                            }
+                        }
+                    }
 
-                    pendingcs->posturl = APIURL;
+                    req->posturl = APIURL;
 
-                    pendingcs->posturl.append("cs?id=");
-                    pendingcs->posturl.append(reqid, sizeof reqid);
-                    pendingcs->posturl.append(auth);
-                    pendingcs->posturl.append(appkey);
+                    req->posturl.append("cs?id=");
+                    req->posturl.append(id);
+                    req->posturl.append(auth);
+                    req->posturl.append(appkey);
 
-                    pendingcs->type = REQ_JSON;
+                    req->type = REQ_JSON;
 
-                    pendingcs->post(this);
+                    req->post(this);
 
-                    reqs.nextRequest();
+                    if (pendingcs)
+                    {
+                        pipelinedcs.push_back(req);
+                    }
+                    else
+                    {
+                        pendingcs = req;
+                    }
                     continue;
                 }
-                else
+                else if (!pendingcs)
                 {
                     btcs.reset();
                 }
@@ -1351,6 +1486,8 @@ void MegaClient::exec()
             break;
         }
 
+        phase = TraceRecorder::complete("cs", phase, traceid);
+
         // handle API server-client requests
         if (!jsonsc.pos && pendingsc)
         {
@@ -1560,6 +1697,8 @@ void MegaClient::exec()
             }
         }
 
+        phase = TraceRecorder::complete("sc", phase, traceid);
+
         // fill transfer slots from the queue
         dispatchmore(PUT);
         dispatchmore(GET);
@@ -1583,6 +1722,8 @@ void MegaClient::exec()
             }
         }
 
+        phase = TraceRecorder::complete("transfers", phase, traceid);
+
 #ifdef ENABLE_SYNC
         // verify filesystem fingerprints, disable deviating syncs
         // (this covers mountovers, some device removals and some failures)
@@ -1652,6 +1793,12 @@ void MegaClient::exec()
             // process active syncs, stop doing so while transient local fs ops are pending
             if (syncs.size() || syncactivity)
             {
+                // queue what the scanner threads have found so far
+                for (it = syncs.begin(); it != syncs.end(); it++)
+                {
+                    (*it)->mergescan();
+                }
+
                 bool prevpending = false;
                 for (int q = syncfslockretry ? DirNotify::RETRY : DirNotify::DIREVENTS; q >= DirNotify::DIREVENTS; q--)
                 {
@@ -1731,7 +1878,8 @@ void MegaClient::exec()
                                     }
                                 }
 
-                                if (sync->state == SYNC_INITIALSCAN && q == DirNotify::DIREVENTS && !sync->dirnotify->notifyq[q].size())
+                                if (sync->state == SYNC_INITIALSCAN && q == DirNotify::DIREVENTS && !sync->dirnotify->notifyq[q].size()
+                                 && !sync->scanpending())
                                 {
                                     sync->changestate(SYNC_ACTIVE);
 
@@ -1762,7 +1910,7 @@ void MegaClient::exec()
                         totalpending += sync->dirnotify->notifyq[q].size();
                         if (q == DirNotify::DIREVENTS)
                         {
-                            scanningpending += sync->dirnotify->notifyq[q].size();
+                            scanningpending += sync->dirnotify->notifyq[q].size() + sync->scanpending();
                         }
                         else if (!syncfslockretry && sync->dirnotify->notifyq[DirNotify::RETRY].size())
                         {
@@ -1847,6 +1995,12 @@ void MegaClient::exec()
 
                             break;
                         }
+
+                        // (the scanner threads wake us up when they have found more)
+                        if ((*it)->scanpending())
+                        {
+                            break;
+                        }
                     }
 
                     if (it == syncs.end())
@@ -1914,7 +2068,8 @@ void MegaClient::exec()
                                 if (sync->state == SYNC_ACTIVE || sync->state == SYNC_INITIALSCAN)
                                 {
                                     if (sync->dirnotify->notifyq[DirNotify::DIREVENTS].size()
-                                     || sync->dirnotify->notifyq[DirNotify::RETRY].size())
+                                     || sync->dirnotify->notifyq[DirNotify::RETRY].size()
+                                     || sync->scanpending())
                                     {
                                         break;
                                     }
@@ -2052,8 +2207,12 @@ void MegaClient::exec()
         }
 #endif
 
+        phase = TraceRecorder::complete("syncs", phase, traceid);
+
         notifypurge();
 
+        phase = TraceRecorder::complete("notifypurge", phase, traceid);
+
         if (!badhostcs && badhosts.size() && btbadhost.armed())
         {
             // report hosts affected by failed requests
@@ -2081,7 +2240,54 @@ void MegaClient::exec()
 
         httpio->updatedownloadspeed();
         httpio->updateuploadspeed();
-    } while (httpio->doio() || execdirectreads() || (!pendingcs && reqs.cmdspending() && btcs.armed()) || looprequested);
+
+        phase = TraceRecorder::complete("misc", phase, traceid);
+    } while (doio(&phase) || execdirectreads() || (reqs.cmdspending() && btcs.armed() && (!pendingcs || reqs.cansend())) || looprequested);
+
+    // transfer cache changes are committed together
+    if (EVER(tcflushds) && Waiter::ds >= tcflushds)
+    {
+        transfercacheflush();
+        TraceRecorder::complete("transfercacheflush", phase, traceid);
+    }
+}
+
+void MegaClient::getmetrics(ClientMetrics* metrics)
+{
+    metrics->counters[ClientMetrics::HTTP_NEW_CONNECTIONS] = httpio->newconnections;
+    metrics->counters[ClientMetrics::HTTP_REUSED_CONNECTIONS] = httpio->reusedconnections;
+    metrics->counters[ClientMetrics::HTTP_HANDSHAKE_MS] = httpio->handshaketimems;
+    metrics->counters[ClientMetrics::DNS_LOOKUPS] = httpio->dnslookups;
+    metrics->counters[ClientMetrics::DNS_CACHE_HITS] = httpio->dnscachehits;
+    metrics->counters[ClientMetrics::DNS_STALE_HITS] = httpio->dnsstalehits;
+    metrics->counters[ClientMetrics::DNS_WAIT_MS] = httpio->dnswaittimems;
+
+    metrics->gauges[ClientMetrics::API_COMMANDS_QUEUED] = reqs.cmdspending();
+    metrics->gauges[ClientMetrics::API_REQUESTS_INFLIGHT] = reqs.inflight();
+    metrics->gauges[ClientMetrics::TRANSFERS_QUEUED] = transfers[GET].size() + transfers[PUT].size();
+    metrics->gauges[ClientMetrics::TRANSFER_SLOTS] = tslots.size();
+}
+
+// the gauges keep their values
+void MegaClient::resetmetrics()
+{
+    httpio->newconnections = 0;
+    httpio->reusedconnections = 0;
+    httpio->handshaketimems = 0;
+    httpio->dnslookups = 0;
+    httpio->dnscachehits = 0;
+    httpio->dnsstalehits = 0;
+    httpio->dnswaittimems = 0;
+}
+
+// network I/O of the exec() loop, as a phase of its own in a trace
+bool MegaClient::doio(m_time_t* phase)
+{
+    bool done = httpio->doio();
+
+    *phase = TraceRecorder::complete("doio", *phase, traceid);
+
+    return done;
 }
 
 // get next event time from all subsystems, then invoke the waiter if needed
@@ -2122,17 +2328,9 @@ int MegaClient::preparewait()
             nds = Waiter::ds;
         }
 
-        nexttransferretry(PUT, &nds);
-        nexttransferretry(GET, &nds);
-
-        // retry transferslots
-        for (transferslot_list::iterator it = tslots.begin(); it != tslots.end(); it++)
-        {
-            if (!(*it)->retrybt.armed())
-            {
-                (*it)->retrybt.update(&nds);
-            }
-        }
+        // retry failed transfers and transferslots, file attribute
+        // fetch backoffs and timeouts
+        timers.update(&nds);
 
         // retry failed client-server requests
         if (!pendingcs)
@@ -2163,19 +2361,6 @@ int MegaClient::preparewait()
             btpfa.update(&nds);
         }
 
-        // retry failed file attribute gets
-        for (fafc_map::iterator cit = fafcs.begin(); cit != fafcs.end(); cit++)
-        {
-            if (cit->second->req.status == REQ_INFLIGHT)
-            {
-                cit->second->timeout.update(&nds);
-            }
-            else if (cit->second->fafs[1].size() || cit->second->fafs[0].size())
-            {
-                cit->second->bt.update(&nds);
-            }
-        }
-
         // next pending pread event
         if (!dsdrns.empty())
         {
@@ -2192,6 +2377,12 @@ int MegaClient::preparewait()
             }
         }
 
+        // write-behind of the transfer cache
+        if (EVER(tcflushds) && tcflushds < nds)
+        {
+            nds = tcflushds > Waiter::ds ? tcflushds : Waiter::ds;
+        }
+
 #ifdef ENABLE_SYNC
         // sync rescan
         if (syncscanfailed)
@@ -2326,6 +2517,7 @@ bool MegaClient::abortbackoff(bool includexfers)
                 {
                     if (it->second->bt.arm())
                     {
+                        transferlist.schedule(it->second);
                         r = true;
                     }
                 }
@@ -2769,27 +2961,6 @@ void MegaClient::freeq(direction_t d)
     }
 }
 
-// determine next scheduled transfer retry
-// FIXME: make this an ordered set and only check the first element instead of
-// scanning the full map!
-void MegaClient::nexttransferretry(direction_t d, dstime* dsmin)
-{
-    for (transfer_map::iterator it = transfers[d].begin(); it != transfers[d].end(); it++)
-    {
-        if ((!it->second->slot || !it->second->slot->fa)
-         && it->second->bt.nextset())
-        {
-            it->second->bt.update(dsmin);
-            if (it->second->bt.armed())
-            {
-                // fire the timer only once but keeping it armed
-                it->second->bt.set(0);
-                LOG_debug << "Disabling armed transfer backoff";
-            }
-        }
-    }
-}
-
 // disconnect all HTTP connections (slows down operations, but is semantically neutral)
 void MegaClient::disconnect()
 {
@@ -2799,6 +2970,11 @@ void MegaClient::disconnect()
         pendingcs->disconnect();
     }
 
+    for (deque<HttpReq*>::iterator it = pipelinedcs.begin(); it != pipelinedcs.end(); it++)
+    {
+        (*it)->disconnect();
+    }
+
     if (pendingsc)
     {
         pendingsc->disconnect();
@@ -2824,6 +3000,7 @@ void MegaClient::disconnect()
     for (fafc_map::iterator it = fafcs.begin(); it != fafcs.end(); it++)
     {
         it->second->req.disconnect();
+        it->second->updatetimers(this);
     }
 
     for (transferslot_list::iterator it = tslots.begin(); it != tslots.end(); it++)
@@ -2840,6 +3017,18 @@ void MegaClient::disconnect()
     httpio->disconnect();
 }
 
+void MegaClient::nextpendingcs()
+{
+    delete pendingcs;
+    pendingcs = NULL;
+
+    if (!pipelinedcs.empty())
+    {
+        pendingcs = pipelinedcs.front();
+        pipelinedcs.pop_front();
+    }
+}
+
 void MegaClient::abortlockrequest()
 {
     delete workinglockcs;
@@ -2875,6 +3064,9 @@ void MegaClient::locallogout()
     publichandle = UNDEF;
     cachedscsn = UNDEF;
 
+    // the cache keeps the last state of the transfers
+    transfercacheflush();
+
     freeq(GET);
     freeq(PUT);
 
@@ -2888,6 +3080,12 @@ void MegaClient::locallogout()
     delete pendingcs;
     pendingcs = NULL;
 
+    while (!pipelinedcs.empty())
+    {
+        delete pipelinedcs.front();
+        pipelinedcs.pop_front();
+    }
+
     for (putfa_list::iterator it = queuedfa.begin(); it != queuedfa.end(); it++)
     {
         delete *it;
@@ -2900,6 +3098,7 @@ void MegaClient::locallogout()
 
     queuedfa.clear();
     activefa.clear();
+    bufferpool.clear();
     xferpaused[PUT] = false;
     xferpaused[GET] = false;
     putmbpscap = 0;
@@ -3040,7 +3239,7 @@ bool MegaClient::procsc()
 
                         if (tctable && cachedfiles.size())
                         {
-                            tctable->begin();
+                            tcbegin();
                             for (unsigned int i = 0; i < cachedfiles.size(); i++)
                             {
                                 direction_t type = NONE;
@@ -3060,7 +3259,7 @@ bool MegaClient::procsc()
                             }
                             cachedfiles.clear();
                             cachedfilesdbids.clear();
-                            tctable->commit();
+                            transfercacheflush();
                         }
 
                         WAIT_CLASS::bumpds();
@@ -3124,6 +3323,8 @@ bool MegaClient::procsc()
         {
             if (jsonsc.enterobject())
             {
+                m_time_t apstart = Waiter::getmicros();
+
                 // the "a" attribute is guaranteed to be the first in the object
                 if (jsonsc.getnameid() == 'a')
                 {
@@ -3292,6 +3493,9 @@ bool MegaClient::procsc()
                     }
                 }
 
+                Metrics::add(Metrics::ACTION_PACKETS);
+                Metrics::observe(Metrics::ACTION_PACKET_TIME, Waiter::getmicros() - apstart);
+
                 jsonsc.leaveobject();
             }
             else
@@ -3391,6 +3595,8 @@ void MegaClient::updatesc()
             return;
         }
 
+        MetricTimer timer(Metrics::UPDATESC_TIME);
+
         bool complete;
 
         // 1. update associated scsn
@@ -3542,6 +3748,7 @@ error MegaClient::getfa(Node* n, fatype t, int cancel)
                         cit->second->req.disconnect();
                     }
 
+                    cit->second->updatetimers(this);
                     return API_OK;
                 }
             }
@@ -3583,6 +3790,7 @@ error MegaClient::getfa(Node* n, fatype t, int cancel)
             return API_EEXIST;
         }
 
+        (*fafcp)->updatetimers(this);
         return API_OK;
     }
 }
@@ -5413,6 +5621,7 @@ int MegaClient::readnodes(JSON* j, int notify, putsource_t source, NewNode* nn,
     }
 
     node_vector dp;
+    node_vector notified;
     Node* n;
 
     while (j->enterobject())
@@ -5628,7 +5837,7 @@ int MegaClient::readnodes(JSON* j, int notify, putsource_t source, NewNode* nn,
                     sts = ts;
                 }
 
-                n = new Node(this, &dp, h, ph, t, s, u, fas.c_str(), ts);
+                n = new (this) Node(this, &dp, h, ph, t, s, u, fas.c_str(), ts);
 
                 n->tag = tag;
 
@@ -5681,11 +5890,24 @@ int MegaClient::readnodes(JSON* j, int notify, putsource_t source, NewNode* nn,
 
             if (notify)
             {
-                notifynode(n);
+                notified.push_back(n);
             }
         }
     }
 
+    // notify once the keys of all the nodes can be decrypted in one batch
+    if (notified.size())
+    {
+        decryptrsakeys(&notified);
+
+        for (unsigned i = 0; i < notified.size(); i++)
+        {
+            notifynode(notified[i]);
+        }
+
+        rsakeys.clear();
+    }
+
     // any child nodes that arrived before their parents?
     for (int i = dp.size(); i--; )
     {
@@ -6105,6 +6327,8 @@ int MegaClient::applykeys()
 {
     int t = 0;
 
+    decryptrsakeys(NULL);
+
     // FIXME: rather than iterating through the whole node set, maintain subset
     // with missing keys
     for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
@@ -6115,6 +6339,8 @@ int MegaClient::applykeys()
         }
     }
 
+    rsakeys.clear();
+
     if (sharekeyrewrite.size())
     {
         reqs.add(new CommandShareKeyUpdate(this, &sharekeyrewrite));
@@ -7273,29 +7499,64 @@ void MegaClient::notifynode(Node* n)
     }
 }
 
+// open the transaction that collects the transfer cache changes until the
+// next flush
+void MegaClient::tcbegin()
+{
+    if (!tctransaction)
+    {
+        tctable->begin();
+        tctransaction = true;
+    }
+
+    if (!EVER(tcflushds))
+    {
+        tcflushds = Waiter::ds + TRANSFERCACHEFLUSHDS;
+    }
+}
+
 void MegaClient::transfercacheadd(Transfer *transfer)
 {
     if (tctable)
     {
-        LOG_debug << "Caching transfer";
-        tctable->put(MegaClient::CACHEDTRANSFER, transfer, &tckey);
+        // repeated updates of the same transfer are written once
+        tcdirty.insert(transfer);
+
+        if (!EVER(tcflushds))
+        {
+            tcflushds = Waiter::ds + TRANSFERCACHEFLUSHDS;
+        }
     }
 }
 
 void MegaClient::transfercachedel(Transfer *transfer)
 {
+    tcdirty.erase(transfer);
+
     if (tctable && transfer->dbid)
     {
         LOG_debug << "Removing cached transfer";
+        tcbegin();
         tctable->del(transfer->dbid);
     }
 }
 
+void MegaClient::transfercachedetach(Transfer *transfer)
+{
+    // a record that was never written can't be referenced yet
+    if (tcdirty.erase(transfer) && tctable && transfer->dbid && !transfer->finished)
+    {
+        tcbegin();
+        tctable->put(MegaClient::CACHEDTRANSFER, transfer, &tckey);
+    }
+}
+
 void MegaClient::filecacheadd(File *file)
 {
     if (tctable && !file->syncxfer)
     {
         LOG_debug << "Caching file";
+        tcbegin();
         tctable->put(MegaClient::CACHEDFILE, file, &tckey);
     }
 }
@@ -7305,6 +7566,7 @@ void MegaClient::filecachedel(File *file)
     if (tctable && !file->syncxfer)
     {
         LOG_debug << "Removing cached file";
+        tcbegin();
         tctable->del(file->dbid);
     }
 
@@ -7315,6 +7577,27 @@ void MegaClient::filecachedel(File *file)
     }
 }
 
+void MegaClient::transfercacheflush()
+{
+    if (tctable && (tcdirty.size() || tctransaction))
+    {
+        LOG_debug << "Writing " << tcdirty.size() << " cached transfers";
+
+        tcbegin();
+
+        for (transfer_set::iterator it = tcdirty.begin(); it != tcdirty.end(); it++)
+        {
+            tctable->put(MegaClient::CACHEDTRANSFER, *it, &tckey);
+        }
+
+        tctable->commit();
+    }
+
+    tcdirty.clear();
+    tctransaction = false;
+    tcflushds = NEVER;
+}
+
 // queue user for notification
 void MegaClient::notifyuser(User* u)
 {
@@ -8134,6 +8417,8 @@ void MegaClient::closetc(bool remove)
     cachedfiles.clear();
     cachedfilesdbids.clear();
 
+    transfercacheflush();
+
     if (remove && tctable)
     {
         tctable->remove();
@@ -8219,7 +8504,7 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
     // postpone the resumption until the filesystem is updated
     if ((!sid.size() && publichandle == UNDEF) || statecurrent)
     {
-        tctable->begin();
+        tcbegin();
         for (unsigned int i = 0; i < cachedfiles.size(); i++)
         {
             direction_t type = NONE;
@@ -8239,7 +8524,7 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
         }
         cachedfiles.clear();
         cachedfilesdbids.clear();
-        tctable->commit();
+        transfercacheflush();
     }
 }
 
@@ -10016,11 +10301,7 @@ void MegaClient::putnodes_sync_result(error e, NewNode* nn, int nni)
         {
             if ((n = nodebyhandle(nn[nni].nodehandle)))
             {
-                if (n->fingerprint_it != fingerprints.end())
-                {
-                    fingerprints.erase(n->fingerprint_it);
-                    n->fingerprint_it = fingerprints.end();
-                }
+                fingerprints.remove(n);
             }
         }
         else if (nn[nni].localnode && (n = nn[nni].localnode->node))
@@ -10072,11 +10353,11 @@ void MegaClient::movetosyncdebris(Node* dn, bool unlink)
     {
         if (unlink)
         {
-            dn->tounlink_it = tounlink.insert(dn).first;
+            tounlink.insert(dn);
         }
         else
         {
-            dn->todebris_it = todebris.insert(dn).first;        
+            todebris.insert(dn);
         }
     }
 }
@@ -10129,7 +10410,6 @@ void MegaClient::execsyncunlink()
             reqtag = creqtag;
         }
 
-        tn->tounlink_it = tounlink.end();
         tounlink.erase(tounlink.begin());
     } while (tounlink.size());
 }
@@ -10213,7 +10493,6 @@ void MegaClient::execmovetosyncdebris()
                 else
                 {
                     n->syncdeleted = SYNCDEL_NONE;
-                    n->todebris_it = todebris.end();
                     todebris.erase(it++);
                 }
             }
@@ -10225,7 +10504,6 @@ void MegaClient::execmovetosyncdebris()
         else if (n->syncdeleted == SYNCDEL_DEBRISDAY)
         {
             n->syncdeleted = SYNCDEL_NONE;
-            n->todebris_it = todebris.end();
             todebris.erase(it++);
         }
         else
@@ -10570,23 +10848,15 @@ void MegaClient::setmaxconnections(direction_t d, int num)
 
 Node* MegaClient::nodebyfingerprint(FileFingerprint* fingerprint)
 {
-    fingerprint_set::iterator it;
-
-    if ((it = fingerprints.find(fingerprint)) != fingerprints.end())
-    {
-        return (Node*)*it;
-    }
-
-    return NULL;
+    return fingerprints.find(fingerprint);
 }
 
 node_vector *MegaClient::nodesbyfingerprint(FileFingerprint* fingerprint)
 {
     node_vector *nodes = new node_vector();
-    pair<fingerprint_set::iterator, fingerprint_set::iterator> p = fingerprints.equal_range(fingerprint);
-    for (fingerprint_set::iterator it = p.first; it != p.second; it++)
+    for (Node* n = fingerprints.find(fingerprint); n; n = FingerprintIndex::next(n))
     {
-        nodes->push_back((Node*)*it);
+        nodes->push_back(n);
     }
     return nodes;
 }
@@ -0,0 +1,522 @@
+/**
+ * @file metrics.cpp
+ * @brief Performance counters, latency histograms and event tracing
+ *
+ * (c) 2013-2014 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega.h"
+#include "mega/metrics.h"
+
+// updates from several threads must not get lost
+#if defined(_WIN32)
+#define METRIC_ADD(var, value) InterlockedExchangeAdd64((volatile LONG64*)(var), (LONG64)(value))
+#define METRIC_CAS64(var, old, value) ((uint64_t)InterlockedCompareExchange64((volatile LONG64*)(var), (LONG64)(value), (LONG64)(old)))
+#define METRIC_CASPTR(var, old, value) InterlockedCompareExchangePointer((PVOID volatile*)(var), (PVOID)(value), (PVOID)(old))
+#elif defined(__GNUC__)
+#define METRIC_ADD(var, value) __sync_fetch_and_add((var), (value))
+#define METRIC_CAS64(var, old, value) __sync_val_compare_and_swap((var), (old), (value))
+#define METRIC_CASPTR(var, old, value) __sync_val_compare_and_swap((var), (old), (value))
+#else
+#define METRIC_ADD(var, value) (*(var) += (value))
+#define METRIC_CAS64(var, old, value) (*(var) == (old) ? (*(var) = (value), (old)) : *(var))
+#define METRIC_CASPTR(var, old, value) (*(var) == (old) ? (*(var) = (value), (old)) : *(var))
+#endif
+
+namespace mega {
+
+// protects the trace output
+#ifdef MUTEX_CLASS
+static MUTEX_CLASS metricsMutex(false);
+#define METRICS_LOCK() metricsMutex.lock()
+#define METRICS_UNLOCK() metricsMutex.unlock()
+#else
+#define METRICS_LOCK()
+#define METRICS_UNLOCK()
+#endif
+
+volatile uint64_t Metrics::counters[Metrics::NUMCOUNTERS];
+MetricHistogram Metrics::histograms[Metrics::NUMHISTOGRAMS];
+const char* volatile Metrics::commandnames[Metrics::MAXCOMMANDS];
+MetricHistogram Metrics::commandhistograms[Metrics::MAXCOMMANDS];
+volatile bool Metrics::timingenabled = false;
+
+static const char* counternames[Metrics::NUMCOUNTERS] = {
+    "api_requests",
+    "api_commands",
+    "action_packets",
+    "crypto_bytes",
+    "crypto_microseconds",
+    "disk_read_bytes",
+    "disk_write_bytes",
+    "fs_notifications",
+    "fs_notifications_coalesced",
+    "fs_notify_overflows",
+    "fs_unwatched_scans"
+};
+
+static const char* clientcounternames[ClientMetrics::NUMCOUNTERS] = {
+    "http_new_connections",
+    "http_reused_connections",
+    "http_handshake_milliseconds",
+    "dns_lookups",
+    "dns_cache_hits",
+    "dns_stale_hits",
+    "dns_wait_milliseconds"
+};
+
+static const char* gaugenames[ClientMetrics::NUMGAUGES] = {
+    "api_commands_queued",
+    "api_requests_inflight",
+    "transfers_queued",
+    "transfer_slots",
+    "callbacks_queued"
+};
+
+static const char* histogramnames[Metrics::NUMHISTOGRAMS] = {
+    "api_rtt",
+    "action_packet_time",
+    "updatesc_time",
+    "disk_read_time",
+    "disk_write_time",
+    "listener_callback_time",
+    "exec_time"
+};
+
+MetricHistogram::MetricHistogram()
+{
+    reset();
+}
+
+void MetricHistogram::reset()
+{
+    count = 0;
+    sum = 0;
+    max = 0;
+    memset((void*)buckets, 0, sizeof buckets);
+}
+
+void MetricHistogram::observe(m_time_t micros)
+{
+    int b = 0;
+
+    if (micros < 0)
+    {
+        micros = 0;
+    }
+
+    while (b < NUMBUCKETS - 1 && ((m_time_t)1 << b) < micros)
+    {
+        b++;
+    }
+
+    METRIC_ADD(&buckets[b], 1);
+    METRIC_ADD(&sum, (uint64_t)micros);
+    METRIC_ADD(&count, 1);
+
+    uint64_t seen = max;
+
+    while ((uint64_t)micros > seen)
+    {
+        uint64_t prev = METRIC_CAS64(&max, seen, (uint64_t)micros);
+
+        if (prev == seen)
+        {
+            break;
+        }
+
+        seen = prev;
+    }
+}
+
+m_time_t MetricHistogram::percentile(double fraction) const
+{
+    uint64_t total = count;
+
+    if (!total)
+    {
+        return -1;
+    }
+
+    uint64_t target = (uint64_t)(fraction * total + 0.5);
+    uint64_t seen = 0;
+
+    for (int b = 0; b < NUMBUCKETS - 1; b++)
+    {
+        seen += buckets[b];
+
+        if (seen >= target)
+        {
+            return (m_time_t)1 << b;
+        }
+    }
+
+    return (m_time_t)1 << (NUMBUCKETS - 1);
+}
+
+void Metrics::add(counter_t counter, uint64_t value)
+{
+    METRIC_ADD(&counters[counter], value);
+}
+
+void Metrics::observe(histogram_t histogram, m_time_t micros)
+{
+    histograms[histogram].observe(micros);
+}
+
+void Metrics::observecommand(const char* command, m_time_t micros)
+{
+    unsigned hash = 0;
+
+    for (const char* p = command; *p; p++)
+    {
+        hash = hash * 31 + (unsigned char)*p;
+    }
+
+    for (int i = 0; i < MAXCOMMANDS; i++)
+    {
+        int slot = (hash + i) % MAXCOMMANDS;
+        const char* name = commandnames[slot];
+
+        if (!name)
+        {
+            name = (const char*)METRIC_CASPTR(&commandnames[slot], (const char*)NULL, command);
+
+            if (!name)
+            {
+                name = command;
+            }
+        }
+
+        if (name == command || !strcmp(name, command))
+        {
+            commandhistograms[slot].observe(micros);
+            return;
+        }
+    }
+}
+
+uint64_t Metrics::get(counter_t counter)
+{
+    return counters[counter];
+}
+
+const MetricHistogram& Metrics::get(histogram_t histogram)
+{
+    return histograms[histogram];
+}
+
+void Metrics::settiming(bool enable)
+{
+    timingenabled = enable;
+}
+
+void Metrics::reset()
+{
+    memset((void*)counters, 0, sizeof counters);
+
+    for (int i = 0; i < NUMHISTOGRAMS; i++)
+    {
+        histograms[i].reset();
+    }
+
+    for (int i = 0; i < MAXCOMMANDS; i++)
+    {
+        commandhistograms[i].reset();
+    }
+}
+
+ClientMetrics::ClientMetrics()
+{
+    memset(counters, 0, sizeof counters);
+    memset(gauges, 0, sizeof gauges);
+    callbacklatency = NULL;
+}
+
+static void histogramjson(ostringstream& oss, const MetricHistogram& h)
+{
+    uint64_t count = h.count;
+    uint64_t sum = h.sum;
+
+    oss << "{\"count\":" << count
+        << ",\"sum\":" << sum
+        << ",\"mean\":" << (count ? sum / count : 0)
+        << ",\"p50\":" << h.percentile(0.5)
+        << ",\"p90\":" << h.percentile(0.9)
+        << ",\"p99\":" << h.percentile(0.99)
+        << ",\"max\":" << h.max << "}";
+}
+
+// all times in microseconds; percentiles are the upper bounds of the
+// buckets that contain them
+void Metrics::tojson(string* json, const ClientMetrics* client)
+{
+    ostringstream oss;
+
+    oss << "{\"counters\":{";
+    for (int i = 0; i < NUMCOUNTERS; i++)
+    {
+        oss << (i ? "," : "") << "\"" << counternames[i] << "\":" << counters[i];
+    }
+
+    if (client)
+    {
+        for (int i = 0; i < ClientMetrics::NUMCOUNTERS; i++)
+        {
+            oss << ",\"" << clientcounternames[i] << "\":" << client->counters[i];
+        }
+    }
+
+    oss << "},\"gauges\":{";
+    if (client)
+    {
+        for (int i = 0; i < ClientMetrics::NUMGAUGES; i++)
+        {
+            oss << (i ? "," : "") << "\"" << gaugenames[i] << "\":" << client->gauges[i];
+        }
+    }
+
+    oss << "},\"histograms\":{";
+    for (int i = 0; i < NUMHISTOGRAMS; i++)
+    {
+        oss << (i ? "," : "") << "\"" << histogramnames[i] << "\":";
+        histogramjson(oss, histograms[i]);
+    }
+
+    if (client && client->callbacklatency)
+    {
+        oss << ",\"callback_latency\":";
+        histogramjson(oss, *client->callbacklatency);
+    }
+
+    oss << "},\"api_commands\":{";
+
+    bool first = true;
+    for (int i = 0; i < MAXCOMMANDS; i++)
+    {
+        if (const char* name = commandnames[i])
+        {
+            oss << (first ? "" : ",") << "\"" << name << "\":";
+            histogramjson(oss, commandhistograms[i]);
+            first = false;
+        }
+    }
+
+    uint64_t cryptomicros = counters[CRYPTO_MICROS];
+
+    oss << "},\"crypto_bytes_per_second\":"
+        << (cryptomicros ? counters[CRYPTO_BYTES] * 1000000 / cryptomicros : 0)
+        << "}";
+
+    json->append(oss.str());
+}
+
+static void histogramprometheus(ostringstream& oss, const string& name, const string& labels, const MetricHistogram& h)
+{
+    uint64_t cumulative = 0;
+    char le[32];
+
+    for (int b = 0; b < MetricHistogram::NUMBUCKETS; b++)
+    {
+        cumulative += h.buckets[b];
+
+        if (b < MetricHistogram::NUMBUCKETS - 1)
+        {
+            sprintf(le, "%g", ((m_time_t)1 << b) / 1000000.0);
+        }
+        else
+        {
+            strcpy(le, "+Inf");
+        }
+
+        oss << name << "_bucket{" << labels << (labels.size() ? "," : "") << "le=\"" << le << "\"} " << cumulative << "\n";
+    }
+
+    string braces = labels.size() ? "{" + labels + "}" : "";
+
+    oss << name << "_sum" << braces << " " << h.sum / 1000000.0 << "\n";
+    oss << name << "_count" << braces << " " << h.count << "\n";
+}
+
+// Prometheus text exposition format, times in seconds
+void Metrics::toprometheus(string* text, const ClientMetrics* client)
+{
+    ostringstream oss;
+
+    for (int i = 0; i < NUMCOUNTERS; i++)
+    {
+        oss << "# TYPE mega_" << counternames[i] << "_total counter\n"
+            << "mega_" << counternames[i] << "_total " << counters[i] << "\n";
+    }
+
+    if (client)
+    {
+        for (int i = 0; i < ClientMetrics::NUMCOUNTERS; i++)
+        {
+            oss << "# TYPE mega_" << clientcounternames[i] << "_total counter\n"
+                << "mega_" << clientcounternames[i] << "_total " << client->counters[i] << "\n";
+        }
+
+        for (int i = 0; i < ClientMetrics::NUMGAUGES; i++)
+        {
+            oss << "# TYPE mega_" << gaugenames[i] << " gauge\n"
+                << "mega_" << gaugenames[i] << " " << client->gauges[i] << "\n";
+        }
+    }
+
+    for (int i = 0; i < NUMHISTOGRAMS; i++)
+    {
+        string name = string("mega_") + histogramnames[i] + "_seconds";
+
+        oss << "# TYPE " << name << " histogram\n";
+        histogramprometheus(oss, name, "", histograms[i]);
+    }
+
+    if (client && client->callbacklatency)
+    {
+        oss << "# TYPE mega_callback_latency_seconds histogram\n";
+        histogramprometheus(oss, "mega_callback_latency_seconds", "", *client->callbacklatency);
+    }
+
+    oss << "# TYPE mega_api_command_rtt_seconds histogram\n";
+
+    for (int i = 0; i < MAXCOMMANDS; i++)
+    {
+        if (const char* name = commandnames[i])
+        {
+            histogramprometheus(oss, "mega_api_command_rtt_seconds", string("command=\"") + name + "\"", commandhistograms[i]);
+        }
+    }
+
+    text->append(oss.str());
+}
+
+MetricTimer::MetricTimer(Metrics::histogram_t h, bool enabled)
+{
+    histogram = h;
+    start = enabled ? Waiter::getmicros() : 0;
+}
+
+MetricTimer::~MetricTimer()
+{
+    if (start)
+    {
+        Metrics::observe(histogram, Waiter::getmicros() - start);
+    }
+}
+
+volatile bool TraceRecorder::enabled = false;
+
+// trace output, written in the JSON array format (which is valid without
+// the closing bracket, should the process end before stop())
+static FILE* tracefile = NULL;
+static string tracebuf;
+static bool tracefirst;
+static volatile uint64_t tracetids = 0;
+
+static void traceflush()
+{
+    if (tracefile && tracebuf.size())
+    {
+        fwrite(tracebuf.data(), 1, tracebuf.size(), tracefile);
+        fflush(tracefile);
+        tracebuf.clear();
+    }
+}
+
+bool TraceRecorder::start(const char* path)
+{
+    stop();
+
+    METRICS_LOCK();
+
+    if ((tracefile = fopen(path, "w")))
+    {
+        fputs("[\n", tracefile);
+        tracefirst = true;
+        enabled = true;
+    }
+
+    METRICS_UNLOCK();
+
+    return tracefile != NULL;
+}
+
+void TraceRecorder::stop()
+{
+    METRICS_LOCK();
+
+    enabled = false;
+
+    if (tracefile)
+    {
+        traceflush();
+        fputs("\n]\n", tracefile);
+        fclose(tracefile);
+        tracefile = NULL;
+    }
+
+    METRICS_UNLOCK();
+}
+
+m_time_t TraceRecorder::now()
+{
+    return enabled ? Waiter::getmicros() : 0;
+}
+
+m_time_t TraceRecorder::complete(const char* name, m_time_t start, unsigned tid)
+{
+    if (!start || !enabled)
+    {
+        return 0;
+    }
+
+    m_time_t end = Waiter::getmicros();
+    char event[192];
+
+    // event names are string literals without characters to escape
+    int len = snprintf(event, sizeof event,
+                       "{\"name\":\"%s\",\"cat\":\"exec\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%u}",
+                       name, (long long)start, (long long)(end - start), tid);
+
+    METRICS_LOCK();
+
+    if (tracefile && len > 0 && len < (int)sizeof event)
+    {
+        if (!tracefirst)
+        {
+            tracebuf.append(",\n");
+        }
+        tracebuf.append(event, len);
+        tracefirst = false;
+
+        if (tracebuf.size() >= FLUSHSIZE)
+        {
+            traceflush();
+        }
+    }
+
+    METRICS_UNLOCK();
+
+    return end;
+}
+
+unsigned TraceRecorder::newtid()
+{
+    return (unsigned)METRIC_ADD(&tracetids, 1) + 1;
+}
+} // namespace
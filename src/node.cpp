@@ -31,6 +31,269 @@
 #include "mega/logging.h"
 
 namespace mega {
+NodeArena::NodeArena()
+{
+    chunks = NULL;
+    freeblocks = NULL;
+    blocksize = 0;
+    inuse = 0;
+    reserved = 0;
+}
+
+NodeArena::~NodeArena()
+{
+    // all Nodes must have been deleted
+    assert(!inuse);
+    release();
+}
+
+void NodeArena::release()
+{
+    while (chunks)
+    {
+        Chunk* next = chunks->next;
+#ifdef _WIN32
+        _aligned_free(chunks);
+#else
+        free(chunks);
+#endif
+        chunks = next;
+    }
+
+    freeblocks = NULL;
+    reserved = 0;
+}
+
+void* NodeArena::allocate(size_t size)
+{
+    if (!blocksize)
+    {
+        // room for the free list link, keep the alignment of the header
+        blocksize = (std::max(size, sizeof(void*)) + sizeof(Chunk) - 1) / sizeof(Chunk) * sizeof(Chunk);
+    }
+
+    assert(size <= blocksize);
+
+    if (!freeblocks)
+    {
+        void* ptr;
+
+#ifdef _WIN32
+        if (!(ptr = _aligned_malloc(CHUNKSIZE, CHUNKSIZE)))
+#else
+        if (posix_memalign(&ptr, CHUNKSIZE, CHUNKSIZE))
+#endif
+        {
+            throw std::bad_alloc();
+        }
+
+        Chunk* chunk = (Chunk*)ptr;
+        chunk->arena = this;
+        chunk->next = chunks;
+        chunks = chunk;
+        reserved += CHUNKSIZE;
+
+        // thread the chunk's blocks into the free list
+        char* blocks = (char*)(chunk + 1);
+        for (size_t i = (CHUNKSIZE - sizeof(Chunk)) / blocksize; i--; )
+        {
+            *(void**)(blocks + i * blocksize) = freeblocks;
+            freeblocks = blocks + i * blocksize;
+        }
+    }
+
+    void* block = freeblocks;
+    freeblocks = *(void**)block;
+    inuse++;
+
+    return block;
+}
+
+void NodeArena::deallocate(void* block)
+{
+    if (!block)
+    {
+        return;
+    }
+
+    NodeArena* arena = ((Chunk*)((uintptr_t)block & ~(uintptr_t)(CHUNKSIZE - 1)))->arena;
+
+    *(void**)block = arena->freeblocks;
+    arena->freeblocks = block;
+
+    // give the memory back once all Nodes are gone (e.g. after a logout)
+    if (!--arena->inuse)
+    {
+        arena->release();
+    }
+}
+
+void* Node::operator new(size_t size, MegaClient* client)
+{
+    return client->nodearena.allocate(size);
+}
+
+void Node::operator delete(void* ptr, MegaClient*)
+{
+    NodeArena::deallocate(ptr);
+}
+
+void Node::operator delete(void* ptr)
+{
+    NodeArena::deallocate(ptr);
+}
+
+FingerprintIndex::FingerprintIndex()
+{
+    count = 0;
+}
+
+size_t FingerprintIndex::hash(const FileFingerprint* fp)
+{
+    uint64_t h = (uint64_t)fp->size * 0x9e3779b97f4a7c15ULL;
+
+    h ^= (uint64_t)fp->mtime + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+
+    for (int i = 4; i--; )
+    {
+        h ^= (uint32_t)fp->crc[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+
+    // final avalanche, the bucket is taken from the low bits
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (size_t)h;
+}
+
+// same ordering key as FileFingerprintCmp
+bool FingerprintIndex::equal(const FileFingerprint* a, const FileFingerprint* b)
+{
+    return a->size == b->size
+        && a->mtime == b->mtime
+        && !memcmp(a->crc, b->crc, sizeof a->crc);
+}
+
+void FingerprintIndex::rehash(size_t numbuckets)
+{
+    vector<Node*> newbuckets(numbuckets, (Node*)NULL);
+
+    for (size_t i = buckets.size(); i--; )
+    {
+        Node* n = buckets[i];
+
+        while (n)
+        {
+            Node* next = n->fingerprintnext;
+            Node** head = &newbuckets[hash(n) & (numbuckets - 1)];
+
+            if ((n->fingerprintnext = *head))
+            {
+                (*head)->fingerprintprev = &n->fingerprintnext;
+            }
+
+            *head = n;
+            n->fingerprintprev = head;
+            n = next;
+        }
+    }
+
+    // swapping keeps the element storage, so the head pointers stay valid
+    buckets.swap(newbuckets);
+}
+
+void FingerprintIndex::add(Node* n)
+{
+    if (contains(n))
+    {
+        return;
+    }
+
+    // keep the load factor at or below 1
+    if (count >= buckets.size())
+    {
+        rehash(buckets.size() ? buckets.size() * 2 : INITIALBUCKETS);
+    }
+
+    Node** head = &buckets[hash(n) & (buckets.size() - 1)];
+
+    if ((n->fingerprintnext = *head))
+    {
+        (*head)->fingerprintprev = &n->fingerprintnext;
+    }
+
+    *head = n;
+    n->fingerprintprev = head;
+    count++;
+}
+
+void FingerprintIndex::remove(Node* n)
+{
+    if (!contains(n))
+    {
+        return;
+    }
+
+    if ((*n->fingerprintprev = n->fingerprintnext))
+    {
+        n->fingerprintnext->fingerprintprev = n->fingerprintprev;
+    }
+
+    n->fingerprintnext = NULL;
+    n->fingerprintprev = NULL;
+    count--;
+}
+
+bool FingerprintIndex::contains(const Node* n)
+{
+    return n->fingerprintprev != NULL;
+}
+
+Node* FingerprintIndex::find(const FileFingerprint* fp) const
+{
+    if (!count)
+    {
+        return NULL;
+    }
+
+    for (Node* n = buckets[hash(fp) & (buckets.size() - 1)]; n; n = n->fingerprintnext)
+    {
+        if (equal(n, fp))
+        {
+            return n;
+        }
+    }
+
+    return NULL;
+}
+
+Node* FingerprintIndex::next(const Node* n)
+{
+    for (Node* m = n->fingerprintnext; m; m = m->fingerprintnext)
+    {
+        if (equal(m, n))
+        {
+            return m;
+        }
+    }
+
+    return NULL;
+}
+
+void FingerprintIndex::clear()
+{
+    for (size_t i = buckets.size(); i--; )
+    {
+        while (buckets[i])
+        {
+            remove(buckets[i]);
+        }
+    }
+
+    vector<Node*>().swap(buckets);
+}
+
 Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
            nodetype_t t, m_off_t s, handle u, const char* fa, m_time_t ts)
 {
@@ -44,14 +307,17 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
     parenthandle = ph;
 
     parent = NULL;
+    prevsibling = NULL;
+    nextsibling = NULL;
+
+    fingerprintnext = NULL;
+    fingerprintprev = NULL;
 
 #ifdef ENABLE_SYNC
     localnode = NULL;
     syncget = NULL;
 
     syncdeleted = SYNCDEL_NONE;
-    todebris_it = client->todebris.end();
-    tounlink_it = client->tounlink.end();
 #endif
 
     type = t;
@@ -100,11 +366,6 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
         {
             dp->push_back(this);
         }
-
-        if (type == FILENODE)
-        {
-            fingerprint_it = client->fingerprints.end();
-        }
     }
 }
 
@@ -114,23 +375,13 @@ Node::~Node()
     client->preadabort(this);
 
     // remove node's fingerprint from hash
-    if (type == FILENODE && fingerprint_it != client->fingerprints.end())
-    {
-        client->fingerprints.erase(fingerprint_it);
-    }
+    client->fingerprints.remove(this);
 
 #ifdef ENABLE_SYNC
-    // remove from todebris node_set
-    if (todebris_it != client->todebris.end())
-    {
-        client->todebris.erase(todebris_it);
-    }
-
-    // remove from tounlink node_set
-    if (tounlink_it != client->tounlink.end())
-    {
-        client->tounlink.erase(tounlink_it);
-    }
+    // remove from the todebris / tounlink node_sets (by key, both are
+    // empty outside of sync deletions)
+    client->todebris.erase(this);
+    client->tounlink.erase(this);
 #endif
 
     if (outshares)
@@ -157,7 +408,7 @@ Node::~Node()
     // remove from parent's children
     if (parent)
     {
-        parent->children.erase(child_it);
+        parent->children.erase(this);
     }
 
     // delete child-parent associations (normally not used, as nodes are
@@ -313,7 +564,7 @@ Node* Node::unserialize(MegaClient* client, string* d, node_vector* dp)
         skey = NULL;
     }
 
-    n = new Node(client, dp, h, ph, t, s, u, fa, ts);
+    n = new (client) Node(client, dp, h, ph, t, s, u, fa, ts);
 
     if (k)
     {
@@ -619,10 +870,7 @@ void Node::setfingerprint()
 {
     if (type == FILENODE && nodekey.size() >= sizeof crc)
     {
-        if (fingerprint_it != client->fingerprints.end())
-        {
-            client->fingerprints.erase(fingerprint_it);
-        }
+        client->fingerprints.remove(this);
 
         attr_map::iterator it = attrs.map.find('c');
 
@@ -642,7 +890,7 @@ void Node::setfingerprint()
             mtime = ctime;
         }
 
-        fingerprint_it = client->fingerprints.insert((FileFingerprint*)this);
+        client->fingerprints.add(this);
     }
 }
 
@@ -807,7 +1055,7 @@ bool Node::setparent(Node* p)
 
     if (parent)
     {
-        parent->children.erase(child_it);
+        parent->children.erase(this);
     }
 
 #ifdef ENABLE_SYNC
@@ -818,7 +1066,7 @@ bool Node::setparent(Node* p)
 
     if (parent)
     {
-        child_it = parent->children.insert(parent->children.end(), this);
+        parent->children.push_back(this);
     }
 
 #ifdef ENABLE_SYNC
@@ -1283,16 +1531,7 @@ LocalNode::~LocalNode()
     if (sync->dirnotify.get())
     {
         // deactivate corresponding notifyq records
-        for (int q = DirNotify::RETRY; q >= DirNotify::DIREVENTS; q--)
-        {
-            for (notify_deque::iterator it = sync->dirnotify->notifyq[q].begin(); it != sync->dirnotify->notifyq[q].end(); it++)
-            {
-                if ((*it).localnode == this)
-                {
-                    (*it).localnode = (LocalNode*)~0;
-                }
-            }
-        }
+        sync->dirnotify->cancelnotifications(this);
     }
     
     // remove from fsidnode map, if present
@@ -42,6 +42,11 @@ namespace mega {
     char* PosixFileSystemAccess::appbasepath = NULL;
 #endif
 
+#ifdef USE_INOTIFY
+const int PosixFileSystemAccess::UNWATCHEDSCANINTERVAL_DS = 300;
+const unsigned PosixFileSystemAccess::UNWATCHEDSCANBATCH = 256;
+#endif
+
 #ifdef HAVE_AIO_RT
 PosixAsyncIOContext::PosixAsyncIOContext() : AsyncIOContext()
 {
@@ -343,7 +348,10 @@ void PosixFileAccess::updatelocalname(string* name)
 
 bool PosixFileAccess::sysread(byte* dst, unsigned len, m_off_t pos)
 {
+    MetricTimer timer(Metrics::DISK_READ_TIME, Metrics::timing());
+
     retry = false;
+    Metrics::add(Metrics::DISK_READ_BYTES, len);
 #ifndef __ANDROID__
     return pread(fd, (char*)dst, len, pos) == len;
 #else
@@ -354,7 +362,10 @@ bool PosixFileAccess::sysread(byte* dst, unsigned len, m_off_t pos)
 
 bool PosixFileAccess::fwrite(const byte* data, unsigned len, m_off_t pos)
 {
+    MetricTimer timer(Metrics::DISK_WRITE_TIME, Metrics::timing());
+
     retry = false;
+    Metrics::add(Metrics::DISK_WRITE_BYTES, len);
 #ifndef __ANDROID__
     return pwrite(fd, data, len, pos) == len;
 #else
@@ -527,10 +538,29 @@ PosixFileSystemAccess::PosixFileSystemAccess(int fseventsfd)
 #ifdef USE_INOTIFY
     lastcookie = 0;
     lastlocalnode = NULL;
+    lastunwatched = NULL;
+    nextunwatchedscan = 0;
+    notifyoverflows = 0;
+    unwatchedscans = 0;
+    numwatches = 0;
+    maxwatches = ~0u;
+
     if ((notifyfd = inotify_init1(IN_NONBLOCK)) >= 0)
     {
         notifyfailed = false;
     }
+
+    // leave a share of the per-user watches to other applications
+    FILE* fp = fopen("/proc/sys/fs/inotify/max_user_watches", "r");
+    if (fp)
+    {
+        unsigned userwatches;
+        if (fscanf(fp, "%u", &userwatches) == 1)
+        {
+            maxwatches = userwatches - userwatches / 8;
+        }
+        fclose(fp);
+    }
 #endif
 
 #ifdef __MACH__
@@ -623,6 +653,19 @@ void PosixFileSystemAccess::addevents(Waiter* w, int flags)
 
         pw->bumpmaxfd(notifyfd);
     }
+
+#ifdef USE_INOTIFY
+    // wake up for the next round of unwatched folder rescans
+    if (unwatched.size())
+    {
+        dstime ds = nextunwatchedscan > Waiter::ds ? nextunwatchedscan - Waiter::ds : 0;
+
+        if (ds < w->maxds)
+        {
+            w->maxds = ds;
+        }
+    }
+#endif
 }
 
 // read all pending inotify events and queue them for processing
@@ -636,7 +679,8 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
 
     if (FD_ISSET(notifyfd, &pw->rfds))
     {
-        char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+        // drain event bursts with few read() calls
+        char buf[65536] __attribute__ ((aligned(__alignof__(struct inotify_event))));
         int p, l;
         inotify_event* in;
         wdlocalnode_map::iterator it;
@@ -650,6 +694,13 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
 
                 if (in->mask & (IN_Q_OVERFLOW | IN_UNMOUNT))
                 {
+                    if (in->mask & IN_Q_OVERFLOW)
+                    {
+                        notifyoverflows++;
+                        Metrics::add(Metrics::FS_NOTIFY_OVERFLOWS);
+                        LOG_warn << "Filesystem notification queue overflow (" << notifyoverflows << ")";
+                    }
+
                     notifyerr = true;
                 }
 
@@ -742,6 +793,11 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
             lastcookie = 0;
         }
     }
+
+    if (unwatched.size() && Waiter::ds >= nextunwatchedscan)
+    {
+        r |= scanunwatched();
+    }
 #endif
 
 #ifdef __MACH__
@@ -1530,6 +1586,75 @@ void PosixFileSystemAccess::statsid(string *id) const
 #endif
 }
 
+#if defined(ENABLE_SYNC) && defined(USE_INOTIFY)
+// rescan a batch of the folders that could not be watched by queueing their
+// current and known children, and watch them if watches were released
+int PosixFileSystemAccess::scanunwatched()
+{
+    localnode_set::iterator it = unwatched.upper_bound(lastunwatched);
+    unsigned scanned = 0;
+    string localpath, localname;
+    int r = 0;
+
+    // (folders that get a watch leave the set on the way)
+    size_t batch = unwatched.size() < UNWATCHEDSCANBATCH ? unwatched.size() : UNWATCHEDSCANBATCH;
+
+    while (unwatched.size() && scanned < batch)
+    {
+        if (it == unwatched.end())
+        {
+            it = unwatched.begin();
+        }
+
+        LocalNode* l = *it;
+        PosixDirNotify* dirnotify = (PosixDirNotify*)l->sync->dirnotify.get();
+
+        lastunwatched = l;
+        scanned++;
+
+        l->getlocalpath(&localpath);
+
+        if (dirnotify->canwatch() && dirnotify->addwatch(l, &localpath))
+        {
+            LOG_debug << "Unwatched folder is now watched: " << l->name;
+            dirnotify->numunwatched--;
+            unwatched.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+
+        for (localnode_map::iterator cit = l->children.begin(); cit != l->children.end(); cit++)
+        {
+            dirnotify->notify(DirNotify::DIREVENTS, l, cit->first->data(), cit->first->size());
+        }
+
+        PosixDirAccess da;
+        if (da.dopen(&localpath, NULL, false))
+        {
+            while (da.dnext(&localpath, &localname, l->sync->client->followsymlinks, NULL))
+            {
+                if (localname != dirnotify->ignore)
+                {
+                    dirnotify->notify(DirNotify::DIREVENTS, l, localname.data(), localname.size());
+                }
+            }
+        }
+
+        unwatchedscans++;
+        Metrics::add(Metrics::FS_UNWATCHED_SCANS);
+        r |= Waiter::NEEDEXEC;
+    }
+
+    LOG_debug << "Rescanned " << scanned << " unwatched folders. Pending: " << unwatched.size();
+
+    nextunwatchedscan = Waiter::ds + UNWATCHEDSCANINTERVAL_DS;
+
+    return r;
+}
+#endif
+
 PosixDirNotify::PosixDirNotify(string* localbasepath, string* ignore) : DirNotify(localbasepath, ignore)
 {
 #ifdef USE_INOTIFY
@@ -1541,9 +1666,20 @@ PosixDirNotify::PosixDirNotify(string* localbasepath, string* ignore) : DirNotif
 #endif
 
     fsaccess = NULL;
+    numwatches = 0;
+    numunwatched = 0;
 }
 
-void PosixDirNotify::addnotify(LocalNode* l, string* path)
+bool PosixDirNotify::canwatch() const
+{
+#ifdef USE_INOTIFY
+    return fsaccess->numwatches < fsaccess->maxwatches && (!maxwatches || numwatches < maxwatches);
+#else
+    return true;
+#endif
+}
+
+bool PosixDirNotify::addwatch(LocalNode* l, string* path)
 {
 #ifdef ENABLE_SYNC
 #ifdef USE_INOTIFY
@@ -1556,7 +1692,53 @@ void PosixDirNotify::addnotify(LocalNode* l, string* path)
     if (wd >= 0)
     {
         l->dirnotifytag = (handle)wd;
-        fsaccess->wdnodes[wd] = l;
+
+        // (the same watch descriptor is returned for an already watched folder)
+        pair<PosixFileSystemAccess::wdlocalnode_map::iterator, bool> res = fsaccess->wdnodes.insert(pair<int, LocalNode*>(wd, l));
+        if (res.second)
+        {
+            fsaccess->numwatches++;
+            numwatches++;
+        }
+        else
+        {
+            res.first->second = l;
+        }
+
+        return true;
+    }
+
+    if (errno == ENOSPC)
+    {
+        // the actual per-user limit is lower than expected
+        fsaccess->maxwatches = fsaccess->numwatches;
+    }
+#endif
+#endif
+    return false;
+}
+
+void PosixDirNotify::addnotify(LocalNode* l, string* path)
+{
+#ifdef ENABLE_SYNC
+#ifdef USE_INOTIFY
+    if (canwatch() && addwatch(l, path))
+    {
+        return;
+    }
+
+    // over budget: fall back to periodic rescans of this folder
+    if (!fsaccess->unwatched.size())
+    {
+        LOG_warn << "Filesystem watch budget exhausted (" << fsaccess->numwatches
+                 << " watches). Falling back to periodic rescans";
+        fsaccess->nextunwatchedscan = Waiter::ds + PosixFileSystemAccess::UNWATCHEDSCANINTERVAL_DS;
+    }
+
+    l->dirnotifytag = (handle)-1;
+    if (fsaccess->unwatched.insert(l).second)
+    {
+        numunwatched++;
     }
 #endif
 #endif
@@ -1566,9 +1748,17 @@ void PosixDirNotify::delnotify(LocalNode* l)
 {
 #ifdef ENABLE_SYNC
 #ifdef USE_INOTIFY
+    if (fsaccess->unwatched.erase(l))
+    {
+        numunwatched--;
+        return;
+    }
+
     if (fsaccess->wdnodes.erase((int)(long)l->dirnotifytag))
     {
         inotify_rm_watch(fsaccess->notifyfd, (int)l->dirnotifytag);
+        fsaccess->numwatches--;
+        numwatches--;
     }
 #endif
 #endif
@@ -1685,39 +1875,149 @@ bool PosixDirAccess::dnext(string* path, string* name, bool followsymlinks, node
         return false;
     }
 
-    dirent* d;
-    size_t pathsize = path->size();
-    struct stat statbuf;
+    DirEntry entry;
+
+    if (!nextentry(path, name, followsymlinks, &entry))
+    {
+        return false;
+    }
 
-    path->append("/");
+    if (type)
+    {
+        *type = entry.type;
+    }
 
-    while ((d = readdir(dp)))
+    return true;
+}
+
+bool PosixDirAccess::dnextentry(string* path, string* name, bool followsymlinks, DirEntry* entry)
+{
+    if (globbing)
     {
-        if (*d->d_name != '.' || (d->d_name[1] && (d->d_name[1] != '.' || d->d_name[2])))
+        return DirAccess::dnextentry(path, name, followsymlinks, entry);
+    }
+
+#ifdef USE_IOS
+    string absolutepath;
+    if (PosixFileSystemAccess::appbasepath)
+    {
+        if (path->size() && path->at(0) != '/')
         {
-            path->append(d->d_name);
+            absolutepath = PosixFileSystemAccess::appbasepath;
+            absolutepath.append(*path);
+            path = &absolutepath;
+        }
+    }
+#endif
 
-            if (followsymlinks ? !stat(path->c_str(), &statbuf) : !lstat(path->c_str(), &statbuf))
-            {
-                if (S_ISREG(statbuf.st_mode) || S_ISDIR(statbuf.st_mode))
-                {
-                    path->resize(pathsize);
-                    *name = d->d_name;
+    return nextentry(path, name, followsymlinks, entry);
+}
 
-                    if (type)
-                    {
-                        *type = S_ISREG(statbuf.st_mode) ? FILENODE : FOLDERNODE;
-                    }
+// sets the entry for a file or folder, fails for anything else
+static bool setentry(mode_t mode, m_off_t size, m_time_t mtime, ino_t ino, DirEntry* entry)
+{
+    if (!S_ISREG(mode) && !S_ISDIR(mode))
+    {
+        return false;
+    }
 
-                    return true;
-                }
-            }
+    entry->type = S_ISREG(mode) ? FILENODE : FOLDERNODE;
+    entry->size = size;
+    entry->mtime = mtime;
+    entry->fsid = (handle)ino;
+    entry->fsidvalid = true;
+    entry->statvalid = true;
 
-            path->resize(pathsize+1);
+    FileSystemAccess::captimestamp(&entry->mtime);
+
+    return true;
+}
+
+// looks up a record relative to the descriptor of its directory, so that the
+// kernel doesn't resolve the full path again for every record (without
+// fstatat(), name is the full path)
+static bool statentry(int fd, const char* name, bool followsymlinks, DirEntry* entry)
+{
+    struct stat statbuf;
+
+#ifdef HAVE_STATX
+    // statx() only fetches the fields needed here, which saves work on
+    // network filesystems - falls back to fstatat() on kernels < 4.11
+    static bool nostatx = false;
+
+    if (!nostatx)
+    {
+        struct statx stx;
+
+        if (!statx(fd, name, followsymlinks ? 0 : AT_SYMLINK_NOFOLLOW,
+                   STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO, &stx))
+        {
+            return setentry(stx.stx_mode, stx.stx_size, stx.stx_mtime.tv_sec, stx.stx_ino, entry);
+        }
+
+        if (errno != ENOSYS)
+        {
+            return false;
         }
+
+        nostatx = true;
+    }
+#endif
+
+#ifdef HAVE_FSTATAT
+    if (fstatat(fd, name, &statbuf, followsymlinks ? 0 : AT_SYMLINK_NOFOLLOW))
+#else
+    if (followsymlinks ? stat(name, &statbuf) : lstat(name, &statbuf))
+#endif
+    {
+        return false;
     }
 
-    path->resize(pathsize);
+    return setentry(statbuf.st_mode, statbuf.st_size, statbuf.st_mtime, statbuf.st_ino, entry);
+}
+
+bool PosixDirAccess::nextentry(string* path, string* name, bool followsymlinks, DirEntry* entry)
+{
+    dirent* d;
+#ifdef HAVE_FSTATAT
+    int fd = dirfd(dp);
+#else
+    int fd = -1;
+    size_t pathsize = path->size();
+#endif
+
+    while ((d = readdir(dp)))
+    {
+        if (*d->d_name == '.' && (!d->d_name[1] || (d->d_name[1] == '.' && !d->d_name[2])))
+        {
+            continue;
+        }
+
+#ifdef DT_UNKNOWN
+        // the type reported by readdir() spares the lookup of records that
+        // are neither files nor folders
+        if (d->d_type != DT_UNKNOWN && d->d_type != DT_REG && d->d_type != DT_DIR
+         && (d->d_type != DT_LNK || !followsymlinks))
+        {
+            continue;
+        }
+#endif
+
+#ifdef HAVE_FSTATAT
+        bool found = statentry(fd, d->d_name, followsymlinks, entry);
+#else
+        path->append("/");
+        path->append(d->d_name);
+        bool found = statentry(fd, path->c_str(), followsymlinks, entry);
+        path->resize(pathsize);
+#endif
+
+        if (found)
+        {
+            *name = d->d_name;
+            return true;
+        }
+    }
 
     return false;
 }
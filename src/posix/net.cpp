@@ -25,10 +25,23 @@
 
 #define IPV6_RETRY_INTERVAL_DS 72000
 #define DNS_CACHE_TIMEOUT_DS 18000
+#define DNS_CACHE_EXPIRES_DS 72000
 #define MAX_SPEED_CONTROL_TIMEOUT_MS 500
 
 namespace mega {
 
+// the record (or the negative answer) is recent enough to skip a new lookup
+static bool dnsfresh(dstime timestamp)
+{
+    return timestamp && Waiter::ds - timestamp < DNS_CACHE_TIMEOUT_DS;
+}
+
+// the record can still be used while it is being revalidated
+static bool dnsusable(const string& ip, dstime timestamp)
+{
+    return ip.size() && Waiter::ds - timestamp < DNS_CACHE_EXPIRES_DS;
+}
+
 MUTEX_CLASS CurlHttpIO::curlMutex(false);
 
 #if !defined(USE_CURL_PUBLIC_KEY_PINNING) || defined(WINDOWS_PHONE)
@@ -103,6 +116,14 @@ CurlHttpIO::CurlHttpIO()
     curlipv6 = data->features & CURL_VERSION_IPV6;
     LOG_debug << "IPv6 enabled: " << curlipv6;
 
+#if defined(CURL_VERSION_HTTP2) && defined(CURLPIPE_MULTIPLEX)
+    http2available = data->features & CURL_VERSION_HTTP2;
+#else
+    http2available = false;
+#endif
+    LOG_debug << "HTTP/2 available: " << http2available;
+    http2 = false;
+
     dnsok = false;
     reset = false;
     statechange = false;
@@ -694,6 +715,11 @@ void CurlHttpIO::disconnect()
     curltimeoutreset[PUT] = -1;
     arerequestspaused[PUT] = false;
 
+    if (http2)
+    {
+        setpipelining();
+    }
+
     if (dnsservers.size())
     {
         LOG_debug << "Using custom DNS servers: " << dnsservers;
@@ -733,6 +759,40 @@ m_off_t CurlHttpIO::getmaxuploadspeed()
     return maxspeed[PUT];
 }
 
+bool CurlHttpIO::sethttp2(bool enable)
+{
+    if (enable && !http2available)
+    {
+        LOG_warn << "cURL built without HTTP/2 support";
+        return false;
+    }
+
+    http2 = enable;
+    setpipelining();
+
+    LOG_info << "HTTP/2 multiplexing " << (enable ? "enabled" : "disabled");
+    return true;
+}
+
+// applies the multiplexing mode to the multi handles, which disconnect()
+// recreates
+void CurlHttpIO::setpipelining()
+{
+#ifdef CURLPIPE_MULTIPLEX
+    // new requests wait for an existing connection to the same host (see
+    // CURLOPT_PIPEWAIT) and are sent as additional streams on it
+    for (int d = GET; d <= API; d++)
+    {
+        curl_multi_setopt(curlm[d], CURLMOPT_PIPELINING, http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+    }
+#endif
+}
+
+bool CurlHttpIO::usinghttp2()
+{
+    return http2;
+}
+
 // wake up from cURL I/O
 void CurlHttpIO::addevents(Waiter* w, int)
 {
@@ -958,22 +1018,6 @@ void CurlHttpIO::ares_completed_callback(void* arg, int status, int, struct host
 
         LOG_verbose << "Received a valid IP for "<< httpctx->hostname << ": " << ip;
 
-        httpio->inetstatus(true);
-
-        // add to DNS cache
-        CurlDNSEntry& dnsEntry = httpio->dnscache[httpctx->hostname];
-
-        if (host->h_addrtype == PF_INET6)
-        {
-            dnsEntry.ipv6 = ip;
-            dnsEntry.ipv6timestamp = Waiter::ds;
-        }
-        else
-        {
-            dnsEntry.ipv4 = ip;
-            dnsEntry.ipv4timestamp = Waiter::ds;
-        }
-
         // IPv6 takes precedence over IPv4
         if (!httpctx->hostip.size() || (host->h_addrtype == PF_INET6 && !httpctx->curl))
         {
@@ -1096,6 +1140,134 @@ void CurlHttpIO::ares_completed_callback(void* arg, int status, int, struct host
     }
 }
 
+// a lookup has finished: update the DNS cache and notify the waiting requests
+void CurlHttpIO::dns_query_callback(void* arg, int status, int timeouts, struct hostent* host)
+{
+    CurlDNSQuery* query = (CurlDNSQuery*)arg;
+    CurlHttpIO* httpio = query->httpio;
+    bool valid = status == ARES_SUCCESS && host && host->h_addr_list[0];
+
+    if (valid)
+    {
+        httpio->inetstatus(true);
+    }
+
+    // the cache could have been cleared while the lookup was in flight
+    std::map<string, CurlDNSEntry>::iterator it = httpio->dnscache.find(query->hostname);
+    if (it != httpio->dnscache.end())
+    {
+        CurlDNSEntry& dnsEntry = it->second;
+        bool isIPv6 = query->family == PF_INET6;
+
+        if ((isIPv6 ? dnsEntry.ipv6query : dnsEntry.ipv4query) == query)
+        {
+            (isIPv6 ? dnsEntry.ipv6query : dnsEntry.ipv4query) = NULL;
+        }
+
+        if (valid)
+        {
+            char ip[INET6_ADDRSTRLEN];
+            mega_inet_ntop(host->h_addrtype, host->h_addr_list[0], ip, sizeof(ip));
+
+            if (host->h_addrtype == PF_INET6)
+            {
+                dnsEntry.ipv6 = ip;
+                dnsEntry.ipv6timestamp = Waiter::ds;
+            }
+            else
+            {
+                dnsEntry.ipv4 = ip;
+                dnsEntry.ipv4timestamp = Waiter::ds;
+            }
+        }
+        else if (status != ARES_EDESTRUCTION && !(isIPv6 ? dnsEntry.ipv6 : dnsEntry.ipv4).size())
+        {
+            // remember hosts without records for this protocol, so that
+            // they aren't looked up again on every request.
+            // failed refreshes keep the previous (stale) record
+            (isIPv6 ? dnsEntry.ipv6timestamp : dnsEntry.ipv4timestamp) = Waiter::ds;
+        }
+    }
+
+    std::vector<CurlHttpContext*> waiting;
+    waiting.swap(query->waiting);
+    delete query;
+
+    for (unsigned i = 0; i < waiting.size(); i++)
+    {
+        ares_completed_callback(waiting[i], status, timeouts, host);
+    }
+}
+
+// start a lookup unless there is one in flight for the same host and protocol.
+// if a request is passed, it's notified when the lookup finishes
+// (the caller must have accounted for it in ares_pending)
+void CurlHttpIO::resolve(const string& hostname, int family, CurlHttpContext* httpctx)
+{
+    CurlDNSEntry& dnsEntry = dnscache[hostname];
+    CurlDNSQuery*& pending = (family == PF_INET6) ? dnsEntry.ipv6query : dnsEntry.ipv4query;
+    CurlDNSQuery* query = pending;
+    bool start = !query;
+
+    if (start)
+    {
+        query = new CurlDNSQuery;
+        query->httpio = this;
+        query->hostname = hostname;
+        query->family = family;
+        pending = query;
+        dnslookups++;
+    }
+    else
+    {
+        LOG_debug << "Joining the DNS lookup in flight for " << hostname;
+    }
+
+    if (httpctx)
+    {
+        query->waiting.push_back(httpctx);
+    }
+
+    if (start)
+    {
+        // the callback can be called synchronously
+        ares_gethostbyname(ares, hostname.c_str(), family, dns_query_callback, query);
+    }
+}
+
+void CurlHttpIO::prefetchdns(const string* url)
+{
+    string posturl = *url;
+    string scheme;
+    string hostname;
+    int port;
+
+    // names are resolved by the proxy
+    if (proxyurl.size() || !crackurl(&posturl, &scheme, &hostname, &port))
+    {
+        return;
+    }
+
+    CurlDNSEntry* dnsEntry = NULL;
+    std::map<string, CurlDNSEntry>::iterator it = dnscache.find(hostname);
+    if (it != dnscache.end())
+    {
+        dnsEntry = &it->second;
+    }
+
+    if (ipv6requestsenabled && !(dnsEntry && dnsfresh(dnsEntry->ipv6timestamp)))
+    {
+        LOG_debug << "Prefetching IPv6 address for " << hostname;
+        resolve(hostname, PF_INET6);
+    }
+
+    if (!(dnsEntry && dnsfresh(dnsEntry->ipv4timestamp)))
+    {
+        LOG_debug << "Prefetching IPv4 address for " << hostname;
+        resolve(hostname, PF_INET);
+    }
+}
+
 struct curl_slist* CurlHttpIO::clone_curl_slist(struct curl_slist* inlist)
 {
     struct curl_slist* outlist = NULL;
@@ -1146,6 +1318,15 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
     else if(httpctx->hostip.size())
     {
         LOG_debug << "Using the IP of the hostname";
+
+        if (httpctx->dnsstart >= 0)
+        {
+            req->dnswaitms = (Waiter::getmicros() - httpctx->dnsstart) / 1000;
+            httpio->dnswaittimems += req->dnswaitms;
+            httpctx->dnsstart = -1;
+            LOG_debug << "DNS wait for " << httpctx->hostname << ": " << req->dnswaitms << " ms";
+        }
+
         httpctx->posturl.replace(httpctx->posturl.find(httpctx->hostname), httpctx->hostname.size(), httpctx->hostip);
         httpctx->headers = curl_slist_append(httpctx->headers, httpctx->hostheader.c_str());
     }
@@ -1189,11 +1370,59 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
         curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE,  90L);
         curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 60L);
 
+        if (httpctx->isIPv6 && !httpio->proxyip.size())
+        {
+            // happy eyeballs: if an IPv4 address is known, don't wait the whole
+            // connect timeout for a broken IPv6 path before falling back to it
+            std::map<string, CurlDNSEntry>::iterator it = httpio->dnscache.find(httpctx->hostname);
+            if (it != httpio->dnscache.end() && dnsusable(it->second.ipv4, it->second.ipv4timestamp))
+            {
+                curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, HAPPYEYEBALLSTIMEOUTMS);
+            }
+        }
+
         if (httpio->maxspeed[GET] && httpio->maxspeed[GET] <= 102400)
         {
             curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 4096L);
         }
 
+#ifdef CURLPIPE_MULTIPLEX
+        // HTTP/2 is only negotiated via ALPN, plain HTTP chunk URLs keep using HTTP/1.1
+        if (httpio->http2 && !httpctx->scheme.compare("https"))
+        {
+            // CURLPIPE_MULTIPLEX and CURLOPT_PIPEWAIT came with 7.43.0, the
+            // other options later; they are enum values, so check the version
+#if LIBCURL_VERSION_NUM >= 0x072f00
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#else
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
+#endif
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+#if LIBCURL_VERSION_NUM >= 0x072e00
+            // API requests are small and latency-sensitive, don't let them
+            // queue behind chunk data sharing the same connection
+            curl_easy_setopt(curl, CURLOPT_STREAM_WEIGHT, httpctx->d == API ? 256L : 16L);
+#endif
+
+            if (httpctx->d == GET && !httpio->maxspeed[GET])
+            {
+                // size the receive buffer of each stream for ~100 ms of data
+                // at the current download speed
+                long bufsize = (long)(httpio->downloadSpeed / 10 / (httpio->numconnections[GET] + 1));
+                if (bufsize < MINHTTP2BUFFERSIZE)
+                {
+                    bufsize = MINHTTP2BUFFERSIZE;
+                }
+                else if (bufsize > MAXHTTP2BUFFERSIZE)
+                {
+                    bufsize = MAXHTTP2BUFFERSIZE;
+                }
+                curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, bufsize);
+            }
+        }
+#endif
+
 #if !defined(USE_CURL_PUBLIC_KEY_PINNING) || defined(WINDOWS_PHONE)
         curl_easy_setopt(curl, CURLOPT_SSL_CTX_FUNCTION, ssl_ctx_function);
         curl_easy_setopt(curl, CURLOPT_SSL_CTX_DATA, (void*)req);
@@ -1461,6 +1690,7 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
     httpctx->headers = NULL;
     httpctx->isIPv6 = false;
     httpctx->ares_pending = 0;
+    httpctx->dnsstart = -1;
     httpctx->d = (req->type == REQ_JSON) ? API : ((data ? len : req->out->size()) ? PUT : GET);
     req->httpiohandle = (void*)httpctx;    
 
@@ -1525,19 +1755,22 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
         {
             CurlDNSEntry& entry = it->second;
 
-            if (entry.ipv6.size() && Waiter::ds - entry.ipv6timestamp >= DNS_CACHE_TIMEOUT_DS)
+            // expired records are still used while they are refreshed,
+            // until they are too old
+            if (Waiter::ds - entry.ipv6timestamp >= DNS_CACHE_EXPIRES_DS)
             {
                 entry.ipv6timestamp = 0;
                 entry.ipv6.clear();
             }
 
-            if (entry.ipv4.size() && Waiter::ds - entry.ipv4timestamp >= DNS_CACHE_TIMEOUT_DS)
+            if (Waiter::ds - entry.ipv4timestamp >= DNS_CACHE_EXPIRES_DS)
             {
                 entry.ipv4timestamp = 0;
                 entry.ipv4.clear();
             }
 
-            if (!entry.ipv6.size() && !entry.ipv4.size())
+            if (!entry.ipv6.size() && !entry.ipv4.size() && !entry.ipv6timestamp && !entry.ipv4timestamp
+                    && !entry.ipv6query && !entry.ipv4query)
             {
                 LOG_debug << "DNS cache record expired for " << it->first;
                 dnscache.erase(it++);
@@ -1572,7 +1805,7 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
 
     httpctx->hostheader = "Host: ";
     httpctx->hostheader.append(httpctx->hostname);
-    httpctx->ares_pending = 1;
+    httpctx->dnsstart = Waiter::getmicros();
 
     CurlDNSEntry* dnsEntry = NULL;
     map<string, CurlDNSEntry>::iterator it = dnscache.find(httpctx->hostname);
@@ -1581,39 +1814,59 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
         dnsEntry = &it->second;
     }
 
-    if (ipv6requestsenabled)
+    // IPv6 takes precedence, but a known IPv4 address is used right away
+    // instead of waiting for the IPv6 lookup (happy eyeballs)
+    bool useipv6 = ipv6requestsenabled && dnsEntry && dnsusable(dnsEntry->ipv6, dnsEntry->ipv6timestamp);
+    bool useipv4 = !useipv6 && dnsEntry && dnsusable(dnsEntry->ipv4, dnsEntry->ipv4timestamp);
+
+    if (useipv6 || useipv4)
     {
-        if (dnsEntry && dnsEntry->ipv6.size() && Waiter::ds - dnsEntry->ipv6timestamp < DNS_CACHE_TIMEOUT_DS)
+        bool stale = !dnsfresh(useipv6 ? dnsEntry->ipv6timestamp : dnsEntry->ipv4timestamp);
+        bool learnipv6 = useipv4 && ipv6requestsenabled && !dnsfresh(dnsEntry->ipv6timestamp);
+
+        LOG_debug << "DNS cache hit for " << httpctx->hostname << (useipv6 ? " (IPv6)" : " (IPv4)") << (stale ? " (stale)" : "");
+        dnscachehits++;
+
+        httpctx->isIPv6 = useipv6;
+        if (useipv6)
         {
-            LOG_debug << "DNS cache hit for " << httpctx->hostname << " (IPv6)";
             std::ostringstream oss;
-            httpctx->isIPv6 = true;
             oss << "[" << dnsEntry->ipv6 << "]";
             httpctx->hostip = oss.str();
-            httpctx->ares_pending = 0;
-            send_request(httpctx);
-            return;
         }
-
-        httpctx->ares_pending++;
-        LOG_debug << "Resolving IPv6 address for " << httpctx->hostname;
-        ares_gethostbyname(ares, httpctx->hostname.c_str(), PF_INET6, ares_completed_callback, httpctx);
-    }
-    else
-    {
-        if (dnsEntry && dnsEntry->ipv4.size() && Waiter::ds - dnsEntry->ipv4timestamp < DNS_CACHE_TIMEOUT_DS)
+        else
         {
-            LOG_debug << "DNS cache hit for " << httpctx->hostname << " (IPv4)";
-            httpctx->isIPv6 = false;
             httpctx->hostip = dnsEntry->ipv4;
-            httpctx->ares_pending = 0;
-            send_request(httpctx);
-            return;
         }
+
+        // stale-while-revalidate: the request doesn't wait for the refresh
+        if (stale)
+        {
+            dnsstalehits++;
+            resolve(httpctx->hostname, useipv6 ? PF_INET6 : PF_INET);
+        }
+
+        if (learnipv6)
+        {
+            resolve(httpctx->hostname, PF_INET6);
+        }
+
+        send_request(httpctx);
+        return;
+    }
+
+    // resolve both protocols in parallel, the request is sent with the first
+    // valid answer. lookups already in flight (prefetches) are reused
+    httpctx->ares_pending = ipv6requestsenabled ? 2 : 1;
+
+    if (ipv6requestsenabled)
+    {
+        LOG_debug << "Resolving IPv6 address for " << httpctx->hostname;
+        resolve(httpctx->hostname, PF_INET6, httpctx);
     }
 
     LOG_debug << "Resolving IPv4 address for " << httpctx->hostname;
-    ares_gethostbyname(ares, httpctx->hostname.c_str(), PF_INET, ares_completed_callback, httpctx);
+    resolve(httpctx->hostname, PF_INET, httpctx);
 }
 
 void CurlHttpIO::setproxy(Proxy* proxy)
@@ -1780,6 +2033,26 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                 curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &req->httpstatus);
 
                 LOG_debug << "CURLMSG_DONE with HTTP status: " << req->httpstatus;
+
+                long numconnects = 0;
+                if (curl_easy_getinfo(msg->easy_handle, CURLINFO_NUM_CONNECTS, &numconnects) == CURLE_OK && numconnects > 0)
+                {
+                    double connecttime = 0;
+                    double appconnecttime = 0;
+                    curl_easy_getinfo(msg->easy_handle, CURLINFO_CONNECT_TIME, &connecttime);
+                    curl_easy_getinfo(msg->easy_handle, CURLINFO_APPCONNECT_TIME, &appconnecttime);
+
+                    newconnections++;
+                    if (appconnecttime > connecttime)
+                    {
+                        handshaketimems += (long long)((appconnecttime - connecttime) * 1000);
+                    }
+                }
+                else if (req->httpstatus || msg->data.result == CURLE_OK)
+                {
+                    // (a request that failed before getting a response didn't use any)
+                    reusedconnections++;
+                }
                 if (req->httpstatus)
                 {
                     if (req->binary)
@@ -1862,7 +2135,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                         ipv6deactivationtime = Waiter::ds;
 
                         // for IPv6 errors, try IPv4 before sending an error to the engine
-                        if((dnsEntry.ipv4.size() && Waiter::ds - dnsEntry.ipv4timestamp < DNS_CACHE_TIMEOUT_DS) || httpctx->ares_pending)
+                        if(dnsusable(dnsEntry.ipv4, dnsEntry.ipv4timestamp) || httpctx->ares_pending)
                         {
                             numconnections[httpctx->d]--;
                             pausedrequests[httpctx->d].erase(msg->easy_handle);
@@ -1875,7 +2148,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                             req->in.clear();
                             req->status = REQ_INFLIGHT;
 
-                            if(dnsEntry.ipv4.size() && Waiter::ds - dnsEntry.ipv4timestamp < DNS_CACHE_TIMEOUT_DS)
+                            if(dnsusable(dnsEntry.ipv4, dnsEntry.ipv4timestamp))
                             {
                                 LOG_debug << "Retrying using IPv4 from cache";
                                 httpctx->isIPv6 = false;
@@ -2296,6 +2569,8 @@ CurlDNSEntry::CurlDNSEntry()
 {
     ipv4timestamp = 0;
     ipv6timestamp = 0;
+    ipv4query = NULL;
+    ipv6query = NULL;
 }
 
 SockInfo::SockInfo()
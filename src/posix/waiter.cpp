@@ -85,6 +85,15 @@ void Waiter::bumpds()
     ds = ts.tv_sec * 10 + ts.tv_nsec / 100000000;
 }
 
+m_time_t Waiter::getmicros()
+{
+    timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 // update maxfd for select()
 void PosixWaiter::bumpmaxfd(int fd)
 {
@@ -22,11 +22,24 @@
 #include "mega/request.h"
 #include "mega/command.h"
 #include "mega/logging.h"
+#include "mega/metrics.h"
+#include "mega/waiter.h"
 
 namespace mega {
+Request::Request()
+{
+    serialcmds = 0;
+    senttime = 0;
+}
+
 void Request::add(Command* c)
 {
     cmds.push_back(c);
+
+    if (!c->concurrent)
+    {
+        serialcmds++;
+    }
 }
 
 int Request::cmdspending() const
@@ -34,6 +47,67 @@ int Request::cmdspending() const
     return cmds.size();
 }
 
+bool Request::concurrent() const
+{
+    return !serialcmds;
+}
+
+bool Request::independent(const orderkey_map& keys, int* verified) const
+{
+    if (serialcmds)
+    {
+        return false;
+    }
+
+    for (; *verified < (int)cmds.size(); (*verified)++)
+    {
+        handle key = cmds[*verified]->orderkey;
+
+        if (!ISUNDEF(key) && keys.find(key) != keys.end())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Request::addkeys(orderkey_map* keys) const
+{
+    for (int i = 0; i < (int)cmds.size(); i++)
+    {
+        if (!ISUNDEF(cmds[i]->orderkey))
+        {
+            (*keys)[cmds[i]->orderkey]++;
+        }
+    }
+}
+
+void Request::removekeys(orderkey_map* keys) const
+{
+    for (int i = 0; i < (int)cmds.size(); i++)
+    {
+        orderkey_map::iterator it;
+
+        if (!ISUNDEF(cmds[i]->orderkey) && (it = keys->find(cmds[i]->orderkey)) != keys->end())
+        {
+            if (!--it->second)
+            {
+                keys->erase(it);
+            }
+        }
+    }
+}
+
+void Request::moveto(Request* other, int pos)
+{
+    other->cmds.insert(other->cmds.begin() + pos, cmds.begin(), cmds.end());
+    other->serialcmds += serialcmds;
+
+    cmds.clear();
+    serialcmds = 0;
+}
+
 void Request::get(string* req) const
 {
     // concatenate all command objects, resulting in an API request
@@ -51,6 +125,17 @@ void Request::get(string* req) const
 
 void Request::procresult(MegaClient* client)
 {
+    m_time_t rtt = Waiter::getmicros() - senttime;
+
+    Metrics::add(Metrics::API_REQUESTS);
+    Metrics::add(Metrics::API_COMMANDS, cmds.size());
+    Metrics::observe(Metrics::API_RTT, rtt);
+
+    for (int i = 0; i < (int)cmds.size(); i++)
+    {
+        Metrics::observecommand(cmds[i]->cmdname ? cmds[i]->cmdname : "unknown", rtt);
+    }
+
     if (!client->json.enterarray())
     {
         LOG_err << "Invalid response from server";
@@ -104,31 +189,42 @@ void Request::clear()
         }
     }
     cmds.clear();
+    serialcmds = 0;
 }
 
 RequestDispatcher::RequestDispatcher()
 {
-    r = 0;
+    first = 0;
+    numinflight = 0;
+    maxinflight = 1;
+    resend = false;
+    stalecmds = 0;
+    verifiedcmds = 0;
+    serialinflight = 0;
 }
 
-void RequestDispatcher::nextRequest()
+int RequestDispatcher::index(int i) const
 {
-    r ^= 1;
+    return (first + i) % (MAXINFLIGHT + 1);
+}
 
-    while(!reqbuf.empty() && reqs[r].cmdspending() < MAX_COMMANDS)
-    {
-        Command *c = reqbuf.front();
-        reqbuf.pop();
-        reqs[r].add(c);
-        LOG_debug << "Command extracted from secondary buffer: " << reqbuf.size();
-    }
+void RequestDispatcher::setmaxinflight(int n)
+{
+    maxinflight = std::max(1, std::min(n, (int)MAXINFLIGHT));
+}
+
+int RequestDispatcher::getmaxinflight() const
+{
+    return maxinflight;
 }
 
 void RequestDispatcher::add(Command *c)
 {
-    if(reqs[r].cmdspending() < MAX_COMMANDS)
+    Request& r = reqs[index(numinflight)];
+
+    if(r.cmdspending() < MAX_COMMANDS)
     {
-        reqs[r].add(c);
+        r.add(c);
     }
     else
     {
@@ -139,17 +235,128 @@ void RequestDispatcher::add(Command *c)
 
 int RequestDispatcher::cmdspending() const
 {
-    return reqs[r].cmdspending();
+    if (resend)
+    {
+        return reqs[first].cmdspending();
+    }
+
+    int pending = reqs[index(numinflight)].cmdspending();
+
+    return pending > stalecmds ? pending : 0;
 }
 
-void RequestDispatcher::get(string *out) const
+int RequestDispatcher::inflight() const
 {
-    reqs[r].get(out);
+    return numinflight;
+}
+
+bool RequestDispatcher::cansend()
+{
+    if (resend || !numinflight)
+    {
+        return true;
+    }
+
+    if (numinflight >= maxinflight || serialinflight)
+    {
+        return false;
+    }
+
+    return reqs[index(numinflight)].independent(inflightkeys, &verifiedcmds);
+}
+
+bool RequestDispatcher::send(string* out, string* id)
+{
+    if (resend)
+    {
+        resend = false;
+        reqs[first].get(out);
+        *id = reqs[first].id;
+        reqs[first].senttime = Waiter::getmicros();
+        return false;
+    }
+
+    Request& r = reqs[index(numinflight)];
+
+    r.get(out);
+    r.id = *id;
+    r.senttime = Waiter::getmicros();
+    r.addkeys(&inflightkeys);
+
+    if (!r.concurrent())
+    {
+        serialinflight++;
+    }
+
+    numinflight++;
+    stalecmds = 0;
+    verifiedcmds = 0;
+
+    // start the next request with the commands that didn't fit
+    Request& next = reqs[index(numinflight)];
+
+    while(!reqbuf.empty() && next.cmdspending() < MAX_COMMANDS)
+    {
+        Command *c = reqbuf.front();
+        reqbuf.pop();
+        next.add(c);
+        LOG_debug << "Command extracted from secondary buffer: " << reqbuf.size();
+    }
+
+    return true;
+}
+
+void RequestDispatcher::popfirst()
+{
+    Request& r = reqs[first];
+
+    r.removekeys(&inflightkeys);
+
+    if (!r.concurrent())
+    {
+        serialinflight--;
+    }
+
+    first = index(1);
+    numinflight--;
 }
 
 void RequestDispatcher::procresult(MegaClient *client)
 {
-    reqs[r ^ 1].procresult(client);
+    if (!numinflight)
+    {
+        return;
+    }
+
+    // the slot is released first, so that the commands issued while
+    // processing the results can't end up in this request
+    Request& r = reqs[first];
+    popfirst();
+    r.procresult(client);
+}
+
+void RequestDispatcher::failed()
+{
+    if (numinflight)
+    {
+        resend = true;
+    }
+}
+
+void RequestDispatcher::rejected()
+{
+    if (!numinflight)
+    {
+        return;
+    }
+
+    Request& r = reqs[first];
+    popfirst();
+
+    int stale = r.cmdspending();
+    r.moveto(&reqs[index(numinflight)], stalecmds);
+    stalecmds += stale;
+    verifiedcmds = 0;
 }
 
 void RequestDispatcher::clear()
@@ -169,6 +376,15 @@ void RequestDispatcher::clear()
             delete c;
         }
     }
+
+    // the request being processed, if any, is not reused for new commands
+    first = index(numinflight);
+    numinflight = 0;
+    resend = false;
+    stalecmds = 0;
+    verifiedcmds = 0;
+    serialinflight = 0;
+    inflightkeys.clear();
 }
 
 } // namespace
@@ -28,10 +28,351 @@
 #include "mega/megaclient.h"
 #include "mega/base64.h"
 
+// target-specific thread support for the scanner threads
+#include "mega/thread/qtthread.h"
+#include "mega/thread/posixthread.h"
+#include "mega/thread/win32thread.h"
+#include "mega/thread/cppthread.h"
+
 namespace mega {
 
 const int Sync::SCANNING_DELAY_DS = 5;
 
+// records of the parallel initial scan processed at once by procscanq()
+const unsigned Sync::PRESCANNEDBATCH = 256;
+
+#ifdef THREAD_CLASS
+// enumerates folders and fingerprints new or changed files of a sync's
+// initial scan on a pool of threads. Folders are queued by the SDK thread as
+// it creates or matches their LocalNodes (so that exclusions apply to whole
+// subtrees), the fingerprints of a folder's files are split into batches
+// that idle threads steal from the thread that enumerated the folder.
+// Finished batches are merged into the notification queue by the SDK thread.
+class SyncScanner
+{
+public:
+    SyncScanner(MegaClient* client, unsigned numthreads)
+    {
+        fsaccess = client->fsaccess;
+        waiter = client->waiter;
+        followsymlinks = client->followsymlinks;
+
+        outstanding = 0;
+        nextworker = 0;
+        exiting = false;
+        mutex.init(false);
+
+        workers.resize(numthreads);
+        threads = new THREAD_CLASS[numthreads];
+
+        for (unsigned i = 0; i < numthreads; i++)
+        {
+            workers[i].scanner = this;
+            workers[i].index = i;
+            threads[i].start(threadentry, &workers[i]);
+        }
+    }
+
+    ~SyncScanner()
+    {
+        mutex.lock();
+        exiting = true;
+        mutex.unlock();
+
+        for (unsigned i = 0; i < workers.size(); i++)
+        {
+            pending.release();
+        }
+
+        for (unsigned i = 0; i < workers.size(); i++)
+        {
+            threads[i].join();
+        }
+
+        delete[] threads;
+
+        for (unsigned i = 0; i < workers.size(); i++)
+        {
+            for (std::deque<Job*>::iterator it = workers[i].jobs.begin(); it != workers[i].jobs.end(); it++)
+            {
+                delete *it;
+            }
+        }
+
+        for (std::deque<Job*>::iterator it = results.begin(); it != results.end(); it++)
+        {
+            delete *it;
+        }
+    }
+
+    // enumerate a folder (path prefixed with the sync's root) - files whose
+    // fsid, size and mtime match the cached LocalNode are not read
+    void queue(string* localpath, LocalNode* l)
+    {
+        Job* job = new Job;
+        job->localpath = *localpath;
+        job->enumerate = true;
+
+        if (l)
+        {
+            for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+            {
+                if (it->second->type == FILENODE)
+                {
+                    DirEntry* cached = &job->cached[*it->first];
+                    cached->type = FILENODE;
+                    cached->size = it->second->size;
+                    cached->mtime = it->second->mtime;
+                    cached->fsid = it->second->fsid;
+                }
+            }
+        }
+
+        mutex.lock();
+        workers[nextworker++ % workers.size()].jobs.push_back(job);
+        outstanding++;
+        mutex.unlock();
+
+        pending.release();
+    }
+
+    // remove the next finished batch, false if none
+    bool pop(string* localpath, vector<ScanRecord*>* records, bool* enumerated)
+    {
+        mutex.lock();
+
+        if (!results.size())
+        {
+            mutex.unlock();
+            return false;
+        }
+
+        Job* job = results.front();
+        results.pop_front();
+        mutex.unlock();
+
+        localpath->swap(job->localpath);
+        records->swap(job->records);
+        *enumerated = job->enumerate;
+
+        delete job;
+        return true;
+    }
+
+    // jobs queued or running, batches not merged yet
+    unsigned busy()
+    {
+        mutex.lock();
+        unsigned result = outstanding + results.size();
+        mutex.unlock();
+
+        return result;
+    }
+
+protected:
+    // number of files fingerprinted per job
+    static const unsigned FINGERPRINTBATCH = 64;
+
+    struct Job
+    {
+        string localpath;
+
+        // enumerate the folder, or fingerprint the records
+        bool enumerate;
+
+        // files of the folder that are known by name
+        map<string, DirEntry> cached;
+
+        vector<ScanRecord*> records;
+
+        ~Job()
+        {
+            for (unsigned i = 0; i < records.size(); i++)
+            {
+                delete records[i];
+            }
+        }
+    };
+
+    struct Worker
+    {
+        SyncScanner* scanner;
+        unsigned index;
+        std::deque<Job*> jobs;
+    };
+
+    static void* threadentry(void* param)
+    {
+        Worker* worker = (Worker*)param;
+        worker->scanner->loop(worker);
+        return NULL;
+    }
+
+    // own jobs are taken from the back (most recently split, still warm in
+    // the page cache), jobs of other threads from the front
+    Job* next(Worker* worker)
+    {
+        if (worker->jobs.size())
+        {
+            Job* job = worker->jobs.back();
+            worker->jobs.pop_back();
+            return job;
+        }
+
+        for (unsigned i = 1; i < workers.size(); i++)
+        {
+            Worker* victim = &workers[(worker->index + i) % workers.size()];
+
+            if (victim->jobs.size())
+            {
+                Job* job = victim->jobs.front();
+                victim->jobs.pop_front();
+                return job;
+            }
+        }
+
+        return NULL;
+    }
+
+    void loop(Worker* worker)
+    {
+        for (;;)
+        {
+            pending.wait();
+
+            mutex.lock();
+            if (exiting)
+            {
+                mutex.unlock();
+                return;
+            }
+
+            Job* job = next(worker);
+            mutex.unlock();
+
+            if (!job)
+            {
+                continue;
+            }
+
+            if (job->enumerate)
+            {
+                enumerate(worker, job);
+            }
+            else
+            {
+                fingerprint(job);
+            }
+
+            mutex.lock();
+            results.push_back(job);
+            outstanding--;
+            mutex.unlock();
+
+            waiter->notify();
+        }
+    }
+
+    void enumerate(Worker* worker, Job* job)
+    {
+        DirAccess* da = fsaccess->newdiraccess();
+        string path = job->localpath;
+        ScanRecord* record = new ScanRecord;
+        vector<ScanRecord*> changed;
+
+        if (da->dopen(&path, NULL, false))
+        {
+            while (da->dnextentry(&path, &record->localname, followsymlinks, &record->entry))
+            {
+                map<string, DirEntry>::iterator it;
+
+                if (record->entry.type == FILENODE
+                 && (!record->entry.statvalid
+                  || (it = job->cached.find(record->localname)) == job->cached.end()
+                  || it->second.fsid != record->entry.fsid
+                  || it->second.size != record->entry.size
+                  || it->second.mtime != record->entry.mtime))
+                {
+                    changed.push_back(record);
+                }
+                else
+                {
+                    job->records.push_back(record);
+                }
+
+                record = new ScanRecord;
+            }
+        }
+
+        delete record;
+        delete da;
+
+        job->cached.clear();
+
+        // the fingerprints are computed in batches that idle threads can take
+        for (unsigned i = 0; i < changed.size(); i += FINGERPRINTBATCH)
+        {
+            Job* batch = new Job;
+            batch->localpath = job->localpath;
+            batch->enumerate = false;
+            batch->records.assign(changed.begin() + i,
+                                  changed.begin() + std::min<size_t>(i + FINGERPRINTBATCH, changed.size()));
+
+            mutex.lock();
+            worker->jobs.push_back(batch);
+            outstanding++;
+            mutex.unlock();
+
+            pending.release();
+        }
+    }
+
+    void fingerprint(Job* job)
+    {
+        string path;
+
+        for (unsigned i = 0; i < job->records.size(); i++)
+        {
+            ScanRecord* record = job->records[i];
+            FileAccess* fa = fsaccess->newfileaccess();
+
+            path = job->localpath;
+            path.append(fsaccess->localseparator);
+            path.append(record->localname);
+
+            // files that can't be read now are opened again by checkpath(),
+            // which handles transient errors
+            if (fa->fopen(&path, true, false) && fa->type == FILENODE)
+            {
+                record->entry.size = fa->size;
+                record->entry.mtime = fa->mtime;
+                record->entry.fsid = fa->fsid;
+                record->entry.fsidvalid = fa->fsidvalid;
+                record->entry.statvalid = true;
+
+                record->fingerprint.genfingerprint(fa);
+                record->fingerprinted = record->fingerprint.size >= 0;
+            }
+
+            delete fa;
+        }
+    }
+
+    FileSystemAccess* fsaccess;
+    Waiter* waiter;
+    bool followsymlinks;
+
+    THREAD_CLASS* threads;
+    MUTEX_CLASS mutex;
+    SEMAPHORE_CLASS pending;
+    vector<Worker> workers;
+    std::deque<Job*> results;
+    unsigned outstanding;
+    unsigned nextworker;
+    bool exiting;
+};
+#endif
+
 // new Syncs are automatically inserted into the session's syncs list
 // and a full read of the subtree is initiated
 Sync::Sync(MegaClient* cclient, string* crootpath, const char* cdebris,
@@ -54,6 +395,18 @@ Sync::Sync(MegaClient* cclient, string* crootpath, const char* cdebris,
     fullscan = true;
     scanseqno = 0;
 
+    scanner = NULL;
+    scannedfolders = 0;
+    scannedrecords = 0;
+    scannedfingerprints = 0;
+
+#ifdef THREAD_CLASS
+    if (client->syncscanthreads)
+    {
+        scanner = new SyncScanner(client, client->syncscanthreads);
+    }
+#endif
+
     if (cdebris)
     {
         debris = cdebris;
@@ -72,6 +425,7 @@ Sync::Sync(MegaClient* cclient, string* crootpath, const char* cdebris,
         dirnotify = auto_ptr<DirNotify>(client->fsaccess->newdirnotify(crootpath, &localdebris));
     }
     dirnotify->sync = this;
+    dirnotify->maxwatches = client->syncmaxwatches;
 
     // set specified fsfp or get from fs if none
     if (cfsfp)
@@ -119,6 +473,10 @@ Sync::~Sync()
     // must be set to prevent remote mass deletion while rootlocal destructor runs
     assert(state == SYNC_CANCELED || state == SYNC_FAILED);
 
+#ifdef THREAD_CLASS
+    delete scanner;
+#endif
+
     // unlock tmp lock
     delete tmpfa;
 
@@ -135,13 +493,23 @@ Sync::~Sync()
     client->syncactivity = true;
 }
 
-void Sync::addstatecachechildren(uint32_t parent_dbid, idlocalnode_map* tmap, string* path, LocalNode *p, int maxdepth)
+// orders cached LocalNodes by parent dbid
+struct ParentDbidCmp
+{
+    bool operator()(const pair<uint32_t, LocalNode*>& a, const pair<uint32_t, LocalNode*>& b) const
+    {
+        return a.first < b.first;
+    }
+};
+
+void Sync::addstatecachechildren(uint32_t parent_dbid, idlocalnode_vector* tmap, string* path, LocalNode *p, int maxdepth)
 {
-    pair<idlocalnode_map::iterator,idlocalnode_map::iterator> range;
-    idlocalnode_map::iterator it;
+    pair<idlocalnode_vector::iterator,idlocalnode_vector::iterator> range;
+    idlocalnode_vector::iterator it;
     size_t pathlen;
 
-    range = tmap->equal_range(parent_dbid);
+    range = equal_range(tmap->begin(), tmap->end(),
+                        pair<uint32_t, LocalNode*>(parent_dbid, (LocalNode*)NULL), ParentDbidCmp());
 
     pathlen = path->size();
 
@@ -181,7 +549,7 @@ bool Sync::readstatecache()
     if (statecachetable && state == SYNC_INITIALSCAN)
     {
         string cachedata;
-        idlocalnode_map tmap;
+        idlocalnode_vector tmap;
         uint32_t cid;
         LocalNode* l;
 
@@ -193,10 +561,13 @@ bool Sync::readstatecache()
             if ((l = LocalNode::unserialize(this, &cachedata)))
             {
                 l->dbid = cid;
-                tmap.insert(pair<int32_t,LocalNode*>(l->parent_dbid,l));
+                tmap.push_back(pair<uint32_t, LocalNode*>(l->parent_dbid, l));
             }
         }
 
+        // group siblings (a sorted vector is much cheaper to build than a multimap)
+        stable_sort(tmap.begin(), tmap.end(), ParentDbidCmp());
+
         // recursively build LocalNode tree, set scanseqnos to sync's current scanseqno
         addstatecachechildren(0, &tmap, &localroot.localname, &localroot, 100);
 
@@ -257,23 +628,50 @@ void Sync::cachenodes()
 
         deleteq.clear();
 
-        // additions - we iterate until completion or until we get stuck
-        bool added;
+        // additions - single pass: queued ancestors that are not in the
+        // database yet are written first, so that their dbid is known
+        localnode_vector pending;
+
+        for (localnode_set::iterator it = insertq.begin(); it != insertq.end(); )
+        {
+            LocalNode* l = *it;
+            bool stuck = false;
+
+            pending.clear();
+            pending.push_back(l);
+
+            while (l->parent != &localroot && !l->parent->dbid)
+            {
+                l = l->parent;
+
+                if (!insertq.count(l))
+                {
+                    // parent neither cached nor queued
+                    stuck = true;
+                    break;
+                }
 
-        do {
-            added = false;
+                pending.push_back(l);
+            }
+
+            if (stuck)
+            {
+                it++;
+                continue;
+            }
 
-            for (set<LocalNode*>::iterator it = insertq.begin(); it != insertq.end(); )
+            for (localnode_vector::reverse_iterator pit = pending.rbegin(); pit != pending.rend(); pit++)
             {
-                if ((*it)->parent->dbid || (*it)->parent == &localroot)
+                statecachetable->put(MegaClient::CACHEDLOCALNODE, *pit, &client->key);
+
+                if (*pit != *it)
                 {
-                    statecachetable->put(MegaClient::CACHEDLOCALNODE, *it, &client->key);
-                    insertq.erase(it++);
-                    added = true;
+                    insertq.erase(*pit);
                 }
-                else it++;
             }
-        } while (added);
+
+            insertq.erase(it++);
+        }
 
         statecachetable->commit();
 
@@ -299,9 +697,94 @@ void Sync::changestate(syncstate_t newstate)
 
         state = newstate;
         fullscan = false;
+
+#ifdef THREAD_CLASS
+        // the scanner only serves the initial scan
+        if (scanner)
+        {
+            LOG_debug << "Parallel scan finished. Folders: " << scannedfolders
+                      << "  Records: " << scannedrecords << "  Fingerprinted: " << scannedfingerprints;
+            delete scanner;
+            scanner = NULL;
+        }
+#endif
     }
 }
 
+// queue the finished batches of the scanner threads - like scan() does,
+// excluded records and the debris folder are skipped
+void Sync::mergescan()
+{
+#ifdef THREAD_CLASS
+    if (!scanner)
+    {
+        return;
+    }
+
+    string folder, localpath, name;
+    vector<ScanRecord*> records;
+    bool enumerated;
+
+    while (scanner->pop(&folder, &records, &enumerated))
+    {
+        if (enumerated)
+        {
+            scannedfolders++;
+        }
+
+        for (unsigned i = 0; i < records.size(); i++)
+        {
+            ScanRecord* record = records[i];
+
+            localpath = folder;
+            localpath.append(client->fsaccess->localseparator);
+            localpath.append(record->localname);
+
+            name = record->localname;
+            client->fsaccess->local2name(&name);
+
+            scannedrecords++;
+            if (record->fingerprinted)
+            {
+                scannedfingerprints++;
+            }
+
+            if (!client->app->sync_syncable(name.c_str(), &folder, &record->localname))
+            {
+                LOG_debug << "Excluded: " << name;
+                delete record;
+                continue;
+            }
+
+            if (localpath.size() >= localdebris.size()
+             && !memcmp(localpath.data(), localdebris.data(), localdebris.size())
+             && (localpath.size() == localdebris.size()
+              || !memcmp(localpath.data() + localdebris.size(),
+                         client->fsaccess->localseparator.data(),
+                         client->fsaccess->localseparator.size())))
+            {
+                delete record;
+                continue;
+            }
+
+            dirnotify->notify(DirNotify::DIREVENTS, NULL, localpath.data(), localpath.size(), true, record);
+        }
+
+        records.clear();
+        client->syncactivity = true;
+    }
+#endif
+}
+
+unsigned Sync::scanpending()
+{
+#ifdef THREAD_CLASS
+    return scanner ? scanner->busy() : 0;
+#else
+    return 0;
+#endif
+}
+
 // walk path and return corresponding LocalNode and its parent
 // path must be relative to l or start with the root prefix if l == NULL
 // path must be a full sync path, i.e. start with localroot->localname
@@ -414,6 +897,7 @@ bool Sync::scan(string* localpath, FileAccess* fa)
                 client->fsaccess->localseparator.size())))
     {
         DirAccess* da;
+        DirEntry entry;
         string localname, name;
         bool success;
 
@@ -424,6 +908,17 @@ bool Sync::scan(string* localpath, FileAccess* fa)
             LOG_debug << "Scanning folder: " << utf8path;
         }
 
+#ifdef THREAD_CLASS
+        // during the initial scan, the folder is enumerated by the scanner
+        // threads and its records are queued by mergescan()
+        if (scanner)
+        {
+            scanner->queue(localpath, *localpath == localroot.localname
+                                      ? &localroot : localnodebypath(NULL, localpath));
+            return true;
+        }
+#endif
+
         da = client->fsaccess->newdiraccess();
 
         // scan the dir, mark all items with a unique identifier
@@ -431,7 +926,7 @@ bool Sync::scan(string* localpath, FileAccess* fa)
         {
             size_t t = localpath->size();
 
-            while (da->dnext(localpath, &localname, client->followsymlinks))
+            while (da->dnextentry(localpath, &localname, client->followsymlinks, &entry))
             {
                 name = localname;
                 client->fsaccess->local2name(&name);
@@ -457,8 +952,9 @@ bool Sync::scan(string* localpath, FileAccess* fa)
                         LocalNode *l = NULL;
                         if (initializing)
                         {
-                            // preload all cached LocalNodes
-                            l = checkpath(NULL, localpath);
+                            // preload all cached LocalNodes (the attributes
+                            // from the enumeration spare reopening the record)
+                            l = checkpath(NULL, localpath, NULL, &entry);
                         }
 
                         if (!l || l == (LocalNode*)~0)
@@ -484,13 +980,30 @@ bool Sync::scan(string* localpath, FileAccess* fa)
     else return false;
 }
 
+// apply a fingerprint computed by the scanner threads - returns whether it
+// changed, like FileFingerprint::genfingerprint()
+static bool copyfingerprint(FileFingerprint* f, const FileFingerprint* scanned)
+{
+    bool changed = !f->isvalid
+                || f->size != scanned->size
+                || f->mtime != scanned->mtime
+                || memcmp(f->crc, scanned->crc, sizeof f->crc);
+
+    f->size = scanned->size;
+    f->mtime = scanned->mtime;
+    memcpy(f->crc, scanned->crc, sizeof f->crc);
+    f->isvalid = true;
+
+    return changed;
+}
+
 // check local path - if !localname, localpath is relative to l, with l == NULL
 // being the root of the sync
 // if localname is set, localpath is absolute and localname its last component
 // path references a new FOLDERNODE: returns created node
 // path references a existing FILENODE: returns node
 // otherwise, returns NULL
-LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname)
+LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, const DirEntry* entry, const FileFingerprint* fingerprint)
 {
     LocalNode* ll = l;
     FileAccess* fa;
@@ -591,7 +1104,23 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname)
     {
         // match cached LocalNode state during initial/rescan to prevent costly re-fingerprinting
         // (just compare the fsids, sizes and mtimes to detect changes)
-        if (fa->fopen(localname ? localpath : &tmppath, false, false))
+        bool opened = false;
+        bool found = entry && entry->statvalid;
+
+        if (found)
+        {
+            fa->type = entry->type;
+            fa->size = entry->size;
+            fa->mtime = entry->mtime;
+            fa->fsid = entry->fsid;
+            fa->fsidvalid = entry->fsidvalid;
+        }
+        else
+        {
+            found = opened = fa->fopen(localname ? localpath : &tmppath, false, false);
+        }
+
+        if (found)
         {
             // find corresponding LocalNode by file-/foldername
             int lastpart = client->fsaccess->lastpartlocal(localname ? localpath : &tmppath);
@@ -616,7 +1145,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname)
 
                     if (l->type == FOLDERNODE)
                     {
-                        scan(localname ? localpath : &tmppath, fa);
+                        scan(localname ? localpath : &tmppath, opened ? fa : NULL);
                     }
                     else
                     {
@@ -639,7 +1168,20 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname)
         fa = client->fsaccess->newfileaccess();
     }
 
-    if (fa->fopen(localname ? localpath : &tmppath, true, false))
+    // the scanner threads have already read the file's fingerprint (folders
+    // only need the attributes)
+    bool prescanned = entry && entry->statvalid && (entry->type == FOLDERNODE || fingerprint);
+
+    if (prescanned)
+    {
+        fa->type = entry->type;
+        fa->size = entry->size;
+        fa->mtime = entry->mtime;
+        fa->fsid = entry->fsid;
+        fa->fsidvalid = entry->fsidvalid;
+    }
+
+    if (prescanned || fa->fopen(localname ? localpath : &tmppath, true, false))
     {
         if (!isroot)
         {
@@ -722,7 +1264,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname)
 
                             m_off_t dsize = l->size > 0 ? l->size : 0;
 
-                            if (l->genfingerprint(fa) && l->size >= 0)
+                            if ((fingerprint ? copyfingerprint(l, fingerprint) : l->genfingerprint(fa)) && l->size >= 0)
                             {
                                 localbytes -= dsize - l->size;
                             }
@@ -795,7 +1337,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname)
                     // immediately scan folder to detect deviations from cached state
                     if (fullscan)
                     {
-                        scan(localname ? localpath : &tmppath, fa);
+                        scan(localname ? localpath : &tmppath, prescanned ? NULL : fa);
                     }
                 }
                 else
@@ -822,7 +1364,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname)
             {
                 if (newnode)
                 {
-                    scan(localname ? localpath : &tmppath, fa);
+                    scan(localname ? localpath : &tmppath, prescanned ? NULL : fa);
                     client->app->syncupdate_local_folder_addition(this, l, path.c_str());
 
                     if (!isroot)
@@ -856,7 +1398,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname)
                         localbytes -= l->size;
                     }
 
-                    if (l->genfingerprint(fa))
+                    if (fingerprint ? copyfingerprint(l, fingerprint) : l->genfingerprint(fa))
                     {
                         changed = true;
                         l->bumpnagleds();
@@ -938,6 +1480,7 @@ dstime Sync::procscanq(int q)
     size_t t = dirnotify->notifyq[q].size();
     dstime dsmin = Waiter::ds - SCANNING_DELAY_DS;
     LocalNode* l;
+    unsigned prescanned = 0;
 
     while (t--)
     {
@@ -949,9 +1492,17 @@ dstime Sync::procscanq(int q)
             return dirnotify->notifyq[q].front().timestamp - dsmin;
         }
 
+        // changes seen from here on get a record of their own
+        dirnotify->processnotification((DirNotify::notifyqueue)q);
+
+        ScanRecord* scanned = dirnotify->notifyq[q].front().scanned;
+        bool fromscanner = scanned != NULL;
+
         if ((l = dirnotify->notifyq[q].front().localnode) != (LocalNode*)~0)
         {
-            l = checkpath(l, &dirnotify->notifyq[q].front().path);
+            l = checkpath(l, &dirnotify->notifyq[q].front().path, NULL,
+                          scanned ? &scanned->entry : NULL,
+                          scanned && scanned->fingerprinted ? &scanned->fingerprint : NULL);
 
             // defer processing because of a missing parent node?
             if (l == (LocalNode*)~0)
@@ -967,13 +1518,17 @@ dstime Sync::procscanq(int q)
             LOG_debug << "Notification skipped: " << utf8path;
         }
 
-        dirnotify->notifyq[q].pop_front();
+        dirnotify->popnotification((DirNotify::notifyqueue)q);
 
         // we return control to the application in case a filenode was added
         // (in order to avoid lengthy blocking episodes due to multiple
-        // consecutive fingerprint calculations)
+        // consecutive fingerprint calculations - records of the parallel
+        // initial scan come with their fingerprint and are processed in
+        // batches)
         // or if new nodes are being added due to a copy/delete operation
-        if ((l && l != (LocalNode*)~0 && l->type == FILENODE) || client->syncadding)
+        if ((l && l != (LocalNode*)~0 && l->type == FILENODE
+             && (!fromscanner || ++prescanned >= PRESCANNEDBATCH))
+         || client->syncadding)
         {
             break;
         }
@@ -33,6 +33,7 @@ Transfer::Transfer(MegaClient* cclient, direction_t ctype)
     client = cclient;
     size = 0;
     failcount = 0;
+    bt.setwheel(&client->timers, this);
     uploadhandle = 0;
     minfa = 0;
     pos = 0;
@@ -50,6 +51,8 @@ Transfer::Transfer(MegaClient* cclient, direction_t ctype)
 
     priority = 0;
     state = TRANSFERSTATE_NONE;
+    listed = false;
+    inreadyset = false;
 
     faputcompletion_it = client->faputcompletion.end();
     transfers_it = client->transfers[type].end();
@@ -58,6 +61,8 @@ Transfer::Transfer(MegaClient* cclient, direction_t ctype)
 // delete transfer with underlying slot, notify files
 Transfer::~Transfer()
 {
+    client->transfercachedetach(this);
+
     if (faputcompletion_it != client->faputcompletion.end())
     {
         client->faputcompletion.erase(faputcompletion_it);
@@ -396,6 +401,7 @@ void Transfer::failed(error e, dstime timeleft)
         failcount++;
         delete slot;
         slot = NULL;
+        client->transferlist.schedule(this);
         client->transfercacheadd(this);
 
         LOG_debug << "Deferring transfer " << failcount << " during " << (bt.retryin() * 100) << " ms";
@@ -421,6 +427,11 @@ void Transfer::failed(error e, dstime timeleft)
     }
 }
 
+void Transfer::timerexpired(BackoffTimer*)
+{
+    client->transferlist.schedule(this);
+}
+
 // transfer completion: copy received file locally, set timestamp(s), verify
 // fingerprint, notify app, notify files
 void Transfer::complete()
@@ -1282,9 +1293,9 @@ DirectReadSlot::~DirectReadSlot()
     delete req;
 }
 
-bool priority_comparator(Transfer* i, Transfer *j)
+bool TransferPriorityCmp::operator()(const Transfer* a, const Transfer* b) const
 {
-    return (i->priority < j->priority);
+    return a->priority < b->priority;
 }
 
 TransferList::TransferList()
@@ -1299,29 +1310,42 @@ void TransferList::addtransfer(Transfer *transfer)
         transfer->state = TRANSFERSTATE_QUEUED;
     }
 
+    if (transfer->priority)
+    {
+        assert(!transfer->listed);
+
+        // the list is keyed by priority: another transfer with the same one
+        // would make this one invisible, so it is moved to the end instead
+        if (!transfers[transfer->type].insert(transfer).second)
+        {
+            LOG_warn << "Duplicate transfer priority: " << transfer->priority;
+            transfer->priority = 0;
+        }
+    }
+
     if (!transfer->priority)
     {
         currentpriority += PRIORITY_STEP;
         transfer->priority = currentpriority;
-        assert(!transfers[transfer->type].size() || transfers[transfer->type][transfers[transfer->type].size() - 1]->priority < transfer->priority);
-        transfers[transfer->type].push_back(transfer);
+        assert(!transfers[transfer->type].size() || (*transfers[transfer->type].rbegin())->priority < transfer->priority);
+        transfers[transfer->type].insert(transfers[transfer->type].end(), transfer);
         client->transfercacheadd(transfer);
     }
-    else
-    {
-        transfer_list::iterator it = std::lower_bound(transfers[transfer->type].begin(), transfers[transfer->type].end(), transfer, priority_comparator);
-        assert(it == transfers[transfer->type].end() || (*it)->priority != transfer->priority);
-        transfers[transfer->type].insert(it, transfer);
-    }
+
+    transfer->listed = true;
+    schedule(transfer);
 }
 
 void TransferList::removetransfer(Transfer *transfer)
 {
-    transfer_list::iterator it = iterator(transfer);
-    if (it != transfers[transfer->type].end())
+    if (!transfer->listed)
     {
-        transfers[transfer->type].erase(it);
+        return;
     }
+
+    unschedule(transfer);
+    transfers[transfer->type].erase(transfer);
+    transfer->listed = false;
 }
 
 void TransferList::movetransfer(Transfer *transfer, Transfer *prevTransfer)
@@ -1342,14 +1366,14 @@ void TransferList::movetransfer(Transfer *transfer, unsigned int position)
         return;
     }
 
-    transfer_list::iterator dstit;
+    transfer_list::iterator dstit = transfers[transfer->type].begin();
     if (position >= transfers[transfer->type].size())
     {
         dstit = transfers[transfer->type].end();
     }
     else
     {
-        dstit = transfers[transfer->type].begin() + position;
+        std::advance(dstit, position);
     }
 
     movetransfer(it, dstit);
@@ -1373,81 +1397,87 @@ void TransferList::movetransfer(transfer_list::iterator it, transfer_list::itera
         return;
     }
 
-    if ((it + 1) == dstit)
+    transfer_list::iterator nextit = it;
+    if (++nextit == dstit)
     {
         LOG_warn << "Trying to move to the same position";
         return;
     }
 
     Transfer *transfer = (*it);
-    if (dstit == transfers[transfer->type].end())
+    transfer_list &tlist = transfers[transfer->type];
+    uint64_t newpriority;
+    bool decrease;
+
+    if (dstit == tlist.end())
     {
         LOG_debug << "Moving transfer to the last position";
-        prepareDecreasePriority(transfer, it, dstit);
-
-        transfers[transfer->type].erase(it);
         currentpriority += PRIORITY_STEP;
-        transfer->priority = currentpriority;
-        assert(!transfers[transfer->type].size() || transfers[transfer->type][transfers[transfer->type].size() - 1]->priority < transfer->priority);
-        transfers[transfer->type].push_back(transfer);
-        client->transfercacheadd(transfer);
-        client->app->transfer_update(transfer);
-        return;
-    }
-
-    int srcindex = std::distance(transfers[transfer->type].begin(), it);
-    int dstindex = std::distance(transfers[transfer->type].begin(), dstit);
-    LOG_debug << "Moving transfer from " << srcindex << " to " << dstindex;
-
-    uint64_t prevpriority = 0;
-    uint64_t nextpriority = 0;
-
-    nextpriority = (*dstit)->priority;
-    if (dstit != transfers[transfer->type].begin())
-    {
-        transfer_list::iterator previt = dstit - 1;
-        prevpriority = (*previt)->priority;
+        newpriority = currentpriority;
+        decrease = true;
     }
     else
     {
-        prevpriority = nextpriority - 2 * PRIORITY_STEP;
-    }
+        uint64_t prevpriority = 0;
+        uint64_t nextpriority = 0;
 
-    uint64_t newpriority = (prevpriority + nextpriority) / 2;
-    LOG_debug << "Moving transfer between priority " << prevpriority << " and " << nextpriority << ". New: " << newpriority;
-    if (prevpriority == newpriority)
-    {
-        LOG_warn << "There is no space for the move. Adjusting priorities.";
-        int positions = dstindex;
-        uint64_t fixedPriority = transfers[transfer->type][0]->priority - PRIORITY_STEP * (positions + 1);
-        for (int i = 0; i < positions; i++)
+        nextpriority = (*dstit)->priority;
+        if (dstit != tlist.begin())
+        {
+            transfer_list::iterator previt = dstit;
+            previt--;
+            prevpriority = (*previt)->priority;
+        }
+        else
         {
-            Transfer *t = transfers[transfer->type][i];
-            LOG_debug << "Adjusting priority of transfer " << i << " to " << fixedPriority;
-            t->priority = fixedPriority;
-            client->transfercacheadd(t);
-            client->app->transfer_update(t);
-            fixedPriority += PRIORITY_STEP;
+            prevpriority = nextpriority - 2 * PRIORITY_STEP;
         }
-        newpriority = fixedPriority;
-        LOG_debug << "Fixed priority: " << fixedPriority;
+
+        newpriority = (prevpriority + nextpriority) / 2;
+        LOG_debug << "Moving transfer between priority " << prevpriority << " and " << nextpriority << ". New: " << newpriority;
+        if (prevpriority == newpriority)
+        {
+            LOG_warn << "There is no space for the move. Adjusting priorities.";
+            int positions = std::distance(tlist.begin(), dstit);
+            uint64_t fixedPriority = (*tlist.begin())->priority - PRIORITY_STEP * (positions + 1);
+
+            // the adjusted transfers keep their relative order and stay below
+            // the rest, so they can be renumbered in place
+            for (transfer_list::iterator fit = tlist.begin(); fit != dstit; fit++)
+            {
+                Transfer *t = (*fit);
+                LOG_debug << "Adjusting priority of transfer " << t->priority << " to " << fixedPriority;
+                t->priority = fixedPriority;
+                client->transfercacheadd(t);
+                client->app->transfer_update(t);
+                fixedPriority += PRIORITY_STEP;
+            }
+            newpriority = fixedPriority;
+            LOG_debug << "Fixed priority: " << fixedPriority;
+        }
+
+        decrease = transfer->priority < (*dstit)->priority;
     }
 
-    transfer->priority = newpriority;
-    if (srcindex > dstindex)
+    if (decrease)
     {
-        prepareIncreasePriority(transfer, it, dstit);
+        prepareDecreasePriority(transfer, dstit);
     }
-    else
+
+    // the position in the sets depends on the priority
+    unschedule(transfer);
+    tlist.erase(it);
+    transfer->priority = newpriority;
+
+    if (!decrease)
     {
-        prepareDecreasePriority(transfer, it, dstit);
-        dstindex--;
+        prepareIncreasePriority(transfer);
     }
 
-    transfers[transfer->type].erase(it);
-    transfer_list::iterator fit = transfers[transfer->type].begin() + dstindex;
-    assert(fit == transfers[transfer->type].end() || (*fit)->priority != transfer->priority);
-    transfers[transfer->type].insert(fit, transfer);
+    assert(tlist.find(transfer) == tlist.end());
+    tlist.insert(dstit, transfer);
+    schedule(transfer);
+
     client->transfercacheadd(transfer);
     client->app->transfer_update(transfer);
 }
@@ -1481,7 +1511,8 @@ void TransferList::moveup(Transfer *transfer)
     {
         return;
     }
-    transfer_list::iterator dstit = it - 1;
+    transfer_list::iterator dstit = it;
+    dstit--;
     movetransfer(it, dstit);
 }
 
@@ -1492,7 +1523,8 @@ void TransferList::moveup(transfer_list::iterator it)
         return;
     }
 
-    transfer_list::iterator dstit = it - 1;
+    transfer_list::iterator dstit = it;
+    dstit--;
     movetransfer(it, dstit);
 }
 
@@ -1504,8 +1536,8 @@ void TransferList::movedown(Transfer *transfer)
         return;
     }
 
-    transfer_list::iterator dstit = it + 1;
-    if (dstit == transfers[transfer->type].end())
+    transfer_list::iterator dstit = it;
+    if (++dstit == transfers[transfer->type].end())
     {
         return;
     }
@@ -1521,7 +1553,8 @@ void TransferList::movedown(transfer_list::iterator it)
         return;
     }
 
-    transfer_list::iterator dstit = it + 1;
+    transfer_list::iterator dstit = it;
+    dstit++;
     movetransfer(it, dstit);
 }
 
@@ -1540,9 +1573,9 @@ error TransferList::pause(Transfer *transfer, bool enable)
 
     if (!enable)
     {
-        transfer_list::iterator it = iterator(transfer);
         transfer->state = TRANSFERSTATE_QUEUED;
-        prepareIncreasePriority(transfer, it, it);
+        prepareIncreasePriority(transfer);
+        schedule(transfer);
         client->transfercacheadd(transfer);
         client->app->transfer_update(transfer);
         return API_OK;
@@ -1559,6 +1592,7 @@ error TransferList::pause(Transfer *transfer, bool enable)
             delete transfer->slot;
         }
         transfer->state = TRANSFERSTATE_PAUSED;
+        schedule(transfer);
         client->transfercacheadd(transfer);
         client->app->transfer_update(transfer);
         return API_OK;
@@ -1585,7 +1619,7 @@ transfer_list::iterator TransferList::iterator(Transfer *transfer)
         return transfer_list::iterator();
     }
 
-    transfer_list::iterator it = std::lower_bound(transfers[transfer->type].begin(), transfers[transfer->type].end(), transfer, priority_comparator);
+    transfer_list::iterator it = transfers[transfer->type].find(transfer);
     if (it != transfers[transfer->type].end() && (*it) == transfer)
     {
         return it;
@@ -1596,15 +1630,29 @@ transfer_list::iterator TransferList::iterator(Transfer *transfer)
 
 Transfer *TransferList::nexttransfer(direction_t direction)
 {
-    for (transfer_list::iterator it = transfers[direction].begin(); it != transfers[direction].end(); it++)
+    // move the transfers whose backoff elapsed to the ready set
+    client->timers.expire();
+
+    transfer_list::iterator it = ready[direction].begin();
+    while (it != ready[direction].end())
     {
-        Transfer *transfer = (*it);
-        if ((!transfer->slot && isReady(transfer))
-                || (transfer->asyncopencontext
-                    && transfer->asyncopencontext->finished))
+        Transfer *transfer = (*it++);
+        if (transfer->asyncopencontext)
+        {
+            if (transfer->asyncopencontext->finished)
+            {
+                return transfer;
+            }
+            continue;
+        }
+
+        if (!transfer->slot && isReady(transfer))
         {
             return transfer;
         }
+
+        // started, paused or backed off since it was indexed
+        schedule(transfer);
     }
     return NULL;
 }
@@ -1613,14 +1661,55 @@ Transfer *TransferList::transferat(direction_t direction, unsigned int position)
 {
     if (transfers[direction].size() > position)
     {
-        return transfers[direction][position];
+        transfer_list::iterator it = transfers[direction].begin();
+        std::advance(it, position);
+        return (*it);
     }
     return NULL;
 }
 
-void TransferList::prepareIncreasePriority(Transfer *transfer, transfer_list::iterator srcit, transfer_list::iterator dstit)
+void TransferList::schedule(Transfer *transfer)
 {
-    if (dstit == transfers[transfer->type].end())
+    unschedule(transfer);
+
+    if (!transfer->listed)
+    {
+        return;
+    }
+
+    // a pending async open is always polled
+    if (!transfer->asyncopencontext)
+    {
+        if (transfer->slot
+                || (transfer->state != TRANSFERSTATE_QUEUED && transfer->state != TRANSFERSTATE_RETRYING))
+        {
+            return;
+        }
+
+        // in backoff: rescheduled by timerexpired() from the client's
+        // TimerWheel
+        if (!transfer->bt.armed())
+        {
+            return;
+        }
+    }
+
+    ready[transfer->type].insert(transfer);
+    transfer->inreadyset = true;
+}
+
+void TransferList::unschedule(Transfer *transfer)
+{
+    if (transfer->inreadyset)
+    {
+        ready[transfer->type].erase(transfer);
+        transfer->inreadyset = false;
+    }
+}
+
+void TransferList::prepareIncreasePriority(Transfer *transfer)
+{
+    if (!transfer->listed)
     {
         return;
     }
@@ -1644,36 +1733,35 @@ void TransferList::prepareIncreasePriority(Transfer *transfer, transfer_list::it
         {
             lastActiveTransfer->bt.arm();
             lastActiveTransfer->cachedtempurl = lastActiveTransfer->slot->tempurl;
-            delete lastActiveTransfer->slot;
             lastActiveTransfer->state = TRANSFERSTATE_QUEUED;
+            delete lastActiveTransfer->slot;
             client->transfercacheadd(lastActiveTransfer);
             client->app->transfer_update(lastActiveTransfer);
         }
     }
 }
 
-void TransferList::prepareDecreasePriority(Transfer *transfer, transfer_list::iterator it, transfer_list::iterator dstit)
+void TransferList::prepareDecreasePriority(Transfer *transfer, transfer_list::iterator dstit)
 {
     if (transfer->slot && transfer->state == TRANSFERSTATE_ACTIVE)
     {
-        transfer_list::iterator cit = it + 1;
-        while (cit != transfers[transfer->type].end())
+        // only the dispatch candidates between both positions can take over
+        transfer_list &candidates = ready[transfer->type];
+        for (transfer_list::iterator cit = candidates.upper_bound(transfer); cit != candidates.end(); cit++)
         {
-            if (!(*cit)->slot && isReady(*cit))
+            if (dstit != transfers[transfer->type].end() && (*cit)->priority > (*dstit)->priority)
             {
-                transfer->bt.arm();
-                transfer->cachedtempurl = (*it)->slot->tempurl;
-                delete transfer->slot;
-                transfer->state = TRANSFERSTATE_QUEUED;
                 break;
             }
 
-            if (cit == dstit)
+            if (!(*cit)->slot && isReady(*cit))
             {
+                transfer->bt.arm();
+                transfer->cachedtempurl = transfer->slot->tempurl;
+                transfer->state = TRANSFERSTATE_QUEUED;
+                delete transfer->slot;
                 break;
             }
-
-            cit++;
         }
     }
 }
@@ -29,8 +29,111 @@
 #include "mega/utils.h"
 #include "mega/logging.h"
 
+// target-specific thread support for the decryption thread
+#include "mega/thread/qtthread.h"
+#include "mega/thread/posixthread.h"
+#include "mega/thread/win32thread.h"
+#include "mega/thread/cppthread.h"
+
 namespace mega {
 
+#ifdef THREAD_CLASS
+// decrypts and MACs the finished chunks of a download in a separate thread,
+// so that network, CPU and disk work in parallel
+class ChunkDecryptor
+{
+public:
+    ChunkDecryptor(Waiter* cwaiter)
+    {
+        waiter = cwaiter;
+        exiting = false;
+        mutex.init(false);
+        thread.start(threadentry, this);
+    }
+
+    ~ChunkDecryptor()
+    {
+        mutex.lock();
+        exiting = true;
+        mutex.unlock();
+
+        pending.release();
+        thread.join();
+    }
+
+    void push(DownloadChunk* chunk)
+    {
+        mutex.lock();
+        chunks.push_back(chunk);
+        mutex.unlock();
+
+        pending.release();
+    }
+
+    bool decrypted(DownloadChunk* chunk)
+    {
+        mutex.lock();
+        bool result = chunk->decrypted;
+        mutex.unlock();
+
+        return result;
+    }
+
+    // block until the chunk has been processed
+    void wait(DownloadChunk* chunk)
+    {
+        while (!decrypted(chunk))
+        {
+            done.wait();
+        }
+    }
+
+protected:
+    static void* threadentry(void* param)
+    {
+        ((ChunkDecryptor*)param)->loop();
+        return NULL;
+    }
+
+    void loop()
+    {
+        for (;;)
+        {
+            pending.wait();
+
+            mutex.lock();
+            if (exiting)
+            {
+                mutex.unlock();
+                return;
+            }
+
+            DownloadChunk* chunk = chunks.front();
+            chunks.pop_front();
+            mutex.unlock();
+
+            HttpReqDL* req = chunk->req;
+            req->finalize(&chunk->key, &req->chunkmacs, chunk->ctriv, chunk->filesize);
+
+            mutex.lock();
+            chunk->decrypted = true;
+            mutex.unlock();
+
+            done.release();
+            waiter->notify();
+        }
+    }
+
+    THREAD_CLASS thread;
+    MUTEX_CLASS mutex;
+    SEMAPHORE_CLASS pending;
+    SEMAPHORE_CLASS done;
+    std::deque<DownloadChunk*> chunks;
+    Waiter* waiter;
+    bool exiting;
+};
+#endif
+
 // transfer attempts are considered failed after XFERTIMEOUT seconds
 // without data flow
 const dstime TransferSlot::XFERTIMEOUT = 600;
@@ -38,6 +141,9 @@ const dstime TransferSlot::XFERTIMEOUT = 600;
 // max time without progress callbacks
 const dstime TransferSlot::PROGRESSTIMEOUT = 10;
 
+// downloads of at least 16 MB are decrypted in a separate thread
+const m_off_t TransferSlot::MIN_THREADED_DECRYPT_SIZE = 16777216;
+
 // max request size for downloads
 #if defined(__ANDROID__) || defined(USE_IOS) || defined(WINDOWS_PHONE)
     const m_off_t TransferSlot::MAX_DOWNLOAD_REQ_SIZE = 2097152; // 2 MB
@@ -65,9 +171,11 @@ TransferSlot::TransferSlot(Transfer* ctransfer)
 
     reqs = NULL;
     pendingcmd = NULL;
+    decryptor = NULL;
 
     transfer = ctransfer;
     transfer->slot = this;
+    retrybt.setwheel(&transfer->client->timers);
     transfer->state = TRANSFERSTATE_ACTIVE;
 
     connections = transfer->size > 131072 ? transfer->client->connections[transfer->type] : 1;
@@ -131,31 +239,45 @@ TransferSlot::~TransferSlot()
     {
         bool cachetransfer = false; // need to save in cache
 
-        if (fa && fa->asyncavailable())
+        for (std::list<DownloadChunk*>::iterator it = downloadchunks.begin(); it != downloadchunks.end(); )
         {
-            for (int i = 0; i < connections; i++)
+            DownloadChunk* chunk = *it;
+
+#ifdef THREAD_CLASS
+            if (decryptor)
+            {
+                decryptor->wait(chunk);
+            }
+#endif
+
+            if (chunk->asyncIO)
             {
-                if (reqs[i] && reqs[i]->status == REQ_ASYNCIO && asyncIO[i])
+                chunk->asyncIO->finish();
+                bool written = !chunk->asyncIO->failed;
+                delete chunk->asyncIO;
+                chunk->asyncIO = NULL;
+
+                if (written)
                 {
-                    asyncIO[i]->finish();
-                    if (!asyncIO[i]->failed)
-                    {
-                        LOG_verbose << "Async write succeeded";
-                        HttpReqDL *downloadRequest = (HttpReqDL *)reqs[i];
-                        for (chunkmac_map::iterator it = downloadRequest->chunkmacs.begin(); it != downloadRequest->chunkmacs.end(); it++)
-                        {
-                            transfer->chunkmacs[it->first] = it->second;
-                        }
-                        downloadRequest->chunkmacs.clear();
-                        transfer->progresscompleted += downloadRequest->bufpos;
-                        LOG_debug << "Cached async data at: " << downloadRequest->dlpos << "   Size: " << downloadRequest->bufpos;
-                        cachetransfer = true;
-                    }
+                    LOG_verbose << "Async write succeeded";
+                    HttpReqDL *downloadRequest = chunk->req;
+                    mergechunk(downloadRequest);
+                    LOG_debug << "Cached async data at: " << downloadRequest->dlpos << "   Size: " << downloadRequest->bufpos;
+                    cachetransfer = true;
+
+                    transfer->client->bufferpool.freereq(downloadRequest);
+                    delete chunk;
+                    it = downloadchunks.erase(it);
+                    continue;
                 }
-                delete asyncIO[i];
-                asyncIO[i] = NULL;
             }
 
+            it++;
+        }
+
+        if (fa && fa->asyncavailable())
+        {
+
             // Open the file in synchonous mode
             delete fa;
             fa = transfer->client->fsaccess->newfileaccess();
@@ -166,6 +288,28 @@ TransferSlot::~TransferSlot()
             }
         }
 
+        // decrypted chunks that weren't written yet
+        for (std::list<DownloadChunk*>::iterator it = downloadchunks.begin(); fa && it != downloadchunks.end(); )
+        {
+            HttpReqDL *downloadRequest = (*it)->req;
+            if (fa->fwrite(downloadRequest->buf, downloadRequest->bufpos, downloadRequest->dlpos))
+            {
+                LOG_verbose << "Sync write succeeded";
+                mergechunk(downloadRequest);
+                LOG_debug << "Cached data at: " << downloadRequest->dlpos << "   Size: " << downloadRequest->bufpos;
+                cachetransfer = true;
+
+                transfer->client->bufferpool.freereq(downloadRequest);
+                delete *it;
+                it = downloadchunks.erase(it);
+            }
+            else
+            {
+                LOG_err << "Error caching data at: " << downloadRequest->dlpos;
+                it++;
+            }
+        }
+
         for (int i = 0; i < connections; i++)
         {
             HttpReqDL *downloadRequest = (HttpReqDL *)reqs[i];
@@ -203,6 +347,7 @@ TransferSlot::~TransferSlot()
     }
 
     transfer->slot = NULL;
+    transfer->client->transferlist.schedule(transfer);
 
     if (slots_it != transfer->client->tslots.end())
     {
@@ -227,10 +372,44 @@ TransferSlot::~TransferSlot()
         transfer->client->asyncfopens--;
     }
 
+    // the buffers can't be released while they are being decrypted or written
+    for (std::list<DownloadChunk*>::iterator it = downloadchunks.begin(); it != downloadchunks.end(); it++)
+    {
+        DownloadChunk* chunk = *it;
+
+#ifdef THREAD_CLASS
+        if (decryptor)
+        {
+            decryptor->wait(chunk);
+        }
+#endif
+
+        if (chunk->asyncIO)
+        {
+            chunk->asyncIO->finish();
+            delete chunk->asyncIO;
+        }
+
+        transfer->client->bufferpool.freereq(chunk->req);
+        delete chunk;
+    }
+    downloadchunks.clear();
+
+#ifdef THREAD_CLASS
+    delete decryptor;
+#endif
+
     while (connections--)
     {
         delete asyncIO[connections];
-        delete reqs[connections];
+        transfer->client->bufferpool.freereq(reqs[connections]);
+    }
+
+    if (!transfer->client->tslots.size())
+    {
+        TransferBufferPool* pool = &transfer->client->bufferpool;
+        LOG_debug << "Transfer buffers. In use: " << pool->bytesinuse << "   Cached: " << pool->bytescached
+                  << "   Peak: " << pool->peakbytes << "   Allocs: " << pool->bufallocs << "   Reuses: " << pool->bufreuses;
     }
 
     delete[] asyncIO;
@@ -297,6 +476,43 @@ int64_t TransferSlot::macsmac(chunkmac_map* macs)
 }
 
 // file transfer state machine
+m_off_t TransferSlot::downloadrequestend(m_off_t pos, m_off_t npos, m_off_t size, m_off_t remaining,
+                                         int connections, m_off_t maxrequestsize, chunkmac_map* chunkmacs)
+{
+    m_off_t maxReqSize = remaining / connections / 2;
+    if (maxReqSize > maxrequestsize)
+    {
+        maxReqSize = maxrequestsize;
+    }
+
+    if (maxReqSize > 0x100000)
+    {
+        m_off_t val = 0x100000;
+        while (val <= maxReqSize)
+        {
+            val <<= 1;
+        }
+        maxReqSize = val >> 1;
+        maxReqSize -= 0x100000;
+    }
+    else
+    {
+        maxReqSize = 0;
+    }
+
+    chunkmac_map::iterator it = chunkmacs->find(npos);
+    while (npos < size
+           && npos - pos <= maxReqSize
+           && (it == chunkmacs->end()
+               || (!it->second.finished && !it->second.offset)))
+    {
+        npos = ChunkedHash::chunkceil(npos, size);
+        it = chunkmacs->find(npos);
+    }
+
+    return npos;
+}
+
 void TransferSlot::doio(MegaClient* client)
 {
     if (!fa || (transfer->size && transfer->progresscompleted == transfer->size))
@@ -359,6 +575,11 @@ void TransferSlot::doio(MegaClient* client)
         return transfer->failed(lasterror);
     }
 
+    if (transfer->type == GET && !processchunks(client, &backoff))
+    {
+        return;
+    }
+
     for (int i = connections; i--; )
     {
         if (reqs[i])
@@ -370,9 +591,11 @@ void TransferSlot::doio(MegaClient* client)
                     break;
 
                 case REQ_SUCCESS:
-                    if (client->orderdownloadedchunks && transfer->type == GET && transfer->progresscompleted != ((HttpReqDL *)reqs[i])->dlpos)
+                    if (transfer->type == GET && downloadchunks.size() >= (size_t)connections
+                            && !(client->orderdownloadedchunks && transfer->progresscompleted == ((HttpReqDL *)reqs[i])->dlpos))
                     {
-                        // postponing unsorted chunk
+                        // postponing the chunk until there is room in the pipeline
+                        // (the next one in file order always fits)
                         p += reqs[i]->size;
                         break;
                     }
@@ -481,92 +704,10 @@ void TransferSlot::doio(MegaClient* client)
                     {
                         if (reqs[i]->size == reqs[i]->bufpos)
                         {
-                            HttpReqDL *downloadRequest = (HttpReqDL *)reqs[i];
-                            if (fa->asyncavailable())
-                            {
-                                if (!asyncIO[i])
-                                { 
-                                    downloadRequest->finalize(transfer);
-                                }
-                                else
-                                {
-                                    LOG_warn << "Retrying failed async write";
-                                    delete asyncIO[i];
-                                    asyncIO[i] = NULL;
-                                }
-
-                                p += reqs[i]->size;
-
-                                LOG_debug << "Writting data asynchronously at " << downloadRequest->dlpos;
-                                asyncIO[i] = fa->asyncfwrite(downloadRequest->buf, downloadRequest->bufpos, downloadRequest->dlpos);
-                                reqs[i]->status = REQ_ASYNCIO;
-                            }
-                            else
-                            {
-                                downloadRequest->finalize(transfer);
-                                if (fa->fwrite(downloadRequest->buf, downloadRequest->bufpos, downloadRequest->dlpos))
-                                {
-                                    LOG_verbose << "Sync write succeeded";
-                                    for (chunkmac_map::iterator it = downloadRequest->chunkmacs.begin(); it != downloadRequest->chunkmacs.end(); it++)
-                                    {
-                                        transfer->chunkmacs[it->first] = it->second;
-                                        assert (transfer->chunkmacs[it->first].finished);
-                                    }
-                                    downloadRequest->chunkmacs.clear();
-                                    transfer->progresscompleted += downloadRequest->bufpos;
-                                    LOG_debug << "Saved data at: " << downloadRequest->dlpos << "   Size: " << downloadRequest->bufpos;
-                                    errorcount = 0;
-                                    transfer->failcount = 0;
-                                }
-                                else
-                                {
-                                    LOG_err << "Error saving finished chunk";
-                                    if (!fa->retry)
-                                    {
-                                        return transfer->failed(API_EWRITE);
-                                    }
-                                    lasterror = API_EWRITE;
-                                    backoff = 2;
-                                    break;
-                                }
-
-                                if (transfer->progresscompleted == transfer->size)
-                                {
-                                    if (transfer->progresscompleted)
-                                    {
-                                        transfer->currentmetamac = macsmac(&transfer->chunkmacs);
-                                        transfer->hascurrentmetamac = true;
-                                    }
-
-                                    // verify meta MAC
-                                    if (!transfer->progresscompleted
-                                            || (transfer->currentmetamac == transfer->metamac))
-                                    {
-                                        client->transfercacheadd(transfer);
-                                        if (transfer->progresscompleted != progressreported)
-                                        {
-                                            progressreported = transfer->progresscompleted;
-                                            lastdata = Waiter::ds;
-
-                                            progress();
-                                        }
-
-                                        return transfer->complete();
-                                    }
-                                    else
-                                    {
-                                        int creqtag = client->reqtag;
-                                        client->reqtag = 0;
-                                        client->sendevent(99431, "MAC verification failed");
-                                        client->reqtag = creqtag;
-
-                                        transfer->chunkmacs.clear();
-                                        return transfer->failed(API_EKEY);
-                                    }
-                                }
-                                client->transfercacheadd(transfer);
-                                reqs[i]->status = REQ_READY;
-                            }
+                            // hand the data over to the pipeline and
+                            // fetch the next chunk right away
+                            queuechunk((HttpReqDL *)reqs[i]);
+                            reqs[i] = client->bufferpool.allocreq(GET);
                         }
                         else
                         {
@@ -612,67 +753,6 @@ void TransferSlot::doio(MegaClient* client)
                                 reqs[i]->pos = ChunkedHash::chunkfloor(asyncIO[i]->pos);
                                 reqs[i]->status = REQ_PREPARED;
                             }
-                            else
-                            {
-                                LOG_verbose << "Async write succeeded";
-                                HttpReqDL *downloadRequest = (HttpReqDL *)reqs[i];
-                                for (chunkmac_map::iterator it = downloadRequest->chunkmacs.begin(); it != downloadRequest->chunkmacs.end(); it++)
-                                {
-                                    transfer->chunkmacs[it->first] = it->second;
-                                }
-                                downloadRequest->chunkmacs.clear();
-                                transfer->progresscompleted += downloadRequest->bufpos;
-                                LOG_debug << "Saved data at: " << downloadRequest->dlpos << "   Size: " << downloadRequest->bufpos;
-                                errorcount = 0;
-                                transfer->failcount = 0;
-
-                                if (transfer->progresscompleted == transfer->size)
-                                {
-                                    if (transfer->progresscompleted)
-                                    {
-                                        transfer->currentmetamac = macsmac(&transfer->chunkmacs);
-                                        transfer->hascurrentmetamac = true;
-                                    }
-
-                                    // verify meta MAC
-                                    if (!transfer->progresscompleted
-                                            || (transfer->currentmetamac == transfer->metamac))
-                                    {
-                                        client->transfercacheadd(transfer);
-                                        if (transfer->progresscompleted != progressreported)
-                                        {
-                                            progressreported = transfer->progresscompleted;
-                                            lastdata = Waiter::ds;
-
-                                            progress();
-                                        }
-
-                                        return transfer->complete();
-                                    }
-                                    else
-                                    {
-                                        int creqtag = client->reqtag;
-                                        client->reqtag = 0;
-                                        client->sendevent(99431, "MAC verification failed");
-                                        client->reqtag = creqtag;
-
-                                        transfer->chunkmacs.clear();
-                                        return transfer->failed(API_EKEY);
-                                    }
-                                }
-
-                                client->transfercacheadd(transfer);
-                                reqs[i]->status = REQ_READY;
-
-                                if (client->orderdownloadedchunks)
-                                {
-                                    // Check connections again looking for postponed chunks
-                                    delete asyncIO[i];
-                                    asyncIO[i] = NULL;
-                                    i = connections;
-                                    continue;
-                                }
-                            }
                             delete asyncIO[i];
                             asyncIO[i] = NULL;
                         }
@@ -687,23 +767,11 @@ void TransferSlot::doio(MegaClient* client)
                             }
 
                             // retry shortly
-                            if (transfer->type == PUT)
-                            {
-                                lasterror = API_EREAD;
-                                reqs[i]->status = REQ_READY;
-                            }
-                            else
-                            {
-                                lasterror = API_EWRITE;
-                                reqs[i]->status = REQ_SUCCESS;
-                            }
+                            lasterror = API_EREAD;
+                            reqs[i]->status = REQ_READY;
                             backoff = 2;
                         }
                     }
-                    else if (transfer->type == GET)
-                    {
-                        p += asyncIO[i]->len;
-                    }
                     break;
 
                 case REQ_FAILURE:
@@ -785,44 +853,15 @@ void TransferSlot::doio(MegaClient* client)
                 {
                     if (transfer->type == GET && transfer->size)
                     {
-                        m_off_t maxReqSize = (transfer->size - transfer->progresscompleted) / connections / 2;
-                        if (maxReqSize > maxDownloadRequestSize)
-                        {
-                            maxReqSize = maxDownloadRequestSize;
-                        }
-
-                        if (maxReqSize > 0x100000)
-                        {
-                            m_off_t val = 0x100000;
-                            while (val <= maxReqSize)
-                            {
-                                val <<= 1;
-                            }
-                            maxReqSize = val >> 1;
-                            maxReqSize -= 0x100000;
-                        }
-                        else
-                        {
-                            maxReqSize = 0;
-                        }
-
-                        chunkmac_map::iterator it = transfer->chunkmacs.find(npos);
-                        m_off_t reqSize = npos - transfer->pos;
-                        while (npos < transfer->size
-                               && reqSize <= maxReqSize
-                               && (it == transfer->chunkmacs.end()
-                                   || (!it->second.finished && !it->second.offset)))
-                        {
-                            npos = ChunkedHash::chunkceil(npos, transfer->size);
-                            reqSize = npos - transfer->pos;
-                            it = transfer->chunkmacs.find(npos);
-                        }
-                        LOG_debug << "Downloading chunk of size " << reqSize;
+                        npos = downloadrequestend(transfer->pos, npos, transfer->size,
+                                                  transfer->size - transfer->progresscompleted,
+                                                  connections, maxDownloadRequestSize, &transfer->chunkmacs);
+                        LOG_debug << "Downloading chunk of size " << npos - transfer->pos;
                     }
 
                     if (!reqs[i])
                     {
-                        reqs[i] = transfer->type == PUT ? (HttpReqXfer*)new HttpReqUL() : (HttpReqXfer*)new HttpReqDL();
+                        reqs[i] = client->bufferpool.allocreq(transfer->type);
                     }
 
                     bool prepare = true;
@@ -925,6 +964,20 @@ void TransferSlot::doio(MegaClient* client)
         }
     }
 
+    if (transfer->type == GET)
+    {
+        // write what has been decrypted meanwhile
+        if (!processchunks(client, &backoff))
+        {
+            return;
+        }
+
+        for (std::list<DownloadChunk*>::iterator it = downloadchunks.begin(); it != downloadchunks.end(); it++)
+        {
+            p += (*it)->req->bufpos;
+        }
+    }
+
     p += transfer->progresscompleted;
 
     if (p != progressreported || (Waiter::ds - lastprogressreport) > PROGRESSTIMEOUT)
@@ -1012,6 +1065,216 @@ void TransferSlot::doio(MegaClient* client)
     }
 }
 
+// detach a finished download request from its connection and start its
+// decryption
+void TransferSlot::queuechunk(HttpReqDL* downloadRequest)
+{
+    DownloadChunk* chunk = new DownloadChunk;
+    chunk->req = downloadRequest;
+    chunk->ctriv = transfer->ctriv;
+    chunk->filesize = transfer->size;
+    chunk->decrypted = false;
+    chunk->asyncIO = NULL;
+
+    // the MAC state of partially downloaded chunks is taken now, the
+    // decryption doesn't access the transfer
+    m_off_t endpos = downloadRequest->dlpos + downloadRequest->bufpos;
+    for (chunkmac_map::iterator it = transfer->chunkmacs.lower_bound(ChunkedHash::chunkfloor(downloadRequest->dlpos));
+         it != transfer->chunkmacs.end() && it->first < endpos; it++)
+    {
+        if (!it->second.finished)
+        {
+            downloadRequest->chunkmacs[it->first] = it->second;
+        }
+    }
+
+    downloadchunks.push_back(chunk);
+
+#ifdef THREAD_CLASS
+    if (!decryptor && transfer->size >= MIN_THREADED_DECRYPT_SIZE)
+    {
+        LOG_debug << "Starting decryption thread";
+        decryptor = new ChunkDecryptor(transfer->client->waiter);
+    }
+
+    if (decryptor)
+    {
+        chunk->key = transfer->key;
+        decryptor->push(chunk);
+        return;
+    }
+#endif
+
+    downloadRequest->finalize(&transfer->key, &downloadRequest->chunkmacs, chunk->ctriv, chunk->filesize);
+    chunk->decrypted = true;
+}
+
+bool TransferSlot::chunkdecrypted(DownloadChunk* chunk)
+{
+#ifdef THREAD_CLASS
+    if (decryptor)
+    {
+        return decryptor->decrypted(chunk);
+    }
+#endif
+
+    return chunk->decrypted;
+}
+
+void TransferSlot::mergechunk(HttpReqDL* downloadRequest)
+{
+    for (chunkmac_map::iterator it = downloadRequest->chunkmacs.begin(); it != downloadRequest->chunkmacs.end(); it++)
+    {
+        transfer->chunkmacs[it->first] = it->second;
+    }
+    downloadRequest->chunkmacs.clear();
+    transfer->progresscompleted += downloadRequest->bufpos;
+}
+
+// write decrypted chunks at their position (in any order) and merge the
+// written ones into the transfer - returns false if the transfer has
+// finished or failed (the slot can be gone)
+bool TransferSlot::processchunks(MegaClient* client, dstime* backoff)
+{
+    std::list<DownloadChunk*>::iterator it = downloadchunks.begin();
+    while (it != downloadchunks.end())
+    {
+        DownloadChunk* chunk = *it;
+        HttpReqDL* downloadRequest = chunk->req;
+
+        if (!chunkdecrypted(chunk))
+        {
+            it++;
+            continue;
+        }
+
+        if (!chunk->asyncIO)
+        {
+            if (client->orderdownloadedchunks && transfer->progresscompleted != downloadRequest->dlpos)
+            {
+                // postponing unsorted chunk
+                it++;
+                continue;
+            }
+
+            if (fa->asyncavailable())
+            {
+                LOG_debug << "Writting data asynchronously at " << downloadRequest->dlpos;
+                chunk->asyncIO = fa->asyncfwrite(downloadRequest->buf, downloadRequest->bufpos, downloadRequest->dlpos);
+            }
+            else if (fa->fwrite(downloadRequest->buf, downloadRequest->bufpos, downloadRequest->dlpos))
+            {
+                LOG_verbose << "Sync write succeeded";
+            }
+            else
+            {
+                LOG_err << "Error saving finished chunk";
+                if (!fa->retry)
+                {
+                    transfer->failed(API_EWRITE);
+                    return false;
+                }
+
+                lasterror = API_EWRITE;
+                *backoff = 2;
+                it++;
+                continue;
+            }
+        }
+
+        if (chunk->asyncIO)
+        {
+            if (!chunk->asyncIO->finished)
+            {
+                it++;
+                continue;
+            }
+
+            bool failed = chunk->asyncIO->failed;
+            bool retry = chunk->asyncIO->retry;
+            delete chunk->asyncIO;
+            chunk->asyncIO = NULL;
+
+            if (failed)
+            {
+                LOG_warn << "Async write failed: " << retry;
+                if (!retry)
+                {
+                    transfer->failed(API_EWRITE);
+                    return false;
+                }
+
+                // retry shortly
+                lasterror = API_EWRITE;
+                *backoff = 2;
+                it++;
+                continue;
+            }
+
+            LOG_verbose << "Async write succeeded";
+        }
+
+        mergechunk(downloadRequest);
+        LOG_debug << "Saved data at: " << downloadRequest->dlpos << "   Size: " << downloadRequest->bufpos;
+        errorcount = 0;
+        transfer->failcount = 0;
+
+        client->bufferpool.freereq(downloadRequest);
+        delete chunk;
+        it = downloadchunks.erase(it);
+
+        if (transfer->progresscompleted == transfer->size)
+        {
+            downloadfinished(client);
+            return false;
+        }
+
+        client->transfercacheadd(transfer);
+
+        if (client->orderdownloadedchunks)
+        {
+            // the next chunk in file order can be anywhere in the queue
+            it = downloadchunks.begin();
+        }
+    }
+
+    return true;
+}
+
+// all data has been written: verify the meta MAC and complete the transfer
+void TransferSlot::downloadfinished(MegaClient* client)
+{
+    if (transfer->progresscompleted)
+    {
+        transfer->currentmetamac = macsmac(&transfer->chunkmacs);
+        transfer->hascurrentmetamac = true;
+    }
+
+    // verify meta MAC
+    if (!transfer->progresscompleted
+            || (transfer->currentmetamac == transfer->metamac))
+    {
+        client->transfercacheadd(transfer);
+        if (transfer->progresscompleted != progressreported)
+        {
+            progressreported = transfer->progresscompleted;
+            lastdata = Waiter::ds;
+
+            progress();
+        }
+
+        return transfer->complete();
+    }
+
+    int creqtag = client->reqtag;
+    client->reqtag = 0;
+    client->sendevent(99431, "MAC verification failed");
+    client->reqtag = creqtag;
+
+    transfer->chunkmacs.clear();
+    return transfer->failed(API_EKEY);
+}
+
 // transfer progress notification to app and related files
 void TransferSlot::progress()
 {
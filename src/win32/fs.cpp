@@ -45,8 +45,11 @@ WinFileAccess::~WinFileAccess()
 
 bool WinFileAccess::sysread(byte* dst, unsigned len, m_off_t pos)
 {
+    MetricTimer timer(Metrics::DISK_READ_TIME, Metrics::timing());
     DWORD dwRead;
 
+    Metrics::add(Metrics::DISK_READ_BYTES, len);
+
     if (!SetFilePointerEx(hFile, *(LARGE_INTEGER*)&pos, NULL, FILE_BEGIN))
     {
         DWORD e = GetLastError();
@@ -74,8 +77,11 @@ bool WinFileAccess::sysread(byte* dst, unsigned len, m_off_t pos)
 
 bool WinFileAccess::fwrite(const byte* data, unsigned len, m_off_t pos)
 {
+    MetricTimer timer(Metrics::DISK_WRITE_TIME, Metrics::timing());
     DWORD dwWritten;
 
+    Metrics::add(Metrics::DISK_WRITE_BYTES, len);
+
     if (!SetFilePointerEx(hFile, *(LARGE_INTEGER*)&pos, NULL, FILE_BEGIN))
     {
         DWORD e = GetLastError();
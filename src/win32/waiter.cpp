@@ -84,6 +84,22 @@ void Waiter::bumpds()
 #endif
 }
 
+m_time_t Waiter::getmicros()
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (!frequency.QuadPart)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    QueryPerformanceCounter(&counter);
+
+    return (m_time_t)(counter.QuadPart / frequency.QuadPart * 1000000
+                      + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+}
+
 // wait for events (socket, I/O completion, timeout + application events)
 // ds specifies the maximum amount of time to wait in deciseconds (or ~0 if no
 // timeout scheduled)
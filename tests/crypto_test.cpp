@@ -23,6 +23,7 @@
 #include "../src/crypto/sodium.cpp"
 #include <math.h>
 #include "gtest/gtest.h"
+#include "test_utils.h"
 
 using namespace mega;
 
@@ -280,3 +281,60 @@ TEST(Crypto, Ed25519_Signing)
 }
 
 #endif
+
+// Decrypts RSA-encrypted node keys one by one and in a batch
+TEST(Crypto, RSA_BatchDecrypt)
+{
+    unsigned numkeys = largebenchmarks() ? 10000 : 500;
+
+    AsymmCipher priv, pub;
+    priv.genkeypair(priv.key, pub.key, 2048);
+
+    vector<string> plains(numkeys);
+    vector<string> ciphers(numkeys);
+    byte buf[AsymmCipher::MAXKEYLENGTH];
+
+    for (unsigned i = 0; i < numkeys; i++)
+    {
+        plains[i].resize(FILENODEKEYLENGTH);
+        PrnGen::genblock((byte*)plains[i].data(), plains[i].size());
+
+        int len = pub.encrypt((const byte*)plains[i].data(), plains[i].size(), buf, sizeof buf);
+        ASSERT_GT(len, 0);
+        ciphers[i].assign((const char*)buf, len);
+    }
+
+    // a corrupt cipher text is reported as such and doesn't affect the others
+    ciphers[1].resize(1);
+
+    m_time_t start = Waiter::getmicros();
+    for (unsigned i = 0; i < numkeys; i++)
+    {
+        int ok = priv.decrypt((const byte*)ciphers[i].data(), ciphers[i].size(), buf, FILENODEKEYLENGTH);
+        ASSERT_EQ(i != 1, !!ok);
+        if (ok)
+        {
+            ASSERT_EQ(plains[i], string((const char*)buf, FILENODEKEYLENGTH));
+        }
+    }
+    m_time_t single = Waiter::getmicros() - start;
+
+    vector<string> results(numkeys);
+
+    start = Waiter::getmicros();
+    ASSERT_EQ(numkeys - 1, priv.decryptbatch(&ciphers[0], numkeys, &results[0], FILENODEKEYLENGTH));
+    m_time_t batch = Waiter::getmicros() - start;
+
+    for (unsigned i = 0; i < numkeys; i++)
+    {
+        ASSERT_EQ(i == 1 ? string() : plains[i], results[i]);
+    }
+
+    // a node key is the prefix of the longer plain text
+    ASSERT_TRUE(priv.decrypt((const byte*)ciphers[0].data(), ciphers[0].size(), buf, SymmCipher::KEYLENGTH));
+    ASSERT_EQ(results[0].substr(0, SymmCipher::KEYLENGTH), string((const char*)buf, SymmCipher::KEYLENGTH));
+
+    TEST_RESULTS(numkeys << " RSA-2048 node keys, keys/s: "
+                 << numkeys * 1000000.0 / single << " one by one, "
+                 << numkeys * 1000000.0 / batch << " batched");
+}
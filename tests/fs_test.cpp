@@ -0,0 +1,642 @@
+/**
+ * @file tests/fs_test.cpp
+ * @brief Mega SDK test for the local filesystem layer
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega.h"
+#include "mega/mega_utf8proc.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+
+using namespace mega;
+
+// normalization as it was done before the quick check: one utf8proc_NFC()
+// call per NUL-separated segment
+static void referencenormalize(string* filename)
+{
+    const char* cfilename = filename->c_str();
+    size_t fnsize = filename->size();
+    string result;
+
+    for (size_t i = 0; i < fnsize; )
+    {
+        if (!cfilename[i])
+        {
+            result.append("", 1);
+            i++;
+            continue;
+        }
+
+        const char* substring = cfilename + i;
+        char* normalized = (char*)utf8proc_NFC((uint8_t*)substring);
+
+        if (!normalized)
+        {
+            filename->clear();
+            return;
+        }
+
+        result.append(normalized);
+        free(normalized);
+
+        i += strlen(substring);
+    }
+
+    *filename = result;
+}
+
+TEST(Normalize, QuickCheck)
+{
+    FSACCESS_CLASS fsaccess;
+
+    // normalized names (Café, Łódź, Москва, Ελλάδα, 照片, ダウンロード, 사진)
+    const char* nfc[] = { "IMG_0001.jpg", "Caf\xc3\xa9", "\xc5\x81\xc3\xb3" "d\xc5\xba",
+                          "\xd0\x9c\xd0\xbe\xd1\x81\xd0\xba\xd0\xb2\xd0\xb0",
+                          "\xce\x95\xce\xbb\xce\xbb\xce\xac\xce\xb4\xce\xb1",
+                          "\xe7\x85\xa7\xe7\x89\x87",
+                          "\xe3\x83\x80\xe3\x82\xa6\xe3\x83\xb3\xe3\x83\xad\xe3\x83\xbc\xe3\x83\x89",
+                          "\xec\x82\xac\xec\xa7\x84" };
+
+    // the same, decomposed
+    const char* nfd[] = { NULL, "Cafe\xcc\x81", "\xc5\x81o\xcc\x81" "dz\xcc\x81", NULL,
+                          "\xce\x95\xce\xbb\xce\xbb\xce\xb1\xcc\x81\xce\xb4\xce\xb1", NULL,
+                          "\xe3\x82\xbf\xe3\x82\x99\xe3\x82\xa6\xe3\x83\xb3\xe3\x83\xad\xe3\x83\xbc\xe3\x83\x88\xe3\x82\x99",
+                          "\xe1\x84\x89\xe1\x85\xa1\xe1\x84\x8c\xe1\x85\xb5\xe1\x86\xab" };
+
+    for (unsigned i = 0; i < sizeof nfc / sizeof *nfc; i++)
+    {
+        ASSERT_TRUE(FileSystemAccess::isnormalized(nfc[i], strlen(nfc[i])));
+
+        string name = nfc[i];
+        fsaccess.normalize(&name);
+        ASSERT_EQ(nfc[i], name);
+
+        if (nfd[i])
+        {
+            ASSERT_FALSE(FileSystemAccess::isnormalized(nfd[i], strlen(nfd[i])));
+
+            name = nfd[i];
+            fsaccess.normalize(&name);
+            ASSERT_EQ(nfc[i], name);
+        }
+    }
+
+    // invalid UTF-8 clears the name
+    string name("abc\xc3", 4);
+    fsaccess.normalize(&name);
+    ASSERT_TRUE(name.empty());
+
+    // NUL bytes are kept between normalized segments
+    name.assign("Cafe\xcc\x81\0Cafe\xcc\x81\0", 14);
+    fsaccess.normalize(&name);
+    ASSERT_EQ(string("Caf\xc3\xa9\0Caf\xc3\xa9\0", 12), name);
+
+    // random strings of code points that exercise singletons, exclusions,
+    // canonical reordering, Hangul and composing starters must come out as
+    // with the previous implementation
+    const utf8proc_int32_t pool[] = { 0, 'a', 'e', 'Z', '.', 0xE9, 0xC5, 0x301, 0x308, 0x323, 0x327,
+                                      0x344, 0x212B, 0x2126, 0x958, 0x915, 0x93C, 0x931, 0x930,
+                                      0xF71, 0xF72, 0xF73, 0xB47, 0xB3E, 0xB4B, 0x1E0A, 0x1F82,
+                                      0x5D0, 0x5B7, 0xFB2E, 0x1100, 0x1161, 0x11A8, 0xAC00, 0xAC01,
+                                      0x30BF, 0x30C0, 0x3099, 0x4E2D, 0x10000, 0x1D15E };
+    vector<string> names, expected;
+    vector<int32_t> buffer;
+
+    srand(1);
+    for (unsigned i = 0; i < 100000; i++)
+    {
+        utf8proc_uint8_t encoded[4];
+        string name;
+
+        for (int j = rand() % 8; j-- > 0; )
+        {
+            name.append((char*)encoded, utf8proc_encode_char(pool[rand() % (sizeof pool / sizeof *pool)], encoded));
+        }
+
+        string reference = name;
+        referencenormalize(&reference);
+
+        fsaccess.normalize(&name);
+        ASSERT_EQ(reference, name);
+
+        names.push_back(name);
+        expected.push_back(reference);
+    }
+
+    // normalized strings are left alone
+    ASSERT_EQ(0u, fsaccess.normalize(&names[0], names.size(), &buffer));
+    ASSERT_TRUE(names == expected);
+}
+
+// Compares the normalization of realistic file names in several scripts
+// against one utf8proc_NFC() per name
+TEST(Normalize, Benchmark)
+{
+    FSACCESS_CLASS fsaccess;
+    unsigned numnames = largebenchmarks() ? 1000000 : 100000;
+
+    struct Corpus
+    {
+        const char* name;
+        const char* words[4];
+    } corpora[] = {
+        { "ASCII", { "IMG", "Holiday photos", "report-final", "backup" } },
+        // Café, Résumé, Müller, Łódź
+        { "Latin", { "Caf\xc3\xa9", "R\xc3\xa9sum\xc3\xa9", "M\xc3\xbcller", "\xc5\x81\xc3\xb3" "d\xc5\xba" } },
+        // Москва, Ελλάδα, صورة, परिवार
+        { "Cyrillic/Greek/Arabic/Devanagari", { "\xd0\x9c\xd0\xbe\xd1\x81\xd0\xba\xd0\xb2\xd0\xb0",
+                                                "\xce\x95\xce\xbb\xce\xbb\xce\xac\xce\xb4\xce\xb1",
+                                                "\xd8\xb5\xd9\x88\xd8\xb1\xd8\xa9",
+                                                "\xe0\xa4\xaa\xe0\xa4\xb0\xe0\xa4\xbf\xe0\xa4\xb5\xe0\xa4\xbe\xe0\xa4\xb0" } },
+        // 照片, ダウンロード, 사진, 写真
+        { "CJK", { "\xe7\x85\xa7\xe7\x89\x87",
+                   "\xe3\x83\x80\xe3\x82\xa6\xe3\x83\xb3\xe3\x83\xad\xe3\x83\xbc\xe3\x83\x89",
+                   "\xec\x82\xac\xec\xa7\x84", "\xe5\x86\x99\xe7\x9c\x9f" } },
+        // decomposed names, as created on macOS
+        { "NFD", { "Cafe\xcc\x81", "Re\xcc\x81sume\xcc\x81", "Mu\xcc\x88ller",
+                   "\xe1\x84\x89\xe1\x85\xa1\xe1\x84\x8c\xe1\x85\xb5\xe1\x86\xab" } },
+    };
+
+    for (unsigned c = 0; c < sizeof corpora / sizeof *corpora; c++)
+    {
+        vector<string> names, reference, single, batch;
+        vector<int32_t> buffer;
+        char suffix[32];
+
+        for (unsigned i = 0; i < numnames; i++)
+        {
+            sprintf(suffix, " %04u.jpg", i % 10000);
+            names.push_back(string(corpora[c].words[i % 4]) + suffix);
+        }
+
+        reference = single = batch = names;
+
+        m_time_t start = Waiter::getmicros();
+        for (unsigned i = 0; i < numnames; i++)
+        {
+            referencenormalize(&reference[i]);
+        }
+        m_time_t referencetime = Waiter::getmicros() - start;
+
+        start = Waiter::getmicros();
+        for (unsigned i = 0; i < numnames; i++)
+        {
+            fsaccess.normalize(&single[i]);
+        }
+        m_time_t singletime = Waiter::getmicros() - start;
+
+        start = Waiter::getmicros();
+        size_t changed = fsaccess.normalize(&batch[0], numnames, &buffer);
+        m_time_t batchtime = Waiter::getmicros() - start;
+
+        ASSERT_TRUE(single == reference);
+        ASSERT_TRUE(batch == reference);
+
+        TEST_RESULTS(corpora[c].name << ", " << numnames << " names ("
+                     << changed << " changed), ns/name: utf8proc_NFC "
+                     << referencetime * 1000.0 / numnames << ", normalize "
+                     << singletime * 1000.0 / numnames << ", batch "
+                     << batchtime * 1000.0 / numnames);
+    }
+}
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+
+TEST(DirAccess, EntryAttributes)
+{
+    LocalTree tree(3);
+    ASSERT_EQ(3u, tree.numfiles);
+
+    string folder = tree.folders[0];
+    ASSERT_FALSE(symlink((folder + "/IMG_0000002.jpg").c_str(), (folder + "/link").c_str()));
+    ASSERT_FALSE(mkfifo((folder + "/fifo").c_str(), 0600));
+    ASSERT_FALSE(mkdir((folder + "/sub").c_str(), 0700));
+
+    FSACCESS_CLASS fsaccess;
+
+    for (int followsymlinks = 0; followsymlinks < 2; followsymlinks++)
+    {
+        DirAccess* da = fsaccess.newdiraccess();
+        string path = folder, name;
+        DirEntry entry;
+        map<string, DirEntry> entries;
+
+        ASSERT_TRUE(da->dopen(&path, NULL, false));
+        while (da->dnextentry(&path, &name, followsymlinks, &entry))
+        {
+            entries[name] = entry;
+        }
+        delete da;
+
+        // the fifo is not reported, the link only if followed
+        ASSERT_EQ(followsymlinks ? 5u : 4u, entries.size());
+        ASSERT_EQ(0u, entries.count("fifo"));
+        ASSERT_EQ(FOLDERNODE, entries["sub"].type);
+
+        // same attributes as when opening the record
+        for (map<string, DirEntry>::iterator it = entries.begin(); it != entries.end(); it++)
+        {
+            FileAccess* fa = fsaccess.newfileaccess();
+            string localpath = folder + "/" + it->first;
+
+            ASSERT_TRUE(it->second.statvalid);
+            ASSERT_TRUE(fa->fopen(&localpath, false, false));
+            ASSERT_EQ(fa->type, it->second.type);
+            ASSERT_EQ(fa->mtime, it->second.mtime);
+            ASSERT_EQ(fa->fsid, it->second.fsid);
+            if (fa->type == FILENODE)
+            {
+                ASSERT_EQ(fa->size, it->second.size);
+            }
+            delete fa;
+        }
+    }
+}
+
+#ifdef ENABLE_SYNC
+// describes the attributes of a LocalNode tree by path
+static void describelocalnodes(LocalNode* l, const string& path, map<string, string>* tree)
+{
+    for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+    {
+        LocalNode* child = it->second;
+        string childpath = path + "/" + child->localname;
+        ostringstream oss;
+
+        oss << child->type << " " << child->fsid;
+        if (child->type == FILENODE)
+        {
+            oss << " " << child->size << " " << child->mtime
+                << " " << child->crc[0] << " " << child->crc[1] << " " << child->crc[2] << " " << child->crc[3];
+        }
+        (*tree)[childpath] = oss.str();
+
+        describelocalnodes(child, childpath, tree);
+    }
+}
+
+// gives the folder LocalNodes a remote node, so that their contents can be
+// added - returns the number of folders that got one
+static unsigned attachfolders(MegaClient* client, LocalNode* l, node_vector* dp, handle* h)
+{
+    unsigned attached = 0;
+
+    for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+    {
+        LocalNode* child = it->second;
+
+        if (child->type == FOLDERNODE)
+        {
+            if (!child->node)
+            {
+                child->setnode(new (client) Node(client, dp, (*h)++, l->node->nodehandle, FOLDERNODE, -1, UNDEF, NULL, 0));
+                attached++;
+            }
+
+            attached += attachfolders(client, child, dp, h);
+        }
+    }
+
+    return attached;
+}
+
+// initial scan of a sync over a folder tree, with the given number of
+// scanner threads - returns the time until all files have their LocalNode
+// and describes the resulting tree
+static m_time_t initialscan(string rootpath, unsigned numfiles, unsigned threads, map<string, string>* scanned)
+{
+    TestClient<>* testclient = new TestClient<>("fs_test");
+    MegaClient* client = testclient->client;
+    node_vector dp;
+    handle h = 1;
+
+    client->syncscanthreads = threads;
+    Node* remoteroot = new (client) Node(client, &dp, h++, UNDEF, ROOTNODE, -1, UNDEF, NULL, 0);
+
+    m_time_t start = Waiter::getmicros();
+    Sync* sync = new Sync(client, &rootpath, ".debris", NULL, remoteroot, 0, false, 0);
+
+    EXPECT_TRUE(sync->scan(&rootpath, NULL));
+    sync->initializing = false;
+
+    // what the exec loop does during the initial scan (the remote folders
+    // are created as soon as their LocalNode exists)
+    while (sync->localnodes[FILENODE] < numfiles && Waiter::getmicros() - start < 600000000)
+    {
+        Waiter::bumpds();
+        sync->mergescan();
+
+        if (sync->dirnotify->notifyq[DirNotify::DIREVENTS].size())
+        {
+            if (!sync->procscanq(DirNotify::DIREVENTS) && !attachfolders(client, &sync->localroot, &dp, &h))
+            {
+                break;
+            }
+        }
+        else if (sync->scanpending())
+        {
+            usleep(1000);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    m_time_t elapsed = Waiter::getmicros() - start;
+
+    EXPECT_EQ(numfiles, sync->localnodes[FILENODE]);
+    EXPECT_EQ(0u, sync->scanpending());
+
+    scanned->clear();
+    describelocalnodes(&sync->localroot, "", scanned);
+
+    sync->changestate(SYNC_CANCELED);
+    delete sync;
+    delete testclient;
+
+    return elapsed;
+}
+
+// The scanner threads build the same LocalNode tree as the SDK thread alone
+TEST(Sync, ParallelInitialScan)
+{
+    unsigned numfiles = 2500;
+    LocalTree tree(numfiles, 1 << 20);
+    ASSERT_EQ(numfiles, tree.numfiles);
+
+    // files of different sizes and a nested folder
+    string nested = tree.folders[1] + "/nested";
+    ASSERT_FALSE(mkdir(nested.c_str(), 0700));
+    tree.folders.push_back(nested);
+    for (unsigned i = 0; i < 10; i++)
+    {
+        char name[32];
+        sprintf(name, "/file%u", i);
+        FILE* fp = fopen((nested + name).c_str(), "w");
+        ASSERT_TRUE(fp != NULL);
+        fwrite(name, 1, strlen(name) * i, fp);
+        fclose(fp);
+    }
+    numfiles += 10;
+
+    map<string, string> serialtree, paralleltree;
+
+    // the first round warms up the page cache
+    initialscan(tree.root, numfiles, 0, &serialtree);
+
+    m_time_t serial = initialscan(tree.root, numfiles, 0, &serialtree);
+    m_time_t parallel = initialscan(tree.root, numfiles, 4, &paralleltree);
+
+    ASSERT_EQ(numfiles + tree.folders.size(), serialtree.size());
+    ASSERT_TRUE(serialtree == paralleltree);
+
+    TEST_RESULTS("initial scan of " << numfiles << " files of up to 1 MB: "
+                 << serial / 1000 << " ms on the SDK thread, "
+                 << parallel / 1000 << " ms with 4 scanner threads");
+}
+
+#ifdef USE_INOTIFY
+// processes the queued filesystem notifications of a sync until they are
+// done or have to wait (for a parent folder or for Sync::SCANNING_DELAY_DS)
+static void procnotifications(Sync* sync)
+{
+    while (sync->dirnotify->notifyq[DirNotify::DIREVENTS].size())
+    {
+        if (sync->procscanq(DirNotify::DIREVENTS) != (dstime)~0)
+        {
+            break;
+        }
+    }
+}
+
+// Folders over the watch budget of a sync are rescanned periodically and get a
+// watch once the budget allows it
+TEST(Sync, WatchBudget)
+{
+    LocalTree tree(10);
+    ASSERT_EQ(10u, tree.numfiles);
+
+    // root, folder0 and four empty folders
+    for (int i = 1; i <= 4; i++)
+    {
+        char name[32];
+        sprintf(name, "/sub%d", i);
+        tree.folders.push_back(tree.root + name);
+        ASSERT_FALSE(mkdir(tree.folders.back().c_str(), 0700));
+    }
+
+    TestClient<> testclient("fs_test");
+    MegaClient* client = testclient.client;
+    PosixFileSystemAccess* fsaccess = &testclient.fsaccess;
+    node_vector dp;
+    dstime savedds = Waiter::ds;
+
+    client->syncscanthreads = 0;
+    client->syncmaxwatches = 3;
+    Node* remoteroot = new (client) Node(client, &dp, 1, UNDEF, ROOTNODE, -1, UNDEF, NULL, 0);
+
+    string rootpath = tree.root;
+    Sync* sync = new Sync(client, &rootpath, ".debris", NULL, remoteroot, 0, false, 0);
+    PosixDirNotify* dirnotify = (PosixDirNotify*)sync->dirnotify.get();
+
+    ASSERT_TRUE(sync->scan(&rootpath, NULL));
+    sync->initializing = false;
+    procnotifications(sync);
+
+    // the files are added once their folders exist in the cloud
+    handle h = 2;
+    ASSERT_EQ(5u, attachfolders(client, &sync->localroot, &dp, &h));
+    procnotifications(sync);
+
+    ASSERT_EQ(10u, sync->localnodes[FILENODE]);
+    ASSERT_EQ(6u, sync->localnodes[FOLDERNODE]);
+    ASSERT_EQ(3u, dirnotify->numwatches);
+    ASSERT_EQ(3u, dirnotify->numunwatched);
+    ASSERT_EQ(3u, fsaccess->unwatched.size());
+
+    // the rescans are scheduled
+    testclient.waiter.init(NEVER);
+    fsaccess->addevents(&testclient.waiter, 0);
+    ASSERT_LE(testclient.waiter.maxds, (dstime)PosixFileSystemAccess::UNWATCHEDSCANINTERVAL_DS);
+
+    // files created in the unwatched folders are found by the rescan, which
+    // doesn't exceed the budget of the sync
+    vector<LocalNode*> unwatched(fsaccess->unwatched.begin(), fsaccess->unwatched.end());
+    string localpath, localname = "new.txt";
+
+    for (unsigned i = 0; i < unwatched.size(); i++)
+    {
+        unwatched[i]->getlocalpath(&localpath);
+        FILE* fp = fopen((localpath + "/" + localname).c_str(), "w");
+        ASSERT_TRUE(fp != NULL);
+        fclose(fp);
+    }
+
+    uint64_t scans = Metrics::get(Metrics::FS_UNWATCHED_SCANS);
+    ASSERT_EQ((int)Waiter::NEEDEXEC, fsaccess->scanunwatched());
+    ASSERT_EQ(3u, Metrics::get(Metrics::FS_UNWATCHED_SCANS) - scans);
+    ASSERT_EQ(3, fsaccess->unwatchedscans);
+    ASSERT_EQ(3u, dirnotify->numwatches);
+    ASSERT_EQ(3u, fsaccess->unwatched.size());
+
+    Waiter::ds += Sync::SCANNING_DELAY_DS;
+    procnotifications(sync);
+
+    ASSERT_EQ(13u, sync->localnodes[FILENODE]);
+    for (unsigned i = 0; i < unwatched.size(); i++)
+    {
+        ASSERT_EQ(1u, unwatched[i]->children.count(&localname));
+    }
+
+    // a higher budget lets the next rescan watch the remaining folders
+    dirnotify->maxwatches = 0;
+    fsaccess->scanunwatched();
+    ASSERT_EQ(6u, dirnotify->numwatches);
+    ASSERT_EQ(0u, dirnotify->numunwatched);
+    ASSERT_EQ(0u, fsaccess->unwatched.size());
+
+    Waiter::ds = savedds;
+
+    sync->changestate(SYNC_CANCELED);
+    delete sync;
+    ASSERT_EQ(0u, fsaccess->numwatches);
+}
+#endif
+
+// Sync with the state cache loader accessible
+class StateCacheSync : public Sync
+{
+public:
+    StateCacheSync(MegaClient* client, string* rootpath, Node* remoteroot)
+        : Sync(client, rootpath, ".debris", NULL, remoteroot, 0, false, 0) { }
+
+    using Sync::readstatecache;
+};
+
+// The LocalNode cache is written parent first in a single transaction and
+// reads back into the same tree
+TEST(Sync, StateCache)
+{
+    LocalTree tree(0);
+    TestClient<> testclient("fs_test");
+    MegaClient* client = testclient.client;
+    node_vector dp;
+    byte key[SymmCipher::KEYLENGTH] = { 0 };
+
+    client->key.setkey(key);
+    client->syncscanthreads = 0;
+    Node* remoteroot = new (client) Node(client, &dp, 1, UNDEF, ROOTNODE, -1, UNDEF, NULL, 0);
+
+    string rootpath = tree.root;
+    Sync* sync = new Sync(client, &rootpath, ".debris", NULL, remoteroot, 0, false, 0);
+    CountingDbTable* table = new CountingDbTable;
+    sync->statecachetable = table;
+
+    // 30 nested folders holding 5 files each, queued deepest first
+    vector<LocalNode*> nodes;
+    LocalNode* parent = &sync->localroot;
+    string path = rootpath;
+    char name[32];
+    handle fsid = 1;
+
+    for (int depth = 0; depth < 30; depth++)
+    {
+        sprintf(name, "folder%d", depth);
+        path.append("/").append(name);
+
+        LocalNode* folder = new LocalNode;
+        folder->init(sync, FOLDERNODE, parent, &path);
+        folder->setfsid(fsid++);
+        nodes.push_back(folder);
+
+        for (int i = 0; i < 5; i++)
+        {
+            sprintf(name, "/file%d", i);
+            string filepath = path + name;
+
+            LocalNode* file = new LocalNode;
+            file->init(sync, FILENODE, folder, &filepath);
+            file->size = depth * 100 + i;
+            file->mtime = 1500000000 + i;
+            file->setfsid(fsid++);
+            nodes.push_back(file);
+        }
+
+        parent = folder;
+    }
+
+    for (size_t i = nodes.size(); i--; )
+    {
+        sync->statecacheadd(nodes[i]);
+    }
+
+    // a folder that is not queued keeps its queued child waiting
+    path = rootpath + "/uncached";
+    LocalNode* uncached = new LocalNode;
+    uncached->init(sync, FOLDERNODE, &sync->localroot, &path);
+    path.append("/waiting");
+    LocalNode* waiting = new LocalNode;
+    waiting->init(sync, FILENODE, uncached, &path);
+    sync->statecacheadd(waiting);
+
+    sync->cachenodes();
+
+    ASSERT_EQ((int)nodes.size(), table->puts);
+    ASSERT_EQ(1, table->begins);
+    ASSERT_EQ(1, table->commits);
+    ASSERT_EQ(1u, sync->insertq.size());
+    ASSERT_EQ(1u, sync->insertq.count(waiting));
+    ASSERT_EQ(0u, waiting->dbid);
+
+    // record IDs are handed out in write order
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        ASSERT_NE(0u, nodes[i]->dbid);
+        ASSERT_TRUE(nodes[i]->parent == &sync->localroot || nodes[i]->parent->dbid < nodes[i]->dbid);
+    }
+
+    map<string, string> written;
+    delete uncached;
+    describelocalnodes(&sync->localroot, "", &written);
+    ASSERT_EQ(nodes.size(), written.size());
+
+    // reload into a new sync
+    sync->statecachetable = NULL;
+    sync->changestate(SYNC_CANCELED);
+    delete sync;
+
+    StateCacheSync* reloaded = new StateCacheSync(client, &rootpath, remoteroot);
+    reloaded->statecachetable = table;
+    ASSERT_TRUE(reloaded->readstatecache());
+    sync = reloaded;
+
+    map<string, string> loaded;
+    describelocalnodes(&sync->localroot, "", &loaded);
+    ASSERT_TRUE(written == loaded);
+    ASSERT_EQ(nodes.size() / 6, sync->localnodes[FOLDERNODE] - 1);
+    ASSERT_EQ(nodes.size() / 6 * 5, sync->localnodes[FILENODE]);
+
+    sync->changestate(SYNC_CANCELED);
+    delete sync;
+}
+#endif
+#endif
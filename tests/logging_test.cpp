@@ -0,0 +1,52 @@
+/**
+ * @file tests/logging_test.cpp
+ * @brief Mega SDK test for the logging backends
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+
+using namespace mega;
+
+TEST_F(LoggingTest, AsyncDeliversAllLines)
+{
+    if (!SimpleLogger::setAsyncMode(true, 16384))
+    {
+        TEST_SKIPPED("Asynchronous logging not supported");
+        return;
+    }
+
+    // a small buffer forces the logging thread to wait for the writer
+    const int lines = 50000;
+    for (int i = 0; i < lines; i++)
+    {
+        LOG_debug << "Line " << i;
+    }
+
+    // larger than the ring buffer
+    LOG_debug << string(65536, 'x');
+
+    SimpleLogger::flush();
+    ASSERT_EQ(lines + 1, counter.lines);
+
+    SimpleLogger::setAsyncMode(false);
+    LOG_debug << "Synchronous line";
+    ASSERT_EQ(lines + 2, counter.lines);
+}
@@ -0,0 +1,227 @@
+/**
+ * @file tests/metrics_test.cpp
+ * @brief Mega SDK test for the performance metrics and the trace recorder
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+
+#include <fstream>
+
+using namespace mega;
+
+TEST(Metrics, Histogram)
+{
+    MetricHistogram h;
+
+    EXPECT_EQ(-1, h.percentile(0.5));
+
+    // 90 fast samples, 10 slow ones
+    for (int i = 0; i < 90; i++)
+    {
+        h.observe(3);
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        h.observe(1000);
+    }
+
+    EXPECT_EQ(100u, h.count);
+    EXPECT_EQ(90u * 3 + 10u * 1000, h.sum);
+    EXPECT_EQ(1000u, h.max);
+    EXPECT_EQ(4, h.percentile(0.5));
+    EXPECT_EQ(4, h.percentile(0.9));
+    EXPECT_EQ(1024, h.percentile(0.99));
+
+    // bucket boundaries are inclusive, negative times count as 0
+    h.reset();
+    h.observe(-5);
+    h.observe(1);
+    h.observe(2);
+    h.observe(1LL << 40);
+    EXPECT_EQ(2u, h.buckets[0]);
+    EXPECT_EQ(1u, h.buckets[1]);
+    EXPECT_EQ(1u, h.buckets[MetricHistogram::NUMBUCKETS - 1]);
+}
+
+#ifdef USE_PTHREAD
+static void* addcounters(void*)
+{
+    for (int i = 0; i < 100000; i++)
+    {
+        Metrics::add(Metrics::API_COMMANDS);
+        Metrics::observe(Metrics::LISTENER_CALLBACK_TIME, i & 1023);
+        Metrics::observecommand(i & 1 ? "us" : "f", i & 1023);
+    }
+
+    return NULL;
+}
+
+TEST(Metrics, ConcurrentUpdates)
+{
+    const int numthreads = 4;
+    pthread_t threads[numthreads];
+
+    Metrics::reset();
+
+    m_time_t start = Waiter::getmicros();
+
+    for (int i = 0; i < numthreads; i++)
+    {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, addcounters, NULL));
+    }
+
+    for (int i = 0; i < numthreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    m_time_t elapsed = Waiter::getmicros() - start;
+
+    EXPECT_EQ(numthreads * 100000u, Metrics::get(Metrics::API_COMMANDS));
+    EXPECT_EQ(numthreads * 100000u, Metrics::get(Metrics::LISTENER_CALLBACK_TIME).count);
+    EXPECT_EQ(1023u, Metrics::get(Metrics::LISTENER_CALLBACK_TIME).max);
+
+    // half of the updates for each command
+    ostringstream count;
+    count << "\"us\":{\"count\":" << numthreads * 50000 << ",";
+
+    string json;
+    Metrics::tojson(&json);
+    EXPECT_NE(string::npos, json.find(count.str()));
+
+    TEST_RESULTS(numthreads << " threads, ns per counter + histogram + command update: "
+                 << elapsed * 1000.0 * numthreads / (numthreads * 100000));
+}
+#endif
+
+TEST(Metrics, Export)
+{
+    Metrics::reset();
+
+    // command names are matched by content, not by address
+    char name[] = "us";
+
+    Metrics::add(Metrics::API_REQUESTS, 3);
+    Metrics::observe(Metrics::API_RTT, 1500);
+    Metrics::observecommand("us", 1500);
+    Metrics::observecommand(name, 500);
+    Metrics::observecommand("f", 250000);
+
+    ClientMetrics client;
+    MetricHistogram latency;
+    client.gauges[ClientMetrics::TRANSFERS_QUEUED] = 7;
+    client.counters[ClientMetrics::DNS_LOOKUPS] = 2;
+    latency.observe(100);
+    client.callbacklatency = &latency;
+
+    string json;
+    Metrics::tojson(&json, &client);
+
+    EXPECT_NE(string::npos, json.find("\"api_requests\":3"));
+    EXPECT_NE(string::npos, json.find("\"dns_lookups\":2"));
+    EXPECT_NE(string::npos, json.find("\"transfers_queued\":7"));
+    EXPECT_NE(string::npos, json.find("\"api_rtt\":{\"count\":1,\"sum\":1500,\"mean\":1500,\"p50\":2048"));
+    EXPECT_NE(string::npos, json.find("\"callback_latency\":{\"count\":1"));
+    EXPECT_NE(string::npos, json.find("\"us\":{\"count\":2,\"sum\":2000"));
+    EXPECT_NE(string::npos, json.find("\"f\":{\"count\":1"));
+    EXPECT_EQ('{', json[0]);
+    EXPECT_EQ('}', json[json.size() - 1]);
+
+    // without a client, only the process-wide metrics
+    json.clear();
+    Metrics::tojson(&json);
+    EXPECT_EQ(string::npos, json.find("\"transfers_queued\""));
+    EXPECT_NE(string::npos, json.find("\"gauges\":{}"));
+
+    string text;
+    Metrics::toprometheus(&text, &client);
+
+    EXPECT_NE(string::npos, text.find("# TYPE mega_api_requests_total counter\nmega_api_requests_total 3\n"));
+    EXPECT_NE(string::npos, text.find("mega_dns_lookups_total 2\n"));
+    EXPECT_NE(string::npos, text.find("mega_transfers_queued 7\n"));
+    EXPECT_NE(string::npos, text.find("mega_api_rtt_seconds_bucket{le=\"0.001024\"} 0\n"));
+    EXPECT_NE(string::npos, text.find("mega_api_rtt_seconds_bucket{le=\"0.002048\"} 1\n"));
+    EXPECT_NE(string::npos, text.find("mega_api_rtt_seconds_bucket{le=\"+Inf\"} 1\n"));
+    EXPECT_NE(string::npos, text.find("mega_callback_latency_seconds_count 1\n"));
+    EXPECT_NE(string::npos, text.find("mega_api_command_rtt_seconds_count{command=\"us\"} 2\n"));
+
+    Metrics::reset();
+    EXPECT_EQ(0u, Metrics::get(Metrics::API_REQUESTS));
+}
+
+TEST(Metrics, Timing)
+{
+    SymmCipher cipher;
+    byte key[SymmCipher::KEYLENGTH] = { 0 };
+    byte data[4096] = { 0 };
+
+    cipher.setkey(key);
+    Metrics::reset();
+
+    // the bytes are always counted, the time only when enabled
+    cipher.ctr_crypt(data, sizeof data, 0, 0, NULL, true);
+    EXPECT_EQ(sizeof data, Metrics::get(Metrics::CRYPTO_BYTES));
+    EXPECT_EQ(0u, Metrics::get(Metrics::CRYPTO_MICROS));
+
+    Metrics::settiming(true);
+    EXPECT_TRUE(Metrics::timing());
+    for (int i = 0; i < 1000; i++)
+    {
+        cipher.ctr_crypt(data, sizeof data, 0, 0, NULL, true);
+    }
+    Metrics::settiming(false);
+
+    EXPECT_EQ(1001 * sizeof data, Metrics::get(Metrics::CRYPTO_BYTES));
+    EXPECT_LT(0u, Metrics::get(Metrics::CRYPTO_MICROS));
+}
+
+TEST(Metrics, Trace)
+{
+    char path[] = "/tmp/megatraceXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    // nothing is recorded while no trace is active
+    EXPECT_EQ(0, TraceRecorder::now());
+    EXPECT_EQ(0, TraceRecorder::complete("idle", 0));
+
+    ASSERT_TRUE(TraceRecorder::start(path));
+    EXPECT_TRUE(TraceRecorder::active());
+
+    unsigned tid = TraceRecorder::newtid();
+    m_time_t phase = TraceRecorder::now();
+    EXPECT_NE(0, phase);
+    phase = TraceRecorder::complete("cs", phase, tid);
+    phase = TraceRecorder::complete("sc", phase, tid);
+
+    TraceRecorder::stop();
+    EXPECT_FALSE(TraceRecorder::active());
+
+    std::ifstream in(path);
+    string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    unlink(path);
+
+    EXPECT_EQ(0u, trace.find("[\n{\"name\":\"cs\",\"cat\":\"exec\",\"ph\":\"X\",\"ts\":"));
+    EXPECT_NE(string::npos, trace.find("},\n{\"name\":\"sc\""));
+    EXPECT_EQ("\n]\n", trace.substr(trace.size() - 3));
+}
@@ -0,0 +1,1279 @@
+/**
+ * @file tests/mock_server.cpp
+ * @brief Local stand-in for the MEGA API and storage servers
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mock_server.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <sstream>
+
+using namespace mega;
+
+// seconds a server-client long-poll is held if nothing changes
+static const int WAITTIMEOUT = 30;
+
+static string base64(const void* data, size_t len)
+{
+    string s;
+
+    s.resize(len * 4 / 3 + 4);
+    s.resize(Base64::btoa((const byte*)data, len, (char*)s.data()));
+
+    return s;
+}
+
+static string base64(handle h, int size)
+{
+    return base64(&h, size);
+}
+
+// value of a URL query parameter
+static string param(const string& query, const char* name)
+{
+    size_t len = strlen(name);
+
+    for (size_t pos = 0; pos < query.size(); )
+    {
+        size_t end = query.find('&', pos);
+
+        if (end == string::npos)
+        {
+            end = query.size();
+        }
+
+        if (end - pos > len && query[pos + len] == '=' && !query.compare(pos, len, name))
+        {
+            return query.substr(pos + len + 1, end - pos - len - 1);
+        }
+
+        pos = end + 1;
+    }
+
+    return string();
+}
+
+static void appenderror(string* out, error e)
+{
+    char buf[16];
+
+    sprintf(buf, "%d", (int)e);
+    out->append(buf);
+}
+
+// encrypted node attributes with only a name, as MegaClient::makeattr()
+// produces them
+static string attrstring(SymmCipher* key, const char* name)
+{
+    string attrs("MEGA{\"n\":\"");
+
+    attrs.append(name);
+    attrs.append("\"}");
+    attrs.resize((attrs.size() + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE);
+
+    key->cbc_encrypt((byte*)attrs.data(), attrs.size());
+
+    return base64(attrs.data(), attrs.size());
+}
+
+MockMegaServer::MockMegaServer()
+{
+    verifymacs = true;
+    latencyms = 0;
+    listenfd = -1;
+    port = 0;
+    stopping = false;
+    emailhash = 0;
+    me = 0x4d6f636b55736572LL;
+    nexthandle = 1;
+    scsn = 1;
+    nextupload = 1;
+    inflight = 0;
+    memset(&counters, 0, sizeof counters);
+    memset(pwkey, 0, sizeof pwkey);
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&changed, NULL);
+
+    // account keys, and the session ID encrypted with the account's RSA key
+    PrnGen::genblock(masterkey, sizeof masterkey);
+    PrnGen::genblock(filekey, sizeof filekey);
+    PrnGen::genblock(folderkey, sizeof folderkey);
+
+    AsymmCipher asymkey;
+    CryptoPP::Integer pubkints[AsymmCipher::PUBKEY];
+    string s;
+
+    asymkey.genkeypair(asymkey.key, pubkints, 2048);
+
+    AsymmCipher::serializeintarray(pubkints, AsymmCipher::PUBKEY, &s);
+    pubkey.setkey(AsymmCipher::PUBKEY, (const byte*)s.data(), s.size());
+    pubk.assign(base64(s.data(), s.size()));
+
+    s.clear();
+    AsymmCipher::serializeintarray(asymkey.key, AsymmCipher::PRIVKEY, &s);
+    s.resize((s.size() + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE);
+
+    SymmCipher key;
+    key.setkey(masterkey);
+    key.ecb_encrypt((byte*)s.data(), (byte*)s.data(), s.size());
+    privk.assign(base64(s.data(), s.size()));
+
+    byte sidbuf[MegaClient::SIDLEN];
+    byte csidbuf[AsymmCipher::MAXKEYLENGTH];
+
+    PrnGen::genblock(sidbuf, sizeof sidbuf);
+    sid.assign(base64(sidbuf, sizeof sidbuf));
+    csid.assign(base64(csidbuf, pubkey.encrypt(sidbuf, sizeof sidbuf, csidbuf, sizeof csidbuf)));
+
+    // the keys shared by the synthetic nodes
+    byte buf[FILENODEKEYLENGTH];
+
+    memcpy(buf, filekey, sizeof filekey);
+    key.ecb_encrypt(buf, buf, sizeof buf);
+    filekeystring = base64(me, MegaClient::USERHANDLE) + ":" + base64(buf, sizeof filekey);
+
+    memcpy(buf, folderkey, sizeof folderkey);
+    key.ecb_encrypt(buf, buf, sizeof folderkey);
+    folderkeystring = base64(me, MegaClient::USERHANDLE) + ":" + base64(buf, sizeof folderkey);
+
+    root = addnode(UNDEF, ROOTNODE, -1);
+    addnode(UNDEF, INCOMINGNODE, -1);
+    addnode(UNDEF, RUBBISHNODE, -1);
+}
+
+MockMegaServer::~MockMegaServer()
+{
+    stop();
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&mutex);
+}
+
+bool MockMegaServer::start()
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof addr;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+            || bind(listenfd, (struct sockaddr*)&addr, sizeof addr)
+            || listen(listenfd, 64)
+            || getsockname(listenfd, (struct sockaddr*)&addr, &addrlen))
+    {
+        return false;
+    }
+
+    port = ntohs(addr.sin_port);
+    stopping = false;
+
+    return !pthread_create(&listenthread, NULL, acceptloop, this);
+}
+
+void MockMegaServer::stop()
+{
+    if (listenfd < 0)
+    {
+        return;
+    }
+
+    shutdown(listenfd, SHUT_RDWR);
+    pthread_join(listenthread, NULL);
+    close(listenfd);
+    listenfd = -1;
+
+    // release the long-polls and close the connections
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&changed);
+    for (unsigned i = 0; i < connections.size(); i++)
+    {
+        shutdown(connections[i], SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    for (unsigned i = 0; i < threads.size(); i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    threads.clear();
+}
+
+string MockMegaServer::apiurl()
+{
+    return url("/");
+}
+
+string MockMegaServer::url(const char* path)
+{
+    std::ostringstream s;
+
+    s << "http://127.0.0.1:" << port << path;
+
+    return s.str();
+}
+
+void MockMegaServer::setaccount(const char* address, const byte* key)
+{
+    SymmCipher pwcipher;
+    byte buf[SymmCipher::KEYLENGTH];
+
+    pthread_mutex_lock(&mutex);
+
+    email = address;
+    std::transform(email.begin(), email.end(), email.begin(), ::tolower);
+
+    memcpy(pwkey, key, sizeof pwkey);
+    pwcipher.setkey(pwkey);
+
+    string s = email;
+    emailhash = MegaClient::stringhash64(&s, &pwcipher);
+
+    // the master key, as the client gets it at login
+    pwcipher.ecb_encrypt(masterkey, buf);
+    k.assign(base64(buf, sizeof buf));
+
+    pthread_mutex_unlock(&mutex);
+}
+
+void MockMegaServer::populate(unsigned numnodes)
+{
+    SymmCipher filecipher, foldercipher;
+    handle folder = UNDEF;
+    unsigned files = 0;
+    char name[32];
+
+    filecipher.setkey(filekey, FILENODE);
+    foldercipher.setkey(folderkey, FOLDERNODE);
+
+    pthread_mutex_lock(&mutex);
+
+    for (unsigned i = 0; i < numnodes; i++)
+    {
+        if (ISUNDEF(folder) || files == 1000)
+        {
+            sprintf(name, "Folder %u", i);
+            folder = addnode(root, FOLDERNODE, -1);
+            nodes[folder].attrs = attrstring(&foldercipher, name);
+            files = 0;
+            continue;
+        }
+
+        sprintf(name, "IMG_%07u.jpg", i);
+        handle h = addnode(folder, FILENODE, 100000 + i % 4096 * 1000);
+        nodes[h].attrs = attrstring(&filecipher, name);
+        files++;
+    }
+
+    scsn++;
+
+    pthread_mutex_unlock(&mutex);
+}
+
+handle MockMegaServer::rootnode()
+{
+    return root;
+}
+
+unsigned MockMegaServer::numnodes(handle h)
+{
+    unsigned count = 0;
+
+    pthread_mutex_lock(&mutex);
+
+    for (std::map<handle, MockNode>::iterator it = nodes.begin(); it != nodes.end(); it++)
+    {
+        for (handle p = it->second.parent; !ISUNDEF(p); p = nodes[p].parent)
+        {
+            if (p == h)
+            {
+                count++;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    return count;
+}
+
+MockMegaServer::Stats MockMegaServer::stats()
+{
+    pthread_mutex_lock(&mutex);
+    Stats s = counters;
+    pthread_mutex_unlock(&mutex);
+
+    return s;
+}
+
+void MockMegaServer::resetstats()
+{
+    pthread_mutex_lock(&mutex);
+    memset(&counters, 0, sizeof counters);
+    pthread_mutex_unlock(&mutex);
+}
+
+void* MockMegaServer::acceptloop(void* param)
+{
+    MockMegaServer* server = (MockMegaServer*)param;
+    int fd;
+
+    while ((fd = accept(server->listenfd, NULL, NULL)) >= 0)
+    {
+        Connection* connection = new Connection;
+        connection->server = server;
+        connection->fd = fd;
+
+        pthread_t thread;
+        pthread_mutex_lock(&server->mutex);
+        server->connections.push_back(fd);
+        if (!pthread_create(&thread, NULL, serve, connection))
+        {
+            server->threads.push_back(thread);
+        }
+        else
+        {
+            server->connections.pop_back();
+            close(fd);
+            delete connection;
+        }
+        pthread_mutex_unlock(&server->mutex);
+    }
+
+    return NULL;
+}
+
+static bool sendall(int fd, const string& data)
+{
+    size_t sent = 0;
+
+    while (sent < data.size())
+    {
+        ssize_t len = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if (len <= 0)
+        {
+            return false;
+        }
+
+        sent += len;
+    }
+
+    return true;
+}
+
+void* MockMegaServer::serve(void* param)
+{
+    Connection* connection = (Connection*)param;
+    MockMegaServer* server = connection->server;
+    int fd = connection->fd;
+    string in, out;
+    char buf[65536];
+    ssize_t len;
+
+    delete connection;
+
+    for (;;)
+    {
+        size_t headerend, bodystart, contentlength = 0;
+
+        while ((headerend = in.find("\r\n\r\n")) == string::npos)
+        {
+            if ((len = recv(fd, buf, sizeof buf, 0)) <= 0)
+            {
+                break;
+            }
+            in.append(buf, len);
+        }
+
+        if (headerend == string::npos)
+        {
+            break;
+        }
+
+        bodystart = headerend + 4;
+        size_t pos = in.find("Content-Length:");
+        if (pos != string::npos && pos < headerend)
+        {
+            contentlength = atol(in.c_str() + pos + 15);
+        }
+
+        while (in.size() < bodystart + contentlength)
+        {
+            if ((len = recv(fd, buf, sizeof buf, 0)) <= 0)
+            {
+                break;
+            }
+            in.append(buf, len);
+        }
+
+        if (in.size() < bodystart + contentlength)
+        {
+            break;
+        }
+
+        // request line: method, path, version
+        size_t pathstart = in.find(' ') + 1;
+        string path = in.substr(pathstart, in.find(' ', pathstart) - pathstart);
+        string body = in.substr(bodystart, contentlength);
+        in.erase(0, bodystart + contentlength);
+
+        bool apirequest = !path.compare(0, 4, "/cs?");
+
+        if (apirequest)
+        {
+            pthread_mutex_lock(&server->mutex);
+            if (++server->inflight > server->counters.maxinflight)
+            {
+                server->counters.maxinflight = server->inflight;
+            }
+            pthread_mutex_unlock(&server->mutex);
+        }
+
+        if (server->latencyms)
+        {
+            usleep(server->latencyms * 1000);
+        }
+
+        int status = 200;
+        out.clear();
+        server->dispatch(path, body, &out, &status);
+
+        if (apirequest)
+        {
+            pthread_mutex_lock(&server->mutex);
+            server->inflight--;
+            pthread_mutex_unlock(&server->mutex);
+        }
+
+        std::ostringstream response;
+        response << "HTTP/1.1 " << status << (status == 200 ? " OK" : " Not Found")
+                 << "\r\nContent-Type: " << (path.compare(0, 4, "/ul/") && path.compare(0, 4, "/dl/")
+                                             ? "application/json" : "application/octet-stream")
+                 << "\r\nContent-Length: " << out.size() << "\r\n\r\n";
+
+        if (!sendall(fd, response.str()) || !sendall(fd, out))
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&server->mutex);
+    for (unsigned i = 0; i < server->connections.size(); i++)
+    {
+        if (server->connections[i] == fd)
+        {
+            server->connections.erase(server->connections.begin() + i);
+            break;
+        }
+    }
+    close(fd);
+    pthread_mutex_unlock(&server->mutex);
+
+    return NULL;
+}
+
+void MockMegaServer::dispatch(const string& path, const string& body, string* out, int* status)
+{
+    size_t q = path.find('?');
+    string base = path.substr(0, q);
+    string query = (q == string::npos) ? string() : path.substr(q + 1);
+
+    if (base == "/cs")
+    {
+        api(query, body, out);
+    }
+    else if (base == "/sc")
+    {
+        sc(query, out);
+    }
+    else if (base == "/wsc")
+    {
+        wait(query, out);
+    }
+    else if (!base.compare(0, 4, "/ul/"))
+    {
+        *status = putchunk(path, body, out);
+    }
+    else if (!base.compare(0, 4, "/dl/"))
+    {
+        *status = getchunk(base, out);
+    }
+    else
+    {
+        *status = 404;
+    }
+}
+
+void MockMegaServer::api(const string& query, const string& body, string* out)
+{
+    JSON json;
+
+    pthread_mutex_lock(&mutex);
+
+    counters.requests++;
+
+    bool authenticated = sid.size() && param(query, "sid") == sid;
+
+    if (param(query, "wlt").size())
+    {
+        // working lock request
+        out->assign("0");
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+
+    json.begin(body.c_str());
+
+    if (!json.enterarray())
+    {
+        appenderror(out, API_EARGS);
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+
+    out->assign("[");
+
+    while (json.enterobject())
+    {
+        string name;
+
+        if (out->size() > 1)
+        {
+            out->append(",");
+        }
+
+        size_t start = out->size();
+        counters.commands++;
+
+        // the command name is guaranteed to come first
+        if (json.getnameid() != 'a' || !json.storeobject(&name))
+        {
+            appenderror(out, API_EARGS);
+        }
+        else if (name == "us")
+        {
+            login(&json, authenticated, out);
+        }
+        else if (name == "echo")
+        {
+            echo(&json, out);
+        }
+        else if (!authenticated)
+        {
+            appenderror(out, API_ESID);
+        }
+        else if (name == "f")
+        {
+            fetchnodes(&json, out);
+        }
+        else if (name == "p")
+        {
+            putnodes(&json, out);
+        }
+        else if (name == "g")
+        {
+            getfile(&json, out);
+        }
+        else if (name == "u")
+        {
+            putfile(&json, out);
+        }
+        else if (name == "uk")
+        {
+            pubkeyrequest(&json, out);
+        }
+        else if (name == "log" || name == "cds")
+        {
+            // events and reports are accepted and dropped
+            appenderror(out, API_OK);
+        }
+        else
+        {
+            appenderror(out, API_ENOENT);
+        }
+
+        if ((*out)[start] == '-')
+        {
+            counters.failed++;
+        }
+
+        json.leaveobject();
+    }
+
+    out->append("]");
+
+    pthread_mutex_unlock(&mutex);
+}
+
+void MockMegaServer::login(JSON* json, bool authenticated, string* out)
+{
+    string user;
+    handle uh = UNDEF;
+    nameid name;
+
+    while ((name = json->getnameid()) != EOO)
+    {
+        switch (name)
+        {
+            case MAKENAMEID4('u', 's', 'e', 'r'):
+                json->storeobject(&user);
+                break;
+
+            case MAKENAMEID2('u', 'h'):
+                uh = json->gethandle(sizeof uh);
+                break;
+
+            default:
+                json->storeobject();
+        }
+    }
+
+    std::transform(user.begin(), user.end(), user.begin(), ::tolower);
+
+    if (user.size() ? (user != email || uh != emailhash) : !authenticated)
+    {
+        return appenderror(out, user.size() ? API_ENOENT : API_ESID);
+    }
+
+    out->append("{\"k\":\"");
+    out->append(k);
+    out->append("\",\"u\":\"");
+    out->append(base64(me, MegaClient::USERHANDLE));
+    out->append("\",\"privk\":\"");
+    out->append(privk);
+
+    // a new session gets its ID
+    if (user.size())
+    {
+        out->append("\",\"csid\":\"");
+        out->append(csid);
+    }
+
+    out->append("\"}");
+}
+
+void MockMegaServer::fetchnodes(JSON*, string* out)
+{
+    out->reserve(out->size() + nodes.size() * 200);
+    out->append("{\"f\":[");
+
+    for (std::map<handle, MockNode>::iterator it = nodes.begin(); it != nodes.end(); it++)
+    {
+        if (it != nodes.begin())
+        {
+            out->append(",");
+        }
+
+        nodejson(it->first, it->second, out);
+    }
+
+    out->append("],\"ok\":[],\"s\":[],\"u\":[{\"u\":\"");
+    out->append(base64(me, MegaClient::USERHANDLE));
+    out->append("\",\"c\":2,\"m\":\"");
+    out->append(email);
+    out->append("\"}],\"sn\":\"");
+    out->append(scsnstring());
+    out->append("\"}");
+}
+
+void MockMegaServer::putnodes(JSON* json, string* out)
+{
+    struct NewMockNode
+    {
+        string h;
+        handle parent;
+        nodetype_t type;
+        string attrs;
+        string key;
+    };
+
+    vector<NewMockNode> newnodes;
+    handle target = UNDEF;
+    nameid name;
+
+    while ((name = json->getnameid()) != EOO)
+    {
+        switch (name)
+        {
+            case 't':
+                target = json->gethandle();
+                break;
+
+            case 'n':
+                if (json->enterarray())
+                {
+                    while (json->enterobject())
+                    {
+                        NewMockNode nn;
+                        nn.parent = UNDEF;
+                        nn.type = TYPE_UNKNOWN;
+
+                        while ((name = json->getnameid()) != EOO)
+                        {
+                            switch (name)
+                            {
+                                case 'h':
+                                    json->storebinary(&nn.h);
+                                    break;
+
+                                case 'p':
+                                    nn.parent = json->gethandle();
+                                    break;
+
+                                case 't':
+                                    nn.type = (nodetype_t)json->getint();
+                                    break;
+
+                                case 'a':
+                                    json->storeobject(&nn.attrs);
+                                    break;
+
+                                case 'k':
+                                    json->storeobject(&nn.key);
+                                    break;
+
+                                default:
+                                    json->storeobject();
+                            }
+                        }
+
+                        newnodes.push_back(nn);
+                    }
+
+                    json->leavearray();
+                }
+                break;
+
+            default:
+                json->storeobject();
+        }
+    }
+
+    std::map<handle, MockNode>::iterator it = nodes.find(target);
+
+    if (it == nodes.end() || it->second.type == FILENODE || !newnodes.size())
+    {
+        return appenderror(out, ISUNDEF(target) ? API_EARGS : API_ENOENT);
+    }
+
+    // check the whole batch first: uploads must be complete and intact,
+    // parents must precede their children
+    std::set<string> tmphandles;
+
+    for (unsigned i = 0; i < newnodes.size(); i++)
+    {
+        NewMockNode* nn = &newnodes[i];
+
+        if (nn->h.size() == NewNode::UPLOADTOKENLEN)
+        {
+            std::map<uint64_t, Upload>::iterator uit = uploads.find(MemAccess::get<uint64_t>(nn->h.data()));
+
+            if (nn->type != FILENODE || uit == uploads.end() || uit->second.token != nn->h)
+            {
+                return appenderror(out, API_ENOENT);
+            }
+
+            if (verifymacs)
+            {
+                byte key[FILENODEKEYLENGTH];
+
+                if (Base64::atob(nn->key.c_str(), key, sizeof key) != sizeof key)
+                {
+                    return appenderror(out, API_EKEY);
+                }
+
+                SymmCipher cipher;
+                cipher.setkey(masterkey);
+                cipher.ecb_decrypt(key, sizeof key);
+
+                if (!checkmac(uit->second.data, key))
+                {
+                    counters.badmac++;
+                    return appenderror(out, API_EKEY);
+                }
+            }
+        }
+        else if (nn->h.size() != MegaClient::NODEHANDLE || nn->type != FOLDERNODE)
+        {
+            return appenderror(out, API_EARGS);
+        }
+        else
+        {
+            tmphandles.insert(nn->h);
+        }
+
+        if (!ISUNDEF(nn->parent) && !tmphandles.count(string((const char*)&nn->parent, MegaClient::NODEHANDLE)))
+        {
+            return appenderror(out, API_EARGS);
+        }
+    }
+
+    std::map<string, handle> newhandles;
+
+    out->append("{\"f\":[");
+
+    for (unsigned i = 0; i < newnodes.size(); i++)
+    {
+        NewMockNode* nn = &newnodes[i];
+        handle parent = ISUNDEF(nn->parent)
+                ? target
+                : newhandles[string((const char*)&nn->parent, MegaClient::NODEHANDLE)];
+        handle h;
+
+        if (nn->type == FILENODE)
+        {
+            uint64_t id = MemAccess::get<uint64_t>(nn->h.data());
+            Upload* upload = &uploads[id];
+
+            h = addnode(parent, FILENODE, upload->size);
+            nodes[h].data.swap(upload->data);
+            uploads.erase(id);
+        }
+        else
+        {
+            h = addnode(parent, FOLDERNODE, -1);
+            newhandles[nn->h] = h;
+        }
+
+        MockNode* n = &nodes[h];
+        n->attrs = nn->attrs;
+        n->key = base64(me, MegaClient::USERHANDLE) + ":" + nn->key;
+
+        if (i)
+        {
+            out->append(",");
+        }
+
+        nodejson(h, *n, out, i);
+    }
+
+    out->append("]}");
+
+    // the other sessions get to see the new nodes
+    scsn++;
+    pthread_cond_broadcast(&changed);
+}
+
+void MockMegaServer::getfile(JSON* json, string* out)
+{
+    handle h = UNDEF;
+    nameid name;
+
+    while ((name = json->getnameid()) != EOO)
+    {
+        if (name == 'n')
+        {
+            h = json->gethandle();
+        }
+        else
+        {
+            json->storeobject();
+        }
+    }
+
+    std::map<handle, MockNode>::iterator it = nodes.find(h);
+
+    // the synthetic files have no content
+    if (it == nodes.end() || it->second.type != FILENODE || (m_off_t)it->second.data.size() != it->second.size)
+    {
+        return appenderror(out, API_ENOENT);
+    }
+
+    std::ostringstream s;
+
+    s << "{\"s\":" << it->second.size
+      << ",\"at\":\"" << it->second.attrs
+      << "\",\"g\":\"" << url("/dl/") << base64(h, MegaClient::NODEHANDLE) << "\"}";
+
+    out->append(s.str());
+}
+
+void MockMegaServer::putfile(JSON* json, string* out)
+{
+    m_off_t size = -1;
+    nameid name;
+
+    while ((name = json->getnameid()) != EOO)
+    {
+        if (name == 's')
+        {
+            size = json->getint();
+        }
+        else
+        {
+            json->storeobject();
+        }
+    }
+
+    if (size < 0)
+    {
+        return appenderror(out, API_EARGS);
+    }
+
+    uint64_t id = nextupload++;
+    Upload* upload = &uploads[id];
+
+    upload->size = size;
+    upload->received = 0;
+    upload->data.resize(size);
+
+    std::ostringstream s;
+
+    s << "{\"p\":\"" << url("/ul/") << id << "\"}";
+
+    out->append(s.str());
+}
+
+void MockMegaServer::pubkeyrequest(JSON* json, string* out)
+{
+    string user;
+    nameid name;
+
+    while ((name = json->getnameid()) != EOO)
+    {
+        if (name == 'u')
+        {
+            json->storeobject(&user);
+        }
+        else
+        {
+            json->storeobject();
+        }
+    }
+
+    if (user != email && user != base64(me, MegaClient::USERHANDLE))
+    {
+        return appenderror(out, API_ENOENT);
+    }
+
+    out->append("{\"u\":\"");
+    out->append(base64(me, MegaClient::USERHANDLE));
+    out->append("\",\"pubk\":\"");
+    out->append(pubk);
+    out->append("\"}");
+}
+
+void MockMegaServer::echo(JSON* json, string* out)
+{
+    m_off_t i = -1;
+    nameid name;
+
+    while ((name = json->getnameid()) != EOO)
+    {
+        if (name == 'i')
+        {
+            i = json->getint();
+        }
+        else
+        {
+            json->storeobject();
+        }
+    }
+
+    std::ostringstream s;
+
+    s << i;
+
+    out->append(s.str());
+}
+
+// server-client request: the changes since the given sequence number (always
+// none, the client learns about its own changes from the command results),
+// or where to wait for them if there are none
+void MockMegaServer::sc(const string& query, string* out)
+{
+    pthread_mutex_lock(&mutex);
+
+    counters.requests++;
+
+    if (param(query, "sid") != sid)
+    {
+        appenderror(out, API_ESID);
+    }
+    else if (param(query, "sn") == scsnstring())
+    {
+        out->append("{\"w\":\"");
+        out->append(url("/wsc?sn="));
+        out->append(scsnstring());
+        out->append("\",\"sn\":\"");
+        out->append(scsnstring());
+        out->append("\"}");
+    }
+    else
+    {
+        out->append("{\"a\":[],\"sn\":\"");
+        out->append(scsnstring());
+        out->append("\"}");
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+// long-poll until the sequence number moves on
+void MockMegaServer::wait(const string& query, string*)
+{
+    struct timeval now;
+    struct timespec deadline;
+
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + WAITTIMEOUT;
+    deadline.tv_nsec = now.tv_usec * 1000;
+
+    pthread_mutex_lock(&mutex);
+
+    string sn = param(query, "sn");
+
+    while (!stopping && sn == scsnstring())
+    {
+        if (pthread_cond_timedwait(&changed, &mutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+// chunk upload to /ul/<upload>/<offset>?c=<CRC>: empty response, or the
+// upload token once the file is complete
+int MockMegaServer::putchunk(const string& path, const string& body, string* out)
+{
+    char* ptr;
+    uint64_t id = strtoull(path.c_str() + 4, &ptr, 10);
+
+    if (*ptr != '/')
+    {
+        return 404;
+    }
+
+    m_off_t pos = strtoll(ptr + 1, &ptr, 10);
+    string crc = param(path.substr(path.find('?') + 1), "c");
+
+    // the CRC folds the chunk into twelve bytes, see HttpReqUL::prepare()
+    byte c[12] = { 0 };
+
+    for (size_t i = 0; i < body.size(); i++)
+    {
+        c[i % sizeof c] ^= body[i];
+    }
+
+    pthread_mutex_lock(&mutex);
+
+    std::map<uint64_t, Upload>::iterator it = uploads.find(id);
+
+    if (it == uploads.end())
+    {
+        appenderror(out, API_ENOENT);
+    }
+    else if (pos < 0 || pos + (m_off_t)body.size() > it->second.size)
+    {
+        appenderror(out, API_EARGS);
+    }
+    else if (crc.size() && crc != base64(c, sizeof c))
+    {
+        // the client sends the chunk again
+        counters.badcrc++;
+        appenderror(out, API_EKEY);
+    }
+    else
+    {
+        Upload* upload = &it->second;
+
+        counters.bytesin += body.size();
+        memcpy((char*)upload->data.data() + pos, body.data(), body.size());
+
+        if (!upload->chunks.count(pos))
+        {
+            upload->received += body.size();
+            upload->chunks[pos] = body.size();
+        }
+
+        if (upload->received == upload->size)
+        {
+            // new-style token: upload ID, padding, version 1
+            upload->token.assign((const char*)&id, sizeof id);
+            upload->token.resize(NewNode::UPLOADTOKENLEN);
+            upload->token[NewNode::UPLOADTOKENLEN - 1] = 1;
+            out->assign(upload->token);
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    return 200;
+}
+
+// chunk download from /dl/<node>/<first>-<last byte>
+int MockMegaServer::getchunk(const string& path, string* out)
+{
+    size_t slash = path.find('/', 4);
+
+    if (slash == string::npos)
+    {
+        return 404;
+    }
+
+    handle h = 0;
+    char* ptr;
+
+    if (Base64::atob(path.substr(4, slash - 4).c_str(), (byte*)&h, sizeof h) != MegaClient::NODEHANDLE)
+    {
+        return 404;
+    }
+
+    m_off_t first = strtoll(path.c_str() + slash + 1, &ptr, 10);
+    m_off_t last = (*ptr == '-') ? strtoll(ptr + 1, NULL, 10) : -1;
+
+    pthread_mutex_lock(&mutex);
+
+    std::map<handle, MockNode>::iterator it = nodes.find(h);
+    int status = 404;
+
+    if (it != nodes.end() && (m_off_t)it->second.data.size() == it->second.size)
+    {
+        m_off_t size = it->second.data.size();
+
+        if (first >= 0 && first <= last && first < size)
+        {
+            out->assign(it->second.data, first, (last < size ? last + 1 : size) - first);
+            counters.bytesout += out->size();
+        }
+
+        status = 200;
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    return status;
+}
+
+handle MockMegaServer::addnode(handle parent, nodetype_t type, m_off_t size)
+{
+    handle h = nexthandle++;
+    MockNode* n = &nodes[h];
+
+    n->parent = parent;
+    n->type = type;
+    n->size = size;
+    n->ts = 1500000000 + h % 1000000;
+
+    return h;
+}
+
+void MockMegaServer::nodejson(handle h, const MockNode& n, string* out, int index)
+{
+    char buf[64];
+
+    out->append("{\"h\":\"");
+    out->append(base64(h, MegaClient::NODEHANDLE));
+
+    if (!ISUNDEF(n.parent))
+    {
+        out->append("\",\"p\":\"");
+        out->append(base64(n.parent, MegaClient::NODEHANDLE));
+    }
+
+    out->append("\",\"u\":\"");
+    out->append(base64(me, MegaClient::USERHANDLE));
+    sprintf(buf, "\",\"t\":%d", (int)n.type);
+    out->append(buf);
+
+    if (n.type == FILENODE || n.type == FOLDERNODE)
+    {
+        out->append(",\"a\":\"");
+        out->append(n.attrs);
+        out->append("\",\"k\":\"");
+        out->append(n.key.size() ? n.key : (n.type == FILENODE ? filekeystring : folderkeystring));
+        out->append("\"");
+    }
+
+    if (n.type == FILENODE)
+    {
+        sprintf(buf, ",\"s\":%" PRId64, n.size);
+        out->append(buf);
+    }
+
+    sprintf(buf, ",\"ts\":%" PRId64, n.ts);
+    out->append(buf);
+
+    if (index >= 0)
+    {
+        sprintf(buf, ",\"i\":%d", index);
+        out->append(buf);
+    }
+
+    out->append("}");
+}
+
+// the meta-MAC of the file content against the one in its key, chunk by
+// chunk like TransferSlot::macsmac()
+bool MockMegaServer::checkmac(const string& data, const byte* key)
+{
+    SymmCipher cipher;
+    byte mac[SymmCipher::BLOCKSIZE] = { 0 };
+    byte chunkmac[SymmCipher::BLOCKSIZE];
+    string buf;
+    m_off_t size = data.size();
+    m_off_t pos = 0;
+
+    cipher.setkey(key, FILENODE);
+
+    int64_t ctriv = MemAccess::get<int64_t>((const char*)key + SymmCipher::KEYLENGTH);
+    int64_t metamac = MemAccess::get<int64_t>((const char*)key + SymmCipher::KEYLENGTH + sizeof ctriv);
+
+    do
+    {
+        m_off_t npos = ChunkedHash::chunkceil(pos, size);
+        unsigned len = (unsigned)(npos - pos);
+
+        buf.assign(data, pos, len);
+        buf.resize((len + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE);
+        cipher.ctr_crypt((byte*)buf.data(), len, pos, ctriv, chunkmac, false);
+
+        SymmCipher::xorblock(chunkmac, mac);
+        cipher.ecb_encrypt(mac);
+
+        pos = npos;
+    } while (pos < size);
+
+    uint32_t* m = (uint32_t*)mac;
+
+    m[0] ^= m[1];
+    m[1] = m[2] ^ m[3];
+
+    return MemAccess::get<int64_t>((const char*)mac) == metamac;
+}
+
+string MockMegaServer::scsnstring()
+{
+    return base64(&scsn, sizeof scsn);
+}
+#endif
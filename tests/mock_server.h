@@ -0,0 +1,193 @@
+/**
+ * @file tests/mock_server.h
+ * @brief Local stand-in for the MEGA API and storage servers
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_TESTS_MOCK_SERVER_H
+#define MEGA_TESTS_MOCK_SERVER_H 1
+
+#include "mega.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+
+// HTTP/1.1 server on the loopback interface that speaks the subset of the API
+// used by MegaClient to log in, fetch the nodes, upload, download and keep up
+// with the server-client channel, and stores the uploaded files like the
+// storage servers do. It holds a single account, with its nodes in memory.
+//
+// Supported commands: us, f, p, g, u, uk (anything else fails with ENOENT),
+// sc requests with their long-poll, chunk uploads (with CRC check) and
+// ranged chunk downloads. The MACs of uploaded files are verified when
+// putnodes attaches them, as the account's master key is known here.
+// The echo command answers with its "i" argument without a session, for
+// tests of the request pipeline.
+class MockMegaServer
+{
+public:
+    struct Stats
+    {
+        unsigned requests;      // API requests
+        unsigned commands;      // commands in them
+        unsigned failed;        // commands that failed
+        unsigned badcrc;        // chunks rejected because of their CRC
+        unsigned badmac;        // uploads rejected because of their MAC
+        unsigned maxinflight;   // API requests served at the same time, at most
+        m_off_t bytesin;  // file data received / sent
+        m_off_t bytesout;
+    };
+
+    // verify the MACs of uploads in putnodes (one decryption pass per file)
+    bool verifymacs;
+
+    // delay before every request is answered (round trip time), requests
+    // on different connections are delayed at the same time
+    int latencyms;
+
+    MockMegaServer();
+    ~MockMegaServer();
+
+    // listens on a free loopback port, false on failure
+    bool start();
+    void stop();
+
+    // base URL to set as MegaClient::APIURL
+    std::string apiurl();
+
+    // login credentials: e-mail and password key (see
+    // MegaApi::getBase64PwKey())
+    void setaccount(const char* email, const byte* pwkey);
+
+    // adds numnodes synthetic nodes below the root: folders of 1000 files
+    // each, without content
+    void populate(unsigned numnodes);
+
+    mega::handle rootnode();
+
+    // number of nodes below h
+    unsigned numnodes(mega::handle h);
+
+    Stats stats();
+    void resetstats();
+
+private:
+    struct MockNode
+    {
+        mega::handle parent;
+        mega::nodetype_t type;
+        m_off_t size;
+        mega::m_time_t ts;
+
+        // encrypted attributes and key (empty: the one of the synthetic
+        // nodes of this type), Base64-encoded
+        std::string attrs;
+        std::string key;
+
+        // encrypted content
+        std::string data;
+    };
+
+    struct Upload
+    {
+        m_off_t size;
+        m_off_t received;
+        std::map<m_off_t, unsigned> chunks;
+        std::string data;
+        std::string token;
+    };
+
+    struct Connection
+    {
+        MockMegaServer* server;
+        int fd;
+    };
+
+    int listenfd;
+    int port;
+    bool stopping;
+    pthread_t listenthread;
+
+    // protects everything below, signals changes to the server-client
+    // long-polls
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    std::vector<int> connections;
+    std::vector<pthread_t> threads;
+
+    // account
+    std::string email;
+    uint64_t emailhash;
+    byte pwkey[mega::SymmCipher::KEYLENGTH];
+    byte masterkey[mega::SymmCipher::KEYLENGTH];
+    mega::handle me;
+    std::string k;
+    std::string sid;
+    std::string csid;
+    std::string privk;
+    std::string pubk;
+    mega::AsymmCipher pubkey;
+
+    // keys of the synthetic nodes
+    byte filekey[mega::FILENODEKEYLENGTH];
+    byte folderkey[mega::FOLDERNODEKEYLENGTH];
+    std::string filekeystring;
+    std::string folderkeystring;
+
+    std::map<mega::handle, MockNode> nodes;
+    mega::handle root;
+    mega::handle nexthandle;
+    uint64_t scsn;
+
+    std::map<uint64_t, Upload> uploads;
+    uint64_t nextupload;
+
+    Stats counters;
+    unsigned inflight;
+
+    static void* acceptloop(void*);
+    static void* serve(void*);
+
+    void dispatch(const std::string& path, const std::string& body, std::string* out, int* status);
+
+    // API requests and their commands
+    void api(const std::string& query, const std::string& body, std::string* out);
+    void login(mega::JSON*, bool, std::string*);
+    void fetchnodes(mega::JSON*, std::string*);
+    void putnodes(mega::JSON*, std::string*);
+    void getfile(mega::JSON*, std::string*);
+    void putfile(mega::JSON*, std::string*);
+    void pubkeyrequest(mega::JSON*, std::string*);
+    void echo(mega::JSON*, std::string*);
+    void sc(const std::string& query, std::string*);
+    void wait(const std::string& query, std::string*);
+
+    // storage
+    int putchunk(const std::string& path, const std::string& body, std::string*);
+    int getchunk(const std::string& path, std::string*);
+
+    mega::handle addnode(mega::handle, mega::nodetype_t, m_off_t);
+    void nodejson(mega::handle, const MockNode&, std::string*, int = -1);
+    bool checkmac(const std::string&, const byte*);
+    std::string scsnstring();
+    std::string url(const char*);
+};
+#endif
+
+#endif
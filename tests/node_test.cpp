@@ -0,0 +1,190 @@
+/**
+ * @file tests/node_test.cpp
+ * @brief Mega SDK test for the node tree and the fingerprint index
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+
+using namespace mega;
+
+// file nodes with key-derived fingerprints, as they come from the server
+class FingerprintIndexTest : public ::testing::Test
+{
+protected:
+    TestClient<>* testclient;
+    MegaClient* client;
+    Node* folder;
+    node_vector dp;
+    handle h;
+
+    void SetUp()
+    {
+        testclient = new TestClient<>("node_test");
+        client = testclient->client;
+        h = 1;
+        folder = new (client) Node(client, &dp, h++, UNDEF, ROOTNODE, -1, UNDEF, NULL, 0);
+    }
+
+    void TearDown()
+    {
+        delete testclient;
+    }
+
+    Node* addfile(m_off_t size, uint32_t keyseed)
+    {
+        char key[FILENODEKEYLENGTH] = { 0 };
+        memcpy(key, &keyseed, sizeof keyseed);
+
+        Node* n = new (client) Node(client, &dp, h++, folder->nodehandle, FILENODE, size, 1, NULL, 1500000000);
+        n->nodekey.assign(key, sizeof key);
+        n->setfingerprint();
+        return n;
+    }
+};
+
+TEST_F(FingerprintIndexTest, Lookup)
+{
+    Node* a = addfile(100, 1);
+    Node* b = addfile(100, 1);
+    Node* c = addfile(100, 2);
+    Node* d = addfile(200, 1);
+
+    // enough entries to go through several rehashes
+    for (unsigned i = 0; i < 10000; i++)
+    {
+        addfile(1000 + i, i);
+    }
+
+    ASSERT_EQ(10004u, client->fingerprints.size());
+
+    FileFingerprint fp;
+    fp = *a;
+
+    // a and b share the fingerprint, in either order
+    Node* first = client->nodebyfingerprint(&fp);
+    Node* second = first ? FingerprintIndex::next(first) : NULL;
+    ASSERT_TRUE((first == a && second == b) || (first == b && second == a));
+    ASSERT_EQ(NULL, FingerprintIndex::next(second));
+
+    node_vector* nodes = client->nodesbyfingerprint(c);
+    ASSERT_EQ(1u, nodes->size());
+    ASSERT_EQ(c, nodes->at(0));
+    delete nodes;
+
+    ASSERT_EQ(d, client->nodebyfingerprint(d));
+
+    fp.size = 300;
+    ASSERT_EQ(NULL, client->nodebyfingerprint(&fp));
+
+    // deleting a node takes it out of the index
+    client->nodes.erase(b->nodehandle);
+    delete b;
+    ASSERT_EQ(a, client->nodebyfingerprint(a));
+    ASSERT_EQ(NULL, FingerprintIndex::next(a));
+    ASSERT_EQ(10003u, client->fingerprints.size());
+
+    // a changed fingerprint is reindexed
+    c->size = 200;
+    c->setfingerprint();
+    nodes = client->nodesbyfingerprint(d);
+    ASSERT_EQ(1u, nodes->size());
+    ASSERT_EQ(d, nodes->at(0));
+    delete nodes;
+    ASSERT_EQ(10003u, client->fingerprints.size());
+
+    client->fingerprints.remove(a);
+    client->fingerprints.remove(a);
+    ASSERT_FALSE(FingerprintIndex::contains(a));
+    ASSERT_EQ(NULL, client->nodebyfingerprint(a));
+    ASSERT_EQ(10002u, client->fingerprints.size());
+}
+
+// Compares insertion, lookup and removal against the multiset that was used
+// before
+TEST_F(FingerprintIndexTest, Benchmark)
+{
+    unsigned numnodes = largebenchmarks() ? 10000000 : 1000000;
+    vector<Node*> files;
+
+    files.reserve(numnodes);
+    for (unsigned i = 0; i < numnodes; i++)
+    {
+        files.push_back(addfile(i % 4096, i));
+    }
+
+    // the nodes are indexed, start over to time the insertion
+    client->fingerprints.clear();
+
+    m_time_t start = Waiter::getmicros();
+    for (unsigned i = 0; i < numnodes; i++)
+    {
+        client->fingerprints.add(files[i]);
+    }
+    m_time_t indexinsert = Waiter::getmicros() - start;
+
+    start = Waiter::getmicros();
+    unsigned found = 0;
+    for (unsigned i = 0; i < numnodes; i++)
+    {
+        found += client->nodebyfingerprint(files[(i * 7919u) % numnodes]) != NULL;
+    }
+    m_time_t indexfind = Waiter::getmicros() - start;
+    ASSERT_EQ(numnodes, found);
+
+    start = Waiter::getmicros();
+    for (unsigned i = 0; i < numnodes; i++)
+    {
+        client->fingerprints.remove(files[i]);
+    }
+    m_time_t indexremove = Waiter::getmicros() - start;
+
+    multiset<FileFingerprint*, FileFingerprintCmp> fingerprints;
+    vector<multiset<FileFingerprint*, FileFingerprintCmp>::iterator> positions;
+    positions.reserve(numnodes);
+
+    start = Waiter::getmicros();
+    for (unsigned i = 0; i < numnodes; i++)
+    {
+        positions.push_back(fingerprints.insert(files[i]));
+    }
+    m_time_t setinsert = Waiter::getmicros() - start;
+
+    start = Waiter::getmicros();
+    found = 0;
+    for (unsigned i = 0; i < numnodes; i++)
+    {
+        found += fingerprints.find(files[(i * 7919u) % numnodes]) != fingerprints.end();
+    }
+    m_time_t setfind = Waiter::getmicros() - start;
+    ASSERT_EQ(numnodes, found);
+
+    start = Waiter::getmicros();
+    for (unsigned i = 0; i < numnodes; i++)
+    {
+        fingerprints.erase(positions[i]);
+    }
+    m_time_t setremove = Waiter::getmicros() - start;
+
+    TEST_RESULTS(numnodes << " nodes, ns/op insert/find/remove: index "
+                 << indexinsert * 1000.0 / numnodes << "/" << indexfind * 1000.0 / numnodes << "/" << indexremove * 1000.0 / numnodes
+                 << ", multiset "
+                 << setinsert * 1000.0 / numnodes << "/" << setfind * 1000.0 / numnodes << "/" << setremove * 1000.0 / numnodes);
+}
@@ -0,0 +1,834 @@
+/**
+ * @file tests/perf_test.cpp
+ * @brief End-to-end performance tests against a local mock server
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega.h"
+#include "../include/megaapi.h"
+#include "mock_server.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+
+#ifndef _WIN32
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "../examples/linux/megafuse.h"
+
+using namespace mega;
+
+static const char* APP_KEY  = "8QxzVRxD";
+static const char* EMAIL    = "perf@example.com";
+static const char* PASSWORD = "perf-test-password";
+
+// seconds a single operation may take before the test fails
+static const int TIMEOUT = 600;
+
+// prints a result, records it as a property of the test (shows up in
+// --gtest_output=xml/json) and appends it as a JSON line to the file named
+// by $MEGA_PERF_OUTPUT, for tracking regressions across builds
+static void report(const string& metric, double value, const char* unit)
+{
+    const ::testing::TestInfo* info = ::testing::UnitTest::GetInstance()->current_test_info();
+    std::ostringstream s;
+
+    s << value;
+
+    TEST_RESULTS(metric << ": " << s.str() << " " << unit);
+
+    ::testing::Test::RecordProperty(metric + "_" + unit, s.str());
+
+    if (const char* path = getenv("MEGA_PERF_OUTPUT"))
+    {
+        std::ofstream out(path, std::ios::app);
+
+        out << "{\"test\":\"" << info->test_case_name() << "." << info->name()
+            << "\",\"metric\":\"" << metric
+            << "\",\"value\":" << s.str()
+            << ",\"unit\":\"" << unit << "\"}" << std::endl;
+    }
+}
+
+static double seconds(m_time_t start)
+{
+    return (Waiter::getmicros() - start) / 1000000.0;
+}
+
+// deterministic file content that does not compress
+static void writefile(const string& path, m_off_t size, unsigned seed)
+{
+    std::ofstream out(path.c_str(), std::ios::binary);
+    string buf(1 << 20, 0);
+    uint32_t x = seed * 2654435761u + 1;
+
+    while (size > 0)
+    {
+        size_t len = size < (m_off_t)buf.size() ? (size_t)size : buf.size();
+
+        for (size_t i = 0; i < len; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            buf[i] = (char)x;
+        }
+
+        out.write(buf.data(), len);
+        size -= len;
+    }
+}
+
+static bool samefile(const string& a, const string& b)
+{
+    std::ifstream fa(a.c_str(), std::ios::binary), fb(b.c_str(), std::ios::binary);
+    std::istreambuf_iterator<char> end;
+
+    return fa && fb && std::equal(std::istreambuf_iterator<char>(fa), end, std::istreambuf_iterator<char>(fb));
+}
+
+static void removetree(const string& path)
+{
+    DIR* dp = opendir(path.c_str());
+
+    if (!dp)
+    {
+        unlink(path.c_str());
+        return;
+    }
+
+    dirent* d;
+
+    while ((d = readdir(dp)))
+    {
+        if (strcmp(d->d_name, ".") && strcmp(d->d_name, ".."))
+        {
+            removetree(path + "/" + d->d_name);
+        }
+    }
+
+    closedir(dp);
+    rmdir(path.c_str());
+}
+
+// counts finished transfers of a batch
+class TransferCounter : public MegaTransferListener
+{
+public:
+    unsigned finished;
+    unsigned failed;
+
+    TransferCounter()
+    {
+        finished = 0;
+        failed = 0;
+        pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~TransferCounter()
+    {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void onTransferFinish(MegaApi*, MegaTransfer*, MegaError* e)
+    {
+        pthread_mutex_lock(&mutex);
+        finished++;
+        if (e->getErrorCode() != MegaError::API_OK)
+        {
+            failed++;
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    unsigned count()
+    {
+        pthread_mutex_lock(&mutex);
+        unsigned n = finished;
+        pthread_mutex_unlock(&mutex);
+
+        return n;
+    }
+
+private:
+    pthread_mutex_t mutex;
+};
+
+class PerfTest : public ::testing::Test
+{
+public:
+    MockMegaServer server;
+    MegaApi* api;
+    string dir;
+
+    // outlives the transfers, which may still run after a failed assertion
+    TransferCounter counter;
+
+    void SetUp()
+    {
+        char path[] = "/tmp/megaperftestXXXXXX";
+
+        api = NULL;
+
+        ASSERT_TRUE(mkdtemp(path) != NULL);
+        dir = path;
+
+        // round trip time of a real connection
+        if (const char* latency = getenv("MEGA_PERF_LATENCY"))
+        {
+            server.latencyms = atoi(latency);
+        }
+
+        ASSERT_TRUE(server.start());
+
+        api = new MegaApi(APP_KEY);
+        api->changeApiUrl(server.apiurl().c_str(), true);
+
+        // the client only keeps the port of http storage URLs (the one of the
+        // server) when it uses the alternative port
+        api->setDownloadMethod(MegaApi::TRANSFER_METHOD_ALTERNATIVE_PORT);
+
+        // the server needs the password key to hand out the master key
+        char* pwkey = api->getBase64PwKey(PASSWORD);
+        byte key[SymmCipher::KEYLENGTH];
+        ASSERT_EQ((int)sizeof key, Base64::atob(pwkey, key, sizeof key));
+        delete [] pwkey;
+
+        server.setaccount(EMAIL, key);
+    }
+
+    void TearDown()
+    {
+        delete api;
+        server.stop();
+        removetree(dir);
+    }
+
+    void login()
+    {
+        SynchronousRequestListener loginlistener, fetchlistener;
+
+        api->login(EMAIL, PASSWORD, &loginlistener);
+        ASSERT_EQ(0, loginlistener.trywait(TIMEOUT * 1000)) << "Login timed out";
+        ASSERT_EQ(MegaError::API_OK, loginlistener.getError()->getErrorCode());
+
+        api->fetchNodes(&fetchlistener);
+        ASSERT_EQ(0, fetchlistener.trywait(TIMEOUT * 1000)) << "Fetchnodes timed out";
+        ASSERT_EQ(MegaError::API_OK, fetchlistener.getError()->getErrorCode());
+    }
+
+    MegaHandle upload(const string& path, MegaNode* parent)
+    {
+        SynchronousTransferListener listener;
+
+        api->startUpload(path.c_str(), parent, &listener);
+
+        if (listener.trywait(TIMEOUT * 1000)
+                || listener.getError()->getErrorCode() != MegaError::API_OK)
+        {
+            return UNDEF;
+        }
+
+        return listener.getTransfer()->getNodeHandle();
+    }
+
+    // reads the whole file through the block cache in reads of 128 KB
+    void readfile(BlockCache* blocks, MegaNode* n, const string& content)
+    {
+        string data(content.size(), 0);
+
+        for (size_t offset = 0; offset < content.size(); offset += 131072)
+        {
+            size_t len = std::min(content.size() - offset, (size_t)131072);
+            ASSERT_EQ((int)len, blocks->read(n, &data[offset], len, offset));
+        }
+
+        ASSERT_TRUE(data == content) << "Wrong data from the block cache";
+    }
+
+    void checkfusecache(BlockCache* blocks, AttrCache* attrs, MegaHandle h, const string& content)
+    {
+        struct stat st;
+
+        // lookups, also of missing paths, and listings are cached
+        ASSERT_EQ(0, attrs->getattr("/fuse.bin", &st));
+        EXPECT_EQ((off_t)content.size(), st.st_size);
+        ASSERT_EQ(0, attrs->getattr("/fuse.bin", &st));
+        ASSERT_EQ(-ENOENT, attrs->getattr("/folder", &st));
+        ASSERT_EQ(-ENOENT, attrs->getattr("/folder", &st));
+        EXPECT_EQ(2, attrs->getHits());
+        EXPECT_EQ(2, attrs->getMisses());
+
+        vector<string> names;
+        vector<struct stat> stats;
+        ASSERT_EQ(0, attrs->list("/", &names, &stats));
+        names.clear();
+        stats.clear();
+        ASSERT_EQ(0, attrs->list("/", &names, &stats));
+        ASSERT_EQ(1u, names.size());
+        EXPECT_EQ("fuse.bin", names[0]);
+        EXPECT_EQ((off_t)content.size(), stats[0].st_size);
+        EXPECT_EQ(3, attrs->getHits());
+        EXPECT_EQ(3, attrs->getMisses());
+
+        // the new folder replaces the cached missing path
+        MegaNode* root = api->getRootNode();
+        ASSERT_TRUE(root != NULL);
+        SynchronousRequestListener listener;
+        api->createFolder("folder", root, &listener);
+        delete root;
+        ASSERT_EQ(0, listener.trywait(TIMEOUT * 1000));
+        ASSERT_EQ(MegaError::API_OK, listener.getError()->getErrorCode());
+
+        for (int i = 0; attrs->getattr("/folder", &st) && i < TIMEOUT * 10; i++)
+        {
+            usleep(100000);
+        }
+        ASSERT_EQ(0, attrs->getattr("/folder", &st));
+        EXPECT_TRUE(S_ISDIR(st.st_mode));
+
+        // every block is downloaded once, the reads after the first one of
+        // each block are hits
+        MegaNode* n = attrs->getNode("/fuse.bin");
+        ASSERT_TRUE(n != NULL);
+        ASSERT_EQ(h, n->getHandle());
+
+        long long numblocks = (content.size() + BlockCache::BLOCK_SIZE - 1) / BlockCache::BLOCK_SIZE;
+        long long numreads = (content.size() + 131071) / 131072;
+
+        ASSERT_NO_FATAL_FAILURE(readfile(blocks, n, content));
+        EXPECT_EQ(numblocks, blocks->getMisses());
+        EXPECT_EQ(numreads - numblocks, blocks->getHits());
+
+        ASSERT_NO_FATAL_FAILURE(readfile(blocks, n, content));
+        EXPECT_EQ(numblocks, blocks->getMisses());
+        EXPECT_EQ(2 * numreads - numblocks, blocks->getHits());
+
+        // the blocks of a changed node are downloaded again
+        blocks->invalidate(h);
+        ASSERT_NO_FATAL_FAILURE(readfile(blocks, n, content));
+        EXPECT_EQ(2 * numblocks, blocks->getMisses());
+
+        delete n;
+    }
+};
+
+/**
+ * @brief Login and fetchnodes of a large account
+ *
+ * The time to log in and to load, decrypt and index 100k nodes (1M with
+ * $MEGA_BENCHMARK_LARGE).
+ */
+TEST_F(PerfTest, FetchNodes)
+{
+    unsigned numnodes = largebenchmarks() ? 1000000 : 100000;
+    SynchronousRequestListener loginlistener, fetchlistener;
+    std::ostringstream metric;
+
+    server.populate(numnodes);
+
+    m_time_t start = Waiter::getmicros();
+    api->login(EMAIL, PASSWORD, &loginlistener);
+    ASSERT_EQ(0, loginlistener.trywait(TIMEOUT * 1000)) << "Login timed out";
+    ASSERT_EQ(MegaError::API_OK, loginlistener.getError()->getErrorCode());
+    report("login", seconds(start), "s");
+
+    start = Waiter::getmicros();
+    api->fetchNodes(&fetchlistener);
+    ASSERT_EQ(0, fetchlistener.trywait(TIMEOUT * 1000)) << "Fetchnodes timed out";
+    ASSERT_EQ(MegaError::API_OK, fetchlistener.getError()->getErrorCode());
+
+    metric << "fetchnodes_" << numnodes;
+    report(metric.str(), seconds(start), "s");
+
+    // plus the root, inbox and rubbish bin
+    EXPECT_EQ(numnodes + 3, (unsigned)api->getNumNodes());
+}
+
+/**
+ * @brief Bulk upload of small files
+ *
+ * 200 files of 4 KB (2000 with $MEGA_BENCHMARK_LARGE) started at once;
+ * measures files/s until the last one is attached to the account.
+ */
+TEST_F(PerfTest, SmallFileUploads)
+{
+    unsigned numfiles = largebenchmarks() ? 2000 : 200;
+    char name[32];
+
+    ASSERT_NO_FATAL_FAILURE(login());
+
+    for (unsigned i = 0; i < numfiles; i++)
+    {
+        sprintf(name, "/small%05u.bin", i);
+        writefile(dir + name, 4096, i);
+    }
+
+    MegaNode* root = api->getRootNode();
+    ASSERT_TRUE(root != NULL);
+
+    m_time_t start = Waiter::getmicros();
+
+    for (unsigned i = 0; i < numfiles; i++)
+    {
+        sprintf(name, "/small%05u.bin", i);
+        api->startUpload((dir + name).c_str(), root, &counter);
+    }
+
+    for (int i = 0; counter.count() < numfiles && i < TIMEOUT * 10; i++)
+    {
+        usleep(100000);
+    }
+
+    double elapsed = seconds(start);
+
+    delete root;
+
+    ASSERT_EQ(numfiles, counter.count()) << "Uploads timed out";
+    EXPECT_EQ(0u, counter.failed);
+    EXPECT_EQ(numfiles, server.numnodes(server.rootnode()));
+    EXPECT_EQ(0u, server.stats().badmac);
+
+    report("small_uploads", elapsed ? numfiles / elapsed : 0, "files/s");
+}
+
+/**
+ * @brief Upload and download throughput of a large file
+ *
+ * A 64 MB file (512 MB with $MEGA_BENCHMARK_LARGE) is uploaded, checked by
+ * the server against its MAC, downloaded again and compared.
+ */
+TEST_F(PerfTest, LargeFile)
+{
+    m_off_t size = (largebenchmarks() ? 512 : 64) << 20;
+    string src = dir + "/large.bin";
+    string dst = dir + "/large.down";
+
+    ASSERT_NO_FATAL_FAILURE(login());
+
+    writefile(src, size, 1);
+
+    MegaNode* root = api->getRootNode();
+    ASSERT_TRUE(root != NULL);
+
+    m_time_t start = Waiter::getmicros();
+    MegaHandle h = upload(src, root);
+    double elapsed = seconds(start);
+
+    delete root;
+
+    ASSERT_NE(UNDEF, h) << "Upload failed";
+    EXPECT_EQ(0u, server.stats().badmac);
+    report("upload", elapsed ? size / elapsed / 1048576 : 0, "MB/s");
+
+    MegaNode* n = api->getNodeByHandle(h);
+    ASSERT_TRUE(n != NULL);
+
+    SynchronousTransferListener listener;
+
+    start = Waiter::getmicros();
+    api->startDownload(n, dst.c_str(), &listener);
+    ASSERT_EQ(0, listener.trywait(TIMEOUT * 1000)) << "Download timed out";
+    elapsed = seconds(start);
+
+    delete n;
+
+    ASSERT_EQ(MegaError::API_OK, listener.getError()->getErrorCode());
+    EXPECT_TRUE(samefile(src, dst)) << "Downloaded file differs";
+    report("download", elapsed ? size / elapsed / 1048576 : 0, "MB/s");
+}
+
+/**
+ * @brief Attribute and data caches of the FUSE example
+ *
+ * Repeated lookups, listings and reads of a 3.5 MB file are answered from
+ * the caches of megafuse; a folder created after a failed lookup of its path
+ * and an invalidated block are fetched again.
+ */
+TEST_F(PerfTest, FuseCache)
+{
+    m_off_t size = 3 * BlockCache::BLOCK_SIZE + BlockCache::BLOCK_SIZE / 2;
+    string src = dir + "/fuse.bin";
+
+    ASSERT_NO_FATAL_FAILURE(login());
+
+    writefile(src, size, 2);
+
+    std::ifstream in(src.c_str(), std::ios::binary);
+    string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(size, (m_off_t)content.size());
+
+    MegaNode* root = api->getRootNode();
+    ASSERT_TRUE(root != NULL);
+    MegaHandle h = upload(src, root);
+    delete root;
+    ASSERT_NE(UNDEF, h) << "Upload failed";
+
+    BlockCache blocks(api);
+    AttrCache attrs(api, &blocks);
+    api->addGlobalListener(&attrs);
+
+    ASSERT_NO_FATAL_FAILURE(checkfusecache(&blocks, &attrs, h, content));
+
+    api->removeGlobalListener(&attrs);
+}
+
+/**
+ * @brief Read throughput of the FUSE example
+ *
+ * The jobs of megafuse --bench (sequential and random reads, cold and warm,
+ * with and without the block cache) over a 16 MB file (64 MB with
+ * $MEGA_BENCHMARK_LARGE).
+ */
+TEST_F(PerfTest, FuseBench)
+{
+    m_off_t size = (largebenchmarks() ? 64 : 16) << 20;
+    string src = dir + "/bench.bin";
+
+    ASSERT_NO_FATAL_FAILURE(login());
+
+    writefile(src, size, 3);
+
+    MegaNode* root = api->getRootNode();
+    ASSERT_TRUE(root != NULL);
+    MegaHandle h = upload(src, root);
+    delete root;
+    ASSERT_NE(UNDEF, h) << "Upload failed";
+
+    MegaNode* n = api->getNodeByHandle(h);
+    ASSERT_TRUE(n != NULL);
+
+    BlockCache blocks(api);
+    vector<BenchResult> results = runBenchmark(api, &blocks, n);
+
+    delete n;
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& result = results[i];
+        string metric = string("fuse_") + result.name;
+
+        std::replace(metric.begin(), metric.end(), ' ', '_');
+
+        EXPECT_FALSE(result.failed) << result.name << " failed";
+        report(metric, result.seconds ? result.bytes / result.seconds / 1048576 : 0, "MB/s");
+        report(metric, result.seconds ? result.ops / result.seconds : 0, "IOPS");
+    }
+}
+
+#ifdef ENABLE_SYNC
+/**
+ * @brief Initial sync of a synthetic local tree
+ *
+ * 10 folders of 50 small files (20 of 250 with $MEGA_BENCHMARK_LARGE) are
+ * synced into an empty remote folder; measures the time until all of them
+ * exist on the server.
+ */
+TEST_F(PerfTest, Sync)
+{
+    bool large = largebenchmarks();
+    unsigned numfolders = large ? 20 : 10;
+    unsigned numfiles = large ? 250 : 50;
+    string local = dir + "/sync";
+    char name[32];
+
+    ASSERT_NO_FATAL_FAILURE(login());
+
+    mkdir(local.c_str(), 0700);
+
+    for (unsigned i = 0; i < numfolders; i++)
+    {
+        sprintf(name, "/folder%u", i);
+        string folder = local + name;
+        mkdir(folder.c_str(), 0700);
+
+        for (unsigned j = 0; j < numfiles; j++)
+        {
+            sprintf(name, "/file%05u.txt", j);
+            writefile(folder + name, 1000 + j, i * numfiles + j);
+        }
+    }
+
+    MegaNode* root = api->getRootNode();
+    ASSERT_TRUE(root != NULL);
+
+    SynchronousRequestListener folderlistener;
+    api->createFolder("sync", root, &folderlistener);
+    ASSERT_EQ(0, folderlistener.trywait(TIMEOUT * 1000));
+    ASSERT_EQ(MegaError::API_OK, folderlistener.getError()->getErrorCode());
+    delete root;
+
+    MegaHandle h = folderlistener.getRequest()->getNodeHandle();
+    MegaNode* remote = api->getNodeByHandle(h);
+    ASSERT_TRUE(remote != NULL);
+
+    SynchronousRequestListener synclistener;
+    m_time_t start = Waiter::getmicros();
+
+    api->syncFolder(local.c_str(), remote, &synclistener);
+    ASSERT_EQ(0, synclistener.trywait(TIMEOUT * 1000));
+    ASSERT_EQ(MegaError::API_OK, synclistener.getError()->getErrorCode());
+    delete remote;
+
+    unsigned expected = numfolders * (numfiles + 1);
+
+    for (int i = 0; server.numnodes(h) < expected && i < TIMEOUT * 10; i++)
+    {
+        usleep(100000);
+    }
+
+    double elapsed = seconds(start);
+
+    ASSERT_EQ(expected, server.numnodes(h)) << "Sync timed out";
+    EXPECT_EQ(0u, server.stats().badmac);
+
+    std::ostringstream metric;
+    metric << "sync_" << numfolders * numfiles;
+    report(metric.str(), elapsed, "s");
+    report("sync_files", elapsed ? numfolders * numfiles / elapsed : 0, "files/s");
+}
+#endif
+
+/**
+ * @brief Enumeration of a local folder tree
+ *
+ * Compares the enumeration of 100k files (1M with $MEGA_BENCHMARK_LARGE)
+ * with the attributes obtained on the way against the previous approach of
+ * opening every record found by dnext().
+ */
+TEST(DirAccess, ScanBenchmark)
+{
+    unsigned numfiles = largebenchmarks() ? 1000000 : 100000;
+    LocalTree tree(numfiles);
+    ASSERT_EQ(numfiles, tree.numfiles);
+
+    FSACCESS_CLASS fsaccess;
+    m_time_t opentime = 0, entrytime = 0;
+
+    // the second round runs with a warm inode cache
+    for (int round = 0; round < 2; round++)
+    {
+        unsigned found = 0;
+        m_time_t start = Waiter::getmicros();
+
+        for (unsigned i = 0; i < tree.folders.size(); i++)
+        {
+            DirAccess* da = fsaccess.newdiraccess();
+            string path = tree.folders[i], name;
+            nodetype_t type;
+
+            if (da->dopen(&path, NULL, false))
+            {
+                while (da->dnext(&path, &name, false, &type))
+                {
+                    FileAccess* fa = fsaccess.newfileaccess();
+                    string localpath = path + "/" + name;
+
+                    found += fa->fopen(&localpath, false, false) && fa->fsidvalid;
+                    delete fa;
+                }
+            }
+            delete da;
+        }
+
+        opentime = Waiter::getmicros() - start;
+        ASSERT_EQ(numfiles, found);
+
+        found = 0;
+        start = Waiter::getmicros();
+
+        for (unsigned i = 0; i < tree.folders.size(); i++)
+        {
+            DirAccess* da = fsaccess.newdiraccess();
+            string path = tree.folders[i], name;
+            DirEntry entry;
+
+            if (da->dopen(&path, NULL, false))
+            {
+                while (da->dnextentry(&path, &name, false, &entry))
+                {
+                    found += entry.statvalid;
+                }
+            }
+            delete da;
+        }
+
+        entrytime = Waiter::getmicros() - start;
+        ASSERT_EQ(numfiles, found);
+    }
+
+    report("dnext_fopen", opentime * 1000.0 / numfiles, "ns/file");
+    report("dnextentry", entrytime * 1000.0 / numfiles, "ns/file");
+}
+
+// logs a typical line, returns the time spent by the caller in ns/line
+static double loglines(LogLevel level, int lines)
+{
+    m_time_t start = Waiter::getmicros();
+    for (int i = 0; i < lines; i++)
+    {
+        switch (level)
+        {
+            case logError:
+                LOG_err << "Request failed: " << i << " " << LOG_NODEHANDLE(i);
+                break;
+            case logWarning:
+                LOG_warn << "Request failed: " << i << " " << LOG_NODEHANDLE(i);
+                break;
+            case logInfo:
+                LOG_info << "Request finished: " << i << " " << LOG_NODEHANDLE(i);
+                break;
+            case logDebug:
+                LOG_debug << "Request finished: " << i << " " << LOG_NODEHANDLE(i);
+                break;
+            default:
+                LOG_verbose << "Request finished: " << i << " " << LOG_NODEHANDLE(i);
+                break;
+        }
+    }
+    m_time_t elapsed = Waiter::getmicros() - start;
+    return elapsed * 1000.0 / lines;
+}
+
+/**
+ * @brief Cost of a log line
+ *
+ * The time a thread spends per log line of each level (200k lines each), in
+ * synchronous and asynchronous mode.
+ */
+TEST_F(LoggingTest, Benchmark)
+{
+    const int lines = 200000;
+    LogLevel levels[] = { logError, logWarning, logInfo, logDebug, logMax };
+
+    for (unsigned i = 0; i < sizeof(levels) / sizeof(*levels); i++)
+    {
+        double syncns = loglines(levels[i], lines);
+        string level = SimpleLogger::toStr(levels[i]);
+        report("log_" + level + "_sync", syncns, "ns/line");
+
+        // large enough not to wait for the writer thread
+        if (!SimpleLogger::setAsyncMode(true, 67108864))
+        {
+            continue;
+        }
+
+        double asyncns = loglines(levels[i], lines);
+        SimpleLogger::flush();
+        SimpleLogger::setAsyncMode(false);
+
+        report("log_" + level + "_async", asyncns, "ns/line");
+    }
+
+    ASSERT_EQ(lines * 2LL * (sizeof(levels) / sizeof(*levels)), counter.lines);
+}
+
+// resident memory of the process in bytes, 0 if not available
+static size_t residentmemory()
+{
+    long size = 0, resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+
+    if (fp)
+    {
+        if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// builds a synthetic account of folders holding 1000 files each
+static void nodetree(unsigned numnodes)
+{
+    TestClient<>* testclient = new TestClient<>("perf_test");
+    MegaClient* client = testclient->client;
+    node_vector dp;
+    char key[FILENODEKEYLENGTH] = { 0 };
+    char name[32];
+    handle h = 1;
+
+    size_t before = residentmemory();
+    m_time_t start = Waiter::getmicros();
+
+    Node* root = new (client) Node(client, &dp, h++, UNDEF, ROOTNODE, -1, UNDEF, NULL, 0);
+    Node* folder = NULL;
+
+    for (unsigned i = 1; i < numnodes; i++)
+    {
+        if (!folder || folder->children.size() == 1000)
+        {
+            folder = new (client) Node(client, &dp, h++, root->nodehandle, FOLDERNODE, -1, 1, NULL, 1500000000);
+            sprintf(name, "Folder %u", i);
+            folder->attrs.map['n'] = name;
+            folder->nodekey.assign(key, FOLDERNODEKEYLENGTH);
+            continue;
+        }
+
+        Node* n = new (client) Node(client, &dp, h++, folder->nodehandle, FILENODE, i, 1, NULL, 1500000000);
+        sprintf(name, "IMG_%07u.jpg", i);
+        n->attrs.map['n'] = name;
+        n->nodekey.assign(key, FILENODEKEYLENGTH);
+    }
+
+    m_time_t elapsed = Waiter::getmicros() - start;
+    size_t after = residentmemory();
+
+    ASSERT_EQ(numnodes, client->nodes.size());
+    ASSERT_EQ(numnodes, client->nodearena.inuse);
+
+    std::ostringstream prefix;
+    prefix << "nodes_" << numnodes << "_";
+
+    report(prefix.str() + "create", elapsed * 1000.0 / numnodes, "ns/node");
+    report(prefix.str() + "sizeof", sizeof(Node), "bytes/node");
+    report(prefix.str() + "arena", client->nodearena.reserved / (double)numnodes, "bytes/node");
+
+    if (after)
+    {
+        report(prefix.str() + "resident", (after - before) / (double)numnodes, "bytes/node");
+    }
+
+    // deletes the node tree
+    delete testclient;
+}
+
+/**
+ * @brief Memory taken by the node tree
+ *
+ * Builds 1M synthetic nodes (10M with $MEGA_BENCHMARK_LARGE) in folders of
+ * 1000 files and reports the creation time and the bytes per node: the size
+ * of Node, the reserved arena and the growth of the resident set, which
+ * includes names, keys, attributes and the handle index.
+ */
+TEST(Node, MemoryFootprint)
+{
+    nodetree(1000000);
+
+    if (largebenchmarks())
+    {
+        nodetree(10000000);
+    }
+}
+#endif
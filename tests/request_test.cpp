@@ -0,0 +1,178 @@
+/**
+ * @file tests/request_test.cpp
+ * @brief Mega SDK test for API request pipelining against a mock API server
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega.h"
+#include "mock_server.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+
+#ifndef _WIN32
+using namespace mega;
+
+// API command answered by the mock server, records when and in which order
+// its result was processed
+class TestCommand : public Command
+{
+public:
+    int id;
+    vector<int>* results;
+    vector<m_time_t>* latencies;
+    m_time_t issued;
+
+    TestCommand(int cid, vector<int>* r, vector<m_time_t>* l, bool c, handle key)
+    {
+        cmd("echo");
+        arg("i", (m_off_t)cid);
+
+        id = cid;
+        results = r;
+        latencies = l;
+        issued = Waiter::getmicros();
+
+        concurrent = c;
+        orderkey = key;
+    }
+
+    void procresult()
+    {
+        // the server echoes the command's id
+        results->push_back(client->json.getint() == id ? id : -1);
+        latencies->push_back(Waiter::getmicros() - issued);
+    }
+};
+
+class RequestPipeliningTest : public ::testing::Test
+{
+protected:
+    TestClient<>* testclient;
+    MegaClient* client;
+    MockMegaServer server;
+    string savedurl;
+
+    vector<int> results;
+    vector<m_time_t> latencies;
+
+    static const int LATENCYMS = 300;
+
+    void SetUp()
+    {
+        server.latencyms = LATENCYMS;
+        ASSERT_TRUE(server.start());
+
+        savedurl = MegaClient::APIURL;
+        MegaClient::APIURL = server.apiurl();
+
+        testclient = new TestClient<>("request_test");
+        client = testclient->client;
+    }
+
+    void TearDown()
+    {
+        delete testclient;
+        server.stop();
+        MegaClient::APIURL = savedurl;
+    }
+
+    // issues one command per decisecond and waits for all results, returns
+    // the average latency of a command in ms
+    double run(int maxinflight, int numcmds, bool concurrent, bool samekey)
+    {
+        client->reqs.setmaxinflight(maxinflight);
+        results.clear();
+        latencies.clear();
+
+        int issued = 0;
+        dstime next = 0;
+        m_time_t deadline = Waiter::getmicros() + 60000000;
+
+        while ((int)results.size() < numcmds && Waiter::getmicros() < deadline)
+        {
+            Waiter::bumpds();
+
+            if (issued < numcmds && Waiter::ds >= next)
+            {
+                client->reqs.add(new TestCommand(issued, &results, &latencies,
+                                                 concurrent, samekey ? 1 : issued + 1));
+                issued++;
+                next = Waiter::ds + 1;
+            }
+
+            client->exec();
+
+            if (!client->preparewait())
+            {
+                if (testclient->waiter.maxds > 1)
+                {
+                    testclient->waiter.maxds = 1;
+                }
+                client->dowait();
+            }
+        }
+
+        double total = 0;
+        for (unsigned i = 0; i < latencies.size(); i++)
+        {
+            total += latencies[i] / 1000.0;
+        }
+
+        return latencies.size() ? total / latencies.size() : 0;
+    }
+
+    void checkorder(int numcmds)
+    {
+        ASSERT_EQ(numcmds, (int)results.size());
+        for (int i = 0; i < numcmds; i++)
+        {
+            ASSERT_EQ(i, results[i]);
+        }
+    }
+};
+
+TEST_F(RequestPipeliningTest, IndependentCommands)
+{
+    double serialms = run(1, 20, true, false);
+    checkorder(20);
+    ASSERT_EQ(1u, server.stats().maxinflight);
+
+    server.resetstats();
+
+    double pipelinedms = run(RequestDispatcher::MAXINFLIGHT, 20, true, false);
+    checkorder(20);
+    ASSERT_GT(server.stats().maxinflight, 1u);
+
+    TEST_RESULTS(LATENCYMS << " ms round trip, average command latency: "
+                 << serialms << " ms serialized, " << pipelinedms << " ms pipelined");
+}
+
+TEST_F(RequestPipeliningTest, SerialCommands)
+{
+    run(RequestDispatcher::MAXINFLIGHT, 10, false, false);
+    checkorder(10);
+    ASSERT_EQ(1u, server.stats().maxinflight);
+}
+
+TEST_F(RequestPipeliningTest, SameOrderKey)
+{
+    run(RequestDispatcher::MAXINFLIGHT, 10, true, true);
+    checkorder(10);
+    ASSERT_EQ(1u, server.stats().maxinflight);
+}
+#endif
@@ -20,6 +20,15 @@
  */
 
 #include "sdk_test.h"
+#include "test_utils.h"
+
+#if defined(HAVE_LIBUV) && !defined(_WIN32)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 void SdkTest::SetUp()
 {
@@ -1897,6 +1906,562 @@ TEST_F(SdkTest, SdkTestShares)
 
 }
 
+#if defined(HAVE_LIBUV) && !defined(_WIN32)
+
+// player of the local HTTP proxy server, requests random ranges of a file one
+// after another
+struct StreamingClient
+{
+    int port;
+    string path;
+    m_off_t filesize;
+    int numRequests;
+    unsigned int seed;
+    m_off_t bytes;
+    int errors;
+};
+
+static void *streamRanges(void *param)
+{
+    StreamingClient *client = (StreamingClient *)param;
+    char buf[16384];
+    ssize_t len;
+
+    for (int i = 0; i < client->numRequests; i++)
+    {
+        m_off_t start = rand_r(&client->seed) % client->filesize;
+        m_off_t end = start + rand_r(&client->seed) % 1048576;
+        if (end >= client->filesize)
+        {
+            end = client->filesize - 1;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(client->port);
+
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof addr))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            client->errors++;
+            continue;
+        }
+
+        std::ostringstream request;
+        request << "GET " << client->path << " HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                << "Range: bytes=" << start << "-" << end << "\r\n\r\n";
+        string data = request.str();
+        send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+
+        // the server closes the connection after the response
+        string response;
+        while ((len = recv(fd, buf, sizeof buf, 0)) > 0)
+        {
+            response.append(buf, len);
+        }
+        close(fd);
+
+        size_t headerend = response.find("\r\n\r\n");
+        if (response.compare(0, 12, "HTTP/1.1 206") || headerend == string::npos
+                || response.size() - headerend - 4 != (size_t)(end - start + 1))
+        {
+            client->errors++;
+            continue;
+        }
+        client->bytes += end - start + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief TEST_F SdkTestStreamingLoad
+ *
+ * Streams a file through the local HTTP proxy server to many concurrent clients
+ * requesting random ranges, with a single event loop and with several of them.
+ *
+ * - Upload a file
+ * - Start the HTTP server with one thread and stream the file to 32 clients
+ * - Start the HTTP server with the default threads and stream the file to 32 clients
+ */
+TEST_F(SdkTest, SdkTestStreamingLoad)
+{
+    megaApi[0]->log(MegaApi::LOG_LEVEL_INFO, "___TEST Streaming load___");
+
+    MegaNode *rootnode = megaApi[0]->getRootNode();
+    string filename1 = UPFILE;
+    createFile(filename1);
+
+    transferFlags[0][MegaTransfer::TYPE_UPLOAD] = false;
+    megaApi[0]->startUpload(filename1.data(), rootnode);
+    ASSERT_TRUE( waitForResponse(&transferFlags[0][MegaTransfer::TYPE_UPLOAD], 600) )
+            << "Upload transfer failed after " << 600 << " seconds";
+    ASSERT_EQ(MegaError::API_OK, lastError[0]) << "Cannot upload file (error: " << lastError[0] << ")";
+
+    MegaNode *n1 = megaApi[0]->getNodeByHandle(h);
+    ASSERT_TRUE(n1 != NULL) << "Cannot upload file";
+
+    const int numClients = 32;
+    const int numRequests = 8;
+    int numThreads[] = { 1, MegaHTTPServer::DEFAULT_NUM_THREADS };
+    std::ostringstream results;
+
+    for (int t = 0; t < 2; t++)
+    {
+        megaApi[0]->httpServerStop();
+        megaApi[0]->httpServerSetNumThreads(numThreads[t]);
+        ASSERT_TRUE(megaApi[0]->httpServerStart(true, 4443)) << "Cannot start the HTTP server";
+
+        char *link = megaApi[0]->httpServerGetLocalLink(n1);
+        ASSERT_TRUE(link != NULL) << "Cannot get the local link";
+        string path = link;
+        delete [] link;
+        path = path.substr(path.find('/', strlen("http://")));
+
+        StreamingClient clients[numClients];
+        pthread_t threads[numClients];
+        m_time_t start = Waiter::getmicros();
+
+        for (int i = 0; i < numClients; i++)
+        {
+            clients[i].port = 4443;
+            clients[i].path = path;
+            clients[i].filesize = n1->getSize();
+            clients[i].numRequests = numRequests;
+            clients[i].seed = i;
+            clients[i].bytes = 0;
+            clients[i].errors = 0;
+            ASSERT_EQ(0, pthread_create(&threads[i], NULL, streamRanges, &clients[i]));
+        }
+
+        m_off_t bytes = 0;
+        int errors = 0;
+        for (int i = 0; i < numClients; i++)
+        {
+            pthread_join(threads[i], NULL);
+            bytes += clients[i].bytes;
+            errors += clients[i].errors;
+        }
+        m_time_t elapsed = Waiter::getmicros() - start;
+
+        EXPECT_EQ(0, errors) << "Failed range requests with " << numThreads[t] << " threads";
+        results << (t ? ", " : "") << numThreads[t] << " threads "
+                << (elapsed ? bytes / (double)elapsed : 0) << " MB/s";
+    }
+
+    megaApi[0]->httpServerStop();
+    delete n1;
+    delete rootnode;
+
+    TEST_RESULTS(numClients << " clients x " << numRequests
+                 << " range requests: " << results.str());
+}
+
+// contents of the streamed file at offset
+static char streamedByte(handle h, m_off_t offset)
+{
+    return (char)(offset * 7 + h);
+}
+
+// fetches [offset, end) of the file through the cache, as a connection
+// downloading it does
+static void fetchRange(StreamingCache *cache, handle h, m_off_t offset, m_off_t end, MegaHTTPContext *fetcher)
+{
+    char chunk[16384];
+
+    cache->startFetch(h, offset, end, fetcher);
+    while (offset < end)
+    {
+        unsigned int len = (end - offset < (m_off_t)sizeof chunk) ? (unsigned int)(end - offset) : sizeof chunk;
+        for (unsigned int i = 0; i < len; i++)
+        {
+            chunk[i] = streamedByte(h, offset + i);
+        }
+        cache->write(fetcher, chunk, len);
+        offset += len;
+    }
+    cache->endFetch(fetcher);
+}
+
+// reads [offset, end) of the file from the cache and checks what it got,
+// returns the number of bytes that were cached
+static m_off_t readRange(StreamingCache *cache, handle h, m_off_t offset, m_off_t end, MegaHTTPContext *reader)
+{
+    StreamingBuffer buffer;
+    bool attached;
+
+    buffer.init(StreamingBuffer::MAX_BUFFER_SIZE);
+    unsigned int copied = cache->read(h, offset, end, &buffer, reader, &attached);
+    EXPECT_FALSE(attached);
+
+    m_off_t position = offset;
+    while (buffer.availableData())
+    {
+        uv_buf_t data = buffer.nextBuffer();
+        for (unsigned int i = 0; i < data.len; i++)
+        {
+            if (data.base[i] != streamedByte(h, position + i))
+            {
+                ADD_FAILURE() << "Wrong cached data at " << position + i;
+                return copied;
+            }
+        }
+        position += data.len;
+        buffer.freeData(data.len);
+    }
+    EXPECT_EQ(offset + copied, position);
+
+    return copied;
+}
+
+/**
+ * @brief TEST StreamingCache.HitRate
+ *
+ * Checks the bytes saved and the hit rate of the cache shared by the
+ * connections of the HTTP server for repeated range requests, and the
+ * eviction of the least recently used segments at capacity.
+ */
+TEST(StreamingCache, HitRate)
+{
+    const m_off_t segment = StreamingCache::SEGMENT_SIZE;
+    StreamingCache cache;
+    int contexts[3];
+    MegaHTTPContext *fetcher = (MegaHTTPContext *)&contexts[0];
+    MegaHTTPContext *reader = (MegaHTTPContext *)&contexts[1];
+    MegaHTTPContext *waiting = (MegaHTTPContext *)&contexts[2];
+    handle h1 = 1, h2 = 2;
+
+    cache.setMaxSize(4 * segment);
+    ASSERT_EQ(4 * segment, cache.getMaxSize());
+    ASSERT_EQ(0, cache.getBytesSaved());
+    ASSERT_EQ(0.0, cache.getHitRate());
+
+    // nothing is cached before the first download
+    ASSERT_EQ(0, readRange(&cache, h1, 0, segment, reader));
+    fetchRange(&cache, h1, 0, 2 * segment, fetcher);
+    ASSERT_EQ(0, cache.getBytesSaved());
+    ASSERT_EQ(0.0, cache.getHitRate());
+
+    // repeated range requests are served from the cache
+    ASSERT_EQ(2 * segment, readRange(&cache, h1, 0, 2 * segment, reader));
+    ASSERT_EQ(2 * segment, cache.getBytesSaved());
+    ASSERT_DOUBLE_EQ(0.5, cache.getHitRate());
+
+    ASSERT_EQ(2 * segment, readRange(&cache, h1, 0, 2 * segment, reader));
+    ASSERT_EQ(4 * segment, cache.getBytesSaved());
+    ASSERT_DOUBLE_EQ(4.0 / 6, cache.getHitRate());
+
+    // a range across segments, the first one is used last
+    ASSERT_EQ(segment, readRange(&cache, h1, segment / 2, segment + segment / 2, reader));
+    ASSERT_EQ(5 * segment, cache.getBytesSaved());
+
+    // the cached data stops where the download did, a connection waits for a
+    // download in progress instead of starting its own
+    ASSERT_EQ(segment, readRange(&cache, h1, segment, 3 * segment, reader));
+    ASSERT_EQ(6 * segment, cache.getBytesSaved());
+
+    StreamingBuffer buffer;
+    bool attached;
+    buffer.init(StreamingBuffer::MAX_BUFFER_SIZE);
+    cache.startFetch(h1, 2 * segment, 3 * segment, fetcher);
+    ASSERT_EQ(0u, cache.read(h1, 2 * segment, 3 * segment, &buffer, waiting, &attached));
+    ASSERT_TRUE(attached);
+    cache.detach(waiting);
+    cache.endFetch(fetcher);
+
+    // another file fills the cache, the least recently used segment of the
+    // first one is evicted
+    fetchRange(&cache, h2, 0, 3 * segment, fetcher);
+    ASSERT_EQ(0, readRange(&cache, h1, 0, segment, reader));
+    ASSERT_EQ(segment, readRange(&cache, h1, segment, 2 * segment, reader));
+    ASSERT_EQ(3 * segment, readRange(&cache, h2, 0, 3 * segment, reader));
+    ASSERT_EQ(10 * segment, cache.getBytesSaved());
+    ASSERT_DOUBLE_EQ(10.0 / 15, cache.getHitRate());
+
+    // a smaller cache keeps the most recently used segment only
+    cache.setMaxSize(segment);
+    ASSERT_EQ(0, readRange(&cache, h1, segment, 2 * segment, reader));
+    ASSERT_EQ(0, readRange(&cache, h2, 0, 2 * segment, reader));
+    ASSERT_EQ(segment, readRange(&cache, h2, 2 * segment, 3 * segment, reader));
+
+    TEST_RESULTS("bytes saved " << cache.getBytesSaved() << ", hit rate " << cache.getHitRate());
+}
+
+#endif
+
+// Records the callbacks of a global listener with the thread they come from.
+// The first one blocks until release(), so that the following callbacks
+// queue up behind it.
+class CallbackRecorder : public MegaListener
+{
+public:
+    struct Event
+    {
+        string name;
+        long long value;
+        uint64_t thread;
+    };
+
+    vector<Event> events;
+    volatile bool blocking;
+    volatile bool blocked;
+
+    CallbackRecorder()
+    {
+        mutex.init(false);
+        blocking = true;
+        blocked = false;
+    }
+
+    void release()
+    {
+        blocking = false;
+    }
+
+    size_t size()
+    {
+        mutex.lock();
+        size_t result = events.size();
+        mutex.unlock();
+        return result;
+    }
+
+    void onRequestStart(MegaApi*, MegaRequest* request)
+    {
+        record("start", request->getTag());
+    }
+
+    void onRequestFinish(MegaApi*, MegaRequest* request, MegaError*)
+    {
+        record("finish", request->getTag());
+    }
+
+    void onTransferUpdate(MegaApi*, MegaTransfer* transfer)
+    {
+        record(transfer->getTag() == 1 ? "update1" : "update2", transfer->getTransferredBytes());
+    }
+
+private:
+    MegaMutex mutex;
+
+    void record(const char* name, long long value)
+    {
+        Event event = { name, value, MegaThread::currentThreadId() };
+
+        mutex.lock();
+        events.push_back(event);
+        bool first = events.size() == 1;
+        mutex.unlock();
+
+        while (first && blocking)
+        {
+            blocked = true;
+            usleep(1000);
+        }
+    }
+};
+
+// polls the condition for up to 10 seconds
+#define WAIT_UNTIL(condition) \
+    for (int waited = 0; !(condition) && waited < 10000; waited++) usleep(1000)
+
+// MegaApiImpl without a session, whose requests that change the proxy
+// settings complete locally (one onRequestStart and one onRequestFinish each)
+class SdkCallbacksTest : public ::testing::Test
+{
+protected:
+    MegaApiImpl* api;
+    CallbackRecorder recorder;
+
+    void SetUp()
+    {
+        char path[1024];
+        ASSERT_TRUE(getcwd(path, sizeof path) != NULL);
+        api = new MegaApiImpl(NULL, APP_KEY.c_str(), path, USER_AGENT.c_str());
+        api->addListener(&recorder);
+    }
+
+    void TearDown()
+    {
+        recorder.release();
+        api->removeListener(&recorder);
+        delete api;
+    }
+
+    void localrequests(int num)
+    {
+        MegaProxy proxy;
+        proxy.setProxyType(MegaProxy::PROXY_NONE);
+
+        for (int i = 0; i < num; i++)
+        {
+            api->setProxySettings(&proxy);
+        }
+    }
+};
+
+// The callbacks queued before asynchronous delivery is disabled, and those
+// generated until the queue is empty, keep their order; later ones are
+// delivered from the SDK thread
+TEST_F(SdkCallbacksTest, DisableKeepsOrder)
+{
+    api->setAsyncCallbacks(true, 1000);
+
+    localrequests(5);
+    WAIT_UNTIL(recorder.blocked && api->getPendingCallbacks() == 10);
+    ASSERT_EQ(10, api->getPendingCallbacks());
+
+    api->setAsyncCallbacks(false, 1000);
+
+    // the first request is still being delivered, these are queued too
+    localrequests(5);
+    WAIT_UNTIL(api->getPendingCallbacks() == 20);
+    ASSERT_EQ(20, api->getPendingCallbacks());
+    ASSERT_EQ(1u, recorder.size());
+
+    recorder.release();
+    WAIT_UNTIL(recorder.size() == 20 && !api->getPendingCallbacks());
+    ASSERT_EQ(20u, recorder.size());
+
+    localrequests(5);
+    WAIT_UNTIL(recorder.size() == 30);
+    ASSERT_EQ(30u, recorder.size());
+    ASSERT_EQ(0, api->getPendingCallbacks());
+    ASSERT_EQ(20, api->getPeakPendingCallbacks());
+
+    // start and finish of each request, in the order of the requests
+    for (size_t i = 0; i < recorder.events.size(); i += 2)
+    {
+        ASSERT_EQ("start", recorder.events[i].name);
+        ASSERT_EQ("finish", recorder.events[i + 1].name);
+        ASSERT_EQ(recorder.events[i].value, recorder.events[i + 1].value);
+        ASSERT_TRUE(!i || recorder.events[i - 1].value < recorder.events[i].value);
+    }
+
+    // the callback thread delivered the first 20, the SDK thread the rest
+    for (size_t i = 0; i < recorder.events.size(); i++)
+    {
+        ASSERT_EQ(i < 20, recorder.events[i].thread == recorder.events[0].thread);
+    }
+}
+
+// Queued updates of a transfer are replaced by the latest one
+TEST_F(SdkCallbacksTest, Coalescing)
+{
+    api->setAsyncCallbacks(true, 1000);
+
+    localrequests(1);
+    WAIT_UNTIL(recorder.blocked);
+    ASSERT_TRUE(recorder.blocked);
+
+    MegaTransferPrivate transfer1(MegaTransfer::TYPE_DOWNLOAD);
+    MegaTransferPrivate transfer2(MegaTransfer::TYPE_DOWNLOAD);
+    transfer1.setTag(1);
+    transfer2.setTag(2);
+
+    for (int i = 1; i <= 10; i++)
+    {
+        transfer1.setTransferredBytes(i * 1000);
+        api->fireOnTransferUpdate(&transfer1);
+
+        if (i <= 5)
+        {
+            transfer2.setTransferredBytes(i);
+            api->fireOnTransferUpdate(&transfer2);
+        }
+    }
+
+    // start (being delivered) + finish + one update per transfer
+    ASSERT_EQ(4, api->getPendingCallbacks());
+    ASSERT_EQ(4, api->getPeakPendingCallbacks());
+    ASSERT_EQ(9 + 4, api->getCoalescedCallbacks());
+
+    recorder.release();
+    WAIT_UNTIL(recorder.size() == 4 && !api->getPendingCallbacks());
+    ASSERT_EQ(4u, recorder.size());
+    ASSERT_EQ(0, api->getPendingCallbacks());
+
+    ASSERT_EQ("update1", recorder.events[2].name);
+    ASSERT_EQ(10000, recorder.events[2].value);
+    ASSERT_EQ("update2", recorder.events[3].name);
+    ASSERT_EQ(5, recorder.events[3].value);
+}
+
+// Once maxPendingCallbacks callbacks are waiting, the SDK thread waits for the
+// callback thread (for up to a second) before processing more requests
+TEST_F(SdkCallbacksTest, MaxPendingCallbacks)
+{
+    api->setAsyncCallbacks(true, 4);
+
+    localrequests(2);
+    WAIT_UNTIL(recorder.blocked && api->getPendingCallbacks() == 4);
+    ASSERT_EQ(4, api->getPendingCallbacks());
+
+    localrequests(2);
+    usleep(300000);
+    ASSERT_EQ(4, api->getPendingCallbacks());
+    ASSERT_EQ(4, api->getPeakPendingCallbacks());
+
+    // the SDK thread goes on when the queue is half empty
+    recorder.release();
+    WAIT_UNTIL(recorder.size() == 8 && !api->getPendingCallbacks());
+    ASSERT_EQ(8u, recorder.size());
+    ASSERT_EQ(0, api->getPendingCallbacks());
+}
+
+// Checks that MegaApi::getCurrentRequest() and MegaApi::getCurrentError()
+// return the parameters of the callback being delivered
+class CurrentRequestChecker : public MegaRequestListener
+{
+public:
+    MegaApiImpl* api;
+    volatile int checked;
+    volatile int failed;
+
+    CurrentRequestChecker(MegaApiImpl* api) : api(api), checked(0), failed(0) { }
+
+    void onRequestStart(MegaApi*, MegaRequest* request)
+    {
+        check(api->getCurrentRequest() == request && !api->getCurrentError());
+    }
+
+    void onRequestFinish(MegaApi*, MegaRequest* request, MegaError* e)
+    {
+        check(api->getCurrentRequest() == request && api->getCurrentError() == e);
+    }
+
+private:
+    void check(bool ok)
+    {
+        failed += !ok;
+        checked++;
+    }
+};
+
+// The current request and error are those of the callback, also on the
+// callback thread
+TEST_F(SdkCallbacksTest, CurrentRequest)
+{
+    CurrentRequestChecker checker(api);
+    recorder.release();
+    api->addRequestListener(&checker);
+    api->setAsyncCallbacks(true, 1000);
+
+    localrequests(5);
+    WAIT_UNTIL(checker.checked == 10);
+    ASSERT_EQ(10, checker.checked);
+    ASSERT_EQ(0, checker.failed);
+    ASSERT_TRUE(!api->getCurrentRequest() && !api->getCurrentError());
+
+    api->removeRequestListener(&checker);
+}
+
 #ifdef ENABLE_CHAT
 
 /**
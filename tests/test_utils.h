@@ -0,0 +1,317 @@
+/**
+ * @file tests/test_utils.h
+ * @brief Helpers shared by the unit tests and benchmarks
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_TEST_UTILS_H
+#define MEGA_TEST_UTILS_H 1
+
+#include "mega.h"
+#include "gtest/gtest.h"
+
+#include <iostream>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// benchmark figures and skipped parts of a test, next to gtest's own output
+#define TEST_RESULTS(text) (std::cout << "[ RESULTS  ] " << text << std::endl)
+#define TEST_SKIPPED(text) (std::cout << "[ SKIPPED  ] " << text << std::endl)
+
+// full-size benchmarks only run with $MEGA_BENCHMARK_LARGE set
+inline bool largebenchmarks()
+{
+    return getenv("MEGA_BENCHMARK_LARGE") != NULL;
+}
+
+// HttpIO that doesn't send anything, it only collects the receive
+// statistics of HttpReq::put()
+struct CountingHttpIO : public mega::HttpIO
+{
+    void post(mega::HttpReq*, const char*, unsigned) { }
+    void cancel(mega::HttpReq*) { }
+    m_off_t postpos(void*) { return 0; }
+    bool doio() { return false; }
+    void addevents(mega::Waiter*, int) { }
+    void setuseragent(std::string*) { }
+};
+
+// DbTable that keeps the records in memory and counts writes and transactions
+struct CountingDbTable : public mega::DbTable
+{
+    std::map<uint32_t, std::string> records;
+    std::map<uint32_t, std::string>::iterator cursor;
+    int puts, dels, begins, commits;
+
+    using mega::DbTable::next;
+    using mega::DbTable::put;
+
+    CountingDbTable()
+    {
+        puts = dels = begins = commits = 0;
+        cursor = records.end();
+    }
+
+    void rewind()
+    {
+        cursor = records.begin();
+    }
+
+    bool next(uint32_t* id, std::string* data)
+    {
+        if (cursor == records.end())
+        {
+            return false;
+        }
+
+        *id = cursor->first;
+        *data = cursor++->second;
+        return true;
+    }
+
+    bool get(uint32_t id, std::string* data)
+    {
+        std::map<uint32_t, std::string>::iterator it = records.find(id);
+
+        if (it == records.end())
+        {
+            return false;
+        }
+
+        *data = it->second;
+        return true;
+    }
+
+    bool put(uint32_t id, char* data, unsigned len)
+    {
+        puts++;
+        records[id].assign(data, len);
+        return true;
+    }
+
+    bool del(uint32_t id)
+    {
+        dels++;
+        records.erase(id);
+        return true;
+    }
+
+    void truncate() { records.clear(); }
+    void begin() { begins++; }
+    void commit() { commits++; }
+    void abort() { }
+    void remove() { }
+};
+
+// discards everything written to it
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c)
+    {
+        return c;
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize n)
+    {
+        return n;
+    }
+};
+
+// counts the lines it receives
+class CountingLogger : public mega::Logger
+{
+public:
+    long long lines;
+
+    CountingLogger()
+    {
+        lines = 0;
+    }
+
+    void log(const char*, int, const char*, const char*)
+    {
+        lines++;
+    }
+};
+
+// replaces the global logging configuration during a test
+class LoggingTest : public ::testing::Test
+{
+protected:
+    NullBuffer nullbuffer;
+    std::ostream *nullstream;
+    CountingLogger counter;
+
+    mega::OutputMap savedOutputs;
+    mega::OutputSettingsMap savedSettings;
+    mega::Logger *savedLogger;
+    mega::LogLevel savedLevel;
+
+    void SetUp()
+    {
+        savedOutputs = mega::SimpleLogger::outputs;
+        savedSettings = mega::SimpleLogger::outputSettings;
+        savedLogger = mega::SimpleLogger::logger;
+        savedLevel = mega::SimpleLogger::logCurrentLevel;
+
+        nullstream = new std::ostream(&nullbuffer);
+        mega::SimpleLogger::outputs = mega::OutputMap();
+        mega::SimpleLogger::setAllOutputs(nullstream);
+        mega::SimpleLogger::setOutputClass(&counter);
+        mega::SimpleLogger::setLogLevel(mega::logMax);
+        for (int i = mega::logFatal; i <= mega::logMax; i++)
+        {
+            mega::SimpleLogger::setOutputSettings(static_cast<mega::LogLevel>(i), true, true, true);
+        }
+    }
+
+    void TearDown()
+    {
+        mega::SimpleLogger::setAsyncMode(false);
+
+        mega::SimpleLogger::outputs = savedOutputs;
+        mega::SimpleLogger::outputSettings = savedSettings;
+        mega::SimpleLogger::logger = savedLogger;
+        mega::SimpleLogger::logCurrentLevel = savedLevel;
+        delete nullstream;
+    }
+};
+
+#ifndef _WIN32
+// synthetic local tree of folders holding 1000 files each, in a temporary
+// folder that is removed again by the destructor (files of the given size
+// are sparse)
+class LocalTree
+{
+public:
+    std::string root;
+    std::vector<std::string> folders;
+    unsigned numfiles;
+
+    LocalTree(unsigned files, off_t filesize = -1)
+    {
+        char path[] = "/tmp/megafstestXXXXXX";
+        numfiles = 0;
+
+        if (!mkdtemp(path))
+        {
+            return;
+        }
+
+        root = path;
+
+        char name[32];
+        std::string folder;
+
+        for (unsigned i = 0; i < files; i++)
+        {
+            if (!(i % 1000))
+            {
+                sprintf(name, "/folder%u", i / 1000);
+                folder = root + name;
+                mkdir(folder.c_str(), 0700);
+                folders.push_back(folder);
+            }
+
+            sprintf(name, "/IMG_%07u.jpg", i);
+            FILE* fp = fopen((folder + name).c_str(), "w");
+            if (fp)
+            {
+                if (filesize < 0)
+                {
+                    fwrite(name, 1, i % 16, fp);
+                }
+                else if (ftruncate(fileno(fp), filesize))
+                {
+                    fclose(fp);
+                    continue;
+                }
+                fclose(fp);
+                numfiles++;
+            }
+        }
+    }
+
+    ~LocalTree()
+    {
+        for (unsigned i = 0; i < folders.size(); i++)
+        {
+            clear(folders[i]);
+        }
+
+        clear(root);
+    }
+
+    static void clear(const std::string& folder)
+    {
+        DIR* dp = opendir(folder.c_str());
+        dirent* d;
+
+        if (dp)
+        {
+            while ((d = readdir(dp)))
+            {
+                if (strcmp(d->d_name, ".") && strcmp(d->d_name, ".."))
+                {
+                    unlink((folder + "/" + d->d_name).c_str());
+                }
+            }
+            closedir(dp);
+        }
+
+        rmdir(folder.c_str());
+    }
+};
+#endif
+
+#if defined(WAIT_CLASS) && defined(FSACCESS_CLASS)
+// MegaClient that isn't logged in, with the platform's waiter and file
+// system access, for tests of the client's local data structures
+template<class HttpIOClass = mega::HTTPIO_CLASS>
+class TestClient
+{
+public:
+    mega::MegaApp app;
+    mega::WAIT_CLASS waiter;
+    HttpIOClass httpio;
+    mega::FSACCESS_CLASS fsaccess;
+    mega::MegaClient* client;
+
+    TestClient(const char* clientname = "test")
+    {
+        client = new mega::MegaClient(&app, &waiter, &httpio, &fsaccess, NULL, NULL, "appkey", clientname);
+    }
+
+    ~TestClient()
+    {
+        delete client;
+    }
+
+    mega::MegaClient* operator->()
+    {
+        return client;
+    }
+};
+#endif
+
+#endif
@@ -49,6 +49,91 @@ TEST(Serialize64, serialize)
     ASSERT_EQ(in, out);
 }
 
+// Repeated notifications of a queued item are coalesced
+TEST(DirNotify, coalesce)
+{
+    string base("base"), ignore("ignore");
+    DirNotify notify(&base, &ignore);
+    LocalNode* a = (LocalNode*)&base;
+    LocalNode* b = (LocalNode*)&ignore;
+    uint64_t coalesced = Metrics::get(Metrics::FS_NOTIFICATIONS_COALESCED);
+
+    notify.notify(DirNotify::DIREVENTS, a, "x", 1);
+    notify.notify(DirNotify::DIREVENTS, a, "y", 1);
+    notify.notify(DirNotify::DIREVENTS, b, "x", 1);
+    notify.notify(DirNotify::DIREVENTS, a, "x", 1);
+    notify.notify(DirNotify::DIREVENTS, a, "y", 1);
+    ASSERT_EQ(3u, notify.notifyq[DirNotify::DIREVENTS].size());
+    ASSERT_EQ(2u, Metrics::get(Metrics::FS_NOTIFICATIONS_COALESCED) - coalesced);
+    ASSERT_EQ(5, notify.notifications);
+    ASSERT_EQ(2, notify.coalescednotifications);
+
+    // immediate notifications are always queued
+    notify.notify(DirNotify::DIREVENTS, a, "x", 1, true);
+    ASSERT_EQ(4u, notify.notifyq[DirNotify::DIREVENTS].size());
+
+    notify.popnotification(DirNotify::DIREVENTS);
+    notify.notify(DirNotify::DIREVENTS, a, "x", 1);
+    ASSERT_EQ(3u, notify.notifyq[DirNotify::DIREVENTS].size());
+
+    // records of a deleted LocalNode are deactivated and no longer coalesce
+    notify.cancelnotifications(a);
+    ASSERT_EQ((LocalNode*)~0, notify.notifyq[DirNotify::DIREVENTS].front().localnode);
+    ASSERT_EQ(b, notify.notifyq[DirNotify::DIREVENTS][1].localnode);
+    notify.notify(DirNotify::DIREVENTS, a, "y", 1);
+    ASSERT_EQ(4u, notify.notifyq[DirNotify::DIREVENTS].size());
+
+    while (notify.notifyq[DirNotify::DIREVENTS].size())
+    {
+        notify.popnotification(DirNotify::DIREVENTS);
+    }
+    ASSERT_TRUE(notify.pendingnotifications[DirNotify::DIREVENTS].empty());
+}
+
+// A coalesced notification delays its queued record, and the record being
+// processed doesn't take new ones
+TEST(DirNotify, requeue)
+{
+    string base("base"), ignore("ignore");
+    DirNotify notify(&base, &ignore);
+    LocalNode* a = (LocalNode*)&base;
+    dstime savedds = Waiter::ds;
+
+    Waiter::ds = 100;
+    notify.notify(DirNotify::DIREVENTS, a, "x", 1);
+    notify.notify(DirNotify::DIREVENTS, a, "y", 1);
+    Waiter::ds = 110;
+    notify.notify(DirNotify::DIREVENTS, a, "x", 1);
+    ASSERT_EQ(2u, notify.notifyq[DirNotify::DIREVENTS].size());
+    ASSERT_EQ(110u, notify.notifyq[DirNotify::DIREVENTS].front().timestamp);
+
+    // a retry queued while its record is checked is kept
+    notify.notify(DirNotify::RETRY, a, "z", 1);
+    notify.processnotification(DirNotify::RETRY);
+    notify.notify(DirNotify::RETRY, a, "z", 1);
+    notify.popnotification(DirNotify::RETRY);
+    ASSERT_EQ(1u, notify.notifyq[DirNotify::RETRY].size());
+    ASSERT_EQ(1u, notify.pendingnotifications[DirNotify::RETRY].size());
+
+    // a change seen while the first record is checked is queued again
+    notify.processnotification(DirNotify::DIREVENTS);
+    notify.notify(DirNotify::DIREVENTS, a, "x", 1);
+    notify.notify(DirNotify::DIREVENTS, a, "y", 1);
+    ASSERT_EQ(3u, notify.notifyq[DirNotify::DIREVENTS].size());
+    notify.popnotification(DirNotify::DIREVENTS);
+    ASSERT_EQ("y", notify.notifyq[DirNotify::DIREVENTS].front().path);
+    ASSERT_EQ("x", notify.notifyq[DirNotify::DIREVENTS].back().path);
+
+    // coalescing still finds the records after the queue moved on
+    Waiter::ds = 120;
+    notify.notify(DirNotify::DIREVENTS, a, "y", 1);
+    ASSERT_EQ(2u, notify.notifyq[DirNotify::DIREVENTS].size());
+    ASSERT_EQ(120u, notify.notifyq[DirNotify::DIREVENTS].front().timestamp);
+    ASSERT_EQ(110u, notify.notifyq[DirNotify::DIREVENTS].back().timestamp);
+
+    Waiter::ds = savedds;
+}
+
 int main (int argc, char *argv[])
 {
     InitGoogleTest(&argc, argv);
@@ -0,0 +1,1058 @@
+/**
+ * @file tests/transfer_test.cpp
+ * @brief Mega SDK test for the transfer engine internals
+ *
+ * (c) 2016 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+#include "mock_server.h"
+
+using namespace mega;
+
+// Simulates the chunk requests of a multi-GB download (sized by
+// TransferSlot::downloadrequestend(), as in TransferSlot::doio()) and reports
+// peak and steady memory of the buffer pool
+TEST(Transfer, BufferPoolDownload)
+{
+    const m_off_t filesize = 4294967296LL + 12345;  // 4 GB + some bytes
+    const int connections = 4;
+    const m_off_t maxDownloadRequestSize = TransferSlot::MAX_DOWNLOAD_REQ_SIZE;
+
+    TransferBufferPool pool;
+    chunkmac_map chunkmacs;
+    HttpReqXfer* reqs[connections] = { };
+    m_off_t pos = 0;
+    m_off_t steady = 0;
+    long long requests = 0;
+    int i = 0;
+
+    while (pos < filesize)
+    {
+        m_off_t npos = TransferSlot::downloadrequestend(pos, ChunkedHash::chunkceil(pos, filesize), filesize,
+                                                        filesize - pos, connections, maxDownloadRequestSize, &chunkmacs);
+
+        // a connection finishes its chunk and the slot gets reset from time
+        // to time (pause/resume, retries)
+        if (!reqs[i] || !(requests % 64))
+        {
+            pool.freereq(reqs[i]);
+            reqs[i] = pool.allocreq(GET);
+        }
+
+        reqs[i]->prepare("http://127.0.0.1/dl", NULL, NULL, 0, pos, npos);
+        ASSERT_NE(reqs[i]->buf, (byte*)NULL);
+        ASSERT_EQ(reqs[i]->buflen, npos - pos);
+        ASSERT_GE(((HttpReqDL*)reqs[i])->bufcapacity, (npos - pos + SymmCipher::BLOCKSIZE - 1) & -SymmCipher::BLOCKSIZE);
+
+        pos = npos;
+        requests++;
+        i = (i + 1) % connections;
+
+        if (requests == 1000)
+        {
+            steady = pool.bytesinuse + pool.bytescached;
+        }
+    }
+
+    for (i = connections; i--; )
+    {
+        pool.freereq(reqs[i]);
+    }
+
+    TEST_RESULTS(requests << " chunk requests");
+    TEST_RESULTS("buffer allocations: " << pool.bufallocs << "   reuses: " << pool.bufreuses);
+    TEST_RESULTS("request allocations: " << pool.reqallocs << "   reuses: " << pool.reqreuses);
+    TEST_RESULTS("peak memory: " << pool.peakbytes << "   steady memory: " << steady
+                 << "   idle after transfer: " << pool.bytescached);
+
+    ASSERT_EQ(pool.bytesinuse, 0);
+    ASSERT_LE(pool.bytescached, pool.maxcachedbytes);
+    ASSERT_LT(pool.bufallocs, requests / 10);
+    ASSERT_LE(pool.reqallocs, (long long)connections);
+
+    pool.clear();
+    ASSERT_EQ(pool.bytescached, 0);
+}
+
+// Download requests span whole chunks, up to a size that shrinks with the
+// bytes left, and stop before chunks that were already downloaded
+TEST(Transfer, DownloadRequestSize)
+{
+    const m_off_t size = 64 << 20;
+    chunkmac_map chunkmacs;
+
+    // 64 MB left on 4 connections: requests of 7 MB and a chunk
+    m_off_t end = TransferSlot::downloadrequestend(0, ChunkedHash::chunkceil(0, size), size, size, 4, 16 << 20, &chunkmacs);
+    ASSERT_GT(end, 7 << 20);
+    ASSERT_LE(end, 8 << 20);
+    ASSERT_EQ(end, ChunkedHash::chunkfloor(end));
+
+    // the download limit of the slot
+    end = TransferSlot::downloadrequestend(0, ChunkedHash::chunkceil(0, size), size, size, 1, 2 << 20, &chunkmacs);
+    ASSERT_GT(end, 1 << 20);
+    ASSERT_LE(end, 2 << 20);
+
+    // the last bytes are requested a chunk at a time
+    m_off_t pos = ChunkedHash::chunkfloor(size - 1);
+    ASSERT_EQ(size, TransferSlot::downloadrequestend(pos, size, size, size - pos, 4, 16 << 20, &chunkmacs));
+    pos = ChunkedHash::chunkfloor(pos - 1);
+    ASSERT_EQ(ChunkedHash::chunkceil(pos, size), TransferSlot::downloadrequestend(pos, ChunkedHash::chunkceil(pos, size), size, 1 << 20, 4, 16 << 20, &chunkmacs));
+
+    // a finished chunk ends the request
+    m_off_t done = ChunkedHash::chunkceil(ChunkedHash::chunkceil(0, size), size);
+    chunkmacs[done].finished = true;
+    ASSERT_EQ(done, TransferSlot::downloadrequestend(0, ChunkedHash::chunkceil(0, size), size, size, 4, 16 << 20, &chunkmacs));
+}
+
+// Feeds a chunk download and a streamed API response through the receive
+// path in cURL-sized pieces and reports the bytes copied per received byte
+TEST(Transfer, ReceiveCopies)
+{
+    const unsigned piece = 16384;
+    byte data[piece];
+    memset(data, 'x', sizeof data);
+
+    TransferBufferPool pool;
+    CountingHttpIO httpio;
+
+    // chunk download: landing copy into the pool buffer only
+    HttpReqDL* dl = (HttpReqDL*)pool.allocreq(GET);
+    dl->prepare("http://127.0.0.1/dl", NULL, NULL, 0, 0, 8 * 1048576);
+    ASSERT_EQ((intptr_t)dl->buf % TransferBufferPool::ALIGNMENT, 0);
+    dl->httpio = &httpio;
+    while (dl->bufpos < dl->size)
+    {
+        dl->put(data, piece, true);
+    }
+    dl->httpio = NULL;
+
+    double dlratio = (double)httpio.copiedbytes / httpio.receivedbytes;
+    ASSERT_EQ(httpio.receivedbytes, dl->size);
+    ASSERT_EQ(httpio.copiedbytes, httpio.receivedbytes);
+    pool.freereq(dl);
+
+    // streamed API response: the parser consumes most of what has arrived
+    httpio.receivedbytes = 0;
+    httpio.copiedbytes = 0;
+    HttpReq api;
+    api.httpio = &httpio;
+    for (int i = 0; i < 512; i++)
+    {
+        api.put(data, piece, true);
+        api.purge(api.size() - api.size() / 8);
+    }
+    api.httpio = NULL;
+
+    double apiratio = (double)httpio.copiedbytes / httpio.receivedbytes;
+
+    TEST_RESULTS("copied bytes per received byte - download: " << dlratio << "   API: " << apiratio);
+
+    ASSERT_LT(apiratio, 2.5);
+    pool.clear();
+}
+
+#ifdef FSACCESS_CLASS
+// TransferSlot with the download pipeline accessible
+class ChunkPipelineSlot : public TransferSlot
+{
+public:
+    ChunkPipelineSlot(Transfer* transfer) : TransferSlot(transfer) { }
+
+    using TransferSlot::queuechunk;
+    using TransferSlot::processchunks;
+};
+
+// Downloads the first 16.5 MB of a 20 MB file (large enough for the
+// decryption thread) through the chunk pipeline with every other pair of
+// requests finishing out of order, and compares the chunk MACs, the meta MAC,
+// the written data and the progress with a single-threaded decryption of the
+// requests in file order
+static void chunkpipeline(bool orderedwrites)
+{
+    const m_off_t filesize = TransferSlot::MIN_THREADED_DECRYPT_SIZE + 4194304;
+    const uint64_t ctriv = 0x0123456789abcdefULL;
+    TestClient<CountingHttpIO> testclient;
+    MegaClient* client = testclient.client;
+    byte key[SymmCipher::KEYLENGTH];
+    string path = "chunk_pipeline.bin";
+
+    for (int i = 0; i < SymmCipher::KEYLENGTH; i++)
+    {
+        key[i] = (byte)(i * 7 + 1);
+    }
+
+    client->orderdownloadedchunks = orderedwrites;
+
+    // chunk-aligned requests of about 2 MB, as TransferSlot::doio() sizes them
+    vector<m_off_t> bounds(1, 0);
+    while (bounds.back() < TransferSlot::MIN_THREADED_DECRYPT_SIZE)
+    {
+        m_off_t npos = ChunkedHash::chunkceil(bounds.back(), filesize);
+        while (npos < filesize && npos - bounds.back() < 2097152)
+        {
+            npos = ChunkedHash::chunkceil(npos, filesize);
+        }
+        bounds.push_back(npos);
+    }
+
+    m_off_t dlsize = bounds.back();
+    int numreqs = (int)bounds.size() - 1;
+    string data((size_t)dlsize, '\0');
+
+    srand(1);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (char)rand();
+    }
+
+    // single-threaded reference
+    SymmCipher cipher;
+    cipher.setkey(key);
+    chunkmac_map refmacs;
+    string plain;
+    vector<m_off_t> refprogress;
+    HttpReqDL ref;
+
+    for (int i = 0; i < numreqs; i++)
+    {
+        m_off_t size = bounds[i + 1] - bounds[i];
+        ref.prepare("http://127.0.0.1/dl", NULL, NULL, 0, bounds[i], bounds[i + 1]);
+        memcpy(ref.buf, data.data() + bounds[i], (size_t)size);
+        ref.bufpos = size;
+        ref.finalize(&cipher, &refmacs, ctriv, filesize);
+
+        for (chunkmac_map::iterator it = ref.chunkmacs.begin(); it != ref.chunkmacs.end(); it++)
+        {
+            refmacs[it->first] = it->second;
+        }
+        ref.chunkmacs.clear();
+
+        plain.append((char*)ref.buf, (size_t)size);
+        refprogress.push_back(bounds[i + 1]);
+    }
+
+    // pipeline, requests queued in pairs, the second one first
+    Transfer* transfer = new Transfer(client, GET);
+    transfer->size = filesize;
+    transfer->key.setkey(key);
+    transfer->ctriv = ctriv;
+    transfer->localfilename = path;
+
+    ChunkPipelineSlot* slot = new ChunkPipelineSlot(transfer);
+    ASSERT_TRUE(slot->fa->fopen(&path, false, true));
+
+    vector<m_off_t> progress;
+    dstime backoff = 0;
+    m_time_t deadline = Waiter::getmicros() + 60000000;
+
+    for (int i = 0; i < numreqs; i += 2)
+    {
+        for (int j = (i + 1 < numreqs) ? i + 1 : i; j >= i; j--)
+        {
+            HttpReqDL* req = (HttpReqDL*)client->bufferpool.allocreq(GET);
+            m_off_t size = bounds[j + 1] - bounds[j];
+            req->prepare("http://127.0.0.1/dl", NULL, NULL, 0, bounds[j], bounds[j + 1]);
+            memcpy(req->buf, data.data() + bounds[j], (size_t)size);
+            req->bufpos = size;
+            slot->queuechunk(req);
+        }
+
+        // a connection is reused while the previous chunks are in flight,
+        // unless the pipeline is full
+        while (transfer->progresscompleted < bounds[i] && Waiter::getmicros() < deadline)
+        {
+            m_off_t before = transfer->progresscompleted;
+            ASSERT_TRUE(slot->processchunks(client, &backoff));
+            if (transfer->progresscompleted != before)
+            {
+                progress.push_back(transfer->progresscompleted);
+            }
+            else
+            {
+                usleep(1000);
+            }
+        }
+    }
+
+#ifdef THREAD_CLASS
+    ASSERT_TRUE(slot->decryptor != NULL);
+#endif
+
+    while (transfer->progresscompleted < dlsize && Waiter::getmicros() < deadline)
+    {
+        m_off_t before = transfer->progresscompleted;
+        ASSERT_TRUE(slot->processchunks(client, &backoff));
+        if (transfer->progresscompleted != before)
+        {
+            progress.push_back(transfer->progresscompleted);
+        }
+        else
+        {
+            usleep(1000);
+        }
+    }
+
+    ASSERT_EQ(0u, backoff);
+    ASSERT_EQ(dlsize, transfer->progresscompleted);
+    ASSERT_TRUE(slot->downloadchunks.empty());
+
+    // the progress grows by whole requests up to the same total - ordered
+    // writes only report what the single-threaded decryption reports
+    ASSERT_FALSE(progress.empty());
+    ASSERT_LE(progress.size(), refprogress.size());
+    for (size_t i = 0; i < progress.size(); i++)
+    {
+        ASSERT_TRUE(!i || progress[i - 1] < progress[i]);
+        if (orderedwrites)
+        {
+            ASSERT_TRUE(std::find(refprogress.begin(), refprogress.end(), progress[i]) != refprogress.end());
+        }
+    }
+    ASSERT_EQ(refprogress.back(), progress.back());
+
+    ASSERT_EQ(refmacs.size(), transfer->chunkmacs.size());
+    for (chunkmac_map::iterator it = refmacs.begin(); it != refmacs.end(); it++)
+    {
+        ChunkMAC& chunkmac = transfer->chunkmacs[it->first];
+        ASSERT_TRUE(chunkmac.finished);
+        ASSERT_EQ(0, memcmp(it->second.mac, chunkmac.mac, sizeof chunkmac.mac));
+    }
+    ASSERT_EQ(slot->macsmac(&refmacs), slot->macsmac(&transfer->chunkmacs));
+
+    delete slot;
+    delete transfer;
+
+    FileAccess* fa = client->fsaccess->newfileaccess();
+    string written;
+    ASSERT_TRUE(fa->fopen(&path, true, false));
+    ASSERT_TRUE(fa->fread(&written, (unsigned)dlsize, 0, 0));
+    delete fa;
+    client->fsaccess->unlinklocal(&path);
+
+    ASSERT_TRUE(written == plain);
+}
+
+TEST(Transfer, ChunkPipelineOutOfOrder)
+{
+    chunkpipeline(false);
+}
+
+TEST(Transfer, ChunkPipelineOrderedWrites)
+{
+    chunkpipeline(true);
+}
+
+// Transfers in backoff leave the dispatch candidates and come back, in
+// priority order, when their timer elapses in the client's TimerWheel
+TEST(Transfer, SchedulerBackoff)
+{
+    TestClient<CountingHttpIO> testclient;
+    MegaClient& client = *testclient.client;
+    TransferList& transferlist = client.transferlist;
+    dstime savedds = Waiter::ds;
+    Transfer* t[3];
+
+    Waiter::ds = 1000;
+    for (int i = 0; i < 3; i++)
+    {
+        t[i] = new Transfer(&client, GET);
+        t[i]->size = i;
+        transferlist.addtransfer(t[i]);
+    }
+
+    t[0]->bt.backoff(50);
+    t[1]->bt.backoff(20);
+    ASSERT_EQ(2u, client.timers.size());
+    ASSERT_EQ(t[2], transferlist.nexttransfer(GET));
+
+    Waiter::ds += 20;
+    ASSERT_EQ(t[1], transferlist.nexttransfer(GET));
+    ASSERT_EQ(1u, client.timers.size());
+
+    // backed off again while it was a candidate
+    t[1]->bt.backoff(100);
+    Waiter::ds += 30;
+    ASSERT_EQ(t[0], transferlist.nexttransfer(GET));
+
+    // the expiry is also processed by the client's wait
+    t[0]->bt.backoff(10);
+    Waiter::ds += 100;
+    dstime nds = NEVER;
+    client.timers.update(&nds);
+    ASSERT_EQ(0u, nds);
+    ASSERT_EQ(3u, transferlist.ready[GET].size());
+    ASSERT_EQ(t[0], transferlist.nexttransfer(GET));
+
+    for (int i = 0; i < 3; i++)
+    {
+        delete t[i];
+    }
+
+    ASSERT_EQ(0u, transferlist.ready[GET].size());
+    ASSERT_EQ(0u, client.timers.size());
+    Waiter::ds = savedds;
+}
+
+// A transfer resumed with the priority of a listed one gets a new priority
+// at the end of the queue instead of being dropped from the list
+TEST(Transfer, DuplicatePriority)
+{
+    TestClient<CountingHttpIO> testclient;
+    MegaClient& client = *testclient.client;
+    TransferList& transferlist = client.transferlist;
+    Transfer* t[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        t[i] = new Transfer(&client, GET);
+        t[i]->size = i;
+    }
+
+    transferlist.addtransfer(t[0]);
+    transferlist.addtransfer(t[1]);
+    t[2]->priority = t[0]->priority;
+    transferlist.addtransfer(t[2]);
+
+    ASSERT_EQ(3u, transferlist.transfers[GET].size());
+    ASSERT_LT(t[1]->priority, t[2]->priority);
+    ASSERT_EQ(t[2], *transferlist.transfers[GET].rbegin());
+
+    // removing one of them leaves the other listed
+    transferlist.removetransfer(t[2]);
+    ASSERT_EQ(2u, transferlist.transfers[GET].size());
+    ASSERT_EQ(t[0], *transferlist.iterator(t[0]));
+
+    for (int i = 0; i < 3; i++)
+    {
+        delete t[i];
+    }
+}
+
+// File attribute channels only keep timers in the wheel while they have
+// something to wait for
+TEST(Transfer, FileAttributeFetchTimers)
+{
+    TestClient<CountingHttpIO> testclient;
+    MegaClient& client = *testclient.client;
+    dstime savedds = Waiter::ds;
+    Waiter::ds = 1000;
+
+    FileAttributeFetchChannel* fc = new FileAttributeFetchChannel();
+    client.fafcs[1] = fc;
+
+    // idle channel after a failure
+    fc->bt.backoff(50);
+    fc->timeout.backoff(100);
+    fc->updatetimers(&client);
+    ASSERT_EQ(0u, client.timers.size());
+
+    // fetches waiting for the retry
+    fc->fafs[0][1] = new FileAttributeFetch(1, 0, 0);
+    fc->updatetimers(&client);
+    ASSERT_EQ(1u, client.timers.size());
+    dstime nds = NEVER;
+    client.timers.update(&nds);
+    ASSERT_EQ(1050u, nds);
+
+    // request in flight: only its timeout counts
+    fc->req.status = REQ_INFLIGHT;
+    fc->timeout.backoff(60);
+    fc->updatetimers(&client);
+    ASSERT_EQ(1u, client.timers.size());
+    nds = NEVER;
+    client.timers.update(&nds);
+    ASSERT_EQ(1060u, nds);
+
+    // done
+    delete fc->fafs[0][1];
+    fc->fafs[0].clear();
+    fc->req.status = REQ_PREPARED;
+    fc->updatetimers(&client);
+    ASSERT_EQ(0u, client.timers.size());
+
+    Waiter::ds = savedds;
+}
+
+// Queues 100k downloads (1M with $MEGA_BENCHMARK_LARGE, or the number in
+// MEGA_SCHED_BENCH_TRANSFERS) with the head of the queue active, paused or in
+// backoff, as a nightly backup does, and reports the cost of dispatching and
+// reprioritizing transfers
+TEST(Transfer, SchedulerBenchmark)
+{
+    int numtransfers = largebenchmarks() ? 1000000 : 100000;
+    const char* env = getenv("MEGA_SCHED_BENCH_TRANSFERS");
+    if (env && atoi(env) > 0)
+    {
+        numtransfers = atoi(env);
+    }
+
+    TestClient<CountingHttpIO> testclient("bench");
+    MegaClient& client = *testclient.client;
+    TransferList& transferlist = client.transferlist;
+    vector<Transfer*> queue;
+    queue.reserve(numtransfers);
+
+    Waiter::bumpds();
+    m_time_t start = Waiter::getmicros();
+    for (int i = 0; i < numtransfers; i++)
+    {
+        Transfer* t = new Transfer(&client, GET);
+        t->size = i;
+        transferlist.addtransfer(t);
+        queue.push_back(t);
+    }
+    m_time_t addus = Waiter::getmicros() - start;
+
+    // the first 10% of the queue was tried and is backing off or paused
+    int skipped = numtransfers / 10;
+    for (int i = 0; i < skipped; i++)
+    {
+        if (i % 2)
+        {
+            transferlist.pause(queue[i], true);
+        }
+        else
+        {
+            queue[i]->bt.backoff(6000);
+            queue[i]->state = TRANSFERSTATE_RETRYING;
+        }
+    }
+
+    const int dispatches = 10000;
+    start = Waiter::getmicros();
+    for (int i = 0; i < dispatches; i++)
+    {
+        Transfer* t = transferlist.nexttransfer(GET);
+        ASSERT_EQ(t, queue[skipped + i]);
+
+        // simulate the slot so the next dispatch picks the next transfer
+        t->state = TRANSFERSTATE_ACTIVE;
+        t->bt.backoff(6000);
+    }
+    m_time_t dispatchus = Waiter::getmicros() - start;
+
+    const int moves = 10000;
+    start = Waiter::getmicros();
+    for (int i = 0; i < moves; i++)
+    {
+        Transfer* t = queue[(int)(((long long)i * 7919) % numtransfers)];
+        switch (i % 3)
+        {
+            case 0:
+                transferlist.movetofirst(t);
+                break;
+            case 1:
+                transferlist.moveup(t);
+                break;
+            default:
+                transferlist.movetransfer(t, queue[(int)(((long long)i * 104729) % numtransfers)]);
+                break;
+        }
+    }
+    m_time_t moveus = Waiter::getmicros() - start;
+
+    // the queue stays ordered by priority
+    uint64_t prevpriority = 0;
+    for (transfer_list::iterator it = transferlist.begin(GET); it != transferlist.end(GET); it++)
+    {
+        ASSERT_LT(prevpriority, (*it)->priority);
+        prevpriority = (*it)->priority;
+    }
+
+    TEST_RESULTS(numtransfers << " queued transfers, " << skipped << " paused or in backoff");
+    TEST_RESULTS("addtransfer: " << addus * 1000.0 / numtransfers << " ns/transfer");
+    TEST_RESULTS("nexttransfer: " << dispatchus * 1000.0 / dispatches << " ns/dispatch");
+    TEST_RESULTS("movetofirst/moveup/movetransfer: " << moveus * 1000.0 / moves << " ns/move");
+
+    start = Waiter::getmicros();
+    for (int i = 0; i < numtransfers; i++)
+    {
+        delete queue[i];
+    }
+    TEST_RESULTS("removetransfer: " << (Waiter::getmicros() - start) * 1000.0 / numtransfers << " ns/transfer");
+
+    ASSERT_EQ(transferlist.transfers[GET].size(), 0u);
+    ASSERT_EQ(transferlist.ready[GET].size(), 0u);
+    ASSERT_EQ(client.timers.size(), 0u);
+}
+
+// Queues transfers and updates them again as priority moves and progress
+// checkpoints do: every transfer is written once, in a single transaction
+TEST(Transfer, CacheWriteBehind)
+{
+    TestClient<CountingHttpIO> testclient;
+    MegaClient& client = *testclient.client;
+    CountingDbTable* table = new CountingDbTable;
+    byte key[SymmCipher::KEYLENGTH] = { 0 };
+
+    client.tckey.setkey(key);
+    client.tctable = table;
+
+    const int numtransfers = 10000;
+    vector<Transfer*> queue;
+
+    Waiter::bumpds();
+    for (int i = 0; i < numtransfers; i++)
+    {
+        Transfer* t = new Transfer(&client, GET);
+        t->size = i;
+        client.transferlist.addtransfer(t);
+        queue.push_back(t);
+    }
+
+    for (int i = 0; i < numtransfers; i++)
+    {
+        client.transferlist.movetofirst(queue[i]);
+        client.transfercacheadd(queue[i]);
+    }
+
+    ASSERT_EQ(0, table->puts);
+    ASSERT_EQ(Waiter::ds + MegaClient::TRANSFERCACHEFLUSHDS, client.tcflushds);
+
+    client.transfercacheflush();
+    ASSERT_EQ(numtransfers, table->puts);
+    ASSERT_EQ(numtransfers, (int)table->records.size());
+    ASSERT_EQ(1, table->begins);
+    ASSERT_EQ(1, table->commits);
+    ASSERT_EQ(NEVER, client.tcflushds);
+
+    // a removed transfer is not written back
+    client.transfercacheadd(queue[0]);
+    client.transfercachedel(queue[0]);
+    client.transfercacheflush();
+    ASSERT_EQ(numtransfers, table->puts);
+    ASSERT_EQ(numtransfers - 1, (int)table->records.size());
+    ASSERT_EQ(2, table->commits);
+
+    // the last changes of a transfer that stays in the cache are not lost
+    // when the object goes away
+    client.transfercacheadd(queue[1]);
+    delete queue[1];
+    ASSERT_EQ(numtransfers + 1, table->puts);
+
+    for (int i = 2; i < numtransfers; i++)
+    {
+        delete queue[i];
+    }
+    delete queue[0];
+
+    client.transfercacheflush();
+    ASSERT_EQ(3, table->commits);
+}
+
+#ifdef DBACCESS_CLASS
+// Reports the cost of caching queued transfers with a write per change and
+// with the write-behind journal
+TEST(Transfer, CacheWriteBehindBenchmark)
+{
+    TestClient<CountingHttpIO> testclient;
+    MegaClient& client = *testclient.client;
+    DBACCESS_CLASS dbaccess;
+    byte key[SymmCipher::KEYLENGTH] = { 0 };
+    string dbname = "transfers_benchmark";
+
+    client.tckey.setkey(key);
+    ASSERT_TRUE((client.tctable = dbaccess.open(&testclient.fsaccess, &dbname)) != NULL);
+
+    // one SQLite transaction per write is slow, time only a few of them
+    const int direct = 1000;
+    const int journaled = 100000;
+    vector<Transfer*> queue;
+
+    for (int i = 0; i < journaled; i++)
+    {
+        Transfer* t = new Transfer(&client, GET);
+        t->size = i;
+        queue.push_back(t);
+    }
+
+    m_time_t start = Waiter::getmicros();
+    for (int i = 0; i < direct; i++)
+    {
+        client.tctable->put(MegaClient::CACHEDTRANSFER, queue[i], &client.tckey);
+    }
+    m_time_t directus = Waiter::getmicros() - start;
+
+    start = Waiter::getmicros();
+    for (int i = 0; i < journaled; i++)
+    {
+        client.transferlist.addtransfer(queue[i]);
+    }
+    client.transfercacheflush();
+    m_time_t journaledus = Waiter::getmicros() - start;
+
+    TEST_RESULTS("transfer cache: " << directus / (double)direct << " us/transfer writing each change, "
+                 << journaledus / (double)journaled << " us/transfer journaled");
+
+    for (int i = 0; i < journaled; i++)
+    {
+        queue[i]->finished = true;
+        delete queue[i];
+    }
+
+    client.transfercacheflush();
+    client.tctable->remove();
+}
+#endif
+#endif
+
+#ifdef HTTPIO_CLASS
+// Sends parallel chunk-like requests to a local HTTP/2 server and returns the
+// number of connections opened for them
+static bool runparallelrequests(HTTPIO_CLASS* httpio, const char* url, int numreqs, long long* connections)
+{
+    WAIT_CLASS waiter;
+    vector<HttpReq*> reqs;
+    long long startconnections = httpio->newconnections;
+
+    for (int i = 0; i < numreqs; i++)
+    {
+        HttpReq* req = new HttpReq(true);
+        req->posturl = url;
+        req->type = REQ_BINARY;
+        req->httpio = httpio;
+        req->contentlength = -1;
+        httpio->post(req);
+        reqs.push_back(req);
+    }
+
+    Waiter::bumpds();
+    dstime timeout = Waiter::ds + 300;
+    bool pending = true;
+    while (pending && Waiter::ds < timeout)
+    {
+        waiter.init(10);
+        waiter.wakeupby(httpio, Waiter::NEEDEXEC);
+        waiter.wait();
+        httpio->doio();
+
+        pending = false;
+        for (int i = 0; i < numreqs; i++)
+        {
+            if (reqs[i]->status == REQ_INFLIGHT)
+            {
+                pending = true;
+            }
+        }
+        Waiter::bumpds();
+    }
+
+    bool ok = !pending;
+    for (int i = 0; i < numreqs; i++)
+    {
+        ok = ok && reqs[i]->status == REQ_SUCCESS;
+        delete reqs[i];
+    }
+
+    *connections = httpio->newconnections - startconnections;
+    return ok;
+}
+
+// Requires a local h2 server, for example:
+//   nghttpd 8443 server.key server.crt -d /tmp/h2root
+//   MEGA_H2_TEST_URL=https://127.0.0.1:8443/chunk ./misc_test
+TEST(Transfer, Http2Multiplexing)
+{
+    const char* url = getenv("MEGA_H2_TEST_URL");
+    if (!url)
+    {
+        TEST_SKIPPED("MEGA_H2_TEST_URL not set");
+        return;
+    }
+
+    const int numreqs = 24;
+    HTTPIO_CLASS h1io, h2io;
+    long long h1connections, h2connections, reconnected;
+
+    if (!h2io.sethttp2(true))
+    {
+        TEST_SKIPPED("cURL without HTTP/2 support");
+        return;
+    }
+
+    ASSERT_TRUE(runparallelrequests(&h1io, url, numreqs, &h1connections));
+    ASSERT_TRUE(runparallelrequests(&h2io, url, numreqs, &h2connections));
+
+    TEST_RESULTS("HTTP/1.1: " << h1connections << " connections, " << h1io.handshaketimems << " ms handshaking");
+    TEST_RESULTS("HTTP/2:   " << h2connections << " connections, " << h2io.handshaketimems << " ms handshaking");
+
+    // more than a couple of connections: h2 was not negotiated
+    ASSERT_LE(h2connections, 2);
+    ASSERT_LT(h2connections, h1connections);
+
+    // the multi handles recreated by a reconnection keep multiplexing
+    h2io.disconnect();
+    ASSERT_TRUE(h2io.usinghttp2());
+    ASSERT_TRUE(runparallelrequests(&h2io, url, numreqs, &reconnected));
+    ASSERT_LE(reconnected, 2);
+}
+
+// Sends echo commands to the API of a mock server, one at a time, and returns
+// the number of them that got a response
+static int runechorequests(HTTPIO_CLASS* httpio, const string& url, int numreqs)
+{
+    WAIT_CLASS waiter;
+    string body = "[{\"a\":\"echo\",\"i\":1}]";
+    int answered = 0;
+
+    for (int i = 0; i < numreqs; i++)
+    {
+        HttpReq req;
+        req.posturl = url + "cs";
+        req.httpio = httpio;
+        httpio->post(&req, body.data(), unsigned(body.size()));
+
+        Waiter::bumpds();
+        dstime timeout = Waiter::ds + 300;
+        while (req.status == REQ_INFLIGHT && Waiter::ds < timeout)
+        {
+            waiter.init(10);
+            waiter.wakeupby(httpio, Waiter::NEEDEXEC);
+            waiter.wait();
+            httpio->doio();
+            Waiter::bumpds();
+        }
+
+        answered += req.httpstatus != 0;
+    }
+
+    return answered;
+}
+
+// Requests reuse the connection of the previous one, also after a reconnection
+// with HTTP/2 enabled, and requests that got no response don't count as reusing
+// one
+TEST(Transfer, ConnectionReuse)
+{
+    MockMegaServer server;
+    ASSERT_TRUE(server.start());
+    string url = server.apiurl();
+    HTTPIO_CLASS httpio;
+
+    ASSERT_EQ(5, runechorequests(&httpio, url, 5));
+    ASSERT_EQ(1, httpio.newconnections);
+    ASSERT_EQ(4, httpio.reusedconnections);
+
+    if (httpio.sethttp2(true))
+    {
+        // a plain HTTP server: the requests fall back to HTTP/1.1
+        httpio.disconnect();
+        ASSERT_TRUE(httpio.usinghttp2());
+        ASSERT_EQ(5, runechorequests(&httpio, url, 5));
+        ASSERT_EQ(2, httpio.newconnections);
+        ASSERT_EQ(8, httpio.reusedconnections);
+    }
+    else
+    {
+        TEST_SKIPPED("cURL without HTTP/2 support");
+    }
+
+    long long newconnections = httpio.newconnections;
+    long long reusedconnections = httpio.reusedconnections;
+
+    server.stop();
+    httpio.disconnect();
+    ASSERT_EQ(0, runechorequests(&httpio, url, 2));
+    ASSERT_EQ(newconnections, httpio.newconnections);
+    ASSERT_EQ(reusedconnections, httpio.reusedconnections);
+}
+
+#ifndef _WIN32
+// exposes the DNS cache, IPv4 only so that the lookups are deterministic
+class DnsTestHttpIO : public CurlHttpIO
+{
+public:
+    DnsTestHttpIO()
+    {
+        // no queries leave the machine, localhost is in the hosts file
+        setdnsservers("127.0.0.1");
+    }
+
+    CurlDNSEntry* entry(const string& hostname)
+    {
+        map<string, CurlDNSEntry>::iterator it = dnscache.find(hostname);
+        return it == dnscache.end() ? NULL : &it->second;
+    }
+
+    // resolves the host of a request, which is cancelled right away: a
+    // failed connection would drop the cached address
+    void request(const char* url)
+    {
+        HttpReq req(true);
+
+        ipv6requestsenabled = false;
+        ipv6deactivationtime = Waiter::ds;
+
+        req.posturl = url;
+        req.httpio = this;
+        post(&req);
+        cancel(&req);
+    }
+
+    // processes the lookups in flight (without bumping Waiter::ds, which the
+    // test moves forward)
+    void waitlookups(const string& hostname)
+    {
+        WAIT_CLASS waiter;
+
+        for (int i = 0; i < 500 && entry(hostname) && entry(hostname)->ipv4query; i++)
+        {
+            waiter.init(1);
+            waiter.wakeupby(this, Waiter::NEEDEXEC);
+            waiter.wait();
+            doio();
+        }
+    }
+};
+
+// Prefetch, cache hits, stale-while-revalidate and expiry of the DNS cache
+TEST(Transfer, DnsCache)
+{
+    const char* url = "http://localhost:8080/chunk";
+    string host = "localhost";
+    dstime savedds = Waiter::ds;
+    DnsTestHttpIO httpio;
+
+    Waiter::bumpds();
+
+    // the prefetch starts the lookup, the request joins it or, if it has
+    // finished already, hits the cache
+    string prefetchurl = url;
+    httpio.prefetchdns(&prefetchurl);
+    ASSERT_EQ(1, httpio.dnslookups);
+    ASSERT_TRUE(httpio.entry(host) != NULL);
+
+    httpio.request(url);
+    httpio.waitlookups(host);
+    ASSERT_EQ(1, httpio.dnslookups);
+    ASSERT_EQ("127.0.0.1", httpio.entry(host)->ipv4);
+    long long hits = httpio.dnscachehits;
+
+    // a prefetch of a cached host does nothing, the next request is a hit
+    httpio.prefetchdns(&prefetchurl);
+    httpio.request(url);
+    ASSERT_EQ(1, httpio.dnslookups);
+    ASSERT_EQ(++hits, httpio.dnscachehits);
+    ASSERT_EQ(0, httpio.dnsstalehits);
+
+    // after 30 minutes the record is still served, but refreshed in the
+    // background
+    Waiter::ds += 18000 + 10;
+    httpio.request(url);
+    ASSERT_EQ(++hits, httpio.dnscachehits);
+    ASSERT_EQ(1, httpio.dnsstalehits);
+    ASSERT_EQ(2, httpio.dnslookups);
+    httpio.waitlookups(host);
+    ASSERT_EQ(Waiter::ds, httpio.entry(host)->ipv4timestamp);
+
+    // two hours later it's dropped and requests wait for a new lookup
+    Waiter::ds += 72000 + 10;
+    httpio.request(url);
+    ASSERT_EQ(hits, httpio.dnscachehits);
+    ASSERT_EQ(3, httpio.dnslookups);
+    httpio.waitlookups(host);
+    ASSERT_EQ("127.0.0.1", httpio.entry(host)->ipv4);
+
+    Waiter::ds = savedds;
+}
+#endif
+#endif
+
+// Arms 100k backoff timers and walks through all the wakeups computed by the
+// TimerWheel, comparing its cost with a scan of every timer
+TEST(Transfer, TimerWheelBenchmark)
+{
+    const int numtimers = 100000;
+    dstime savedds = Waiter::ds;
+    Waiter::ds = 1000;
+
+    TimerWheel wheel;
+    BackoffTimer* timers = new BackoffTimer[numtimers];
+
+    srand(1);
+    m_time_t start = Waiter::getmicros();
+    for (int i = 0; i < numtimers; i++)
+    {
+        timers[i].setwheel(&wheel);
+
+        // up to one hour, a few far away ones
+        timers[i].backoff(1 + (i % 100 ? rand() % 36000 : rand() % 30000000));
+    }
+    m_time_t armus = Waiter::getmicros() - start;
+    ASSERT_EQ((unsigned)numtimers, wheel.size());
+
+    long long wakeups = 0;
+    long long scans = 0;
+    m_time_t wheelus = 0;
+    m_time_t scanus = 0;
+
+    while (wheel.size())
+    {
+        dstime nds = NEVER;
+
+        start = Waiter::getmicros();
+        wheel.update(&nds);
+        wheelus += Waiter::getmicros() - start;
+        wakeups++;
+
+        if (!nds)
+        {
+            // timers expired, check them against a full scan (sampled)
+            if (wakeups % 100 < 2)
+            {
+                start = Waiter::getmicros();
+                unsigned pending = 0;
+                dstime scands = NEVER;
+                for (int i = 0; i < numtimers; i++)
+                {
+                    if (!timers[i].armed())
+                    {
+                        pending++;
+                        if (timers[i].nextset() < scands)
+                        {
+                            scands = timers[i].nextset();
+                        }
+                    }
+                }
+                scanus += Waiter::getmicros() - start;
+                scans++;
+
+                ASSERT_EQ(pending, wheel.size());
+            }
+            continue;
+        }
+
+        // never late
+        ASSERT_GT(nds, Waiter::ds);
+        for (int i = 0; i < numtimers && wakeups % 1000 == 1; i++)
+        {
+            ASSERT_TRUE(timers[i].armed() || timers[i].nextset() >= nds);
+        }
+
+        Waiter::ds = nds;
+    }
+
+    TEST_RESULTS(numtimers << " timers armed in " << armus / 1000.0 << " ms, "
+                 << wakeups << " wheel updates: " << wheelus * 1000.0 / wakeups << " ns/update, "
+                 << "full scan: " << (scans ? scanus * 1000.0 / scans : 0) << " ns/update");
+
+    delete [] timers;
+    Waiter::ds = savedds;
+}